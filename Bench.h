@@ -0,0 +1,188 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// The benchmark matrix: every combination of volume size, output
+// resolution, step size and camera angle is one case. Step sizes are given
+// as steps per unit, so 50 is the default stepsize of 1/50.
+struct BenchMatrix {
+
+    BenchMatrix() : frames(10), warmup(2) {
+        const int v[] = { 128, 256, 512 };
+        const int s[] = { 400, 800, 1600 };
+        const int t[] = { 50, 100, 200 };
+        const int a[] = { 0, 60, 120 };
+        volumes.assign(v, v + 3);
+        sizes.assign(s, s + 3);
+        steps.assign(t, t + 3);
+        angles.assign(a, a + 3);
+    }
+
+    // --volumes 128,256 --sizes 800 --steps 50,100 --angles 0,90 --frames N --warmup N
+    void parse(int argc, char* argv[])
+    {
+        for(int i = 1; i < argc - 1; i++)
+        {
+            if(!strcmp(argv[i], "--volumes")) volumes = parse_list(argv[++i]);
+            else if(!strcmp(argv[i], "--sizes")) sizes = parse_list(argv[++i]);
+            else if(!strcmp(argv[i], "--steps")) steps = parse_list(argv[++i]);
+            else if(!strcmp(argv[i], "--angles")) angles = parse_list(argv[++i]);
+            else if(!strcmp(argv[i], "--frames")) frames = std::max(atoi(argv[++i]), 1);
+            else if(!strcmp(argv[i], "--warmup")) warmup = std::max(atoi(argv[++i]), 0);
+        }
+    }
+
+    int cases() const { return int(volumes.size() * sizes.size() * steps.size() * angles.size()); }
+
+    static std::vector<int> parse_list(const char* s)
+    {
+        std::vector<int> v;
+        std::istringstream in(s);
+        std::string item;
+        while(std::getline(in, item, ','))
+            if(!item.empty()) v.push_back(atoi(item.c_str()));
+        return v;
+    }
+
+    std::vector<int> volumes, sizes, steps, angles;
+    int frames; // timed frames per case
+    int warmup; // untimed frames before them
+};
+
+struct BenchResult {
+
+    BenchResult() : volume(0), size(0), steps(0), angle(0),
+                    ms_median(0), ms_mean(0), msamples_per_sec(0), memory_mb(0), rss_mb(0), submit_ms(0) {}
+
+    // identifies the case when comparing against a baseline
+    std::string key() const {
+        char k[128];
+        snprintf(k, sizeof(k), "%s vol %d size %d steps %d angle %d", backend.c_str(), volume, size, steps, angle);
+        return k;
+    }
+
+    std::string backend; // gl, compute or cpu
+    int volume, size, steps, angle;
+    double ms_median, ms_mean;
+    double msamples_per_sec;
+    double memory_mb; // volume, occupancy grid and render targets
+    double rss_mb;    // peak resident set of the process so far
+    double submit_ms; // median CPU time to issue a frame, before waiting for the GPU; gl only
+};
+
+// median and mean of the frame times
+inline void frame_time_stats(std::vector<double> ms, double& median, double& mean)
+{
+    median = mean = 0.0;
+    if(ms.empty()) return;
+    std::sort(ms.begin(), ms.end());
+    size_t n = ms.size();
+    median = n % 2 ? ms[n/2] : 0.5 * (ms[n/2 - 1] + ms[n/2]);
+    for(size_t i = 0; i < n; i++) mean += ms[i];
+    mean /= n;
+}
+
+inline double peak_rss_mb()
+{
+#ifdef _WIN32
+    return 0.0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0; // kilobytes on Linux
+#endif
+}
+
+#define BENCH_CSV_HEADER "backend,volume,size,steps,angle,ms_median,ms_mean,msamples_per_sec,memory_mb,rss_mb,submit_ms"
+
+// CSV with one case per line; lines starting with '#' describe the machine
+inline bool write_bench_results(const char* filename, const std::vector<BenchResult>& results, const std::string& comment)
+{
+    FILE* f = fopen(filename, "w");
+    if(!f)
+    {
+        std::cout << "Could not open " << filename << " for writing" << std::endl;
+        return false;
+    }
+    if(!comment.empty()) fprintf(f, "# %s\n", comment.c_str());
+    fprintf(f, "%s\n", BENCH_CSV_HEADER);
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        fprintf(f, "%s,%d,%d,%d,%d,%.4f,%.4f,%.3f,%.2f,%.2f,%.4f\n", r.backend.c_str(), r.volume, r.size, r.steps, r.angle,
+                r.ms_median, r.ms_mean, r.msamples_per_sec, r.memory_mb, r.rss_mb, r.submit_ms);
+    }
+    fclose(f);
+    std::cout << results.size() << " results written to " << filename << std::endl;
+    return true;
+}
+
+inline bool read_bench_results(const char* filename, std::vector<BenchResult>& results)
+{
+    std::ifstream in(filename);
+    if(!in)
+    {
+        std::cout << "Could not open " << filename << std::endl;
+        return false;
+    }
+    results.clear();
+    std::string line;
+    int line_no = 0;
+    while(std::getline(in, line))
+    {
+        line_no++;
+        if(line.empty() || line[0] == '#' || !line.compare(0, 8, "backend,")) continue;
+        for(size_t i = 0; i < line.size(); i++)
+            if(line[i] == ',') line[i] = ' ';
+        std::istringstream ls(line);
+        BenchResult r;
+        if(!(ls >> r.backend >> r.volume >> r.size >> r.steps >> r.angle
+                >> r.ms_median >> r.ms_mean >> r.msamples_per_sec >> r.memory_mb >> r.rss_mb))
+        {
+            std::cout << filename << ":" << line_no << ": malformed result" << std::endl;
+            return false;
+        }
+        ls >> r.submit_ms; // missing in older files
+        results.push_back(r);
+    }
+    return true;
+}
+
+// print every case found in both sets and return how many got slower than
+// the baseline by more than threshold ( 0.05 = 5% median frame time )
+inline int compare_bench_results(const std::vector<BenchResult>& baseline, const std::vector<BenchResult>& current, double threshold)
+{
+    int regressions = 0, matched = 0;
+    printf("%-44s %10s %10s %8s\n", "case", "base ms", "ms", "change");
+    for(size_t i = 0; i < current.size(); i++)
+    {
+        const BenchResult* base = 0;
+        for(size_t j = 0; j < baseline.size() && !base; j++)
+            if(baseline[j].key() == current[i].key()) base = &baseline[j];
+        if(!base || base->ms_median <= 0.0) continue;
+        matched++;
+        double change = current[i].ms_median / base->ms_median - 1.0;
+        bool slower = change > threshold;
+        if(slower) regressions++;
+        printf("%-44s %10.3f %10.3f %+7.1f%%%s\n", current[i].key().c_str(),
+               base->ms_median, current[i].ms_median, 100.0 * change, slower ? "  REGRESSION" : "");
+    }
+    printf("%d of %d cases matched the baseline, %d regressed by more than %.1f%%\n",
+           matched, int(current.size()), regressions, 100.0 * threshold);
+    return regressions;
+}
+
+#endif
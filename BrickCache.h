@@ -0,0 +1,255 @@
+#ifndef BRICKCACHE_H
+#define BRICKCACHE_H
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <list>
+#include <algorithm>
+
+#include "Volume.h"
+#include "VolumeLoader.h"
+#include "OccupancyGrid.h"
+#include "BrickFile.h"
+
+// Page table states, in the alpha of a page table entry
+enum { PAGE_MISSING = 0, PAGE_EMPTY = 128, PAGE_RESIDENT = 255 };
+
+// Feedback states, in the alpha of a feedback pixel; the shader writes
+// 0.5 for FEEDBACK_USED, so they are told apart by the nearest value
+enum { FEEDBACK_NONE = 0, FEEDBACK_USED = 128, FEEDBACK_MISS = 255 };
+
+// How a volume is cut into bricks of brick_size^3 voxels and where they go
+// in the atlas. Every slot holds a brick with a one voxel apron copied from
+// its neighbours ( zero outside the volume ), padded = brick_size + 2 voxels
+// a side, so GL_LINEAR filtering inside a brick never reads another slot.
+struct BrickLayout {
+
+    BrickLayout() : brick_size(0), padded(0) {
+        size[0] = size[1] = size[2] = 0;
+        bricks[0] = bricks[1] = bricks[2] = 0;
+        slots[0] = slots[1] = slots[2] = 0;
+    }
+
+    // as many slots as fit atlas_bytes and max_texture texels a side; the
+    // page table stores slot and brick coordinates in 8 bits
+    void init(int w, int h, int d, int brick, int bytes_per_voxel, size_t atlas_bytes, int max_texture)
+    {
+        size[0] = w; size[1] = h; size[2] = d;
+        brick_size = brick;
+        padded = brick + 2;
+        for(int a = 0; a < 3; a++)
+            bricks[a] = (size[a] + brick - 1) / brick;
+        const double slot_bytes = double(padded) * padded * padded * bytes_per_voxel;
+        int n = int(floor(cbrt(atlas_bytes / slot_bytes)));
+        n = std::max(std::min(std::min(n, max_texture / padded), 256), 1);
+        for(int a = 0; a < 3; a++)
+            slots[a] = std::min(n, bricks[a]);
+    }
+
+    int brick_count() const { return bricks[0] * bricks[1] * bricks[2]; }
+    int slot_count() const { return slots[0] * slots[1] * slots[2]; }
+
+    int brick_index(int bx, int by, int bz) const { return bx + bricks[0] * (by + bricks[1] * bz); }
+
+    void brick_coords(int index, int c[3]) const {
+        c[0] = index % bricks[0];
+        c[1] = index / bricks[0] % bricks[1];
+        c[2] = index / (bricks[0] * bricks[1]);
+    }
+
+    void slot_coords(int slot, int c[3]) const {
+        c[0] = slot % slots[0];
+        c[1] = slot / slots[0] % slots[1];
+        c[2] = slot / (slots[0] * slots[1]);
+    }
+
+    int size[3];      // of the volume, in voxels
+    int brick_size;
+    int padded;       // brick_size plus the apron on both sides
+    int bricks[3];    // per axis, the last one can be partly outside the volume
+    int slots[3];     // of the atlas, per axis
+};
+
+// Least recently used assignment of bricks to atlas slots. Bricks are
+// stamped with the frame they were last used in; a slot used in the
+// current frame is never evicted, so a view that needs more bricks than
+// there are slots does not thrash within a frame.
+class BrickCache {
+public:
+
+    void init(int bricks, int slots)
+    {
+        brick_slot.assign(bricks, -1);
+        slot_brick.assign(slots, -1);
+        slot_frame.assign(slots, 0);
+        lru.clear();
+        slot_pos.resize(slots);
+        for(int s = 0; s < slots; s++)
+            slot_pos[s] = lru.insert(lru.end(), s);
+    }
+
+    int slot_of(int brick) const { return brick_slot[brick]; }
+
+    void touch(int brick, unsigned frame)
+    {
+        int s = brick_slot[brick];
+        if(s < 0) return;
+        slot_frame[s] = frame;
+        lru.splice(lru.begin(), lru, slot_pos[s]);
+    }
+
+    // slot for a brick that is not resident: a free one or the least
+    // recently used one, whose brick comes back in evicted ( -1 if none ).
+    // Returns -1 when every slot was used in this frame.
+    int insert(int brick, unsigned frame, int& evicted)
+    {
+        int s = lru.back();
+        evicted = slot_brick[s];
+        if(evicted >= 0 && slot_frame[s] == frame) return -1;
+        if(evicted >= 0) brick_slot[evicted] = -1;
+        slot_brick[s] = brick;
+        brick_slot[brick] = s;
+        slot_frame[s] = frame;
+        lru.splice(lru.begin(), lru, slot_pos[s]);
+        return s;
+    }
+
+    int resident() const { return int(std::count_if(slot_brick.begin(), slot_brick.end(), [](int b) { return b >= 0; })); }
+
+private:
+
+    std::vector<int> brick_slot;       // per brick, -1 when not resident
+    std::vector<int> slot_brick;       // per slot, -1 when free
+    std::vector<unsigned> slot_frame;  // frame a slot was last used in
+    std::list<int> lru;                // slots, most recently used first
+    std::vector<std::list<int>::iterator> slot_pos;
+};
+
+// A bricked volume: layout, cache and the page table the marcher reads,
+// one RGBA8 entry per brick with the slot in rgb and the state in a.
+// Bricks come from the host copy of the volume, straight from a mapped
+// volume file or from a bricked volume file, and read_feedback() turns
+// what the marcher reported into the list of bricks to page in.
+class BrickedVolume {
+public:
+
+    BrickedVolume() : format(VOLUME_R8), volume(0), file(0), brick_file(0) {}
+
+    void init(int w, int h, int d, VolumeFormat f, int brick_size, size_t atlas_bytes, int max_texture)
+    {
+        format = f;
+        layout.init(w, h, d, brick_size, bytes_per_voxel(), atlas_bytes, max_texture);
+        cache.init(layout.brick_count(), layout.slot_count());
+        page_table.assign(size_t(layout.brick_count()) * 4, 0);
+        empty.assign(layout.brick_count(), false);
+        requests.assign(layout.brick_count(), 0);
+    }
+
+    void set_source(const Volume* v, const VolumeFile* f, const BrickFile* b = 0) { volume = v; file = f; brick_file = b; }
+
+    int bytes_per_voxel() const { return format == VOLUME_RGBA8 ? 4 : format == VOLUME_R16 ? 2 : 1; }
+    size_t brick_bytes() const { return size_t(layout.padded) * layout.padded * layout.padded * bytes_per_voxel(); }
+
+    // bricks whose occupancy cells are all empty never need to be loaded;
+    // brick_size is a multiple of the cell size. Returns the bricks that
+    // are not empty.
+    int classify(const OccupancyGrid& grid)
+    {
+        const int cells = layout.brick_size / grid.cell_size;
+        int needed = 0;
+        for(int b = 0; b < layout.brick_count(); b++)
+        {
+            int c[3];
+            layout.brick_coords(b, c);
+            bool all_empty = true;
+            for(int z = c[2] * cells; z < std::min((c[2] + 1) * cells, grid.nz) && all_empty; z++)
+                for(int y = c[1] * cells; y < std::min((c[1] + 1) * cells, grid.ny) && all_empty; y++)
+                    for(int x = c[0] * cells; x < std::min((c[0] + 1) * cells, grid.nx); x++)
+                        if(grid.cells[grid.index(x, y, z)])
+                        {
+                            all_empty = false;
+                            break;
+                        }
+            empty[b] = all_empty;
+            needed += !all_empty;
+            if(cache.slot_of(b) < 0)
+                set_page(b, all_empty ? PAGE_EMPTY : PAGE_MISSING, -1);
+        }
+        return needed;
+    }
+
+    // go through a feedback image: bricks reported as used are touched,
+    // missing ones come back in misses, most requested first
+    void read_feedback(const unsigned char* rgba, size_t pixels, unsigned frame, std::vector<int>& misses)
+    {
+        misses.clear();
+        for(size_t i = 0; i < pixels; i++)
+        {
+            const unsigned char* p = rgba + i * 4;
+            if(p[3] < FEEDBACK_USED / 2) continue;
+            if(p[0] >= layout.bricks[0] || p[1] >= layout.bricks[1] || p[2] >= layout.bricks[2]) continue;
+            int b = layout.brick_index(p[0], p[1], p[2]);
+            if(p[3] < (FEEDBACK_USED + FEEDBACK_MISS) / 2)
+                cache.touch(b, frame);
+            else if(cache.slot_of(b) < 0 && !empty[b] && !requests[b]++)
+                misses.push_back(b);
+        }
+        std::stable_sort(misses.begin(), misses.end(), [this](int a, int b) { return requests[a] > requests[b]; });
+        for(size_t i = 0; i < misses.size(); i++)
+            requests[misses[i]] = 0;
+    }
+
+    // a slot for brick, updating the page table for it and for the brick
+    // it evicts; -1 when the atlas is full of bricks used in this frame
+    int place(int brick, unsigned frame)
+    {
+        int evicted;
+        int s = cache.insert(brick, frame, evicted);
+        if(s < 0) return -1;
+        if(evicted >= 0)
+            set_page(evicted, empty[evicted] ? PAGE_EMPTY : PAGE_MISSING, -1);
+        set_page(brick, PAGE_RESIDENT, s);
+        return s;
+    }
+
+    // the voxels of a brick and its apron, padded^3 voxels x fastest
+    void read_brick(int brick, unsigned char* dst) const
+    {
+        if(brick_file)
+        {
+            if(!brick_file->read_brick(0, brick, dst))
+                memset(dst, 0, brick_bytes());
+            return;
+        }
+        int c[3];
+        layout.brick_coords(brick, c);
+        copy_brick(volume, file, layout.size, layout.brick_size, bytes_per_voxel(), c, dst);
+    }
+
+    VolumeFormat format;
+    BrickLayout layout;
+    BrickCache cache;
+    std::vector<unsigned char> page_table; // RGBA8 per brick
+
+private:
+
+    void set_page(int brick, int state, int slot)
+    {
+        unsigned char* e = &page_table[size_t(brick) * 4];
+        int c[3] = { 0, 0, 0 };
+        if(slot >= 0) layout.slot_coords(slot, c);
+        e[0] = (unsigned char)c[0];
+        e[1] = (unsigned char)c[1];
+        e[2] = (unsigned char)c[2];
+        e[3] = (unsigned char)state;
+    }
+
+    const Volume* volume;
+    const VolumeFile* file;
+    const BrickFile* brick_file; // level 0 of a .bvol, same brick size
+    std::vector<bool> empty;
+    std::vector<int> requests; // feedback pixels per missing brick, while reading feedback
+};
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef BRICKFILE_H
+#define BRICKFILE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "Volume.h"
+#include "VolumeLoader.h"
+#include "ThreadPool.h"
+
+// The bricked volume file ( .bvol ) written by volume_convert. After the
+// header come the bricks, then a table of levels and a table of bricks, so
+// any ( level, brick ) is found without reading anything else:
+//
+//   BrickFileHeader
+//   brick data, each brick compressed on its own
+//   BrickFileLevel[levels]      at header.level_table
+//   BrickFileEntry[all bricks]  at header.brick_table, level by level,
+//                               x fastest within a level
+//
+// Level 0 is the full volume, every further level halves each axis ( a
+// 2x2x2 box filter ) down to one brick. A brick holds brick_size^3 voxels
+// plus a one voxel apron from its neighbours, ( brick_size + 2 )^3 voxels
+// x fastest, the layout an atlas slot of BrickedVolume takes. The range is
+// over the apron too, so it bounds every value a filtered sample inside
+// the brick can see. All numbers are little endian.
+
+#define BRICK_FILE_MAGIC "BVOL0001"
+#define BRICK_FILE_MAX_LEVELS 16  // 262144 voxels a side in bricks of 8
+#define BRICK_FILE_MAX_BRICK_SIZE 512
+
+enum BrickCodec { BRICK_RAW, BRICK_LZ4, BRICK_ZSTD, BRICK_CONSTANT };
+
+struct BrickFileHeader {
+    char magic[8];
+    uint32_t format;      // VOLUME_R8 or VOLUME_R16
+    uint32_t levels;
+    int32_t dims[3];      // of level 0
+    int32_t brick_size;
+    double value_min;     // source values stored as 0 and as the largest voxel value
+    double value_max;
+    uint64_t level_table;
+    uint64_t brick_table;
+};
+
+struct BrickFileLevel {
+    int32_t dims[3];
+    int32_t bricks[3];
+    uint64_t first;       // index of the level's first brick in the brick table
+};
+
+struct BrickFileEntry {
+    uint64_t offset;
+    uint32_t bytes;       // stored, 0 for constant bricks
+    uint16_t min, max;    // voxel values, a constant brick is all min
+    uint8_t codec;
+    uint8_t reserved[7];
+};
+
+static_assert(sizeof(BrickFileHeader) == 64, "BrickFileHeader layout");
+static_assert(sizeof(BrickFileLevel) == 32, "BrickFileLevel layout");
+static_assert(sizeof(BrickFileEntry) == 24, "BrickFileEntry layout");
+
+inline bool is_brick_file(const char* filename) { return has_extension(filename, ".bvol"); }
+
+inline const char* brick_codec_name(int codec)
+{
+    const char* names[] = { "raw", "lz4", "zstd", "constant" };
+    return codec >= 0 && codec <= BRICK_CONSTANT ? names[codec] : "unknown";
+}
+
+// whether this build can write and read a codec
+inline bool brick_codec_available(int codec)
+{
+#ifndef HAVE_LZ4
+    if(codec == BRICK_LZ4) return false;
+#endif
+#ifndef HAVE_ZSTD
+    if(codec == BRICK_ZSTD) return false;
+#endif
+    return codec >= BRICK_RAW && codec <= BRICK_CONSTANT;
+}
+
+// compress n bytes; false when the codec does not make them smaller
+inline bool compress_brick(int codec, const unsigned char* src, size_t n, std::vector<unsigned char>& out)
+{
+#ifdef HAVE_LZ4
+    if(codec == BRICK_LZ4)
+    {
+        out.resize(LZ4_compressBound(int(n)));
+        int size = LZ4_compress_default((const char*)src, (char*)&out[0], int(n), int(out.size()));
+        if(size <= 0 || size_t(size) >= n) return false;
+        out.resize(size);
+        return true;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if(codec == BRICK_ZSTD)
+    {
+        out.resize(ZSTD_compressBound(n));
+        size_t size = ZSTD_compress(&out[0], out.size(), src, n, 3);
+        if(ZSTD_isError(size) || size >= n) return false;
+        out.resize(size);
+        return true;
+    }
+#endif
+    (void)codec; (void)src; (void)n; (void)out;
+    return false;
+}
+
+inline bool decompress_brick(int codec, const unsigned char* src, size_t n, unsigned char* dst, size_t dst_bytes)
+{
+    if(codec == BRICK_RAW)
+    {
+        if(n != dst_bytes) return false;
+        memcpy(dst, src, n);
+        return true;
+    }
+#ifdef HAVE_LZ4
+    if(codec == BRICK_LZ4)
+        return LZ4_decompress_safe((const char*)src, (char*)dst, int(n), int(dst_bytes)) == int(dst_bytes);
+#endif
+#ifdef HAVE_ZSTD
+    if(codec == BRICK_ZSTD)
+        return ZSTD_decompress(dst, dst_bytes, src, n) == dst_bytes;
+#endif
+    return false;
+}
+
+// brick_size^3 voxels plus apron of the volume, from the host copy or a
+// mapped volume file; brick c sits at voxel c * brick_size, the apron and
+// everything outside the volume is zero
+inline void copy_brick(const Volume* volume, const VolumeFile* file, const int size[3], int brick_size,
+                       int bytes_per_voxel, const int c[3], unsigned char* dst)
+{
+    const int p = brick_size + 2;
+    int origin[3], lo[3], hi[3];
+    for(int a = 0; a < 3; a++)
+    {
+        origin[a] = c[a] * brick_size - 1;
+        lo[a] = std::max(origin[a], 0);
+        hi[a] = std::min(origin[a] + p, size[a]); // exclusive
+    }
+    memset(dst, 0, size_t(p) * p * p * bytes_per_voxel);
+    if(lo[0] >= hi[0]) return;
+    const int count = hi[0] - lo[0];
+    for(int z = lo[2]; z < hi[2]; z++)
+        for(int y = lo[1]; y < hi[1]; y++)
+        {
+            unsigned char* row = dst + ((size_t(z - origin[2]) * p + (y - origin[1])) * p + (lo[0] - origin[0])) * bytes_per_voxel;
+            if(volume)
+                memcpy(row, volume->voxel(lo[0], y, z), size_t(count) * bytes_per_voxel);
+            else
+                file->convert_row(lo[0], y, z, count, row);
+        }
+}
+
+// the next level of the pyramid: every voxel the rounded mean of 2x2x2
+// voxels of src, clamped at the far faces of odd sizes. src is the host
+// copy or, without one, a mapped volume file of the given size.
+inline void downsample_volume(const Volume* volume, const VolumeFile* file, const int size[3], VolumeFormat format,
+                              Volume& dst, ThreadPool& pool)
+{
+    const int w = (size[0] + 1) / 2, h = (size[1] + 1) / 2, d = (size[2] + 1) / 2;
+    const int bpv = format == VOLUME_R16 ? 2 : 1;
+    dst.resize(w, h, d, format);
+    pool.parallel_for(d, [&](int z, int)
+    {
+        std::vector<unsigned char> rows(size_t(size[0]) * bpv * 4);
+        unsigned char* src[4];
+        for(int j = 0; j < 4; j++) src[j] = &rows[size_t(size[0]) * bpv * j];
+        for(int y = 0; y < h; y++)
+        {
+            for(int j = 0; j < 4; j++)
+            {
+                int sy = std::min(2 * y + (j & 1), size[1] - 1);
+                int sz = std::min(2 * z + (j >> 1), size[2] - 1);
+                if(volume)
+                    memcpy(src[j], volume->voxel(0, sy, sz), size_t(size[0]) * bpv);
+                else
+                    file->convert_row(0, sy, sz, size[0], src[j]);
+            }
+            unsigned char* out = &dst.data[(size_t(y) + size_t(z) * h) * w * bpv];
+            for(int x = 0; x < w; x++)
+            {
+                int x0 = 2 * x, x1 = std::min(2 * x + 1, size[0] - 1);
+                unsigned sum = 0;
+                for(int j = 0; j < 4; j++)
+                    sum += bpv == 2 ? ((const unsigned short*)src[j])[x0] + ((const unsigned short*)src[j])[x1]
+                                    : src[j][x0] + src[j][x1];
+                if(bpv == 2) ((unsigned short*)out)[x] = (unsigned short)((sum + 4) / 8);
+                else         out[x] = (unsigned char)((sum + 4) / 8);
+            }
+        }
+    });
+}
+
+// Reader for .bvol files. open() reads the header and the tables only;
+// bricks are read with pread when asked for, so opening is fast whatever
+// the size of the volume, and read_brick() can run on several threads.
+class BrickFile {
+public:
+
+    BrickFile() : fd(-1) { memset(&header, 0, sizeof(header)); }
+    ~BrickFile() { close(); }
+
+    bool open(const char* filename)
+    {
+        close();
+#ifdef _WIN32
+        std::cout << "Bricked volume files are not supported on this platform" << std::endl;
+        return false;
+#else
+        fd = ::open(filename, O_RDONLY);
+        if(fd < 0)
+        {
+            std::cout << "Could not open " << filename << std::endl;
+            return false;
+        }
+        if(!read_at(0, &header, sizeof(header)) || memcmp(header.magic, BRICK_FILE_MAGIC, 8))
+        {
+            std::cout << filename << " is not a bricked volume file" << std::endl;
+            close();
+            return false;
+        }
+        // nothing from the file is trusted before it is checked against the
+        // file size, so a corrupt file fails here instead of allocating
+        // or reading out of bounds later
+        struct stat st;
+        const uint64_t file_size = fstat(fd, &st) == 0 ? uint64_t(st.st_size) : 0;
+        if(header.levels == 0 || header.levels > BRICK_FILE_MAX_LEVELS || header.brick_size <= 0
+           || header.brick_size > BRICK_FILE_MAX_BRICK_SIZE || (header.format != VOLUME_R8 && header.format != VOLUME_R16)
+           || header.level_table > file_size || file_size - header.level_table < header.levels * sizeof(BrickFileLevel))
+        {
+            std::cout << filename << ": bad header" << std::endl;
+            close();
+            return false;
+        }
+        levels.resize(header.levels);
+        if(!read_at(header.level_table, &levels[0], levels.size() * sizeof(BrickFileLevel)))
+        {
+            std::cout << filename << ": bad level table" << std::endl;
+            close();
+            return false;
+        }
+        // the levels must tile their sizes with bricks and follow each
+        // other in the brick table, which must fit in the file
+        uint64_t count = 0;
+        for(size_t l = 0; l < levels.size(); l++)
+        {
+            const BrickFileLevel& level = levels[l];
+            bool ok = level.first == count;
+            for(int a = 0; a < 3 && ok; a++)
+                ok = level.dims[a] > 0 && (l > 0 || level.dims[a] == header.dims[a])
+                     && level.bricks[a] == (level.dims[a] + header.brick_size - 1) / header.brick_size;
+            if(!ok)
+            {
+                std::cout << filename << ": bad level table" << std::endl;
+                close();
+                return false;
+            }
+            count += uint64_t(level.bricks[0]) * level.bricks[1] * level.bricks[2];
+        }
+        if(header.brick_table > file_size || (file_size - header.brick_table) / sizeof(BrickFileEntry) < count)
+        {
+            std::cout << filename << ": bad brick table" << std::endl;
+            close();
+            return false;
+        }
+        bricks.resize(count);
+        if(!read_at(header.brick_table, &bricks[0], bricks.size() * sizeof(BrickFileEntry)))
+        {
+            std::cout << filename << ": bad brick table" << std::endl;
+            close();
+            return false;
+        }
+        for(size_t i = 0; i < bricks.size(); i++)
+        {
+            const BrickFileEntry& e = bricks[i];
+            if(e.codec != BRICK_CONSTANT && (e.offset > file_size || file_size - e.offset < e.bytes))
+            {
+                std::cout << filename << ": brick " << i << " lies outside the file" << std::endl;
+                close();
+                return false;
+            }
+            if(!brick_codec_available(e.codec))
+            {
+                std::cout << filename << " has " << brick_codec_name(bricks[i].codec)
+                          << " bricks, which this build cannot read" << std::endl;
+                close();
+                return false;
+            }
+        }
+        return true;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if(fd >= 0) ::close(fd);
+#endif
+        fd = -1;
+    }
+
+    VolumeFormat format() const { return VolumeFormat(header.format); }
+    int bytes_per_voxel() const { return header.format == VOLUME_R16 ? 2 : 1; }
+    int padded() const { return header.brick_size + 2; }
+    size_t brick_bytes() const { return size_t(padded()) * padded() * padded() * bytes_per_voxel(); }
+
+    const BrickFileEntry& entry(int level, int brick) const { return bricks[levels[level].first + brick]; }
+
+    // the padded voxels of a brick, brick_bytes() of them
+    bool read_brick(int level, int brick, unsigned char* dst) const
+    {
+        const BrickFileEntry& e = entry(level, brick);
+        if(e.codec == BRICK_CONSTANT)
+        {
+            if(bytes_per_voxel() == 1)
+                memset(dst, e.min, brick_bytes());
+            else
+                std::fill((unsigned short*)dst, (unsigned short*)(dst + brick_bytes()), e.min);
+            return true;
+        }
+        std::vector<unsigned char> stored(e.bytes);
+        if(!read_at(e.offset, &stored[0], e.bytes)) return false;
+        return decompress_brick(e.codec, &stored[0], e.bytes, dst, brick_bytes());
+    }
+
+    // a whole level as a host volume
+    bool read_volume(int level, Volume& vol, ThreadPool& pool) const
+    {
+        const BrickFileLevel& l = levels[level];
+        const int b = header.brick_size, p = padded(), bpv = bytes_per_voxel();
+        vol.resize(l.dims[0], l.dims[1], l.dims[2], format());
+        bool ok = true;
+        pool.parallel_for(l.bricks[0] * l.bricks[1] * l.bricks[2], [&](int i, int)
+        {
+            std::vector<unsigned char> brick(brick_bytes());
+            if(!read_brick(level, i, &brick[0])) { ok = false; return; }
+            int c[3] = { i % l.bricks[0], i / l.bricks[0] % l.bricks[1], i / (l.bricks[0] * l.bricks[1]) };
+            int count = std::min(b, l.dims[0] - c[0] * b);
+            for(int z = 0; z < b && c[2] * b + z < l.dims[2]; z++)
+                for(int y = 0; y < b && c[1] * b + y < l.dims[1]; y++)
+                    memcpy((unsigned char*)vol.voxel(c[0] * b, c[1] * b + y, c[2] * b + z),
+                           &brick[((size_t(z + 1) * p + y + 1) * p + 1) * bpv], size_t(count) * bpv);
+        });
+        return ok;
+    }
+
+    BrickFileHeader header;
+    std::vector<BrickFileLevel> levels;
+    std::vector<BrickFileEntry> bricks;
+
+private:
+
+    BrickFile(const BrickFile&);
+    BrickFile& operator=(const BrickFile&);
+
+    bool read_at(uint64_t offset, void* dst, size_t n) const
+    {
+#ifdef _WIN32
+        return false;
+#else
+        unsigned char* p = (unsigned char*)dst;
+        while(n)
+        {
+            ssize_t r = pread(fd, p, n, off_t(offset));
+            if(r <= 0) return false;
+            p += r; n -= size_t(r); offset += uint64_t(r);
+        }
+        return true;
+#endif
+    }
+
+    int fd;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#include "Matrix4.h"
+
+// The view used by display(): the unit texture cube is centered, spun
+// around the (0,1,1) axis and pushed back along -z. Both the GL path and
+// the CPU raycaster build their matrices from here so they see the same
+// rays.
+struct Camera {
+
+    Camera() : rotate(0.0f), distance(2.25f), fovy(60.0f) {}
+
+    Matrix4 modelview() const {
+        return Matrix4::translation(0.0f, 0.0f, -distance) *
+               Matrix4::rotation(rotate, 0.0f, 1.0f, 1.0f) *
+               Matrix4::translation(-0.5f, -0.5f, -0.5f);
+    }
+
+    // matches resize(): gluPerspective(60.0, w/h, 0.01, 400.0)
+    Matrix4 projection(int width, int height) const {
+        if(height == 0) height = 1;
+        return Matrix4::perspective(fovy, float(width)/float(height), 0.01f, 400.0f);
+    }
+
+    float rotate;   // degrees around (0,1,1)
+    float distance; // eye to cube center
+    float fovy;
+};
+
+// Scripted camera for batch rendering. The file holds one key per line,
+//
+//     rotate distance
+//
+// blank lines and lines starting with '#' are skipped. Frames are spread
+// evenly from the first to the last key and interpolated linearly.
+struct CameraPath {
+
+    bool load(const char* filename)
+    {
+        std::ifstream in(filename);
+        if(!in)
+        {
+            std::cout << "Could not open camera path " << filename << std::endl;
+            return false;
+        }
+        keys.clear();
+        std::string line;
+        int line_no = 0;
+        while(std::getline(in, line))
+        {
+            line_no++;
+            size_t first = line.find_first_not_of(" \t\r");
+            if(first == std::string::npos || line[first] == '#') continue;
+            std::istringstream ls(line);
+            Camera key;
+            if(!(ls >> key.rotate >> key.distance))
+            {
+                std::cout << filename << ":" << line_no << ": expected 'rotate distance'" << std::endl;
+                return false;
+            }
+            keys.push_back(key);
+        }
+        if(keys.empty())
+            std::cout << "Camera path " << filename << " has no keys" << std::endl;
+        return !keys.empty();
+    }
+
+    // the spin of display(), starting at 0 and adding 0.25 degrees per frame
+    void make_spin(int frames)
+    {
+        keys.clear();
+        for(int f = 0; f < frames; f++)
+        {
+            Camera key;
+            key.rotate = 0.25f * (f + 1);
+            keys.push_back(key);
+        }
+    }
+
+    Camera at(int frame, int frames) const
+    {
+        if(keys.size() < 2 || frames < 2) return keys.empty() ? Camera() : keys[0];
+        float t = float(frame) / (frames - 1) * (keys.size() - 1);
+        size_t k = std::min(size_t(t), keys.size() - 2);
+        float f = t - k;
+        Camera c = keys[k];
+        // exact where two keys are the same, so a held view stays still
+        c.rotate   = keys[k].rotate   + (keys[k+1].rotate   - keys[k].rotate)   * f;
+        c.distance = keys[k].distance + (keys[k+1].distance - keys[k].distance) * f;
+        return c;
+    }
+
+    std::vector<Camera> keys;
+};
+
+#endif
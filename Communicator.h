@@ -0,0 +1,285 @@
+#ifndef COMMUNICATOR_H
+#define COMMUNICATOR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+// A fully connected mesh of stream sockets between the processes of one
+// parallel render, addressed by rank. spawn() forks the processes of a
+// single machine and connects them with Unix socket pairs; connect() joins
+// processes started separately, one per rank and possibly on different
+// nodes, over TCP. Every call blocks until its bytes are through, and a
+// failed connection is reported once and makes every later call fail.
+class Communicator {
+public:
+
+    Communicator() : rank(0), size(1), failed(false) {}
+
+    ~Communicator() { finish(); }
+
+    // fork n - 1 children; returns in every process, with its rank set.
+    // Only rank 0 should go on to write output.
+    bool spawn(int n)
+    {
+        size = std::max(n, 1);
+        rank = 0;
+        std::vector<int> pairs(size_t(size) * size * 2, -1);
+        for(int a = 0; a < size; a++)
+            for(int b = a + 1; b < size; b++)
+                if(socketpair(AF_UNIX, SOCK_STREAM, 0, &pairs[(size_t(a) * size + b) * 2]) != 0)
+                {
+                    std::cout << "socketpair failed: " << strerror(errno) << std::endl;
+                    return false;
+                }
+        for(int r = 1; r < size; r++)
+        {
+            pid_t pid = fork();
+            if(pid < 0)
+            {
+                std::cout << "fork failed: " << strerror(errno) << std::endl;
+                return false;
+            }
+            if(pid == 0)
+            {
+                rank = r;
+                children.clear();
+                break;
+            }
+            children.push_back(pid);
+        }
+        // a pair a < b: a keeps the first socket, b the second
+        fds.assign(size, -1);
+        for(int a = 0; a < size; a++)
+            for(int b = a + 1; b < size; b++)
+            {
+                const int* p = &pairs[(size_t(a) * size + b) * 2];
+                if(a == rank)      { fds[b] = p[0]; close(p[1]); }
+                else if(b == rank) { fds[a] = p[1]; close(p[0]); }
+                else               { close(p[0]); close(p[1]); }
+            }
+        return true;
+    }
+
+    // rank r of the processes listening at peers, "host:port" each. Every
+    // rank listens on its own port, connects to the lower ranks and then
+    // accepts the higher ones, so the ranks can be started in any order.
+    bool connect(int r, const std::vector<std::string>& peers, int timeout_s = 60)
+    {
+        rank = r;
+        size = int(peers.size());
+        fds.assign(size, -1);
+        std::string host, port;
+        if(r < 0 || r >= size || !split_address(peers[r], host, port))
+        {
+            std::cout << "rank " << r << " has no address in the peer list" << std::endl;
+            return false;
+        }
+        int listener = listen_on(port.c_str());
+        if(listener < 0) return false;
+        for(int p = 0; p < r; p++)
+        {
+            int fd = -1;
+            for(int tries = 0; tries < timeout_s * 10 && fd < 0; tries++)
+            {
+                if(split_address(peers[p], host, port)) fd = dial(host.c_str(), port.c_str());
+                if(fd < 0) usleep(100000);
+            }
+            if(fd < 0 || !write_all(fd, &rank, sizeof(rank)))
+            {
+                std::cout << "Could not connect to rank " << p << " at " << peers[p] << std::endl;
+                close(listener);
+                return false;
+            }
+            fds[p] = fd;
+        }
+        for(int n = r + 1; n < size; n++)
+        {
+            int fd = accept(listener, NULL, NULL);
+            int peer = -1;
+            if(fd < 0 || !read_all(fd, &peer, sizeof(peer)) || peer <= r || peer >= size || fds[peer] >= 0)
+            {
+                std::cout << "Bad connection from a peer of rank " << r << std::endl;
+                if(fd >= 0) close(fd);
+                close(listener);
+                return false;
+            }
+            no_delay(fd);
+            fds[peer] = fd;
+        }
+        close(listener);
+        return true;
+    }
+
+    bool send(int peer, const void* data, size_t bytes) { return check(write_all(fds[peer], data, bytes)); }
+    bool recv(int peer, void* data, size_t bytes) { return check(read_all(fds[peer], data, bytes)); }
+
+    // send and receive at the same time, so two ranks swapping buffers
+    // larger than the socket buffers do not both block in write()
+    bool exchange(int peer, const void* out, size_t out_bytes, void* in, size_t in_bytes)
+    {
+        if(failed) return false;
+        const int fd = fds[peer];
+        const char* o = (const char*)out;
+        char* i = (char*)in;
+        while(out_bytes || in_bytes)
+        {
+            pollfd p;
+            p.fd = fd;
+            p.events = short((out_bytes ? POLLOUT : 0) | (in_bytes ? POLLIN : 0));
+            p.revents = 0;
+            if(poll(&p, 1, -1) < 0)
+            {
+                if(errno == EINTR) continue;
+                return check(false);
+            }
+            if(in_bytes && (p.revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                ssize_t n = ::recv(fd, i, in_bytes, MSG_DONTWAIT);
+                if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) return check(false);
+                if(n > 0) { i += n; in_bytes -= size_t(n); }
+            }
+            if(out_bytes && (p.revents & POLLOUT))
+            {
+                ssize_t n = ::send(fd, o, out_bytes, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if(n < 0 && errno != EAGAIN && errno != EINTR) return check(false);
+                if(n > 0) { o += n; out_bytes -= size_t(n); }
+            }
+        }
+        return true;
+    }
+
+    // close the sockets; rank 0 of a spawned mesh also waits for its children
+    void finish()
+    {
+        for(size_t p = 0; p < fds.size(); p++)
+            if(fds[p] >= 0) close(fds[p]);
+        fds.clear();
+        for(size_t c = 0; c < children.size(); c++)
+            waitpid(children[c], NULL, 0);
+        children.clear();
+    }
+
+    int rank, size;
+
+    // socket helpers of the mesh, also used by the remote rendering server
+    // and its clients
+    static void no_delay(int fd)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    // a TCP listener on port of every interface, -1 on failure
+    static int listen_on(const char* port)
+    {
+        addrinfo hints, *res = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if(getaddrinfo(NULL, port, &hints, &res) != 0)
+        {
+            std::cout << "bad port " << port << std::endl;
+            return -1;
+        }
+        int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        int one = 1;
+        if(fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(fd < 0 || bind(fd, res->ai_addr, res->ai_addrlen) != 0 || listen(fd, 64) != 0)
+        {
+            std::cout << "Could not listen on port " << port << ": " << strerror(errno) << std::endl;
+            if(fd >= 0) close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+        return fd;
+    }
+
+    // a TCP connection to host:port, -1 on failure
+    static int dial(const char* host, const char* port)
+    {
+        addrinfo hints, *res = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if(getaddrinfo(host, port, &hints, &res) != 0) return -1;
+        int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if(fd >= 0 && ::connect(fd, res->ai_addr, res->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+        if(fd >= 0) no_delay(fd);
+        return fd;
+    }
+
+    static bool write_all(int fd, const void* data, size_t bytes)
+    {
+        const char* p = (const char*)data;
+        while(bytes)
+        {
+            ssize_t n = ::send(fd, p, bytes, MSG_NOSIGNAL);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            p += n;
+            bytes -= size_t(n);
+        }
+        return true;
+    }
+
+    static bool read_all(int fd, void* data, size_t bytes)
+    {
+        char* p = (char*)data;
+        while(bytes)
+        {
+            ssize_t n = ::recv(fd, p, bytes, 0);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            p += n;
+            bytes -= size_t(n);
+        }
+        return true;
+    }
+
+private:
+
+    bool check(bool ok)
+    {
+        if(!ok && !failed)
+        {
+            std::cout << "rank " << rank << ": connection lost" << std::endl;
+            failed = true;
+        }
+        return ok && !failed;
+    }
+
+    static bool split_address(const std::string& a, std::string& host, std::string& port)
+    {
+        size_t colon = a.rfind(':');
+        if(colon == std::string::npos || colon + 1 == a.size()) return false;
+        host = colon ? a.substr(0, colon) : "localhost";
+        port = a.substr(colon + 1);
+        return true;
+    }
+
+    std::vector<int> fds;
+    std::vector<pid_t> children;
+    bool failed;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef CPURAYCASTER_H
+#define CPURAYCASTER_H
+
+#include <vector>
+#include <algorithm>
+
+#include "Vector3.h"
+#include "Matrix4.h"
+#include "Camera.h"
+#include "Volume.h"
+#include "ThreadPool.h"
+#include "RayMarch.h"
+#include "RayPacket.h"
+
+//--------------------------------------------------------------------------------------
+// slab test against the unit texture cube, t is the parameter along p0 -> p1
+//--------------------------------------------------------------------------------------
+inline bool intersect_unit_box(const Vector3& p0, const Vector3& d, float& tnear, float& tfar)
+{
+    tnear = -1e30f;
+    tfar  =  1e30f;
+    for(int a = 0; a < 3; a++)
+    {
+        if(d[a] == 0.0f)
+        {
+            if(p0[a] < 0.0f || p0[a] > 1.0f) return false;
+            continue;
+        }
+        float t0 = (0.0f - p0[a]) / d[a];
+        float t1 = (1.0f - p0[a]) / d[a];
+        if(t0 > t1) std::swap(t0, t1);
+        tnear = std::max(tnear, t0);
+        tfar  = std::min(tfar, t1);
+    }
+    return tnear <= tfar;
+}
+
+// Pixel to ray setup shared by the CPU kernels: unprojects the pixel center
+// through the inverse model-view-projection and clips against the cube
+struct RaySetup {
+
+    RaySetup(const Camera& cam, int w, int h)
+        : width(w), height(h), inv_mvp((cam.projection(w, h) * cam.modelview()).inverse()) {}
+
+    // returns false when the pixel does not see a front face of the cube
+    bool ray(int px, int py, Vector3& start, Vector3& back) const
+    {
+        float nx = (px + 0.5f) / width  * 2.0f - 1.0f;
+        float ny = (py + 0.5f) / height * 2.0f - 1.0f;
+        Vector3 p0 = inv_mvp.transformPoint(Vector3(nx, ny, -1.0f));
+        Vector3 p1 = inv_mvp.transformPoint(Vector3(nx, ny,  1.0f));
+        Vector3 d = p1 - p0;
+        float tnear, tfar;
+        // the eye inside the cube has no front face to rasterize
+        if(!intersect_unit_box(p0, d, tnear, tfar) || tnear < 0.0f)
+            return false;
+        start = p0 + d * tnear;
+        back  = p0 + d * tfar;
+        return true;
+    }
+
+    int width, height;
+    Matrix4 inv_mvp;
+};
+
+// Multithreaded reference implementation of raycasting_pass(). The image is
+// cut into TILE_SIZE x TILE_SIZE tiles that are spread over a work-stealing
+// pool. Inside a tile the rays that hit the cube are collected into packets
+// and marched by the widest kernel the CPU supports. The output is RGBA
+// float, bottom row first, i.e. the same layout glGetTexImage() returns for
+// final_image. The packet kernels march the default variant; any other
+// variant marches ray by ray with its instance of march_ray_variant().
+class CpuRaycaster {
+public:
+
+    static const int TILE_SIZE = 32;
+
+    explicit CpuRaycaster(int num_threads = 0)
+        : pool(num_threads), simd(detect_simd_level()), grid(0), tf(0), preint(0), pyramid(0), samples(0), worker_samples(pool.size(), 0) {}
+
+    int num_threads() const { return pool.size(); }
+
+    SimdLevel simd_level() const { return simd; }
+
+    // returns false if the CPU cannot run the requested kernel
+    bool set_simd_level(SimdLevel level)
+    {
+        if(!simd_level_supported(level)) return false;
+        simd = level;
+        return true;
+    }
+
+    // jump over empty cells of this grid, NULL samples every step
+    void set_occupancy_grid(const OccupancyGrid* g) { grid = g; }
+
+    // classification of scalar volumes, unused for RGBA8
+    void set_transfer_function(const TransferFunction* t) { tf = t; }
+
+    // march pre-integrated segments for scalar volumes, NULL for point samples
+    void set_preintegration(const PreintegrationTable* p) { preint = p; }
+
+    // level of detail sampling from this pyramid of the volume, NULL for
+    // full resolution; pre-integration takes precedence
+    void set_level_of_detail(const VolumePyramid* p) { pyramid = p; }
+
+    // compositing, early exit, skipping and loop bound of the marcher;
+    // pre-integration and level of detail only apply to DVR
+    void set_variant(const RayMarchVariant& v) { variant = v; }
+
+    // volume samples taken by the last render()
+    long long last_samples() const { return samples; }
+
+    void render(const Volume& vol, const Camera& cam, float stepsize,
+                int width, int height, std::vector<float>& rgba)
+    {
+        rgba.assign(size_t(width) * height * 4, 0.0f);
+        const RaySetup setup(cam, width, height);
+        const RayMarchVariant v = variant.normalized();
+        const bool dvr = v.compositing == COMPOSITE_DVR;
+        const OccupancyGrid* skip = v.skip_empty ? grid : 0;
+        const PreintegrationTable* pre = dvr ? preint : 0;
+        const bool lod = dvr && pyramid && !pyramid->empty() && !pre;
+        const bool packets = dvr && v.loop == LOOP_CAPPED && v.early_exit == 1.0f;
+        const MarchFunction march = march_function(v, skip);
+        const Vector3 eye = cam.modelview().inverse().transformPoint(Vector3(0.0f, 0.0f, 0.0f));
+        const float pixel = 2.0f * tanf(cam.fovy * 0.5f * float(M_PI) / 180.0f) / height;
+        const int tiles_x = (width  + TILE_SIZE - 1) / TILE_SIZE;
+        const int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+        float* out = &rgba[0];
+
+        std::fill(worker_samples.begin(), worker_samples.end(), 0);
+        pool.parallel_for(tiles_x * tiles_y, [&](int tile, int worker)
+        {
+            const int x0 = (tile % tiles_x) * TILE_SIZE;
+            const int y0 = (tile / tiles_x) * TILE_SIZE;
+            const int x1 = std::min(x0 + TILE_SIZE, width);
+            const int y1 = std::min(y0 + TILE_SIZE, height);
+            const int lanes = simd == SIMD_AVX2 ? 8 : RayPacket::MAX_RAYS;
+            long long tile_samples = 0;
+            RayPacket packet;
+            Vector3 start, back;
+            Ray ray;
+            for(int y = y0; y < y1; y++)
+                for(int x = x0; x < x1; x++)
+                {
+                    if(!setup.ray(x, y, start, back)) continue;
+                    setup_ray(start, back, stepsize, ray);
+                    if(lod)
+                    {
+                        tile_samples += march_ray_lod(vol, *pyramid, ray, (start - eye).length(), pixel, stepsize,
+                                                      out + (size_t(y)*width + x)*4, skip, tf, v.termination());
+                        continue;
+                    }
+                    if(!packets)
+                    {
+                        float* pixel_out = out + (size_t(y)*width + x)*4;
+                        if(pre)
+                            tile_samples += march_ray_preintegrated(vol, ray, stepsize, pixel_out, skip, *pre, v.termination());
+                        else
+                            tile_samples += march(vol, ray, stepsize, pixel_out, skip, tf, v.early_exit);
+                        continue;
+                    }
+                    packet.add(ray, out + (size_t(y)*width + x)*4);
+                    if(packet.count == lanes)
+                    {
+                        tile_samples += march_packet(simd, vol, packet, stepsize, skip, tf, pre);
+                        packet.count = 0;
+                    }
+                }
+            if(packet.count)
+                tile_samples += march_packet(simd, vol, packet, stepsize, skip, tf, pre);
+            worker_samples[worker] += tile_samples;
+        });
+
+        samples = 0;
+        for(size_t i = 0; i < worker_samples.size(); i++)
+            samples += worker_samples[i];
+    }
+
+private:
+    ThreadPool pool;
+    SimdLevel simd;
+    const OccupancyGrid* grid;
+    const TransferFunction* tf;
+    const PreintegrationTable* preint;
+    const VolumePyramid* pyramid;
+    RayMarchVariant variant;
+    long long samples;
+    std::vector<long long> worker_samples;
+};
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+
+#include "ImageIO.h"
+
+// Recording of rendered frames without stalling the render loop. capture()
+// only queues a copy of the image into the next pixel buffer object of a
+// ring and fences it, so the copy runs behind the next frame's passes.
+// Once a fence has signaled, the buffer is mapped and its pointer handed to
+// the writer threads, which encode and write the file straight from the
+// mapping; the buffer goes back into the ring when the file is written.
+// The render loop only waits when the ring is full, which is counted as a
+// stall. Without GL_ARB_pixel_buffer_object or GL_ARB_sync every frame is
+// read back at once into host memory, and only the writing is deferred.
+//
+// All GL calls happen in capture() and finish(), on the thread of the
+// context; images are RGBA float, bottom row first, like read_final_image().
+class FrameCapture {
+public:
+
+    FrameCapture() : frames(0), stalls(0), stall_ms(0.0), write_ms(0.0), failed(0),
+                     width(0), height(0), async(false), next(0), stopping(false) {}
+
+    ~FrameCapture() { finish(); }
+
+    // ring_size images in flight, written by writers threads; call with a
+    // current GL context
+    void init(int w, int h, int ring_size = 3, int writers = 2)
+    {
+        finish();
+        width = w;
+        height = h;
+        async = GLEW_ARB_pixel_buffer_object && GLEW_ARB_sync;
+        if(!async)
+            std::cout << "GL_ARB_pixel_buffer_object or GL_ARB_sync not supported, frames are read back synchronously" << std::endl;
+        slots.assign(std::max(ring_size, 2), Slot());
+        for(size_t s = 0; s < slots.size(); s++)
+        {
+            if(!async) continue;
+            glGenBuffers(1, &slots[s].pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[s].pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, bytes(), NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        next = 0;
+        stopping = false;
+        for(int t = 0; t < std::max(writers, 1); t++)
+            threads.push_back(std::thread(&FrameCapture::write_loop, this));
+    }
+
+    bool enabled() const { return !slots.empty(); }
+
+    // queue texture, a width x height RGBA image, to be written to filename
+    void capture(GLuint texture, const std::string& filename)
+    {
+        advance(false);
+        Slot& slot = slots[next];
+        if(slot.state != SLOT_FREE)
+        {
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            while(slot.state != SLOT_FREE) advance(true, &slot);
+            stalls++;
+            stall_ms += 1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        }
+        next = (next + 1) % slots.size();
+        frames++;
+        slot.filename = filename;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if(async)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, 0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            slot.state = SLOT_READING;
+        }
+        else
+        {
+            slot.host.resize(size_t(width) * height * 4);
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &slot.host[0]);
+            queue(slot, &slot.host[0]);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // write every queued frame and stop the writers; returns false if a
+    // file could not be written
+    bool finish()
+    {
+        for(size_t s = 0; s < slots.size(); s++)
+            while(slots[s].state != SLOT_FREE) advance(true, &slots[s]);
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+        threads.clear();
+        for(size_t s = 0; s < slots.size(); s++)
+            if(slots[s].pbo) glDeleteBuffers(1, &slots[s].pbo);
+        slots.clear();
+        return failed == 0;
+    }
+
+    long long frames, stalls; // captured, and how often the ring was full
+    double stall_ms;          // the render loop spent waiting for a free slot
+    double write_ms;          // the writers spent encoding and writing
+    int failed;               // files that could not be written
+
+private:
+
+    enum SlotState { SLOT_FREE, SLOT_READING, SLOT_WRITING };
+
+    struct Slot {
+        Slot() : pbo(0), fence(0), state(SLOT_FREE), written(false), pixels(NULL) {}
+        GLuint pbo;
+        GLsync fence;
+        SlotState state;     // only changed by the GL thread
+        bool written;        // set by the writer, under lock
+        std::string filename;
+        const float* pixels; // the mapping or host, while writing
+        std::vector<float> host;
+    };
+
+    size_t bytes() const { return size_t(width) * height * 4 * sizeof(float); }
+
+    // move the slots on whose copy or write is done; with wait set, block
+    // until the one in target can move
+    void advance(bool wait, Slot* target = NULL)
+    {
+        for(size_t s = 0; s < slots.size(); s++)
+        {
+            Slot& slot = slots[s];
+            const bool block = wait && &slot == target;
+            if(slot.state == SLOT_READING)
+            {
+                GLenum r = glClientWaitSync(slot.fence, block ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, block ? 1000000000ull : 0);
+                if(r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED) continue;
+                glDeleteSync(slot.fence);
+                slot.fence = 0;
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+                const float* p = (const float*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                if(!p)
+                {
+                    std::cout << "Could not map the capture buffer of " << slot.filename << std::endl;
+                    std::lock_guard<std::mutex> lk(lock);
+                    failed++;
+                    slot.state = SLOT_FREE;
+                    continue;
+                }
+                queue(slot, p);
+            }
+            else if(slot.state == SLOT_WRITING)
+            {
+                std::unique_lock<std::mutex> lk(lock);
+                if(block) done.wait(lk, [&] { return slot.written; });
+                if(!slot.written) continue;
+                slot.written = false;
+                slot.state = SLOT_FREE;
+                lk.unlock();
+                if(async)
+                {
+                    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+                    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                }
+            }
+        }
+    }
+
+    void queue(Slot& slot, const float* pixels)
+    {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            slot.pixels = pixels;
+            slot.state = SLOT_WRITING;
+            jobs.push_back(&slot);
+        }
+        wake.notify_one();
+    }
+
+    void write_loop()
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        while(true)
+        {
+            wake.wait(lk, [&] { return stopping || !jobs.empty(); });
+            if(jobs.empty()) return;
+            Slot* slot = jobs.front();
+            jobs.pop_front();
+            lk.unlock();
+
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            const bool ok = write_image(slot->filename.c_str(), slot->pixels, width, height);
+            const double ms = 1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+            lk.lock();
+            write_ms += ms;
+            if(!ok) failed++;
+            slot->written = true;
+            done.notify_all();
+        }
+    }
+
+    int width, height;
+    bool async;
+    std::vector<Slot> slots;
+    size_t next;               // the slot the next capture goes into
+    std::deque<Slot*> jobs;    // mapped, waiting for a writer
+    bool stopping;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    std::vector<std::thread> threads;
+};
+
+#endif
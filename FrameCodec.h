@@ -0,0 +1,219 @@
+#ifndef FRAMECODEC_H
+#define FRAMECODEC_H
+
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+// Lossless delta coding of RGB8 frames for the remote clients, without any
+// library. The frame is cut into TILE x TILE tiles; a bitmap says which
+// tiles differ from the frame the client already has, and only those are
+// sent. A changed tile is predicted either from the same tile of that
+// frame or from the pixel to its left ( above for the first column ),
+// whichever leaves more zero bytes, and the residuals are stored as runs
+// of zeros and literals. The first frame is coded against a black one.
+//
+// Stream: bitmap of ( tiles + 7 ) / 8 bytes, then for every changed tile in
+// row major order a mode byte ( FRAME_TILE_TEMPORAL or FRAME_TILE_SPATIAL )
+// and its residuals as pairs of varints zeros, literals followed by the
+// literal bytes, until the tile's width * height * 3 bytes are covered.
+
+enum { FRAME_TILE_TEMPORAL = 1, FRAME_TILE_SPATIAL = 2 };
+
+inline void put_varint(std::vector<unsigned char>& out, size_t v)
+{
+    while(v >= 0x80)
+    {
+        out.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char)v);
+}
+
+inline bool get_varint(const unsigned char*& p, const unsigned char* end, size_t& v)
+{
+    v = 0;
+    for(int shift = 0; p < end && shift < 63; shift += 7)
+    {
+        const unsigned char b = *p++;
+        v |= size_t(b & 0x7f) << shift;
+        if(!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// Tiles of a width x height frame, shared by both ends
+struct FrameTiling {
+
+    static const int TILE = 16;
+
+    FrameTiling() : width(0), height(0), tiles_x(0), tiles_y(0) {}
+
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        tiles_x = (w + TILE - 1) / TILE;
+        tiles_y = (h + TILE - 1) / TILE;
+    }
+
+    int count() const { return tiles_x * tiles_y; }
+
+    void rect(int t, int& x0, int& y0, int& w, int& h) const
+    {
+        x0 = (t % tiles_x) * TILE;
+        y0 = (t / tiles_x) * TILE;
+        w = std::min(TILE, width - x0);
+        h = std::min(TILE, height - y0);
+    }
+
+    int width, height, tiles_x, tiles_y;
+};
+
+// One client's end of the stream: codes every frame against the previous
+// one it coded, so frames must reach the client in order and none may be
+// dropped after encode().
+class FrameEncoder {
+public:
+
+    FrameEncoder() : changed_tiles(0) {}
+
+    // rgba is 4 bytes per pixel, the alpha is not sent
+    void encode(const unsigned char* rgba, int width, int height, std::vector<unsigned char>& out)
+    {
+        if(width != tiling.width || height != tiling.height)
+        {
+            tiling.resize(width, height);
+            reference.assign(size_t(width) * height * 3, 0);
+        }
+        const int tiles = tiling.count();
+        out.assign((tiles + 7) / 8, 0);
+        changed_tiles = 0;
+        unsigned char cur[FrameTiling::TILE * FrameTiling::TILE * 3];
+        unsigned char temporal[sizeof(cur)], spatial[sizeof(cur)];
+        for(int t = 0; t < tiles; t++)
+        {
+            int x0, y0, w, h;
+            tiling.rect(t, x0, y0, w, h);
+            const size_t row = size_t(w) * 3;
+            bool changed = false;
+            for(int y = 0; y < h; y++)
+            {
+                const unsigned char* src = rgba + (size_t(y0 + y) * width + x0) * 4;
+                unsigned char* c = cur + y * row;
+                for(int x = 0; x < w; x++)
+                {
+                    c[x*3] = src[x*4]; c[x*3+1] = src[x*4+1]; c[x*3+2] = src[x*4+2];
+                }
+                if(memcmp(c, &reference[(size_t(y0 + y) * width + x0) * 3], row)) changed = true;
+            }
+            if(!changed) continue;
+
+            out[t >> 3] |= (unsigned char)(1 << (t & 7));
+            changed_tiles++;
+            size_t zeros_t = 0, zeros_s = 0;
+            for(int y = 0; y < h; y++)
+            {
+                unsigned char* ref = &reference[(size_t(y0 + y) * width + x0) * 3];
+                const unsigned char* c = cur + y * row;
+                for(size_t i = 0; i < row; i++)
+                {
+                    const unsigned char pred = i >= 3 ? c[i - 3] : y > 0 ? c[i - row] : 0;
+                    temporal[y * row + i] = (unsigned char)(c[i] - ref[i]);
+                    spatial[y * row + i] = (unsigned char)(c[i] - pred);
+                    zeros_t += temporal[y * row + i] == 0;
+                    zeros_s += spatial[y * row + i] == 0;
+                }
+                memcpy(ref, c, row);
+            }
+            const bool use_spatial = zeros_s > zeros_t;
+            out.push_back(use_spatial ? FRAME_TILE_SPATIAL : FRAME_TILE_TEMPORAL);
+            put_runs(use_spatial ? spatial : temporal, row * h, out);
+        }
+    }
+
+    int changed_tiles;   // of the last frame
+    FrameTiling tiling;
+
+private:
+
+    static void put_runs(const unsigned char* r, size_t n, std::vector<unsigned char>& out)
+    {
+        for(size_t i = 0; i < n; )
+        {
+            size_t zeros = 0;
+            while(i + zeros < n && r[i + zeros] == 0) zeros++;
+            i += zeros;
+            // a literal run ends at the first pair of zeros, single ones are
+            // cheaper to keep
+            size_t lit = 0;
+            while(i + lit < n && !(r[i + lit] == 0 && (i + lit + 1 == n || r[i + lit + 1] == 0))) lit++;
+            put_varint(out, zeros);
+            put_varint(out, lit);
+            out.insert(out.end(), r + i, r + i + lit);
+            i += lit;
+        }
+    }
+
+    std::vector<unsigned char> reference;
+};
+
+// The client's end: rgb holds the current frame, 3 bytes per pixel, bottom
+// row first like the server's readback
+class FrameDecoder {
+public:
+
+    // false on a stream that does not fit a width x height frame
+    bool decode(const unsigned char* data, size_t bytes, int width, int height)
+    {
+        if(width != tiling.width || height != tiling.height)
+        {
+            tiling.resize(width, height);
+            rgb.assign(size_t(width) * height * 3, 0);
+        }
+        const int tiles = tiling.count();
+        const unsigned char* p = data + (tiles + 7) / 8;
+        const unsigned char* end = data + bytes;
+        if(p > end) return false;
+        unsigned char residual[FrameTiling::TILE * FrameTiling::TILE * 3];
+        for(int t = 0; t < tiles; t++)
+        {
+            if(!(data[t >> 3] & (1 << (t & 7)))) continue;
+            int x0, y0, w, h;
+            tiling.rect(t, x0, y0, w, h);
+            const size_t row = size_t(w) * 3, n = row * h;
+            if(p >= end) return false;
+            const int mode = *p++;
+            for(size_t i = 0; i < n; )
+            {
+                size_t zeros, lit;
+                if(!get_varint(p, end, zeros) || !get_varint(p, end, lit) || zeros > n - i || lit > n - i - zeros
+                   || lit > size_t(end - p))
+                    return false;
+                memset(residual + i, 0, zeros);
+                memcpy(residual + i + zeros, p, lit);
+                p += lit;
+                i += zeros + lit;
+            }
+            for(int y = 0; y < h; y++)
+            {
+                unsigned char* dst = &rgb[(size_t(y0 + y) * width + x0) * 3];
+                const unsigned char* r = residual + y * row;
+                for(size_t i = 0; i < row; i++)
+                {
+                    if(mode == FRAME_TILE_SPATIAL)
+                        dst[i] = (unsigned char)(r[i] + (i >= 3 ? dst[i - 3] : y > 0 ? dst[int(i) - int(width) * 3] : 0));
+                    else
+                        dst[i] = (unsigned char)(dst[i] + r[i]);
+                }
+            }
+        }
+        return p == end;
+    }
+
+    std::vector<unsigned char> rgb;
+    FrameTiling tiling;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef FRAMEGOVERNOR_H
+#define FRAMEGOVERNOR_H
+
+#include <vector>
+#include <algorithm>
+
+// What the governor currently asks for: render at 1/scale of the
+// resolution per side, with the step scaled by step_scale. frame_ms is the
+// measured frame time the decision was made on.
+struct GovernorDecision {
+    GovernorDecision() : level(0), scale(1), step_scale(1.0f), frame_ms(0.0) {}
+    int level; // 0 is full quality, higher levels are cheaper
+    int scale;
+    float step_scale;
+    double frame_ms;
+};
+
+// Closed loop control of the frame time. Quality levels form a ladder from
+// full resolution and step down to a quarter of the resolution with three
+// times the step; the cost of a level is taken as proportional to pixels
+// times samples, so one measurement predicts the frame time of every other
+// level. The measurement is the median of the last frames, so a single
+// hitch such as a shader compile does not count. When it is over budget
+// the governor drops straight to the first level predicted to fit with
+// 10% to spare; it only climbs one level at a time, and only after the
+// predicted time of the level above has stayed under 85% of the budget
+// for up_frames frames.
+// The gap between the two thresholds, and the frames skipped after every
+// change so the window only holds frames of the new level, keep it from
+// oscillating between two levels.
+class FrameGovernor {
+public:
+
+    FrameGovernor() : window(8), up_frames(30), cooldown_frames(3), budget(0.0), cooldown(0), fits(0)
+    {
+        const int scales[]        = { 1, 1,     1,    1,    2,    2,    2,    3,    4,    4 };
+        const float step_scales[] = { 1, 1.25f, 1.5f, 2.0f, 1.0f, 1.5f, 2.0f, 2.0f, 2.0f, 3.0f };
+        for(int i = 0; i < int(sizeof(scales) / sizeof(scales[0])); i++)
+        {
+            GovernorDecision d;
+            d.level = i;
+            d.scale = scales[i];
+            d.step_scale = step_scales[i];
+            ladder.push_back(d);
+        }
+        current = ladder[0];
+    }
+
+    // target frame time in ms, 0 turns the governor off and restores full quality
+    void set_budget(double ms)
+    {
+        budget = std::max(ms, 0.0);
+        reset();
+    }
+    double budget_ms() const { return budget; }
+    bool enabled() const { return budget > 0.0; }
+
+    // back to full quality, forgetting the measurements
+    void reset()
+    {
+        current = ladder[0];
+        times.clear();
+        cooldown = 0;
+        fits = 0;
+    }
+
+    // the time of a frame rendered as decision() says; returns true when
+    // the decision changed
+    bool frame(double ms)
+    {
+        if(!enabled()) return false;
+        if(cooldown > 0)
+        {
+            cooldown--;
+            return false;
+        }
+        times.push_back(ms);
+        if(int(times.size()) > window) times.erase(times.begin());
+        if(int(times.size()) < window) return false;
+
+        std::vector<double> sorted(times);
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        const double median = sorted[sorted.size() / 2];
+        current.frame_ms = median;
+
+        const int level = current.level;
+        if(median > budget * 1.1)
+        {
+            int next = level;
+            while(next + 1 < levels() && predict(median, next) > budget * 0.9) next++;
+            return change(next, median);
+        }
+        if(level > 0 && predict(median, level - 1) < budget * 0.85)
+        {
+            if(++fits >= up_frames) return change(level - 1, median);
+        }
+        else
+            fits = 0;
+        return false;
+    }
+
+    const GovernorDecision& decision() const { return current; }
+    const GovernorDecision& level(int i) const { return ladder[i]; }
+    int levels() const { return int(ladder.size()); }
+
+    int window;          // frames measured
+    int up_frames;       // frames the level above must fit before climbing
+    int cooldown_frames; // frames ignored after a change
+
+private:
+
+    static double cost(const GovernorDecision& d) { return 1.0 / (double(d.scale) * d.scale * d.step_scale); }
+
+    // frame time at level i from the time of the current level
+    double predict(double ms, int i) const { return ms * cost(ladder[i]) / cost(current); }
+
+    bool change(int level, double ms)
+    {
+        if(level == current.level) return false;
+        current = ladder[level];
+        current.frame_ms = ms;
+        times.clear();
+        cooldown = cooldown_frames;
+        fits = 0;
+        return true;
+    }
+
+    double budget;
+    std::vector<GovernorDecision> ladder;
+    GovernorDecision current;
+    std::vector<double> times;
+    int cooldown;
+    int fits;
+};
+
+#endif
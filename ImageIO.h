@@ -0,0 +1,167 @@
+#ifndef IMAGEIO_H
+#define IMAGEIO_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+//--------------------------------------------------------------------------------------
+// clamp and flip an RGBA float image into top row first RGB bytes
+//--------------------------------------------------------------------------------------
+inline void to_rgb8(const float* rgba, int width, int height, std::vector<unsigned char>& rgb)
+{
+    rgb.resize(size_t(width) * height * 3);
+    for(int y = 0; y < height; y++)
+    {
+        const float* src = rgba + size_t(height - 1 - y) * width * 4;
+        unsigned char* dst = &rgb[size_t(y) * width * 3];
+        for(int x = 0; x < width; x++)
+            for(int c = 0; c < 3; c++)
+            {
+                float v = src[x*4 + c];
+                v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+                dst[x*3 + c] = (unsigned char)(v * 255.0f + 0.5f);
+            }
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// write an RGBA float image ( bottom row first, as read back from GL ) to a
+// binary PPM, colors are clamped to [0,1]
+//--------------------------------------------------------------------------------------
+inline bool write_ppm(const char* filename, const float* rgba, int width, int height)
+{
+    FILE* f = fopen(filename, "wb");
+    if(!f)
+    {
+        std::cout << "Could not open " << filename << " for writing" << std::endl;
+        return false;
+    }
+    std::vector<unsigned char> rgb;
+    to_rgb8(rgba, width, height, rgb);
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    fwrite(&rgb[0], 1, rgb.size(), f);
+    fclose(f);
+    return true;
+}
+
+struct PngCrcTable {
+    PngCrcTable() {
+        for(unsigned i = 0; i < 256; i++)
+        {
+            unsigned c = i;
+            for(int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            v[i] = c;
+        }
+    }
+    unsigned v[256];
+};
+
+inline unsigned png_crc(unsigned crc, const unsigned char* p, size_t n)
+{
+    static const PngCrcTable table;
+    crc = ~crc;
+    for(size_t i = 0; i < n; i++) crc = table.v[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline void png_chunk(FILE* f, const char* type, const unsigned char* data, size_t n)
+{
+    unsigned char head[8] = { (unsigned char)(n >> 24), (unsigned char)(n >> 16),
+                              (unsigned char)(n >> 8), (unsigned char)n,
+                              (unsigned char)type[0], (unsigned char)type[1],
+                              (unsigned char)type[2], (unsigned char)type[3] };
+    unsigned crc = png_crc(png_crc(0, head + 4, 4), data, n);
+    unsigned char tail[4] = { (unsigned char)(crc >> 24), (unsigned char)(crc >> 16),
+                              (unsigned char)(crc >> 8), (unsigned char)crc };
+    fwrite(head, 1, 8, f);
+    if(n) fwrite(data, 1, n, f);
+    fwrite(tail, 1, 4, f);
+}
+
+//--------------------------------------------------------------------------------------
+// write an RGBA float image as an 8 bit RGB PNG. The zlib stream uses stored
+// ( uncompressed ) deflate blocks, which keeps this free of dependencies and
+// cheap enough for batch output.
+//--------------------------------------------------------------------------------------
+inline bool write_png(const char* filename, const float* rgba, int width, int height)
+{
+    FILE* f = fopen(filename, "wb");
+    if(!f)
+    {
+        std::cout << "Could not open " << filename << " for writing" << std::endl;
+        return false;
+    }
+    std::vector<unsigned char> rgb;
+    to_rgb8(rgba, width, height, rgb);
+
+    // scanlines with filter type 0
+    const size_t stride = size_t(width) * 3 + 1;
+    std::vector<unsigned char> raw(stride * height);
+    for(int y = 0; y < height; y++)
+    {
+        raw[y * stride] = 0;
+        memcpy(&raw[y * stride + 1], &rgb[size_t(y) * width * 3], stride - 1);
+    }
+
+    std::vector<unsigned char> z;
+    z.push_back(0x78); z.push_back(0x01);
+    unsigned a = 1, b = 0;
+    for(size_t pos = 0; pos < raw.size(); )
+    {
+        size_t n = std::min(raw.size() - pos, size_t(65535));
+        z.push_back(pos + n == raw.size() ? 1 : 0);
+        z.push_back(n & 0xff); z.push_back(n >> 8);
+        z.push_back(~n & 0xff); z.push_back((~n >> 8) & 0xff);
+        z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + n);
+        for(size_t i = pos; i < pos + n; i++) { a = (a + raw[i]) % 65521; b = (b + a) % 65521; }
+        pos += n;
+    }
+    unsigned adler = (b << 16) | a;
+    z.push_back(adler >> 24); z.push_back(adler >> 16); z.push_back(adler >> 8); z.push_back(adler);
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    unsigned char ihdr[13] = { (unsigned char)(width >> 24), (unsigned char)(width >> 16),
+                               (unsigned char)(width >> 8), (unsigned char)width,
+                               (unsigned char)(height >> 24), (unsigned char)(height >> 16),
+                               (unsigned char)(height >> 8), (unsigned char)height,
+                               8, 2, 0, 0, 0 };
+    fwrite(signature, 1, 8, f);
+    png_chunk(f, "IHDR", ihdr, 13);
+    png_chunk(f, "IDAT", &z[0], z.size());
+    png_chunk(f, "IEND", 0, 0);
+    fclose(f);
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// write the RGBA float pixels unchanged, bottom row first, no header
+//--------------------------------------------------------------------------------------
+inline bool write_raw(const char* filename, const float* rgba, int width, int height)
+{
+    FILE* f = fopen(filename, "wb");
+    if(!f)
+    {
+        std::cout << "Could not open " << filename << " for writing" << std::endl;
+        return false;
+    }
+    size_t n = size_t(width) * height * 4;
+    bool ok = fwrite(rgba, sizeof(float), n, f) == n;
+    fclose(f);
+    return ok;
+}
+
+//--------------------------------------------------------------------------------------
+// pick the writer from the file extension: .png, .raw or else PPM
+//--------------------------------------------------------------------------------------
+inline bool write_image(const char* filename, const float* rgba, int width, int height)
+{
+    const char* ext = strrchr(filename, '.');
+    if(ext && !strcmp(ext, ".png")) return write_png(filename, rgba, width, height);
+    if(ext && !strcmp(ext, ".raw")) return write_raw(filename, rgba, width, height);
+    return write_ppm(filename, rgba, width, height);
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef INSITU_H
+#define INSITU_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <iostream>
+
+#include "Volume.h"
+
+#define INSITU_MAGIC "RCINSITU"
+#define INSITU_VERSION 1
+
+// In-situ frames from a running simulation: a POSIX shared memory object
+// holding a ring of volume slots, written by one producer and read by one
+// renderer. The handshake is two counters in the header. The producer
+// fills slot head % slots and then publishes it by advancing head; the
+// renderer takes the newest published slot, uploads straight from the
+// mapping and then advances tail past it, which hands that slot and every
+// older one back. Neither side ever waits for the other: a producer that
+// finds the ring full drops its frame, and a renderer that finds nothing
+// new keeps showing the last frame. Older frames the renderer skips on
+// its way to the newest one are counted as superseded.
+//
+// Both processes must be built for the same host, the layout is in host
+// byte order. Slots start on page boundaries. The renderer checks the
+// layout when it opens the ring and keeps its own copy of where the slots
+// are, so a producer that rewrites its header later cannot move a read
+// outside the mapping; frame_fits() checks each frame against it.
+struct InSituSlot {
+    uint64_t step;     // simulation step of the frame
+    double published;  // steady clock of the producer, seconds, CLOCK_MONOTONIC on Linux
+};
+
+struct InSituHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;         // VolumeFormat, VOLUME_R8 or VOLUME_R16
+    int32_t dims[3];
+    uint32_t slots;
+    uint64_t slot_bytes;     // voxels of a slot, padded to a page
+    uint64_t data_offset;    // of slot 0 from the start of the object
+    std::atomic<uint64_t> head;    // frames published, written by the producer only
+    std::atomic<uint64_t> tail;    // frames handed back, written by the renderer only
+    std::atomic<uint64_t> dropped; // frames the producer found no free slot for
+    std::atomic<uint32_t> ready;   // the fields above are set
+    std::atomic<uint32_t> closed;  // the producer is done
+    InSituSlot slot[1];            // slots entries
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the in-situ ring needs lock-free 64 bit atomics");
+
+inline double insitu_clock()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One end of the ring. create() is the producer's, open() the renderer's.
+class InSituRing {
+public:
+
+    InSituRing() : header(NULL), bytes(0), owner(false), slots(0), slot_bytes(0), data_offset(0) {}
+
+    ~InSituRing() { close(); }
+
+    // name is a shared memory name such as /rayCast; an existing ring of
+    // that name is replaced
+    bool create(const char* ring_name, const int dims[3], VolumeFormat format, int slots)
+    {
+        close();
+        name = ring_name;
+        const size_t page = size_t(sysconf(_SC_PAGESIZE));
+        const size_t voxel_bytes = size_t(dims[0]) * dims[1] * dims[2] * (format == VOLUME_R16 ? 2 : 1);
+        const size_t slot_bytes = (voxel_bytes + page - 1) / page * page;
+        const size_t header_bytes = sizeof(InSituHeader) + sizeof(InSituSlot) * (slots - 1);
+        const size_t data_offset = (header_bytes + page - 1) / page * page;
+        shm_unlink(ring_name);
+        int fd = shm_open(ring_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if(fd < 0 || ftruncate(fd, off_t(data_offset + slot_bytes * slots)) != 0)
+        {
+            std::cout << "Could not create the shared memory " << ring_name << ": " << strerror(errno) << std::endl;
+            if(fd >= 0) ::close(fd);
+            return false;
+        }
+        if(!map(fd, data_offset + slot_bytes * slots)) return false;
+        owner = true;
+        // the object starts zeroed, so the counters are 0 already
+        memcpy(header->magic, INSITU_MAGIC, 8);
+        header->version = INSITU_VERSION;
+        header->format = uint32_t(format);
+        for(int a = 0; a < 3; a++) header->dims[a] = dims[a];
+        header->slots = uint32_t(slots);
+        header->slot_bytes = slot_bytes;
+        header->data_offset = data_offset;
+        keep_layout();
+        header->ready.store(1, std::memory_order_release);
+        return true;
+    }
+
+    // false until a producer has created the ring
+    bool open(const char* ring_name)
+    {
+        close();
+        name = ring_name;
+        int fd = shm_open(ring_name, O_RDWR, 0);
+        if(fd < 0) return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(InSituHeader))
+        {
+            ::close(fd);
+            return false;
+        }
+        if(!map(fd, size_t(st.st_size))) return false;
+        if(!header->ready.load(std::memory_order_acquire) || memcmp(header->magic, INSITU_MAGIC, 8) || header->version != INSITU_VERSION ||
+           !layout_valid())
+        {
+            close();
+            return false;
+        }
+        keep_layout();
+        return true;
+    }
+
+    void close()
+    {
+        if(header) munmap((void*)header, bytes);
+        if(owner) shm_unlink(name.c_str());
+        header = NULL;
+        bytes = 0;
+        owner = false;
+        slots = 0;
+    }
+
+    // producer: the slot to fill next, NULL when the ring is full, which
+    // counts the frame as dropped
+    unsigned char* begin_write()
+    {
+        const uint64_t head = header->head.load(std::memory_order_relaxed);
+        if(head - header->tail.load(std::memory_order_acquire) >= slots)
+        {
+            header->dropped.fetch_add(1, std::memory_order_relaxed);
+            return NULL;
+        }
+        return slot_data(head);
+    }
+
+    // producer: publish the slot begin_write() returned
+    void commit(uint64_t step)
+    {
+        const uint64_t head = header->head.load(std::memory_order_relaxed);
+        InSituSlot& s = header->slot[head % slots];
+        s.step = step;
+        s.published = insitu_clock();
+        header->head.store(head + 1, std::memory_order_release);
+    }
+
+    void finish() { header->closed.store(1, std::memory_order_release); }
+
+    // renderer: the newest published frame not taken yet, or NULL. The
+    // frames before it are skipped; all stay valid until release(seq).
+    const unsigned char* newest(uint64_t& seq, InSituSlot& info, uint64_t& skipped)
+    {
+        const uint64_t head = header->head.load(std::memory_order_acquire);
+        const uint64_t tail = header->tail.load(std::memory_order_relaxed);
+        if(head == tail) return NULL;
+        seq = head - 1;
+        skipped = seq - tail;
+        info = header->slot[seq % slots];
+        return slot_data(seq);
+    }
+
+    // renderer: the header still describes frames of dims and format that
+    // fit the slots the ring was opened with
+    bool frame_fits(const int dims[3], VolumeFormat format) const
+    {
+        return layout_valid() && header->slots == slots && header->slot_bytes == slot_bytes && header->data_offset == data_offset
+               && header->format == uint32_t(format) && header->dims[0] == dims[0] && header->dims[1] == dims[1]
+               && header->dims[2] == dims[2];
+    }
+
+    // renderer: done with frame seq and everything before it
+    void release(uint64_t seq) { header->tail.store(seq + 1, std::memory_order_release); }
+
+    bool producer_closed() const { return header->closed.load(std::memory_order_acquire) != 0; }
+    uint64_t dropped() const { return header->dropped.load(std::memory_order_relaxed); }
+
+    InSituHeader* header;
+
+private:
+
+    bool map(int fd, size_t size)
+    {
+        void* p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(p == MAP_FAILED)
+        {
+            std::cout << "Could not map the shared memory " << name << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        header = (InSituHeader*)p;
+        bytes = size;
+        return true;
+    }
+
+    // a header whose slots, frames and slot table all fit the mapping;
+    // the products are formed so that they cannot overflow
+    bool layout_valid() const
+    {
+        const InSituHeader* h = header;
+        if((h->format != VOLUME_R8 && h->format != VOLUME_R16) || h->slots == 0 || h->dims[0] <= 0 || h->dims[1] <= 0 || h->dims[2] <= 0)
+            return false;
+        if(h->data_offset < sizeof(InSituHeader) || h->data_offset > bytes
+           || (h->data_offset - sizeof(InSituHeader)) / sizeof(InSituSlot) + 1 < h->slots
+           || (bytes - h->data_offset) / h->slots < h->slot_bytes)
+            return false;
+        const uint64_t row = uint64_t(h->dims[0]) * h->dims[1] * (h->format == VOLUME_R16 ? 2 : 1);
+        return row <= h->slot_bytes && h->slot_bytes / row >= uint64_t(h->dims[2]);
+    }
+
+    void keep_layout()
+    {
+        slots = header->slots;
+        slot_bytes = header->slot_bytes;
+        data_offset = header->data_offset;
+    }
+
+    unsigned char* slot_data(uint64_t seq) const {
+        return (unsigned char*)header + data_offset + (seq % slots) * slot_bytes;
+    }
+
+    std::string name;
+    size_t bytes;
+    bool owner; // unlinks the object on close
+    uint32_t slots;       // the layout as checked by open(), not as the
+    uint64_t slot_bytes;  // header says now
+    uint64_t data_offset;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef MATRIX4_H
+#define MATRIX4_H
+
+#include <math.h>
+#include <string.h>
+
+#include "Vector3.h"
+
+// 4x4 matrix stored column-major, exactly like the fixed function OpenGL
+// matrix stack, so m can be handed to glLoadMatrixf() directly.
+class Matrix4 {
+public:
+
+    Matrix4() { setIdentity(); }
+    explicit Matrix4(const float* v) { memcpy(m, v, sizeof(m)); }
+
+    float& operator()(int row, int col) { return m[col*4 + row]; }
+    float operator()(int row, int col) const { return m[col*4 + row]; }
+
+    void setIdentity() {
+        memset(m, 0, sizeof(m));
+        m[0] = m[5] = m[10] = m[15] = 1.0f;
+    }
+
+    // transform a point ( w = 1 ) and return the homogeneous result
+    void transform(float x, float y, float z, float w, float out[4]) const {
+        for(int r = 0; r < 4; r++)
+            out[r] = m[r]*x + m[4+r]*y + m[8+r]*z + m[12+r]*w;
+    }
+
+    Vector3 transformPoint(const Vector3& p) const {
+        float o[4];
+        transform(p.x(), p.y(), p.z(), 1.0f, o);
+        return Vector3(o[0]/o[3], o[1]/o[3], o[2]/o[3]);
+    }
+
+    Vector3 transformDirection(const Vector3& d) const {
+        float o[4];
+        transform(d.x(), d.y(), d.z(), 0.0f, o);
+        return Vector3(o[0], o[1], o[2]);
+    }
+
+    Matrix4 inverse() const;
+
+    static Matrix4 translation(float x, float y, float z) {
+        Matrix4 t;
+        t.m[12] = x; t.m[13] = y; t.m[14] = z;
+        return t;
+    }
+
+    // same as glRotatef: angle in degrees around an arbitrary axis
+    static Matrix4 rotation(float angle, float x, float y, float z) {
+        Matrix4 r;
+        float len = sqrt(x*x + y*y + z*z);
+        if(len == 0.0f) return r;
+        x /= len; y /= len; z /= len;
+        float a = angle * float(M_PI) / 180.0f;
+        float c = cos(a), s = sin(a), t = 1.0f - c;
+        r(0,0) = x*x*t + c;   r(0,1) = x*y*t - z*s; r(0,2) = x*z*t + y*s;
+        r(1,0) = y*x*t + z*s; r(1,1) = y*y*t + c;   r(1,2) = y*z*t - x*s;
+        r(2,0) = x*z*t - y*s; r(2,1) = y*z*t + x*s; r(2,2) = z*z*t + c;
+        return r;
+    }
+
+    // same as gluPerspective
+    static Matrix4 perspective(float fovy, float aspect, float znear, float zfar) {
+        Matrix4 p;
+        float f = 1.0f / tan(fovy * float(M_PI) / 360.0f);
+        p.m[0]  = f / aspect;
+        p.m[5]  = f;
+        p.m[10] = (zfar + znear) / (znear - zfar);
+        p.m[11] = -1.0f;
+        p.m[14] = 2.0f * zfar * znear / (znear - zfar);
+        p.m[15] = 0.0f;
+        return p;
+    }
+
+    float m[16];
+};
+
+inline Matrix4 operator*(const Matrix4& a, const Matrix4& b) {
+    Matrix4 r;
+    for(int c = 0; c < 4; c++)
+        for(int row = 0; row < 4; row++)
+            r(row,c) = a(row,0)*b(0,c) + a(row,1)*b(1,c) + a(row,2)*b(2,c) + a(row,3)*b(3,c);
+    return r;
+}
+
+// general inverse by cofactors ( same layout as the MESA gluInvertMatrix )
+inline Matrix4 Matrix4::inverse() const {
+    float inv[16];
+    inv[0] = m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+    inv[4] = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+    inv[8] = m[4]*m[9]*m[15] - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+    inv[12] = -m[4]*m[9]*m[14] + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+    inv[1] = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+    inv[5] = m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+    inv[9] = -m[0]*m[9]*m[15] + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+    inv[13] = m[0]*m[9]*m[14] - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+    inv[2] = m[1]*m[6]*m[15] - m[1]*m[7]*m[14] - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[7] - m[13]*m[3]*m[6];
+    inv[6] = -m[0]*m[6]*m[15] + m[0]*m[7]*m[14] + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[7] + m[12]*m[3]*m[6];
+    inv[10] = m[0]*m[5]*m[15] - m[0]*m[7]*m[13] - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[7] - m[12]*m[3]*m[5];
+    inv[14] = -m[0]*m[5]*m[14] + m[0]*m[6]*m[13] + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[6] + m[12]*m[2]*m[5];
+    inv[3] = -m[1]*m[6]*m[11] + m[1]*m[7]*m[10] + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[9]*m[2]*m[7] + m[9]*m[3]*m[6];
+    inv[7] = m[0]*m[6]*m[11] - m[0]*m[7]*m[10] - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[8]*m[2]*m[7] - m[8]*m[3]*m[6];
+    inv[11] = -m[0]*m[5]*m[11] + m[0]*m[7]*m[9] + m[4]*m[1]*m[11] - m[4]*m[3]*m[9] - m[8]*m[1]*m[7] + m[8]*m[3]*m[5];
+    inv[15] = m[0]*m[5]*m[10] - m[0]*m[6]*m[9] - m[4]*m[1]*m[10] + m[4]*m[2]*m[9] + m[8]*m[1]*m[6] - m[8]*m[2]*m[5];
+
+    float det = m[0]*inv[0] + m[1]*inv[4] + m[2]*inv[8] + m[3]*inv[12];
+    assert(det != 0.0f);
+    det = 1.0f / det;
+
+    Matrix4 r;
+    for(int i = 0; i < 16; i++)
+        r.m[i] = inv[i] * det;
+    return r;
+}
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef OCCUPANCYGRID_H
+#define OCCUPANCYGRID_H
+
+#include <vector>
+#include <algorithm>
+
+#include "Vector3.h"
+#include "Volume.h"
+#include "TransferFunction.h"
+
+// Coarse max-alpha grid over the volume, one byte per macro cell of
+// cell_size^3 voxels. A cell covers its voxels plus a one voxel apron,
+// which is every texel a GL_LINEAR fetch from inside the cell can touch.
+// A sample in a cell with max alpha 0 therefore adds exactly nothing to
+// the ray, and the marcher can jump to the first step past the cell.
+//
+// For scalar volumes the grid keeps the scalar range of every cell and
+// classify() turns it into the largest alpha the transfer function gives
+// anywhere in that range, so only classify() has to run when the transfer
+// function changes.
+struct OccupancyGrid {
+
+    OccupancyGrid() : cell_size(0), nx(0), ny(0), nz(0) {
+        cells_per_unit[0] = cells_per_unit[1] = cells_per_unit[2] = 0.0f;
+        size[0] = size[1] = size[2] = 0;
+    }
+
+    // scalar ranges of the cells a slab of voxels touches, cz0 .. cz1;
+    // filled by slab_ranges() and merged into the grid by merge_ranges()
+    struct SlabRanges {
+        SlabRanges() : cz0(0), cz1(-1) {}
+        int cz0, cz1;
+        std::vector<float> range_min, range_max;
+    };
+
+    // tf is needed for scalar volumes only
+    void build(const Volume& vol, int cell = 8, const TransferFunction* tf = 0)
+    {
+        reset(vol.width, vol.height, vol.depth, cell);
+
+        if(vol.is_scalar())
+        {
+            SlabRanges ranges;
+            slab_ranges(vol, 0, ranges);
+            merge_ranges(ranges);
+            finish_ranges(*tf);
+            return;
+        }
+
+        // cells touched by each voxel coordinate, usually one, two on a border
+        std::vector<int> lo_x, hi_x, lo_y, hi_y, lo_z, hi_z;
+        cell_range(vol.width,  nx, lo_x, hi_x);
+        cell_range(vol.height, ny, lo_y, hi_y);
+        cell_range(vol.depth,  nz, lo_z, hi_z);
+
+        range_min.clear();
+        range_max.clear();
+
+        for(int z = 0; z < vol.depth; z++)
+            for(int y = 0; y < vol.height; y++)
+            {
+                const unsigned char* row = vol.voxel(0, y, z);
+                for(int x = 0; x < vol.width; x++)
+                {
+                    unsigned char a = row[x*4 + 3];
+                    if(!a) continue;
+                    for(int cz = lo_z[z]; cz <= hi_z[z]; cz++)
+                        for(int cy = lo_y[y]; cy <= hi_y[y]; cy++)
+                            for(int cx = lo_x[x]; cx <= hi_x[x]; cx++)
+                            {
+                                unsigned char& m = cells[index(cx, cy, cz)];
+                                m = std::max(m, a);
+                            }
+                }
+            }
+    }
+
+    // empty grid for a width x height x depth volume; scalar volumes are
+    // then added slab by slab and finished with finish_ranges()
+    void reset(int width, int height, int depth, int cell = 8)
+    {
+        cell_size = cell;
+        size[0] = width; size[1] = height; size[2] = depth;
+        nx = (width  + cell - 1) / cell;
+        ny = (height + cell - 1) / cell;
+        nz = (depth  + cell - 1) / cell;
+        cells_per_unit[0] = float(width)  / cell;
+        cells_per_unit[1] = float(height) / cell;
+        cells_per_unit[2] = float(depth)  / cell;
+        // padded so a kernel can fetch any cell as a 32 bit word
+        cells.assign(size_t(nx) * ny * nz + 4, 0);
+        range_min.assign(size_t(nx) * ny * nz, 1.0f);
+        range_max.assign(size_t(nx) * ny * nz, 0.0f);
+    }
+
+    // scalar ranges of the cells touched by a slab of a scalar volume, the
+    // slab holding voxels z0 .. z0 + slab.depth - 1. Only reads the grid, so
+    // slabs can be done on several threads at once.
+    void slab_ranges(const Volume& slab, int z0, SlabRanges& out) const
+    {
+        slab_ranges(&slab.data[0], slab.format, slab.width, slab.height, slab.depth, z0, out);
+    }
+
+    // the same for R8 or R16 voxels held elsewhere, such as a mapped buffer
+    void slab_ranges(const unsigned char* voxels, VolumeFormat format, int width, int height, int depth, int z0, SlabRanges& out) const
+    {
+        std::vector<int> lo_x, hi_x, lo_y, hi_y, lo_z, hi_z;
+        cell_range(size[0], nx, lo_x, hi_x);
+        cell_range(size[1], ny, lo_y, hi_y);
+        cell_range(size[2], nz, lo_z, hi_z);
+        out.cz0 = lo_z[z0];
+        out.cz1 = hi_z[z0 + depth - 1];
+        const size_t count = size_t(nx) * ny * (out.cz1 - out.cz0 + 1);
+        out.range_min.assign(count, 1.0f);
+        out.range_max.assign(count, 0.0f);
+        const size_t bytes = format == VOLUME_R16 ? 2 : 1;
+        for(int z = 0; z < depth; z++)
+            for(int y = 0; y < height; y++)
+                for(int x = 0; x < width; x++)
+                {
+                    const unsigned char* p = voxels + ((size_t(z) * height + y) * width + x) * bytes;
+                    float v = format == VOLUME_R16 ? *(const unsigned short*)p * (1.0f / 65535.0f) : *p * (1.0f / 255.0f);
+                    for(int cz = lo_z[z0 + z]; cz <= hi_z[z0 + z]; cz++)
+                        for(int cy = lo_y[y]; cy <= hi_y[y]; cy++)
+                            for(int cx = lo_x[x]; cx <= hi_x[x]; cx++)
+                            {
+                                size_t i = index(cx, cy, cz - out.cz0);
+                                out.range_min[i] = std::min(out.range_min[i], v);
+                                out.range_max[i] = std::max(out.range_max[i], v);
+                            }
+                }
+    }
+
+    void merge_ranges(const SlabRanges& r)
+    {
+        const size_t first = index(0, 0, r.cz0);
+        for(size_t i = 0; i < r.range_min.size(); i++)
+        {
+            range_min[first + i] = std::min(range_min[first + i], r.range_min[i]);
+            range_max[first + i] = std::max(range_max[first + i], r.range_max[i]);
+        }
+    }
+
+    // a range known for a block of cells c0 .. c1 - 1 as a whole, such as
+    // the range of a brick of a bricked volume file
+    void merge_cell_ranges(const int c0[3], const int c1[3], float lo, float hi)
+    {
+        for(int cz = c0[2]; cz < c1[2]; cz++)
+            for(int cy = c0[1]; cy < c1[1]; cy++)
+                for(int cx = c0[0]; cx < c1[0]; cx++)
+                {
+                    size_t i = index(cx, cy, cz);
+                    range_min[i] = std::min(range_min[i], lo);
+                    range_max[i] = std::max(range_max[i], hi);
+                }
+    }
+
+    // after the last slab: samples near the faces blend with the zero
+    // border, then classify
+    void finish_ranges(const TransferFunction& tf)
+    {
+        for(int cz = 0; cz < nz; cz++)
+            for(int cy = 0; cy < ny; cy++)
+                for(int cx = 0; cx < nx; cx++)
+                    if(cx == 0 || cy == 0 || cz == 0 || cx == nx-1 || cy == ny-1 || cz == nz-1)
+                        range_min[index(cx, cy, cz)] = 0.0f;
+        classify(tf);
+    }
+
+    size_t index(int cx, int cy, int cz) const {
+        return size_t(cx) + size_t(cy) * nx + size_t(cz) * nx * ny;
+    }
+
+    // cell of a texture coordinate, clamped like GL_CLAMP_TO_EDGE
+    void cell_of(const Vector3& p, int c[3]) const {
+        const int n[3] = { nx, ny, nz };
+        for(int a = 0; a < 3; a++)
+            c[a] = std::min(std::max(int(floorf(p[a] * cells_per_unit[a])), 0), n[a] - 1);
+    }
+
+    bool empty_at(const Vector3& p) const {
+        int c[3];
+        cell_of(p, c);
+        return cells[index(c[0], c[1], c[2])] == 0;
+    }
+
+    // number of delta_dir steps from p to the first sample past the current
+    // cell; inv_delta is 1/delta_dir with a huge value for zero components,
+    // which always face the upper bound and so never limit the jump
+    int steps_to_exit(const Vector3& p, const Vector3& delta_dir, const Vector3& inv_delta) const {
+        return int(floorf(exit_param(p, delta_dir, inv_delta))) + 1;
+    }
+
+    // distance from p to the end of the current cell in multiples of dir,
+    // at least 0
+    float exit_param(const Vector3& p, const Vector3& dir, const Vector3& inv_dir) const {
+        float t = 1e30f;
+        for(int a = 0; a < 3; a++)
+        {
+            float cell = floorf(p[a] * cells_per_unit[a]) + (dir[a] >= 0.0f ? 1.0f : 0.0f);
+            t = std::min(t, (cell / cells_per_unit[a] - p[a]) * inv_dir[a]);
+        }
+        return std::max(t, 0.0f);
+    }
+
+    // scalar volumes: max alpha of the transfer function over each cell's
+    // range, taken from a table of the max over every span of entries
+    void classify(const TransferFunction& tf)
+    {
+        const int N = TransferFunction::TABLE_SIZE;
+        std::vector<unsigned char> span_max(N * N, 0);
+        for(int lo = 0; lo < N; lo++)
+        {
+            unsigned char m = 0;
+            for(int hi = lo; hi < N; hi++)
+            {
+                m = std::max(m, tf.table[hi*4 + 3]);
+                span_max[lo*N + hi] = m;
+            }
+        }
+        for(size_t i = 0; i < range_min.size(); i++)
+        {
+            int first, last;
+            TransferFunction::entry_range(range_min[i], range_max[i], first, last);
+            cells[i] = span_max[first*N + last];
+        }
+    }
+
+    size_t bytes() const { return cells.size() + (range_min.size() + range_max.size()) * sizeof(float); }
+
+    int cell_size;
+    int size[3]; // of the volume, in voxels
+    int nx, ny, nz;
+    float cells_per_unit[3]; // volume size / cell size, in cells per texture unit
+    std::vector<unsigned char> cells;
+    std::vector<float> range_min, range_max; // scalar range per cell, scalar volumes only
+
+private:
+
+    // voxel v lies in the apron of cells floor((v-1)/C) .. floor((v+1)/C)
+    void cell_range(int extent, int count, std::vector<int>& lo, std::vector<int>& hi) const {
+        lo.resize(extent);
+        hi.resize(extent);
+        for(int v = 0; v < extent; v++)
+        {
+            lo[v] = std::max((v - 1 + cell_size) / cell_size - 1, 0);
+            hi[v] = std::min((v + 1) / cell_size, count - 1);
+        }
+    }
+};
+
+// 1/delta_dir for OccupancyGrid::steps_to_exit()
+inline Vector3 safe_inverse(const Vector3& d)
+{
+    return Vector3(d.x() != 0.0f ? 1.0f / d.x() : 1e30f,
+                   d.y() != 0.0f ? 1.0f / d.y() : 1e30f,
+                   d.z() != 0.0f ? 1.0f / d.z() : 1e30f);
+}
+
+#endif
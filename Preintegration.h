@@ -0,0 +1,225 @@
+#ifndef PREINTEGRATION_H
+#define PREINTEGRATION_H
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "TransferFunction.h"
+
+// Pre-integrated transfer function. A ray segment between two samples is
+// assumed to see the scalar change linearly from the front to the back
+// value; entry (front, back) holds the average of the transfer function
+// over that ramp: the alpha weighted color in RGB and the alpha in A. The
+// marcher composites one entry per segment, so detail between two samples
+// that a 1D lookup would miss is still integrated. Self-attenuation inside
+// a segment is ignored, which keeps the table independent of the step
+// size. The front scalar runs along x ( fastest ), the back along y, and
+// entries sit at texel centers like the 1D table, so a GL_LINEAR lookup
+// of a TABLE_SIZE^2 RGBA16 texture and lookup() agree.
+struct PreintegrationTable {
+
+    enum { SIZE = TransferFunction::TABLE_SIZE };
+
+    PreintegrationTable() : revision(0) {}
+
+    bool empty() const { return table.empty(); }
+
+    // full build
+    void build(const TransferFunction& tf)
+    {
+        prepare(tf);
+        update(0, SIZE - 1);
+        revision = tf.revision;
+    }
+
+    // rebuild after the transfer function changed; only entries whose span
+    // of the 1D table overlaps the changed entries are recomputed. Returns
+    // the number of entries computed.
+    int rebuild(const TransferFunction& tf)
+    {
+        if(table.empty() || source.size() != tf.table.size())
+        {
+            build(tf);
+            return SIZE * SIZE;
+        }
+        int lo = SIZE, hi = -1;
+        for(int i = 0; i < SIZE; i++)
+            if(memcmp(&source[i*4], &tf.table[i*4], 4))
+            {
+                lo = std::min(lo, i);
+                hi = std::max(hi, i);
+            }
+        revision = tf.revision;
+        if(hi < 0) return 0;
+        prepare(tf);
+        // the linear pieces next to a changed entry change as well
+        return update(std::max(lo - 1, 0), std::min(hi + 1, SIZE - 1));
+    }
+
+    // texture2D() of the table at ( front, back )
+    void lookup(float front, float back, float out[4]) const
+    {
+        float u = front * SIZE - 0.5f, v = back * SIZE - 0.5f;
+        float fu = floorf(u), fv = floorf(v);
+        float au = u - fu, av = v - fv;
+        int x0 = clamp_index(int(fu)), x1 = clamp_index(int(fu) + 1);
+        int y0 = clamp_index(int(fv)), y1 = clamp_index(int(fv) + 1);
+        const unsigned short* c00 = &table[(size_t(y0) * SIZE + x0) * 4];
+        const unsigned short* c10 = &table[(size_t(y0) * SIZE + x1) * 4];
+        const unsigned short* c01 = &table[(size_t(y1) * SIZE + x0) * 4];
+        const unsigned short* c11 = &table[(size_t(y1) * SIZE + x1) * 4];
+        const float inv = 1.0f / 65535.0f;
+        for(int j = 0; j < 4; j++)
+        {
+            float a = c00[j] + (c10[j] - c00[j]) * au;
+            float b = c01[j] + (c11[j] - c01[j]) * au;
+            out[j] = (a + (b - a) * av) * inv;
+        }
+    }
+
+    std::vector<unsigned short> table; // SIZE * SIZE RGBA16 entries
+    unsigned revision;                 // of the transfer function it was built from
+
+private:
+
+    static int clamp_index(int i) { return std::min(std::max(i, 0), int(SIZE) - 1); }
+
+    // running integrals of alpha weighted color and alpha over the 1D
+    // table, which is piecewise linear between texel centers
+    void prepare(const TransferFunction& tf)
+    {
+        source = tf.table;
+        table.resize(size_t(SIZE) * SIZE * 4);
+        point.resize(SIZE * 4);
+        integral.resize(SIZE * 4);
+        const float inv = 1.0f / 255.0f;
+        for(int i = 0; i < SIZE; i++)
+        {
+            float a = source[i*4 + 3] * inv;
+            point[i*4 + 0] = source[i*4 + 0] * inv * a;
+            point[i*4 + 1] = source[i*4 + 1] * inv * a;
+            point[i*4 + 2] = source[i*4 + 2] * inv * a;
+            point[i*4 + 3] = a;
+        }
+        for(int j = 0; j < 4; j++)
+            integral[j] = 0.0;
+        for(int i = 1; i < SIZE; i++)
+            for(int j = 0; j < 4; j++)
+                integral[i*4 + j] = integral[(i-1)*4 + j] + 0.5 * (point[(i-1)*4 + j] + point[i*4 + j]);
+    }
+
+    // recompute every entry whose span touches [lo, hi]
+    int update(int lo, int hi)
+    {
+        int count = 0;
+        for(int b = 0; b < SIZE; b++)
+            for(int f = 0; f < SIZE; f++)
+            {
+                if(std::max(f, b) < lo || std::min(f, b) > hi) continue;
+                unsigned short* e = &table[(size_t(b) * SIZE + f) * 4];
+                for(int j = 0; j < 4; j++)
+                {
+                    double v = f == b ? point[f*4 + j]
+                                      : (integral[b*4 + j] - integral[f*4 + j]) / (b - f);
+                    e[j] = (unsigned short)(std::min(std::max(v, 0.0), 1.0) * 65535.0 + 0.5);
+                }
+                count++;
+            }
+        return count;
+    }
+
+    std::vector<unsigned char> source; // the 1D table this was built from
+    std::vector<float> point;          // premultiplied 1D table
+    std::vector<double> integral;
+};
+
+// Keeps a PreintegrationTable up to date on its own thread. request()
+// hands over a copy of the transfer function and returns at once; requests
+// that arrive while a build runs are merged into one. poll() picks up a
+// finished table without blocking.
+class PreintegrationBuilder {
+public:
+
+    PreintegrationBuilder() : pending(false), ready(false), quit(false), build_ms(0.0), built_entries(0) {
+        worker = std::thread([this] { run(); });
+    }
+
+    ~PreintegrationBuilder()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    void request(const TransferFunction& tf)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requested = tf;
+            pending = true;
+        }
+        wake.notify_one();
+    }
+
+    // true and the new table in out if a build finished since the last poll
+    bool poll(PreintegrationTable& out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!ready) return false;
+        out = finished;
+        ready = false;
+        return true;
+    }
+
+    // duration and entries computed of the last build
+    double last_build_ms() const { std::lock_guard<std::mutex> lock(mutex); return build_ms; }
+    int last_build_entries() const { std::lock_guard<std::mutex> lock(mutex); return built_entries; }
+
+private:
+
+    void run()
+    {
+        PreintegrationTable working;
+        for(;;)
+        {
+            TransferFunction tf;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return pending || quit; });
+                if(quit) return;
+                tf = requested;
+                pending = false;
+            }
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            int entries = working.rebuild(tf);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished = working;
+                ready = true;
+                build_ms = ms;
+                built_entries = entries;
+            }
+        }
+    }
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    TransferFunction requested;
+    PreintegrationTable finished;
+    bool pending, ready, quit;
+    double build_ms;
+    int built_entries;
+    std::thread worker;
+};
+
+#endif
@@ -0,0 +1,347 @@
+#ifndef PROCEDURALVOLUME_H
+#define PROCEDURALVOLUME_H
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#include "Volume.h"
+#include "ThreadPool.h"
+
+// Where a channel value comes from. Values are integers in the range of the
+// voxel format ( 0..255 or 0..65535 ); SET stores them truncated to the
+// channel width like the original test volume did, ADD saturates.
+struct VolumeValue {
+
+    enum Kind { CONSTANT, COORDINATE, RADIAL, NOISE };
+
+    VolumeValue() : kind(CONSTANT), axis(0), modulus(0), value(0), outer(0), scale(0), octaves(0), seed(0) {}
+
+    static VolumeValue constant(int v) {
+        VolumeValue s; s.value = v; return s;
+    }
+
+    // the voxel's x, y or z index, wrapped to modulus when that is > 0
+    static VolumeValue coordinate(int axis, int modulus = 0) {
+        VolumeValue s; s.kind = COORDINATE; s.axis = axis; s.modulus = modulus; return s;
+    }
+
+    // for spheres: inner at the center to outer at the surface, falling off
+    // with the squared distance so no square root is needed
+    static VolumeValue radial(int inner, int outer) {
+        VolumeValue s; s.kind = RADIAL; s.value = inner; s.outer = outer; return s;
+    }
+
+    // value noise: offset + amplitude * fbm, the lattice spaced 1/frequency
+    // voxels apart, each further octave at twice the frequency and half the
+    // amplitude
+    static VolumeValue noise(int offset, int amplitude, float frequency, int octaves = 3, unsigned seed = 1) {
+        VolumeValue s; s.kind = NOISE; s.value = offset; s.outer = amplitude;
+        s.scale = frequency; s.octaves = octaves; s.seed = seed; return s;
+    }
+
+    // values of the voxels x0..x1 of row ( y, z ) into out[0..x1-x0]. For
+    // spheres cx is the center's x, dyz2 the squared distance of the row to
+    // the center and r2 the squared radius.
+    void eval_row(int x0, int x1, int y, int z, int cx, int64_t dyz2, int64_t r2, int* out) const
+    {
+        const int n = x1 - x0 + 1;
+        switch(kind)
+        {
+        case COORDINATE:
+            if(axis == 0)
+                for(int i = 0; i < n; i++)
+                    out[i] = modulus > 0 ? (x0 + i) % modulus : x0 + i;
+            else
+                std::fill(out, out + n, modulus > 0 ? (axis == 1 ? y : z) % modulus : (axis == 1 ? y : z));
+            break;
+        case RADIAL:
+            for(int i = 0; i < n; i++)
+            {
+                int64_t dx = x0 + i - cx;
+                out[i] = r2 > 0 ? value + int((outer - value) * (dx * dx + dyz2) / r2) : value;
+            }
+            break;
+        case NOISE:
+            noise_row(x0, n, y, z, out);
+            break;
+        default:
+            std::fill(out, out + n, value);
+        }
+    }
+
+    Kind kind;
+    int axis, modulus;
+    int value, outer; // constant / inner / offset and outer / amplitude
+    float scale;
+    int octaves;
+    unsigned seed;
+
+private:
+
+    static float lattice(int x, int y, int z, unsigned seed)
+    {
+        uint32_t h = uint32_t(x) * 73856093u ^ uint32_t(y) * 19349663u ^ uint32_t(z) * 83492791u ^ seed * 2654435761u;
+        h ^= h >> 13; h *= 0x5bd1e995u; h ^= h >> 15;
+        return (h & 0xffffff) * (1.0f / 16777216.0f);
+    }
+
+    static float smooth(float t) { return t * t * (3.0f - 2.0f * t); }
+
+    // fractal value noise along a row. y and z are fixed, so every octave
+    // blends its four lattice columns in y and z once per lattice cell and
+    // only interpolates along x per voxel.
+    void noise_row(int x0, int n, int y, int z, int* out) const
+    {
+        std::vector<float> sum(n, 0.0f);
+        float amp = 0.5f, total = 0.0f, f = scale;
+        for(int o = 0; o < octaves; o++)
+        {
+            float fy = floorf(y * f), fz = floorf(z * f);
+            int iy = int(fy), iz = int(fz);
+            float ty = smooth(y * f - fy), tz = smooth(z * f - fz);
+            int cell = -0x7fffffff;
+            float left = 0.0f, right = 0.0f;
+            for(int i = 0; i < n; i++)
+            {
+                float xf = (x0 + i) * f;
+                float fx = floorf(xf);
+                if(int(fx) != cell)
+                {
+                    cell = int(fx);
+                    left = column(cell, iy, iz, ty, tz, seed + o);
+                    right = column(cell + 1, iy, iz, ty, tz, seed + o);
+                }
+                sum[i] += amp * (left + (right - left) * smooth(xf - fx));
+            }
+            total += amp;
+            amp *= 0.5f;
+            f *= 2.0f;
+        }
+        const float norm = total > 0.0f ? outer / total : 0.0f;
+        for(int i = 0; i < n; i++)
+            out[i] = value + int(sum[i] * norm);
+    }
+
+    // lattice values at x, bilinearly blended in y and z
+    static float column(int x, int iy, int iz, float ty, float tz, unsigned seed)
+    {
+        float a = lattice(x, iy, iz, seed), b = lattice(x, iy + 1, iz, seed);
+        float c = lattice(x, iy, iz + 1, seed), d = lattice(x, iy + 1, iz + 1, seed);
+        float ab = a + (b - a) * ty, cd = c + (d - c) * ty;
+        return ab + (cd - ab) * tz;
+    }
+};
+
+// A region of the volume and what it writes into the channels of its
+// voxels. Spheres cover the voxels strictly closer than radius to the
+// center, boxes the inclusive index ranges lo..hi; a slab is a box that
+// spans the volume along some axes.
+struct VolumePrimitive {
+
+    enum Shape { EVERYWHERE, SPHERE, BOX };
+    enum Blend { SET, ADD };
+
+    VolumePrimitive() : shape(EVERYWHERE), radius(0), blend(SET) {
+        for(int a = 0; a < 3; a++) { center[a] = 0; lo[a] = 0; hi[a] = 1 << 30; }
+        for(int c = 0; c < 4; c++) writes[c] = false;
+    }
+
+    static VolumePrimitive everywhere() { return VolumePrimitive(); }
+
+    static VolumePrimitive sphere(int cx, int cy, int cz, int r) {
+        VolumePrimitive p;
+        p.shape = SPHERE;
+        p.center[0] = cx; p.center[1] = cy; p.center[2] = cz;
+        p.radius = r;
+        return p;
+    }
+
+    static VolumePrimitive box(int x0, int x1, int y0, int y1, int z0, int z1) {
+        VolumePrimitive p;
+        p.shape = BOX;
+        p.lo[0] = x0; p.hi[0] = x1;
+        p.lo[1] = y0; p.hi[1] = y1;
+        p.lo[2] = z0; p.hi[2] = z1;
+        return p;
+    }
+
+    // channel 0 is the scalar of R8/R16 volumes
+    VolumePrimitive& set(int channel, const VolumeValue& v) {
+        value[channel] = v; writes[channel] = true; return *this;
+    }
+
+    VolumePrimitive& add() { blend = ADD; return *this; }
+
+    Shape shape;
+    int center[3], radius;
+    int lo[3], hi[3];
+    Blend blend;
+    VolumeValue value[4];
+    bool writes[4];
+};
+
+// An ordered list of primitives; later ones are painted over earlier ones.
+// generate() fills the volume in z slabs spread over a thread pool. Each
+// row is written front to back in memory order, and every primitive only
+// visits the x span it covers in that row, found with integer arithmetic.
+class ProceduralVolume {
+public:
+
+    ProceduralVolume& add(const VolumePrimitive& p) { primitives.push_back(p); return *this; }
+
+    void generate(Volume& vol, int width, int height, int depth, VolumeFormat format, int num_threads = 0) const
+    {
+        const int lo[3] = { 0, 0, 0 };
+        const int hi[3] = { width, height, depth };
+        generate_region(vol, lo, hi, format, num_threads);
+    }
+
+    // only the voxels lo .. hi - 1 of the volume, with the values generate()
+    // gives them, such as the brick of one process of a sort-last render
+    void generate_region(Volume& vol, const int lo[3], const int hi[3], VolumeFormat format, int num_threads = 0) const
+    {
+        vol.resize(hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], format);
+        ThreadPool pool(num_threads);
+        pool.parallel_for(vol.depth, [&](int z, int)
+        {
+            std::vector<int> values(size_t(vol.width) * 4);
+            for(int y = 0; y < vol.height; y++)
+                fill_row(vol, lo, y, z, &values[0]);
+        });
+    }
+
+    std::vector<VolumePrimitive> primitives;
+
+private:
+
+    // paint the primitives over one row of a volume whose first voxel is at
+    // origin; values holds 4 * width ints
+    void fill_row(Volume& vol, const int origin[3], int ly, int lz, int* values) const
+    {
+        const int y = ly + origin[1], z = lz + origin[2];
+        const int bpv = vol.bytes_per_voxel();
+        const int channels = vol.is_scalar() ? 1 : 4;
+        const int max_value = vol.format == VOLUME_R16 ? 65535 : 255;
+        unsigned char* row = &vol.data[(size_t(ly) * vol.width + size_t(lz) * vol.width * vol.height) * bpv];
+
+        for(size_t i = 0; i < primitives.size(); i++)
+        {
+            const VolumePrimitive& p = primitives[i];
+            int x0 = origin[0], x1 = origin[0] + vol.width - 1;
+            int64_t r2 = 0, dyz2 = 0;
+            if(p.shape == VolumePrimitive::BOX)
+            {
+                if(y < p.lo[1] || y > p.hi[1] || z < p.lo[2] || z > p.hi[2]) continue;
+                x0 = std::max(x0, p.lo[0]);
+                x1 = std::min(x1, p.hi[0]);
+            }
+            else if(p.shape == VolumePrimitive::SPHERE)
+            {
+                int64_t dy = y - p.center[1], dz = z - p.center[2];
+                r2 = int64_t(p.radius) * p.radius;
+                dyz2 = dy * dy + dz * dz;
+                if(dyz2 >= r2) continue;
+                // shrink the span from the bounding box until dx^2 < r^2 - dy^2 - dz^2
+                int64_t rem = r2 - dyz2;
+                int dx = p.radius;
+                while(int64_t(dx) * dx >= rem) dx--;
+                x0 = std::max(x0, p.center[0] - dx);
+                x1 = std::min(x1, p.center[0] + dx);
+            }
+            if(x0 > x1) continue;
+            const int n = x1 - x0 + 1;
+
+            for(int c = 0; c < channels; c++)
+            {
+                if(!p.writes[c]) continue;
+                int* v = values + size_t(c) * vol.width;
+                p.value[c].eval_row(x0, x1, y, z, p.center[0], dyz2, r2, v);
+                if(bpv == 2)
+                {
+                    unsigned short* dst = (unsigned short*)row + (x0 - origin[0]) * channels + c;
+                    if(p.blend == VolumePrimitive::ADD)
+                        for(int k = 0; k < n; k++)
+                            dst[k*channels] = (unsigned short)std::min(std::max(dst[k*channels] + v[k], 0), max_value);
+                    else
+                        for(int k = 0; k < n; k++)
+                            dst[k*channels] = (unsigned short)v[k];
+                }
+                else
+                {
+                    unsigned char* dst = row + size_t(x0 - origin[0]) * channels + c;
+                    if(p.blend == VolumePrimitive::ADD)
+                        for(int k = 0; k < n; k++)
+                            dst[k*channels] = (unsigned char)std::min(std::max(dst[k*channels] + v[k], 0), max_value);
+                    else
+                        for(int k = 0; k < n; k++)
+                            dst[k*channels] = (unsigned char)v[k];
+                }
+            }
+        }
+    }
+};
+
+//--------------------------------------------------------------------------------------
+// the tutorial test volume: colors from the voxel position, three colored
+// slabs and three empty spheres
+//--------------------------------------------------------------------------------------
+inline ProceduralVolume test_volume(int size)
+{
+    const int UPPER = size *2 - 6;
+    ProceduralVolume v;
+    v.add(VolumePrimitive::everywhere()
+          .set(0, VolumeValue::coordinate(2))
+          .set(1, VolumeValue::coordinate(1))
+          .set(2, VolumeValue::constant(UPPER))
+          .set(3, VolumeValue::constant(UPPER-20)));
+    v.add(VolumePrimitive::sphere(size-20, size-30, size-30, 42).set(3, VolumeValue::constant(0)));
+    v.add(VolumePrimitive::sphere(size/2, size/2, size/2, 24).set(3, VolumeValue::constant(0)));
+
+    const int slab_x[3] = { 20, 50, 80 };
+    const int slab_r[3] = { UPPER/2, UPPER, UPPER };
+    const int slab_g[3] = { UPPER, UPPER, UPPER/3 };
+    for(int i = 0; i < 3; i++)
+        v.add(VolumePrimitive::box(slab_x[i] + 1, slab_x[i] + 19, 1, size - 1, 11, 49)
+              .set(0, VolumeValue::constant(slab_r[i]))
+              .set(1, VolumeValue::constant(slab_g[i]))
+              .set(2, VolumeValue::coordinate(1, UPPER/2))
+              .set(3, VolumeValue::constant(UPPER)));
+
+    v.add(VolumePrimitive::sphere(24, 24, 24, 40).set(3, VolumeValue::constant(0)));
+    return v;
+}
+
+inline void create_test_volume(Volume& vol, int size)
+{
+    test_volume(size).generate(vol, size, size, size, VOLUME_RGBA8);
+}
+
+//--------------------------------------------------------------------------------------
+// a scalar test volume for the transfer function: a ball whose density
+// falls off from the center, roughened with noise, a denser core and a
+// hollow off-center bubble
+//--------------------------------------------------------------------------------------
+inline ProceduralVolume test_scalar_volume(int size, VolumeFormat format)
+{
+    const int max_value = format == VOLUME_R16 ? 65535 : 255;
+    const int c = size / 2;
+    ProceduralVolume v;
+    v.add(VolumePrimitive::sphere(c, c, c, size * 45 / 100)
+          .set(0, VolumeValue::radial(max_value * 85 / 100, max_value / 4)));
+    v.add(VolumePrimitive::sphere(c, c, c, size * 45 / 100)
+          .set(0, VolumeValue::noise(-max_value / 20, max_value / 10, 8.0f / size)).add());
+    v.add(VolumePrimitive::sphere(c - size / 8, c, c, size / 6)
+          .set(0, VolumeValue::constant(max_value * 15 / 100)).add());
+    v.add(VolumePrimitive::sphere(size * 65 / 100, size * 60 / 100, size * 40 / 100, size * 15 / 100)
+          .set(0, VolumeValue::constant(0)));
+    return v;
+}
+
+inline void create_test_scalar_volume(Volume& vol, int size, VolumeFormat format)
+{
+    test_scalar_volume(size, format).generate(vol, size, size, size, format);
+}
+
+#endif
@@ -0,0 +1,421 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <GL/glew.h>
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// Per pass timing of the render loop. Every pass gets the wall clock time
+// the CPU spent in it and, with GL_ARB_timer_query, the GPU time between
+// two timestamp queries. Queries are kept in a ring of QUERY_FRAMES frames
+// and only read back once GL reports them available, so timing never
+// stalls the pipeline; a frame whose queries are still pending when its
+// slot comes round again simply has no GPU time. Two more timestamps at
+// begin_frame() and end_frame() give the GPU time of the whole frame;
+// finished() hands it out a frame or two late, along with the wall clock
+// time to the next begin_frame(), e.g. to the frame time governor.
+// Finished frames go into a ring of HISTORY_FRAMES records used for the
+// statistics and the export.
+class Profiler {
+public:
+
+    enum { MAX_PASSES = 8, QUERY_FRAMES = 4, HISTORY_FRAMES = 1024 };
+
+    struct Timing {
+        Timing() : cpu_ms(-1.0), gpu_ms(-1.0) {}
+        double cpu_ms;
+        double gpu_ms; // < 0 when not measured or not available
+    };
+
+    struct Frame {
+        Frame() : frame(-1), frame_ms(-1.0), interval_ms(-1.0), gpu_frame_ms(-1.0) {}
+        long long frame;
+        double frame_ms;
+        double interval_ms;  // to the next begin_frame(), < 0 until then
+        double gpu_frame_ms; // begin_frame() to end_frame() on the GPU, < 0 when not measured
+        Timing pass[MAX_PASSES];
+    };
+
+    struct Stats {
+        Stats() : count(0), mean(0), p50(0), p95(0), p99(0), max(0) {}
+        int count;
+        double mean, p50, p95, p99, max;
+    };
+
+    Profiler() : gpu_timing(false), frame_count(0), in_frame(false), dropped(0), history(HISTORY_FRAMES) {}
+
+    // call with a current GL context, before any timing
+    void init()
+    {
+        gpu_timing = GLEW_ARB_timer_query != 0;
+        if(!gpu_timing)
+        {
+            std::cout << "GL_ARB_timer_query not supported, only CPU times are recorded" << std::endl;
+            return;
+        }
+        for(int s = 0; s < QUERY_FRAMES; s++)
+        {
+            slots[s].frame = -1;
+            memset(slots[s].issued, 0, sizeof(slots[s].issued));
+            slots[s].frame_issued = false;
+            glGenQueries(2 * MAX_PASSES, slots[s].queries);
+            glGenQueries(2, slots[s].frame_queries);
+        }
+        load_slot.frame = -1;
+        memset(load_slot.issued, 0, sizeof(load_slot.issued));
+        load_slot.frame_issued = false;
+        glGenQueries(2 * MAX_PASSES, load_slot.queries);
+    }
+
+    int add_pass(const char* name)
+    {
+        assert(names.size() < MAX_PASSES);
+        names.push_back(name);
+        return int(names.size()) - 1;
+    }
+
+    int num_passes() const { return int(names.size()); }
+    const char* pass_name(int pass) const { return names[pass].c_str(); }
+
+    void begin_frame()
+    {
+        if(gpu_timing)
+        {
+            // results of the frame that used this slot before, if the GPU is done
+            QuerySlot& slot = slots[frame_count % QUERY_FRAMES];
+            if(slot.frame >= 0 && !resolve(slot, false))
+                dropped++;
+            slot.frame = frame_count;
+            memset(slot.issued, 0, sizeof(slot.issued));
+            glQueryCounter(slot.frame_queries[0], GL_TIMESTAMP);
+            slot.frame_issued = true;
+        }
+        if(frame_count > 0 && history[(frame_count - 1) % HISTORY_FRAMES].frame == frame_count - 1)
+            history[(frame_count - 1) % HISTORY_FRAMES].interval_ms = ms_since(frame_start);
+        current = Frame();
+        current.frame = frame_count;
+        frame_start = clock::now();
+        in_frame = true;
+    }
+
+    void end_frame()
+    {
+        if(gpu_timing)
+            glQueryCounter(slots[frame_count % QUERY_FRAMES].frame_queries[1], GL_TIMESTAMP);
+        current.frame_ms = ms_since(frame_start);
+        history[frame_count % HISTORY_FRAMES] = current;
+        in_frame = false;
+        frame_count++;
+        // pick up anything that finished in the meantime
+        if(gpu_timing)
+            for(int s = 0; s < QUERY_FRAMES; s++)
+                if(slots[s].frame >= 0 && slots[s].frame < frame_count)
+                    resolve(slots[s], false);
+    }
+
+    // passes outside begin_frame()/end_frame(), e.g. loading the volume,
+    // are kept in a separate load record
+    void begin(int pass)
+    {
+        pass_start[pass] = clock::now();
+        QuerySlot* slot = active_slot();
+        if(slot)
+        {
+            glQueryCounter(slot->queries[2*pass], GL_TIMESTAMP);
+            slot->issued[pass] = true;
+        }
+    }
+
+    void end(int pass)
+    {
+        QuerySlot* slot = active_slot();
+        if(slot)
+            glQueryCounter(slot->queries[2*pass + 1], GL_TIMESTAMP);
+        double ms = ms_since(pass_start[pass]);
+        if(in_frame)
+            current.pass[pass].cpu_ms = ms;
+        else
+        {
+            load.pass[pass].cpu_ms = ms;
+            if(slot)
+                resolve(load_slot, true, &load); // one-off, waiting is fine here
+        }
+    }
+
+    long long frames() const { return frame_count; }
+    long long dropped_gpu_frames() const { return dropped; }
+
+    // frame f once the next one has begun and its GPU times are in, or
+    // lost; NULL before, or when f is not in the history
+    const Frame* finished(long long f) const
+    {
+        if(f < 0 || f >= frame_count || f < frame_count - HISTORY_FRAMES) return 0;
+        const Frame& fr = history[f % HISTORY_FRAMES];
+        if(fr.frame != f || fr.interval_ms < 0.0 || (gpu_timing && slots[f % QUERY_FRAMES].frame == f)) return 0;
+        return &fr;
+    }
+
+    // most recent frame that has all results in, NULL if none yet
+    const Frame* latest() const
+    {
+        for(long long f = frame_count - 1; f >= 0 && f >= frame_count - HISTORY_FRAMES; f--)
+        {
+            const Frame& fr = history[f % HISTORY_FRAMES];
+            if(fr.frame == f && (!gpu_timing || frame_count - f > QUERY_FRAMES || has_gpu(fr)))
+                return &fr;
+        }
+        return 0;
+    }
+
+    // statistics over the frames in the history; pass -1 is the whole frame
+    Stats stats(int pass, bool gpu) const
+    {
+        std::vector<double> v;
+        for(int i = 0; i < HISTORY_FRAMES; i++)
+        {
+            const Frame& fr = history[i];
+            if(fr.frame < 0) continue;
+            double t = pass < 0 ? (gpu ? -1.0 : fr.frame_ms) : (gpu ? fr.pass[pass].gpu_ms : fr.pass[pass].cpu_ms);
+            if(t >= 0.0) v.push_back(t);
+        }
+        Stats s;
+        s.count = int(v.size());
+        if(v.empty()) return s;
+        std::sort(v.begin(), v.end());
+        double sum = 0.0;
+        for(size_t i = 0; i < v.size(); i++) sum += v[i];
+        s.mean = sum / v.size();
+        s.p50 = percentile(v, 0.50);
+        s.p95 = percentile(v, 0.95);
+        s.p99 = percentile(v, 0.99);
+        s.max = v.back();
+        return s;
+    }
+
+    const Frame& load_timing() const { return load; }
+
+    // write the history and the aggregate statistics, .csv or else JSON
+    bool write(const char* filename) const
+    {
+        FILE* f = fopen(filename, "w");
+        if(!f)
+        {
+            std::cout << "Could not open " << filename << " for writing" << std::endl;
+            return false;
+        }
+        const char* ext = strrchr(filename, '.');
+        if(ext && !strcmp(ext, ".csv"))
+            write_csv(f);
+        else
+            write_json(f);
+        fclose(f);
+        std::cout << "profile written to " << filename << std::endl;
+        return true;
+    }
+
+    void print_summary() const
+    {
+        Stats fs = stats(-1, false);
+        printf("%-26s %10s %10s %10s %10s\n", "pass ( ms )", "mean", "p50", "p95", "p99");
+        printf("%-26s %10.3f %10.3f %10.3f %10.3f\n", "frame", fs.mean, fs.p50, fs.p95, fs.p99);
+        for(int p = 0; p < num_passes(); p++)
+            for(int g = 0; g < 2; g++)
+            {
+                Stats s = stats(p, g != 0);
+                if(!s.count) continue;
+                std::string label = names[p] + (g ? " gpu" : " cpu");
+                printf("%-26s %10.3f %10.3f %10.3f %10.3f\n", label.c_str(), s.mean, s.p50, s.p95, s.p99);
+            }
+        if(dropped)
+            printf("%lld frames without GPU times ( queries not ready in time )\n", dropped);
+    }
+
+private:
+
+    typedef std::chrono::steady_clock clock;
+
+    struct QuerySlot {
+        long long frame;
+        GLuint queries[2 * MAX_PASSES];
+        bool issued[MAX_PASSES];
+        GLuint frame_queries[2];
+        bool frame_issued;
+    };
+
+    static double ms_since(clock::time_point t) {
+        return std::chrono::duration<double, std::milli>(clock::now() - t).count();
+    }
+
+    // nearest rank
+    static double percentile(const std::vector<double>& sorted, double q) {
+        size_t rank = size_t(ceil(q * sorted.size()));
+        return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+    }
+
+    static bool has_gpu(const Frame& fr) {
+        for(int p = 0; p < MAX_PASSES; p++)
+            if(fr.pass[p].gpu_ms >= 0.0) return true;
+        return false;
+    }
+
+    QuerySlot* active_slot() {
+        if(!gpu_timing) return 0;
+        return in_frame ? &slots[frame_count % QUERY_FRAMES] : &load_slot;
+    }
+
+    // read the timestamps of a slot into its history record; without wait
+    // nothing is read unless every query of the slot is available
+    bool resolve(QuerySlot& slot, bool wait, Frame* target = 0)
+    {
+        if(!wait)
+            for(int p = 0; p < MAX_PASSES; p++)
+            {
+                if(!slot.issued[p]) continue;
+                GLint available = 0;
+                glGetQueryObjectiv(slot.queries[2*p + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if(!available) return false;
+            }
+        if(!wait && slot.frame_issued)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(slot.frame_queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if(!available) return false;
+        }
+        if(!target)
+        {
+            target = &history[slot.frame % HISTORY_FRAMES];
+            if(target->frame != slot.frame) target = 0; // fell out of the history
+        }
+        for(int p = 0; p < MAX_PASSES; p++)
+        {
+            if(!slot.issued[p]) continue;
+            GLuint64 t0 = 0, t1 = 0;
+            glGetQueryObjectui64v(slot.queries[2*p], GL_QUERY_RESULT, &t0);
+            glGetQueryObjectui64v(slot.queries[2*p + 1], GL_QUERY_RESULT, &t1);
+            if(target) target->pass[p].gpu_ms = (t1 - t0) * 1e-6;
+            slot.issued[p] = false;
+        }
+        if(slot.frame_issued)
+        {
+            GLuint64 t0 = 0, t1 = 0;
+            glGetQueryObjectui64v(slot.frame_queries[0], GL_QUERY_RESULT, &t0);
+            glGetQueryObjectui64v(slot.frame_queries[1], GL_QUERY_RESULT, &t1);
+            if(target) target->gpu_frame_ms = (t1 - t0) * 1e-6;
+            slot.frame_issued = false;
+        }
+        slot.frame = -1;
+        return true;
+    }
+
+    void write_stats_json(FILE* f, const Stats& s) const {
+        fprintf(f, "{ \"count\": %d, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+                s.count, s.mean, s.p50, s.p95, s.p99, s.max);
+    }
+
+    void write_json(FILE* f) const
+    {
+        fprintf(f, "{\n  \"gpu_timing\": %s,\n  \"frames_rendered\": %lld,\n  \"dropped_gpu_frames\": %lld,\n",
+                gpu_timing ? "true" : "false", frame_count, dropped);
+        fprintf(f, "  \"load\": {");
+        bool first = true;
+        for(int p = 0; p < num_passes(); p++)
+        {
+            if(load.pass[p].cpu_ms < 0.0) continue;
+            fprintf(f, "%s \"%s\": { \"cpu_ms\": %.4f, \"gpu_ms\": %.4f }", first ? "" : ",",
+                    names[p].c_str(), load.pass[p].cpu_ms, load.pass[p].gpu_ms);
+            first = false;
+        }
+        fprintf(f, " },\n  \"aggregate\": {\n    \"frame\": { \"cpu\": ");
+        write_stats_json(f, stats(-1, false));
+        fprintf(f, " }");
+        for(int p = 0; p < num_passes(); p++)
+        {
+            fprintf(f, ",\n    \"%s\": { \"cpu\": ", names[p].c_str());
+            write_stats_json(f, stats(p, false));
+            fprintf(f, ", \"gpu\": ");
+            write_stats_json(f, stats(p, true));
+            fprintf(f, " }");
+        }
+        fprintf(f, "\n  },\n  \"frames\": [");
+        first = true;
+        for_each_frame([&](const Frame& fr)
+        {
+            fprintf(f, "%s\n    { \"frame\": %lld, \"frame_ms\": %.4f", first ? "" : ",", fr.frame, fr.frame_ms);
+            for(int p = 0; p < num_passes(); p++)
+                fprintf(f, ", \"%s\": { \"cpu_ms\": %.4f, \"gpu_ms\": %.4f }",
+                        names[p].c_str(), fr.pass[p].cpu_ms, fr.pass[p].gpu_ms);
+            fprintf(f, " }");
+            first = false;
+        });
+        fprintf(f, "\n  ]\n}\n");
+    }
+
+    void write_csv(FILE* f) const
+    {
+        fprintf(f, "frame,frame_ms");
+        for(int p = 0; p < num_passes(); p++)
+            fprintf(f, ",%s_cpu_ms,%s_gpu_ms", names[p].c_str(), names[p].c_str());
+        fprintf(f, "\n");
+        for_each_frame([&](const Frame& fr)
+        {
+            fprintf(f, "%lld,%.4f", fr.frame, fr.frame_ms);
+            for(int p = 0; p < num_passes(); p++)
+                fprintf(f, ",%.4f,%.4f", fr.pass[p].cpu_ms, fr.pass[p].gpu_ms);
+            fprintf(f, "\n");
+        });
+        // aggregate rows, frame column holds the statistic
+        const char* names_q[] = { "mean", "p50", "p95", "p99" };
+        for(int q = 0; q < 4; q++)
+        {
+            Stats fs = stats(-1, false);
+            double fv[] = { fs.mean, fs.p50, fs.p95, fs.p99 };
+            fprintf(f, "%s,%.4f", names_q[q], fv[q]);
+            for(int p = 0; p < num_passes(); p++)
+            {
+                Stats c = stats(p, false), g = stats(p, true);
+                double cv[] = { c.mean, c.p50, c.p95, c.p99 }, gv[] = { g.mean, g.p50, g.p95, g.p99 };
+                fprintf(f, ",%.4f,%.4f", c.count ? cv[q] : -1.0, g.count ? gv[q] : -1.0);
+            }
+            fprintf(f, "\n");
+        }
+    }
+
+    template<class F> void for_each_frame(F fn) const
+    {
+        long long first = std::max(0LL, frame_count - HISTORY_FRAMES);
+        for(long long fr = first; fr < frame_count; fr++)
+            if(history[fr % HISTORY_FRAMES].frame == fr)
+                fn(history[fr % HISTORY_FRAMES]);
+    }
+
+    bool gpu_timing;
+    long long frame_count;
+    bool in_frame;
+    long long dropped;
+    std::vector<std::string> names;
+    std::vector<Frame> history;
+    Frame current;
+    Frame load;
+    QuerySlot slots[QUERY_FRAMES];
+    QuerySlot load_slot;
+    clock::time_point frame_start;
+    clock::time_point pass_start[MAX_PASSES];
+};
+
+// times a pass for the lifetime of the object
+struct ProfileScope {
+    ProfileScope(Profiler& p, int pass) : profiler(p), id(pass) { profiler.begin(id); }
+    ~ProfileScope() { profiler.end(id); }
+    Profiler& profiler;
+    int id;
+};
+
+#endif
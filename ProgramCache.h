@@ -0,0 +1,186 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <GL/glew.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#define PROGRAM_CACHE_MAGIC "RCPB0001"
+
+// header of a cached program binary, followed by length bytes of binary
+struct ProgramBinaryHeader {
+    char magic[8];
+    uint64_t key;
+    uint32_t format; // GLenum from glGetProgramBinary
+    uint32_t length;
+};
+
+// Linked programs kept on disk with GL_ARB_get_program_binary, one file
+// per program named after its key. The key hashes the shader sources, the
+// defines they were built with and the vendor, renderer and version
+// strings of the driver, so a change to any of them simply misses. A file
+// the driver no longer accepts, after an update that kept its version
+// string, fails to link from the binary; the caller then compiles the
+// sources as usual and store() replaces the file.
+class ProgramCache {
+public:
+
+    ProgramCache() : hits(0), misses(0), enabled(false) {}
+
+    // call with a current GL context; dir NULL picks $XDG_CACHE_HOME/rayCast
+    // or ~/.cache/rayCast
+    void init(const char* dir)
+    {
+        GLint formats = 0;
+        if(GLEW_ARB_get_program_binary)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        enabled = formats > 0;
+        if(!enabled)
+        {
+            std::cout << "no program binary formats, shaders are compiled at every start" << std::endl;
+            return;
+        }
+        if(dir)
+            path = dir;
+        else if(getenv("XDG_CACHE_HOME") && *getenv("XDG_CACHE_HOME"))
+            path = std::string(getenv("XDG_CACHE_HOME")) + "/rayCast";
+        else if(getenv("HOME"))
+            path = std::string(getenv("HOME")) + "/.cache/rayCast";
+        else
+            enabled = false;
+        driver = string_of(GL_VENDOR) + "\n" + string_of(GL_RENDERER) + "\n" + string_of(GL_VERSION) + "\n"
+               + string_of(GL_SHADING_LANGUAGE_VERSION);
+    }
+
+    void disable() { enabled = false; }
+    bool active() const { return enabled; }
+
+    uint64_t key(const std::vector<const char*>& sources, const std::string& defines) const
+    {
+        uint64_t h = 1469598103934665603ULL; // FNV-1a
+        h = hash(h, driver.c_str(), driver.size() + 1);
+        h = hash(h, defines.c_str(), defines.size() + 1);
+        for(size_t i = 0; i < sources.size(); i++)
+            h = hash(h, sources[i], strlen(sources[i]) + 1);
+        return h;
+    }
+
+    // link program from the cached binary for key; false when there is none
+    // or the driver rejects it
+    bool load(GLuint program, uint64_t key)
+    {
+        if(!enabled) return false;
+        FILE* f = fopen(file_name(key).c_str(), "rb");
+        ProgramBinaryHeader header;
+        std::vector<char> binary;
+        bool ok = f && fread(&header, sizeof(header), 1, f) == 1 && !memcmp(header.magic, PROGRAM_CACHE_MAGIC, 8)
+                  && header.key == key && header.length > 0;
+        if(ok)
+        {
+            binary.resize(header.length);
+            ok = fread(&binary[0], 1, binary.size(), f) == binary.size();
+        }
+        if(f) fclose(f);
+        if(ok)
+        {
+            glProgramBinary(program, header.format, &binary[0], GLsizei(binary.size()));
+            GLint linked = 0;
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+            ok = linked != 0;
+        }
+        if(ok) hits++;
+        else   misses++;
+        return ok;
+    }
+
+    // before linking a program that is going to be stored
+    void prepare(GLuint program)
+    {
+        if(enabled) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // write the binary of a linked program; written to a temporary file and
+    // renamed, so a concurrent start never reads half a file
+    void store(GLuint program, uint64_t key)
+    {
+        if(!enabled) return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(length <= 0) return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+        ProgramBinaryHeader header;
+        memcpy(header.magic, PROGRAM_CACHE_MAGIC, 8);
+        header.key = key;
+        header.format = format;
+        header.length = uint32_t(length);
+        if(!make_dirs(path))
+        {
+            std::cout << "Could not create the shader cache " << path << std::endl;
+            enabled = false;
+            return;
+        }
+        const std::string name = file_name(key);
+        const std::string tmp = name + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "wb");
+        bool ok = f && fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(&binary[0], 1, length, f) == size_t(length);
+        if(f && fclose(f) != 0) ok = false;
+        if(!ok || rename(tmp.c_str(), name.c_str()) != 0)
+        {
+            std::cout << "Could not write " << name << std::endl;
+            remove(tmp.c_str());
+        }
+    }
+
+    int hits, misses;
+
+private:
+
+    static uint64_t hash(uint64_t h, const char* data, size_t n)
+    {
+        for(size_t i = 0; i < n; i++)
+        {
+            h ^= (unsigned char)data[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    static std::string string_of(GLenum name)
+    {
+        const GLubyte* s = glGetString(name);
+        return s ? (const char*)s : "";
+    }
+
+    std::string file_name(uint64_t key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+        return path + name;
+    }
+
+    static bool make_dirs(const std::string& dir)
+    {
+        for(size_t i = 1; i <= dir.size(); i++)
+            if(i == dir.size() || dir[i] == '/')
+                if(mkdir(dir.substr(0, i).c_str(), 0755) != 0 && errno != EEXIST)
+                    return false;
+        return true;
+    }
+
+    bool enabled;
+    std::string path;
+    std::string driver;
+};
+
+#endif
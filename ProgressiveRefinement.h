@@ -0,0 +1,87 @@
+#ifndef PROGRESSIVEREFINEMENT_H
+#define PROGRESSIVEREFINEMENT_H
+
+// How a single frame is rendered: at 1/scale of the resolution, with the
+// step scaled by step_scale, the image shifted by jitter pixels and every
+// ray started ray_offset of a step further in. The default is a plain
+// frame.
+struct ProgressivePass {
+    ProgressivePass() : scale(1), step_scale(1.0f), ray_offset(0.0f), weight(1.0f), coarse(false) {
+        jitter[0] = jitter[1] = 0.0f;
+    }
+    int scale;
+    float step_scale;
+    float jitter[2];
+    float ray_offset;
+    float weight; // of this frame in the running mean of a refined image
+    bool coarse;  // to be upsampled rather than accumulated
+};
+
+// Progressive refinement of the interactive view. While the view keeps
+// changing every frame is a coarse pass: a fraction of the pixels with a
+// longer step, upsampled to the window. Once it has been still for settle
+// seconds the passes are at full resolution and accumulated into a running
+// mean: the first is the plain frame, the following ones are shifted by a
+// sub-pixel jitter and start their rays at a fraction of a step, both from
+// Halton sequences, which antialiases the edges and fills in the samples
+// between steps. After passes frames the image is final and nothing more
+// is rendered until the view changes again.
+struct ProgressiveRefinement {
+
+    ProgressiveRefinement() : scale(2), step_scale(2.0f), passes(16), settle(0.15), pass(0), last_motion(-1e30) {}
+
+    // the view changed at time now ( in seconds )
+    void moved(double now) { last_motion = now; pass = 0; }
+
+    // the image changed without the view moving, such as bricks paged in
+    void restart() { pass = 0; }
+
+    bool moving(double now) const { return now - last_motion < settle; }
+    bool done(double now) const { return !moving(now) && pass >= passes; }
+
+    // passes finished on the still image so far
+    int refined() const { return pass; }
+
+    ProgressivePass next(double now)
+    {
+        ProgressivePass p;
+        if(moving(now))
+        {
+            p.scale = scale;
+            p.step_scale = step_scale;
+            p.coarse = true;
+            return p;
+        }
+        const int k = pass++;
+        p.weight = 1.0f / (k + 1);
+        if(k > 0)
+        {
+            p.jitter[0] = halton(k, 2) - 0.5f;
+            p.jitter[1] = halton(k, 3) - 0.5f;
+            p.ray_offset = halton(k, 5);
+        }
+        return p;
+    }
+
+    static float halton(int index, int base)
+    {
+        float f = 1.0f, r = 0.0f;
+        for(; index > 0; index /= base)
+        {
+            f /= base;
+            r += f * (index % base);
+        }
+        return r;
+    }
+
+    int scale;        // of the coarse passes, in pixels per side
+    float step_scale; // of the coarse passes
+    int passes;       // accumulated into the still image
+    double settle;    // seconds without change before refining
+
+private:
+    int pass;
+    double last_motion;
+};
+
+#endif
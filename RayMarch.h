@@ -0,0 +1,425 @@
+#ifndef RAYMARCH_H
+#define RAYMARCH_H
+
+#include "Vector3.h"
+#include "Volume.h"
+#include "OccupancyGrid.h"
+#include "TransferFunction.h"
+#include "Preintegration.h"
+#include "VolumePyramid.h"
+#include "RayMarchVariant.h"
+
+// The same 450 step cap as the frag shader
+#define MAX_RAY_STEPS 450
+
+// How far march_ray_lod() moves past the border of an empty cell, so the
+// next sample is inside the following cell
+#define LOD_SKIP_EPSILON 1e-4f
+
+//--------------------------------------------------------------------------------------
+// texture3D().r on an R8 or R16 volume, filtered like sample_volume()
+//--------------------------------------------------------------------------------------
+inline float sample_scalar(const Volume& vol, float s, float t, float r)
+{
+    float u = s * vol.width  - 0.5f;
+    float v = t * vol.height - 0.5f;
+    float w = r * vol.depth  - 0.5f;
+    float fu = floorf(u), fv = floorf(v), fw = floorf(w);
+    int x0 = int(fu), y0 = int(fv), z0 = int(fw);
+    float ax = u - fu, ay = v - fv, az = w - fw;
+
+    float value = 0.0f;
+    for(int k = 0; k < 2; k++)
+    {
+        int z = z0 + k;
+        if(z < 0 || z >= vol.depth) continue;
+        float wz = k ? az : 1.0f - az;
+        for(int j = 0; j < 2; j++)
+        {
+            int y = y0 + j;
+            if(y < 0 || y >= vol.height) continue;
+            float wy = wz * (j ? ay : 1.0f - ay);
+            for(int i = 0; i < 2; i++)
+            {
+                int x = x0 + i;
+                if(x < 0 || x >= vol.width) continue;
+                value += wy * (i ? ax : 1.0f - ax) * vol.scalar(x, y, z);
+            }
+        }
+    }
+    return value;
+}
+
+//--------------------------------------------------------------------------------------
+// texture3D() on an RGBA8 volume: GL_LINEAR filtering with GL_CLAMP_TO_BORDER
+// and the default ( 0,0,0,0 ) border color. Scalar volumes are classified
+// through the transfer function like the frag shader does.
+//--------------------------------------------------------------------------------------
+inline void sample_volume(const Volume& vol, float s, float t, float r, float out[4],
+                          const TransferFunction* tf = 0)
+{
+    if(vol.is_scalar())
+    {
+        tf->lookup(sample_scalar(vol, s, t, r), out);
+        return;
+    }
+    float u = s * vol.width  - 0.5f;
+    float v = t * vol.height - 0.5f;
+    float w = r * vol.depth  - 0.5f;
+    float fu = floorf(u), fv = floorf(v), fw = floorf(w);
+    int x0 = int(fu), y0 = int(fv), z0 = int(fw);
+    float ax = u - fu, ay = v - fv, az = w - fw;
+
+    out[0] = out[1] = out[2] = out[3] = 0.0f;
+    for(int k = 0; k < 2; k++)
+    {
+        int z = z0 + k;
+        if(z < 0 || z >= vol.depth) continue;
+        float wz = k ? az : 1.0f - az;
+        for(int j = 0; j < 2; j++)
+        {
+            int y = y0 + j;
+            if(y < 0 || y >= vol.height) continue;
+            float wy = wz * (j ? ay : 1.0f - ay);
+            for(int i = 0; i < 2; i++)
+            {
+                int x = x0 + i;
+                if(x < 0 || x >= vol.width) continue;
+                float wgt = wy * (i ? ax : 1.0f - ax);
+                const unsigned char* c = vol.voxel(x, y, z);
+                out[0] += wgt * c[0];
+                out[1] += wgt * c[1];
+                out[2] += wgt * c[2];
+                out[3] += wgt * c[3];
+            }
+        }
+    }
+    const float inv = 1.0f / 255.0f;
+    out[0] *= inv; out[1] *= inv; out[2] *= inv; out[3] *= inv;
+}
+
+// One ray as the frag shader sets it up: start point, the per step offset
+// delta_dir and the length of the segment to the back face
+struct Ray {
+    Vector3 start;
+    Vector3 delta_dir;
+    float len;
+    float delta_dir_len;
+};
+
+//--------------------------------------------------------------------------------------
+// start and back are texture coordinates of the front and back face of the cube
+//--------------------------------------------------------------------------------------
+inline void setup_ray(const Vector3& start, const Vector3& back, float stepsize, Ray& ray)
+{
+    Vector3 dir = back - start;
+    ray.len = dir.length();
+    Vector3 norm_dir = ray.len > 0.0f ? dir / ray.len : Vector3(0,0,0);
+    float delta = stepsize;
+    ray.delta_dir = norm_dir * delta;
+    ray.delta_dir_len = ray.len > 0.0f ? ray.delta_dir.length() : delta;
+    ray.start = start;
+}
+
+//--------------------------------------------------------------------------------------
+// the samples from the start of the ray to its back face, at most MAX_RAY_STEPS
+//--------------------------------------------------------------------------------------
+inline int ray_steps(const Ray& ray)
+{
+    return std::min(int(floorf(ray.len / ray.delta_dir_len)) + 1, MAX_RAY_STEPS);
+}
+
+//--------------------------------------------------------------------------------------
+// the ray marching loop of the frag shader built for one RayMarchVariant,
+// returns the number of samples taken. With Skip the samples that fall into
+// empty cells of grid are jumped over; they would add nothing, so the result
+// does not change. tf is only used, and required, for scalar volumes.
+// Average is the mean of the opacity weighted colors, with the skipped
+// samples taken as transparent ones.
+//--------------------------------------------------------------------------------------
+template<Compositing C, bool Skip, LoopBound Loop, bool EarlyExit>
+inline int march_ray_variant(const Volume& vol, const Ray& ray, float stepsize, float col_acc[4],
+                             const OccupancyGrid* grid, const TransferFunction* tf, float early_exit)
+{
+    Vector3 vect = ray.start;
+    float alpha_acc = 0.0f;
+    float length_acc = 0.0f;
+    float color_sample[4];
+    int n = 0; // index of the sample at vect
+    int taken = 0;
+    const int steps = Loop == LOOP_COUNTED ? ray_steps(ray) : MAX_RAY_STEPS;
+    Vector3 inv_delta;
+    if constexpr (Skip) inv_delta = safe_inverse(ray.delta_dir);
+
+    col_acc[0] = col_acc[1] = col_acc[2] = col_acc[3] = 0.0f;
+
+    while(n < steps)
+    {
+        if constexpr (Skip)
+        {
+            if(grid->empty_at(vect))
+            {
+                n += grid->steps_to_exit(vect, ray.delta_dir, inv_delta);
+                vect = ray.start + ray.delta_dir * float(n);
+                if constexpr (Loop == LOOP_CAPPED)
+                {
+                    length_acc = ray.delta_dir_len * float(n);
+                    if( length_acc > ray.len )
+                        break;
+                }
+                continue;
+            }
+        }
+        sample_volume(vol, vect.x(), vect.y(), vect.z(), color_sample, tf);
+        taken++;
+        if constexpr (C == COMPOSITE_DVR)
+        {
+            float alpha_sample = color_sample[3] * stepsize;
+            float wgt = (1.0f - alpha_acc) * alpha_sample * 3.0f;
+            col_acc[0] += color_sample[0] * wgt;
+            col_acc[1] += color_sample[1] * wgt;
+            col_acc[2] += color_sample[2] * wgt;
+            col_acc[3] += color_sample[3] * wgt;
+            alpha_acc += alpha_sample;
+        }
+        else if constexpr (C == COMPOSITE_MIP)
+        {
+            if(color_sample[3] > col_acc[3])
+                for(int c = 0; c < 4; c++) col_acc[c] = color_sample[c];
+        }
+        else if constexpr (C == COMPOSITE_MINIP)
+        {
+            if(n == 0 || color_sample[3] < col_acc[3])
+                for(int c = 0; c < 4; c++) col_acc[c] = color_sample[c];
+        }
+        else
+        {
+            col_acc[0] += color_sample[0] * color_sample[3];
+            col_acc[1] += color_sample[1] * color_sample[3];
+            col_acc[2] += color_sample[2] * color_sample[3];
+            col_acc[3] += color_sample[3];
+        }
+        vect += ray.delta_dir;
+        n++;
+        if constexpr (Loop == LOOP_CAPPED)
+        {
+            length_acc += ray.delta_dir_len;
+            if( length_acc > ray.len )
+                break;
+        }
+        if constexpr (EarlyExit)
+        {
+            if( alpha_acc > early_exit )
+                break;
+        }
+    }
+    if constexpr (C == COMPOSITE_AVERAGE)
+    {
+        const float inv = 1.0f / float(std::max(std::min(n, ray_steps(ray)), 1));
+        for(int c = 0; c < 4; c++) col_acc[c] *= inv;
+    }
+    return taken;
+}
+
+// march_ray_variant() for a variant picked at runtime
+typedef int (*MarchFunction)(const Volume& vol, const Ray& ray, float stepsize, float col_acc[4],
+                             const OccupancyGrid* grid, const TransferFunction* tf, float early_exit);
+
+template<Compositing C, bool Skip, LoopBound Loop>
+inline MarchFunction march_function(bool early_exit)
+{
+    return early_exit ? &march_ray_variant<C, Skip, Loop, true> : &march_ray_variant<C, Skip, Loop, false>;
+}
+
+template<Compositing C, bool Skip>
+inline MarchFunction march_function(LoopBound loop, bool early_exit)
+{
+    return loop == LOOP_COUNTED ? march_function<C, Skip, LOOP_COUNTED>(early_exit)
+                                : march_function<C, Skip, LOOP_CAPPED>(early_exit);
+}
+
+template<Compositing C>
+inline MarchFunction march_function(bool skip, LoopBound loop, bool early_exit)
+{
+    return skip ? march_function<C, true>(loop, early_exit) : march_function<C, false>(loop, early_exit);
+}
+
+//--------------------------------------------------------------------------------------
+// the instance of march_ray_variant() for variant, skipping only with a grid;
+// call it with variant.early_exit
+//--------------------------------------------------------------------------------------
+inline MarchFunction march_function(const RayMarchVariant& variant, const OccupancyGrid* grid)
+{
+    const RayMarchVariant v = variant.normalized();
+    const bool skip = v.skip_empty && grid;
+    const bool early_exit = v.early_exit > 0.0f;
+    switch(v.compositing)
+    {
+    case COMPOSITE_MIP:     return march_function<COMPOSITE_MIP>(skip, v.loop, early_exit);
+    case COMPOSITE_MINIP:   return march_function<COMPOSITE_MINIP>(skip, v.loop, early_exit);
+    case COMPOSITE_AVERAGE: return march_function<COMPOSITE_AVERAGE>(skip, v.loop, early_exit);
+    default:                return march_function<COMPOSITE_DVR>(skip, v.loop, early_exit);
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// the default variant: DVR with the 450 step cap and early exit at opacity 1,
+// skipping when there is a grid
+//--------------------------------------------------------------------------------------
+inline int march_ray(const Volume& vol, const Ray& ray, float stepsize, float col_acc[4],
+                     const OccupancyGrid* grid = 0, const TransferFunction* tf = 0)
+{
+    if(grid)
+        return march_ray_variant<COMPOSITE_DVR, true, LOOP_CAPPED, true>(vol, ray, stepsize, col_acc, grid, tf, 1.0f);
+    return march_ray_variant<COMPOSITE_DVR, false, LOOP_CAPPED, true>(vol, ray, stepsize, col_acc, grid, tf, 1.0f);
+}
+
+//--------------------------------------------------------------------------------------
+// march_preintegrated() of the frag shader: composites one pre-integrated
+// segment per step, the last one shortened to end at the back face. Empty
+// cells are jumped over like in march_ray(); when a jump lands in an
+// occupied cell the marcher backs up one step, so the segment entering the
+// cell starts at the last sample before it. Returns the number of volume
+// fetches. A ray ends early once its opacity passes early_exit.
+//--------------------------------------------------------------------------------------
+inline int march_ray_preintegrated(const Volume& vol, const Ray& ray, float stepsize, float col_acc[4],
+                                   const OccupancyGrid* grid, const PreintegrationTable& preint,
+                                   float early_exit = 1.0f)
+{
+    Vector3 vect = ray.start;
+    float alpha_acc = 0.0f;
+    float segment[4];
+    float s_front = 0.0f;
+    bool front_stale = true;
+    int n = 0;
+    int taken = 0;
+    Vector3 inv_delta = grid ? safe_inverse(ray.delta_dir) : Vector3();
+
+    col_acc[0] = col_acc[1] = col_acc[2] = col_acc[3] = 0.0f;
+
+    while(n < MAX_RAY_STEPS)
+    {
+        if(grid && grid->empty_at(vect))
+        {
+            n += grid->steps_to_exit(vect, ray.delta_dir, inv_delta);
+            if(n >= MAX_RAY_STEPS || ray.delta_dir_len * float(n) > ray.len)
+                break;
+            vect = ray.start + ray.delta_dir * float(n);
+            front_stale = true;
+            continue;
+        }
+        if(front_stale)
+        {
+            if(n > 0) n--;
+            vect = ray.start + ray.delta_dir * float(n);
+            s_front = sample_scalar(vol, vect.x(), vect.y(), vect.z());
+            taken++;
+            front_stale = false;
+        }
+        float seg = std::min((ray.len - ray.delta_dir_len * float(n)) / ray.delta_dir_len, 1.0f);
+        if(seg <= 0.0f)
+            break;
+        vect = ray.start + ray.delta_dir * (float(n) + seg);
+        float s_back = sample_scalar(vol, vect.x(), vect.y(), vect.z());
+        taken++;
+        preint.lookup(s_front, s_back, segment);
+        float alpha_sample = segment[3] * stepsize * seg;
+        float wgt = (1.0f - alpha_acc) * stepsize * seg * 3.0f;
+        col_acc[0] += segment[0] * wgt;
+        col_acc[1] += segment[1] * wgt;
+        col_acc[2] += segment[2] * wgt;
+        col_acc[3] += segment[3] * alpha_sample * (1.0f - alpha_acc) * 3.0f;
+        alpha_acc += alpha_sample;
+        s_front = s_back;
+        n++;
+        if( seg < 1.0f || alpha_acc > early_exit )
+            break;
+    }
+    return taken;
+}
+
+//--------------------------------------------------------------------------------------
+// texture3DLod() on the pyramid's texture: GL_LINEAR_MIPMAP_LINEAR, a blend
+// of the two levels around level
+//--------------------------------------------------------------------------------------
+inline void sample_pyramid(const VolumePyramid& pyramid, const Vector3& p, float level, float out[4])
+{
+    level = std::min(std::max(level, 0.0f), float(pyramid.count() - 1));
+    const int l0 = int(level);
+    const float f = level - l0;
+    sample_volume(pyramid.levels[l0], p.x(), p.y(), p.z(), out);
+    if(f > 0.0f)
+    {
+        float next[4];
+        sample_volume(pyramid.levels[l0 + 1], p.x(), p.y(), p.z(), next);
+        for(int c = 0; c < 4; c++)
+            out[c] += (next[c] - out[c]) * f;
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// march_lod() of the frag shader. A sample at distance d from the eye lies
+// in a pixel d * pixel texture units wide, footprint voxels of the volume.
+// Below two voxels it reads the volume like march_ray(), above that the
+// pyramid at log2( footprint ) - 1, and the next sample is a pixel width
+// further on, or stepsize when that is longer. Opacity scales with the
+// step, so longer steps do not make the volume more transparent. Empty
+// cells are jumped over to just past their border. Returns the number of
+// samples taken.
+//--------------------------------------------------------------------------------------
+inline int march_ray_lod(const Volume& vol, const VolumePyramid& pyramid, const Ray& ray, float eye_dist,
+                         float pixel, float stepsize, float col_acc[4], const OccupancyGrid* grid = 0,
+                         const TransferFunction* tf = 0, float early_exit = 1.0f)
+{
+    const Vector3 dir = ray.delta_dir_len > 0.0f ? ray.delta_dir / ray.delta_dir_len : Vector3(0,0,0);
+    const Vector3 inv_dir = safe_inverse(dir);
+    const float voxels = float(std::max(vol.width, std::max(vol.height, vol.depth)));
+    float alpha_acc = 0.0f;
+    float color_sample[4];
+    float t = 0.0f;
+    int taken = 0;
+
+    col_acc[0] = col_acc[1] = col_acc[2] = col_acc[3] = 0.0f;
+
+    for(int i = 0; i < MAX_RAY_STEPS; i++)
+    {
+        Vector3 vect = ray.start + dir * t;
+        if(grid && grid->empty_at(vect))
+        {
+            t += grid->exit_param(vect, dir, inv_dir) + LOD_SKIP_EPSILON;
+            if( t > ray.len )
+                break;
+            continue;
+        }
+        float width = (eye_dist + t) * pixel;
+        float level = log2f(std::max(width * voxels, 1.0f));
+        if(level < 1.0f)
+            sample_volume(vol, vect.x(), vect.y(), vect.z(), color_sample, tf);
+        else
+            sample_pyramid(pyramid, vect, level - 1.0f, color_sample);
+        taken++;
+        float delta = std::max(stepsize, width);
+        float alpha_sample = color_sample[3] * delta;
+        float wgt = (1.0f - alpha_acc) * alpha_sample * 3.0f;
+        col_acc[0] += color_sample[0] * wgt;
+        col_acc[1] += color_sample[1] * wgt;
+        col_acc[2] += color_sample[2] * wgt;
+        col_acc[3] += color_sample[3] * wgt;
+        alpha_acc += alpha_sample;
+        t += delta;
+        if( t > ray.len || alpha_acc > early_exit )
+            break;
+    }
+    return taken;
+}
+
+inline int march_ray(const Volume& vol, const Vector3& start, const Vector3& back,
+                     float stepsize, float col_acc[4], const OccupancyGrid* grid = 0,
+                     const TransferFunction* tf = 0)
+{
+    Ray ray;
+    setup_ray(start, back, stepsize, ray);
+    return march_ray(vol, ray, stepsize, col_acc, grid, tf);
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef RAYMARCHVARIANT_H
+#define RAYMARCHVARIANT_H
+
+#include <string.h>
+#include <cfloat>
+#include <string>
+#include <sstream>
+
+// How the samples along a ray make up the pixel
+enum Compositing {
+    COMPOSITE_DVR,     // front to back emission and absorption
+    COMPOSITE_MIP,     // the sample of highest opacity
+    COMPOSITE_MINIP,   // the sample of lowest opacity
+    COMPOSITE_AVERAGE, // the mean of the samples
+    COMPOSITINGS
+};
+
+// What ends the loop of the plain marcher besides early termination
+enum LoopBound {
+    LOOP_CAPPED, // the length marched passes the ray, or MAX_RAY_STEPS
+    LOOP_COUNTED // a step count to the back face, computed before the loop
+};
+
+inline const char* compositing_name(Compositing c)
+{
+    switch(c)
+    {
+    case COMPOSITE_MIP:     return "mip";
+    case COMPOSITE_MINIP:   return "minip";
+    case COMPOSITE_AVERAGE: return "average";
+    default:                return "dvr";
+    }
+}
+
+inline bool parse_compositing(const char* s, Compositing& c)
+{
+    for(int i = 0; i < COMPOSITINGS; i++)
+        if(!strcmp(s, compositing_name(Compositing(i))))
+        {
+            c = Compositing(i);
+            return true;
+        }
+    return false;
+}
+
+// The compile time choices of the ray marching loop. The frag shader gets
+// them as #defines in front of its source, one program per variant that is
+// actually used; the CPU marcher instantiates march_ray_variant() for each,
+// so no sample pays for a test of a flag.
+struct RayMarchVariant {
+
+    RayMarchVariant() : compositing(COMPOSITE_DVR), early_exit(1.0f), skip_empty(true), loop(LOOP_CAPPED) {}
+
+    Compositing compositing;
+    float early_exit; // DVR ends a ray once the summed opacity passes this, 0 never
+    bool skip_empty;  // jump over the empty cells of the occupancy grid
+    LoopBound loop;
+
+    // the same variant with the flags that would change nothing cleared:
+    // only DVR terminates early, and MinIP cannot skip empty cells since
+    // their zero opacity is the minimum it looks for
+    RayMarchVariant normalized() const
+    {
+        RayMarchVariant v = *this;
+        if(v.compositing != COMPOSITE_DVR) v.early_exit = 0.0f;
+        if(v.compositing == COMPOSITE_MINIP) v.skip_empty = false;
+        if(v.early_exit < 0.0f) v.early_exit = 0.0f;
+        return v;
+    }
+
+    bool operator==(const RayMarchVariant& o) const
+    {
+        return compositing == o.compositing && early_exit == o.early_exit && skip_empty == o.skip_empty && loop == o.loop;
+    }
+
+    // opacity at which DVR ends a ray, never reached with early exit off
+    float termination() const { return early_exit > 0.0f ? early_exit : FLT_MAX; }
+
+    // what the frag shader is built with
+    std::string defines() const
+    {
+        const RayMarchVariant v = normalized();
+        std::ostringstream s;
+        s << "#define COMPOSITING " << int(v.compositing) << "\n";
+        if(v.early_exit > 0.0f) s << "#define EARLY_EXIT " << std::showpoint << v.early_exit << "\n";
+        if(v.skip_empty) s << "#define SKIP_EMPTY\n";
+        if(v.loop == LOOP_COUNTED) s << "#define COUNTED_LOOP\n";
+        return s.str();
+    }
+
+    std::string name() const
+    {
+        const RayMarchVariant v = normalized();
+        std::ostringstream s;
+        s << compositing_name(v.compositing);
+        if(v.compositing == COMPOSITE_DVR)
+        {
+            if(v.early_exit > 0.0f) s << ", early exit at " << v.early_exit;
+            else s << ", no early exit";
+        }
+        s << (v.skip_empty ? ", skipping" : ", no skipping") << (v.loop == LOOP_COUNTED ? ", counted loop" : ", capped loop");
+        return s.str();
+    }
+};
+
+#endif
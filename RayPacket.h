@@ -0,0 +1,491 @@
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include <string.h>
+
+#include "RayMarch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RAYPACKET_X86 1
+#include <immintrin.h>
+#endif
+
+// Instruction set used by the packet kernels, picked at runtime
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+inline const char* simd_level_name(SimdLevel level)
+{
+    switch(level)
+    {
+    case SIMD_AVX2:   return "avx2";
+    case SIMD_AVX512: return "avx512";
+    default:          return "scalar";
+    }
+}
+
+inline bool simd_level_supported(SimdLevel level)
+{
+#ifdef RAYPACKET_X86
+    __builtin_cpu_init();
+    switch(level)
+    {
+    case SIMD_AVX2:   return __builtin_cpu_supports("avx2");
+    case SIMD_AVX512: return __builtin_cpu_supports("avx512f");
+    default:          return true;
+    }
+#else
+    return level == SIMD_SCALAR;
+#endif
+}
+
+inline SimdLevel detect_simd_level()
+{
+    if(simd_level_supported(SIMD_AVX512)) return SIMD_AVX512;
+    if(simd_level_supported(SIMD_AVX2))   return SIMD_AVX2;
+    return SIMD_SCALAR;
+}
+
+// Up to 16 rays in structure-of-arrays form, one lane per ray. The fields
+// are the members of Ray split per component so a kernel can load them
+// straight into vector registers.
+struct RayPacket {
+
+    enum { MAX_RAYS = 16 };
+
+    RayPacket() : count(0) {
+        // lanes past count are loaded but masked off, keep them finite
+        memset(ox, 0, sizeof(float) * MAX_RAYS * 8);
+        memset(out, 0, sizeof(out));
+    }
+
+    void add(const Ray& ray, float* dst) {
+        ox[count] = ray.start.x();     oy[count] = ray.start.y();     oz[count] = ray.start.z();
+        dx[count] = ray.delta_dir.x(); dy[count] = ray.delta_dir.y(); dz[count] = ray.delta_dir.z();
+        len[count] = ray.len;
+        delta_len[count] = ray.delta_dir_len;
+        out[count] = dst;
+        count++;
+    }
+
+    bool full() const { return count == MAX_RAYS; }
+
+    // eight consecutive 64 byte aligned lane arrays
+    alignas(64) float ox[MAX_RAYS];
+    float oy[MAX_RAYS];
+    float oz[MAX_RAYS];
+    float dx[MAX_RAYS];
+    float dy[MAX_RAYS];
+    float dz[MAX_RAYS];
+    float len[MAX_RAYS];
+    float delta_len[MAX_RAYS];
+    float* out[MAX_RAYS]; // RGBA destination of each lane
+    int count;
+};
+
+//--------------------------------------------------------------------------------------
+// fallback: march every lane with the scalar loop
+//--------------------------------------------------------------------------------------
+inline long long march_packet_scalar(const Volume& vol, const RayPacket& p, float stepsize,
+                                     const OccupancyGrid* grid, const TransferFunction* tf = 0,
+                                     const PreintegrationTable* preint = 0)
+{
+    long long samples = 0;
+    Ray ray;
+    for(int i = 0; i < p.count; i++)
+    {
+        ray.start = Vector3(p.ox[i], p.oy[i], p.oz[i]);
+        ray.delta_dir = Vector3(p.dx[i], p.dy[i], p.dz[i]);
+        ray.len = p.len[i];
+        ray.delta_dir_len = p.delta_len[i];
+        if(preint)
+            samples += march_ray_preintegrated(vol, ray, stepsize, p.out[i], grid, *preint);
+        else
+            samples += march_ray(vol, ray, stepsize, p.out[i], grid, tf);
+    }
+    return samples;
+}
+
+#ifdef RAYPACKET_X86
+
+//--------------------------------------------------------------------------------------
+// 8 lanes at a time with AVX2. Each of the 8 trilinear corners is fetched
+// with one masked gather of the RGBA8 texel as a 32 bit word; corners
+// outside the volume are masked off and read as the zero border. Lanes in
+// an empty occupancy cell jump ahead instead of sampling.
+//--------------------------------------------------------------------------------------
+__attribute__((target("avx2")))
+inline long long march_packet_avx2(const Volume& vol, const RayPacket& p, float stepsize,
+                                   const OccupancyGrid* grid)
+{
+    long long samples = 0;
+    const int* texels = (const int*)&vol.data[0];
+    const __m256i dim_x = _mm256_set1_epi32(vol.width);
+    const __m256i dim_y = _mm256_set1_epi32(vol.height);
+    const __m256i dim_z = _mm256_set1_epi32(vol.depth);
+    const __m256i minus_one = _mm256_set1_epi32(-1);
+    const __m256i stride_y = _mm256_set1_epi32(vol.width);
+    const __m256i stride_z = _mm256_set1_epi32(vol.width * vol.height);
+    const __m256i byte_mask = _mm256_set1_epi32(0xff);
+    const __m256 size_x = _mm256_set1_ps(float(vol.width));
+    const __m256 size_y = _mm256_set1_ps(float(vol.height));
+    const __m256 size_z = _mm256_set1_ps(float(vol.depth));
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 three = _mm256_set1_ps(3.0f);
+    const __m256 inv255 = _mm256_set1_ps(1.0f / 255.0f);
+    const __m256 step = _mm256_set1_ps(stepsize);
+    const __m256 max_steps = _mm256_set1_ps(float(MAX_RAY_STEPS));
+    const __m256 zero = _mm256_setzero_ps();
+
+    const int* cells = grid ? (const int*)&grid->cells[0] : 0;
+    const __m256 cpu_x = _mm256_set1_ps(grid ? grid->cells_per_unit[0] : 0.0f);
+    const __m256 cpu_y = _mm256_set1_ps(grid ? grid->cells_per_unit[1] : 0.0f);
+    const __m256 cpu_z = _mm256_set1_ps(grid ? grid->cells_per_unit[2] : 0.0f);
+    const __m256i last_x = _mm256_set1_epi32(grid ? grid->nx - 1 : 0);
+    const __m256i last_y = _mm256_set1_epi32(grid ? grid->ny - 1 : 0);
+    const __m256i last_z = _mm256_set1_epi32(grid ? grid->nz - 1 : 0);
+    const __m256i cell_stride_y = _mm256_set1_epi32(grid ? grid->nx : 0);
+    const __m256i cell_stride_z = _mm256_set1_epi32(grid ? grid->nx * grid->ny : 0);
+
+    for(int base = 0; base < p.count; base += 8)
+    {
+        const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256 active = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(p.count - base), lane));
+
+        __m256 vx = _mm256_load_ps(p.ox + base);
+        __m256 vy = _mm256_load_ps(p.oy + base);
+        __m256 vz = _mm256_load_ps(p.oz + base);
+        const __m256 ddx = _mm256_load_ps(p.dx + base);
+        const __m256 ddy = _mm256_load_ps(p.dy + base);
+        const __m256 ddz = _mm256_load_ps(p.dz + base);
+        const __m256 len = _mm256_load_ps(p.len + base);
+        const __m256 dlen = _mm256_load_ps(p.delta_len + base);
+
+        __m256 col_r = _mm256_setzero_ps(), col_g = _mm256_setzero_ps();
+        __m256 col_b = _mm256_setzero_ps(), col_a = _mm256_setzero_ps();
+        __m256 alpha_acc = _mm256_setzero_ps();
+        __m256 length_acc = _mm256_setzero_ps();
+        __m256 n = _mm256_setzero_ps(); // index of the sample at vx,vy,vz
+        const __m256 sx = vx, sy = vy, sz = vz;
+        // 1/delta_dir, zero components get a huge value
+        const __m256 inv_x = _mm256_blendv_ps(_mm256_div_ps(one, ddx), _mm256_set1_ps(1e30f), _mm256_cmp_ps(ddx, zero, _CMP_EQ_OQ));
+        const __m256 inv_y = _mm256_blendv_ps(_mm256_div_ps(one, ddy), _mm256_set1_ps(1e30f), _mm256_cmp_ps(ddy, zero, _CMP_EQ_OQ));
+        const __m256 inv_z = _mm256_blendv_ps(_mm256_div_ps(one, ddz), _mm256_set1_ps(1e30f), _mm256_cmp_ps(ddz, zero, _CMP_EQ_OQ));
+        const __m256 up_x = _mm256_and_ps(_mm256_cmp_ps(ddx, zero, _CMP_GE_OQ), one);
+        const __m256 up_y = _mm256_and_ps(_mm256_cmp_ps(ddy, zero, _CMP_GE_OQ), one);
+        const __m256 up_z = _mm256_and_ps(_mm256_cmp_ps(ddz, zero, _CMP_GE_OQ), one);
+
+        for(int i = 0; i < MAX_RAY_STEPS; i++)
+        {
+            if(!_mm256_movemask_ps(active)) break;
+
+            __m256 sampling = active;
+            if(grid)
+            {
+                __m256 cx = _mm256_floor_ps(_mm256_mul_ps(vx, cpu_x));
+                __m256 cy = _mm256_floor_ps(_mm256_mul_ps(vy, cpu_y));
+                __m256 cz = _mm256_floor_ps(_mm256_mul_ps(vz, cpu_z));
+                __m256i ix = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(cx), _mm256_setzero_si256()), last_x);
+                __m256i iy = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(cy), _mm256_setzero_si256()), last_y);
+                __m256i iz = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(cz), _mm256_setzero_si256()), last_z);
+                __m256i idx = _mm256_add_epi32(ix, _mm256_add_epi32(_mm256_mullo_epi32(iy, cell_stride_y),
+                                                                    _mm256_mullo_epi32(iz, cell_stride_z)));
+                __m256i occ = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), cells, idx,
+                                                          _mm256_castps_si256(active), 1);
+                __m256 empty = _mm256_and_ps(active, _mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32(_mm256_and_si256(occ, byte_mask), _mm256_setzero_si256())));
+                if(_mm256_movemask_ps(empty))
+                {
+                    // steps to the first sample past the cell, as OccupancyGrid::steps_to_exit()
+                    __m256 tx = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(_mm256_add_ps(cx, up_x), cpu_x), vx), inv_x);
+                    __m256 ty = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(_mm256_add_ps(cy, up_y), cpu_y), vy), inv_y);
+                    __m256 tz = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(_mm256_add_ps(cz, up_z), cpu_z), vz), inv_z);
+                    __m256 t = _mm256_max_ps(_mm256_min_ps(tx, _mm256_min_ps(ty, tz)), zero);
+                    __m256 jump = _mm256_add_ps(n, _mm256_add_ps(_mm256_floor_ps(t), one));
+                    n = _mm256_blendv_ps(n, jump, empty);
+                    vx = _mm256_blendv_ps(vx, _mm256_add_ps(sx, _mm256_mul_ps(ddx, n)), empty);
+                    vy = _mm256_blendv_ps(vy, _mm256_add_ps(sy, _mm256_mul_ps(ddy, n)), empty);
+                    vz = _mm256_blendv_ps(vz, _mm256_add_ps(sz, _mm256_mul_ps(ddz, n)), empty);
+                    length_acc = _mm256_blendv_ps(length_acc, _mm256_mul_ps(dlen, n), empty);
+                    __m256 ended = _mm256_or_ps(_mm256_cmp_ps(length_acc, len, _CMP_GT_OQ),
+                                                _mm256_cmp_ps(n, max_steps, _CMP_GE_OQ));
+                    active = _mm256_andnot_ps(_mm256_and_ps(empty, ended), active);
+                    sampling = _mm256_andnot_ps(empty, active);
+                }
+            }
+            int live = _mm256_movemask_ps(sampling);
+            if(!live) continue;
+            samples += __builtin_popcount(live);
+
+            // texel space position, integer corner and fractions
+            __m256 u = _mm256_sub_ps(_mm256_mul_ps(vx, size_x), half);
+            __m256 v = _mm256_sub_ps(_mm256_mul_ps(vy, size_y), half);
+            __m256 w = _mm256_sub_ps(_mm256_mul_ps(vz, size_z), half);
+            __m256 fu = _mm256_floor_ps(u), fv = _mm256_floor_ps(v), fw = _mm256_floor_ps(w);
+            __m256 ax = _mm256_sub_ps(u, fu), ay = _mm256_sub_ps(v, fv), az = _mm256_sub_ps(w, fw);
+            __m256i x0 = _mm256_cvttps_epi32(fu), y0 = _mm256_cvttps_epi32(fv), z0 = _mm256_cvttps_epi32(fw);
+
+            __m256 r = _mm256_setzero_ps(), g = _mm256_setzero_ps();
+            __m256 b = _mm256_setzero_ps(), a = _mm256_setzero_ps();
+            for(int k = 0; k < 2; k++)
+            {
+                __m256i z = _mm256_add_epi32(z0, _mm256_set1_epi32(k));
+                __m256i in_z = _mm256_and_si256(_mm256_cmpgt_epi32(z, minus_one), _mm256_cmpgt_epi32(dim_z, z));
+                __m256 wz = k ? az : _mm256_sub_ps(one, az);
+                for(int j = 0; j < 2; j++)
+                {
+                    __m256i y = _mm256_add_epi32(y0, _mm256_set1_epi32(j));
+                    __m256i in_zy = _mm256_and_si256(in_z,
+                        _mm256_and_si256(_mm256_cmpgt_epi32(y, minus_one), _mm256_cmpgt_epi32(dim_y, y)));
+                    __m256 wy = _mm256_mul_ps(wz, j ? ay : _mm256_sub_ps(one, ay));
+                    __m256i row = _mm256_add_epi32(_mm256_mullo_epi32(z, stride_z), _mm256_mullo_epi32(y, stride_y));
+                    for(int c = 0; c < 2; c++)
+                    {
+                        __m256i x = _mm256_add_epi32(x0, _mm256_set1_epi32(c));
+                        __m256i in = _mm256_and_si256(in_zy,
+                            _mm256_and_si256(_mm256_cmpgt_epi32(x, minus_one), _mm256_cmpgt_epi32(dim_x, x)));
+                        in = _mm256_and_si256(in, _mm256_castps_si256(sampling));
+                        __m256i texel = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), texels,
+                                                                    _mm256_add_epi32(row, x), in, 4);
+                        __m256 wgt = _mm256_mul_ps(wy, c ? ax : _mm256_sub_ps(one, ax));
+                        r = _mm256_add_ps(r, _mm256_mul_ps(wgt, _mm256_cvtepi32_ps(_mm256_and_si256(texel, byte_mask))));
+                        g = _mm256_add_ps(g, _mm256_mul_ps(wgt, _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(texel, 8), byte_mask))));
+                        b = _mm256_add_ps(b, _mm256_mul_ps(wgt, _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(texel, 16), byte_mask))));
+                        a = _mm256_add_ps(a, _mm256_mul_ps(wgt, _mm256_cvtepi32_ps(_mm256_srli_epi32(texel, 24))));
+                    }
+                }
+            }
+            r = _mm256_mul_ps(r, inv255); g = _mm256_mul_ps(g, inv255);
+            b = _mm256_mul_ps(b, inv255); a = _mm256_mul_ps(a, inv255);
+
+            // front to back compositing, finished and skipping lanes keep their values
+            __m256 alpha_sample = _mm256_and_ps(_mm256_mul_ps(a, step), sampling);
+            __m256 wgt = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(one, alpha_acc), alpha_sample), three);
+            col_r = _mm256_add_ps(col_r, _mm256_mul_ps(r, wgt));
+            col_g = _mm256_add_ps(col_g, _mm256_mul_ps(g, wgt));
+            col_b = _mm256_add_ps(col_b, _mm256_mul_ps(b, wgt));
+            col_a = _mm256_add_ps(col_a, _mm256_mul_ps(a, wgt));
+            alpha_acc = _mm256_add_ps(alpha_acc, alpha_sample);
+            vx = _mm256_blendv_ps(vx, _mm256_add_ps(vx, ddx), sampling);
+            vy = _mm256_blendv_ps(vy, _mm256_add_ps(vy, ddy), sampling);
+            vz = _mm256_blendv_ps(vz, _mm256_add_ps(vz, ddz), sampling);
+            length_acc = _mm256_blendv_ps(length_acc, _mm256_add_ps(length_acc, dlen), sampling);
+            n = _mm256_add_ps(n, _mm256_and_ps(sampling, one));
+
+            __m256 done = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(length_acc, len, _CMP_GT_OQ),
+                                                    _mm256_cmp_ps(alpha_acc, one, _CMP_GT_OQ)),
+                                       _mm256_cmp_ps(n, max_steps, _CMP_GE_OQ));
+            active = _mm256_andnot_ps(_mm256_and_ps(done, sampling), active);
+        }
+
+        alignas(32) float res[4][8];
+        _mm256_store_ps(res[0], col_r); _mm256_store_ps(res[1], col_g);
+        _mm256_store_ps(res[2], col_b); _mm256_store_ps(res[3], col_a);
+        for(int l = 0; l < 8 && base + l < p.count; l++)
+            for(int c = 0; c < 4; c++)
+                p.out[base + l][c] = res[c][l];
+    }
+    return samples;
+}
+
+//--------------------------------------------------------------------------------------
+// the same with 16 lanes and AVX-512 mask registers
+//--------------------------------------------------------------------------------------
+#ifndef __clang__
+// GCC 12 takes the _mm512_undefined_* inside the intrinsics for uninitialized
+// reads ( GCC bug 105593 )
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+__attribute__((target("avx512f")))
+inline long long march_packet_avx512(const Volume& vol, const RayPacket& p, float stepsize,
+                                     const OccupancyGrid* grid)
+{
+    long long samples = 0;
+    const int* texels = (const int*)&vol.data[0];
+    const __m512i dim_x = _mm512_set1_epi32(vol.width);
+    const __m512i dim_y = _mm512_set1_epi32(vol.height);
+    const __m512i dim_z = _mm512_set1_epi32(vol.depth);
+    const __m512i zero_i = _mm512_setzero_si512();
+    const __m512i stride_y = _mm512_set1_epi32(vol.width);
+    const __m512i stride_z = _mm512_set1_epi32(vol.width * vol.height);
+    const __m512i byte_mask = _mm512_set1_epi32(0xff);
+    const __m512 size_x = _mm512_set1_ps(float(vol.width));
+    const __m512 size_y = _mm512_set1_ps(float(vol.height));
+    const __m512 size_z = _mm512_set1_ps(float(vol.depth));
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 three = _mm512_set1_ps(3.0f);
+    const __m512 inv255 = _mm512_set1_ps(1.0f / 255.0f);
+    const __m512 step = _mm512_set1_ps(stepsize);
+    const __m512 max_steps = _mm512_set1_ps(float(MAX_RAY_STEPS));
+    const __m512 zero = _mm512_setzero_ps();
+
+    const int* cells = grid ? (const int*)&grid->cells[0] : 0;
+    const __m512 cpu_x = _mm512_set1_ps(grid ? grid->cells_per_unit[0] : 0.0f);
+    const __m512 cpu_y = _mm512_set1_ps(grid ? grid->cells_per_unit[1] : 0.0f);
+    const __m512 cpu_z = _mm512_set1_ps(grid ? grid->cells_per_unit[2] : 0.0f);
+    const __m512i last_x = _mm512_set1_epi32(grid ? grid->nx - 1 : 0);
+    const __m512i last_y = _mm512_set1_epi32(grid ? grid->ny - 1 : 0);
+    const __m512i last_z = _mm512_set1_epi32(grid ? grid->nz - 1 : 0);
+    const __m512i cell_stride_y = _mm512_set1_epi32(grid ? grid->nx : 0);
+    const __m512i cell_stride_z = _mm512_set1_epi32(grid ? grid->nx * grid->ny : 0);
+
+    __mmask16 active = __mmask16((1u << p.count) - 1);
+
+    __m512 vx = _mm512_load_ps(p.ox);
+    __m512 vy = _mm512_load_ps(p.oy);
+    __m512 vz = _mm512_load_ps(p.oz);
+    const __m512 ddx = _mm512_load_ps(p.dx);
+    const __m512 ddy = _mm512_load_ps(p.dy);
+    const __m512 ddz = _mm512_load_ps(p.dz);
+    const __m512 len = _mm512_load_ps(p.len);
+    const __m512 dlen = _mm512_load_ps(p.delta_len);
+
+    __m512 col_r = _mm512_setzero_ps(), col_g = _mm512_setzero_ps();
+    __m512 col_b = _mm512_setzero_ps(), col_a = _mm512_setzero_ps();
+    __m512 alpha_acc = _mm512_setzero_ps();
+    __m512 length_acc = _mm512_setzero_ps();
+    __m512 n = _mm512_setzero_ps(); // index of the sample at vx,vy,vz
+    const __m512 sx = vx, sy = vy, sz = vz;
+    const __m512 inv_x = _mm512_mask_div_ps(_mm512_set1_ps(1e30f), _mm512_cmp_ps_mask(ddx, zero, _CMP_NEQ_OQ), one, ddx);
+    const __m512 inv_y = _mm512_mask_div_ps(_mm512_set1_ps(1e30f), _mm512_cmp_ps_mask(ddy, zero, _CMP_NEQ_OQ), one, ddy);
+    const __m512 inv_z = _mm512_mask_div_ps(_mm512_set1_ps(1e30f), _mm512_cmp_ps_mask(ddz, zero, _CMP_NEQ_OQ), one, ddz);
+    const __m512 up_x = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(ddx, zero, _CMP_GE_OQ), one);
+    const __m512 up_y = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(ddy, zero, _CMP_GE_OQ), one);
+    const __m512 up_z = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(ddz, zero, _CMP_GE_OQ), one);
+
+    for(int i = 0; i < MAX_RAY_STEPS && active; i++)
+    {
+        __mmask16 sampling = active;
+        if(grid)
+        {
+            __m512 cx = _mm512_floor_ps(_mm512_mul_ps(vx, cpu_x));
+            __m512 cy = _mm512_floor_ps(_mm512_mul_ps(vy, cpu_y));
+            __m512 cz = _mm512_floor_ps(_mm512_mul_ps(vz, cpu_z));
+            __m512i ix = _mm512_min_epi32(_mm512_max_epi32(_mm512_cvttps_epi32(cx), zero_i), last_x);
+            __m512i iy = _mm512_min_epi32(_mm512_max_epi32(_mm512_cvttps_epi32(cy), zero_i), last_y);
+            __m512i iz = _mm512_min_epi32(_mm512_max_epi32(_mm512_cvttps_epi32(cz), zero_i), last_z);
+            __m512i idx = _mm512_add_epi32(ix, _mm512_add_epi32(_mm512_mullo_epi32(iy, cell_stride_y),
+                                                                _mm512_mullo_epi32(iz, cell_stride_z)));
+            __m512i occ = _mm512_mask_i32gather_epi32(zero_i, active, idx, cells, 1);
+            __mmask16 empty = _mm512_mask_cmpeq_epi32_mask(active, _mm512_and_si512(occ, byte_mask), zero_i);
+            if(empty)
+            {
+                __m512 tx = _mm512_mul_ps(_mm512_sub_ps(_mm512_div_ps(_mm512_add_ps(cx, up_x), cpu_x), vx), inv_x);
+                __m512 ty = _mm512_mul_ps(_mm512_sub_ps(_mm512_div_ps(_mm512_add_ps(cy, up_y), cpu_y), vy), inv_y);
+                __m512 tz = _mm512_mul_ps(_mm512_sub_ps(_mm512_div_ps(_mm512_add_ps(cz, up_z), cpu_z), vz), inv_z);
+                __m512 t = _mm512_max_ps(_mm512_min_ps(tx, _mm512_min_ps(ty, tz)), zero);
+                n = _mm512_mask_add_ps(n, empty, n, _mm512_add_ps(_mm512_floor_ps(t), one));
+                vx = _mm512_mask_add_ps(vx, empty, sx, _mm512_mul_ps(ddx, n));
+                vy = _mm512_mask_add_ps(vy, empty, sy, _mm512_mul_ps(ddy, n));
+                vz = _mm512_mask_add_ps(vz, empty, sz, _mm512_mul_ps(ddz, n));
+                length_acc = _mm512_mask_mul_ps(length_acc, empty, dlen, n);
+                __mmask16 ended = _mm512_mask_cmp_ps_mask(empty, length_acc, len, _CMP_GT_OQ) |
+                                  _mm512_mask_cmp_ps_mask(empty, n, max_steps, _CMP_GE_OQ);
+                active &= ~ended;
+                sampling = active & ~empty;
+            }
+        }
+        if(!sampling) continue;
+        samples += __builtin_popcount(sampling);
+
+        __m512 u = _mm512_sub_ps(_mm512_mul_ps(vx, size_x), half);
+        __m512 v = _mm512_sub_ps(_mm512_mul_ps(vy, size_y), half);
+        __m512 w = _mm512_sub_ps(_mm512_mul_ps(vz, size_z), half);
+        __m512 fu = _mm512_floor_ps(u);
+        __m512 fv = _mm512_floor_ps(v);
+        __m512 fw = _mm512_floor_ps(w);
+        __m512 ax = _mm512_sub_ps(u, fu), ay = _mm512_sub_ps(v, fv), az = _mm512_sub_ps(w, fw);
+        __m512i x0 = _mm512_cvttps_epi32(fu), y0 = _mm512_cvttps_epi32(fv), z0 = _mm512_cvttps_epi32(fw);
+
+        __m512 r = _mm512_setzero_ps(), g = _mm512_setzero_ps();
+        __m512 b = _mm512_setzero_ps(), a = _mm512_setzero_ps();
+        for(int k = 0; k < 2; k++)
+        {
+            __m512i z = _mm512_add_epi32(z0, _mm512_set1_epi32(k));
+            __mmask16 in_z = _mm512_cmpge_epi32_mask(z, zero_i) & _mm512_cmplt_epi32_mask(z, dim_z) & sampling;
+            __m512 wz = k ? az : _mm512_sub_ps(one, az);
+            for(int j = 0; j < 2; j++)
+            {
+                __m512i y = _mm512_add_epi32(y0, _mm512_set1_epi32(j));
+                __mmask16 in_zy = in_z & _mm512_cmpge_epi32_mask(y, zero_i) & _mm512_cmplt_epi32_mask(y, dim_y);
+                __m512 wy = _mm512_mul_ps(wz, j ? ay : _mm512_sub_ps(one, ay));
+                __m512i row = _mm512_add_epi32(_mm512_mullo_epi32(z, stride_z), _mm512_mullo_epi32(y, stride_y));
+                for(int c = 0; c < 2; c++)
+                {
+                    __m512i x = _mm512_add_epi32(x0, _mm512_set1_epi32(c));
+                    __mmask16 in = in_zy & _mm512_cmpge_epi32_mask(x, zero_i) & _mm512_cmplt_epi32_mask(x, dim_x);
+                    __m512i texel = _mm512_mask_i32gather_epi32(zero_i, in, _mm512_add_epi32(row, x), texels, 4);
+                    __m512 wgt = _mm512_mul_ps(wy, c ? ax : _mm512_sub_ps(one, ax));
+                    r = _mm512_add_ps(r, _mm512_mul_ps(wgt, _mm512_cvtepi32_ps(_mm512_and_si512(texel, byte_mask))));
+                    g = _mm512_add_ps(g, _mm512_mul_ps(wgt, _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(texel, 8), byte_mask))));
+                    b = _mm512_add_ps(b, _mm512_mul_ps(wgt, _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(texel, 16), byte_mask))));
+                    a = _mm512_add_ps(a, _mm512_mul_ps(wgt, _mm512_cvtepi32_ps(_mm512_srli_epi32(texel, 24))));
+                }
+            }
+        }
+        r = _mm512_mul_ps(r, inv255); g = _mm512_mul_ps(g, inv255);
+        b = _mm512_mul_ps(b, inv255); a = _mm512_mul_ps(a, inv255);
+
+        __m512 alpha_sample = _mm512_maskz_mul_ps(sampling, a, step);
+        __m512 wgt = _mm512_mul_ps(_mm512_mul_ps(_mm512_sub_ps(one, alpha_acc), alpha_sample), three);
+        col_r = _mm512_add_ps(col_r, _mm512_mul_ps(r, wgt));
+        col_g = _mm512_add_ps(col_g, _mm512_mul_ps(g, wgt));
+        col_b = _mm512_add_ps(col_b, _mm512_mul_ps(b, wgt));
+        col_a = _mm512_add_ps(col_a, _mm512_mul_ps(a, wgt));
+        alpha_acc = _mm512_add_ps(alpha_acc, alpha_sample);
+        vx = _mm512_mask_add_ps(vx, sampling, vx, ddx);
+        vy = _mm512_mask_add_ps(vy, sampling, vy, ddy);
+        vz = _mm512_mask_add_ps(vz, sampling, vz, ddz);
+        length_acc = _mm512_mask_add_ps(length_acc, sampling, length_acc, dlen);
+        n = _mm512_mask_add_ps(n, sampling, n, one);
+
+        __mmask16 done = _mm512_mask_cmp_ps_mask(sampling, length_acc, len, _CMP_GT_OQ) |
+                         _mm512_mask_cmp_ps_mask(sampling, alpha_acc, one, _CMP_GT_OQ) |
+                         _mm512_mask_cmp_ps_mask(sampling, n, max_steps, _CMP_GE_OQ);
+        active &= ~done;
+    }
+
+    alignas(64) float res[4][16];
+    _mm512_store_ps(res[0], col_r); _mm512_store_ps(res[1], col_g);
+    _mm512_store_ps(res[2], col_b); _mm512_store_ps(res[3], col_a);
+    for(int l = 0; l < p.count; l++)
+        for(int c = 0; c < 4; c++)
+            p.out[l][c] = res[c][l];
+    return samples;
+}
+#ifndef __clang__
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+//--------------------------------------------------------------------------------------
+// march a packet with the requested kernel, returns the number of samples
+// taken; grid may be NULL to sample every step. The SIMD kernels gather
+// RGBA8 texels, so scalar volumes always take the scalar loop, which marches
+// pre-integrated segments when preint is given.
+//--------------------------------------------------------------------------------------
+inline long long march_packet(SimdLevel level, const Volume& vol, const RayPacket& p, float stepsize,
+                              const OccupancyGrid* grid = 0, const TransferFunction* tf = 0,
+                              const PreintegrationTable* preint = 0)
+{
+    if(vol.is_scalar())
+        return march_packet_scalar(vol, p, stepsize, grid, tf, preint);
+#ifdef RAYPACKET_X86
+    switch(level)
+    {
+    case SIMD_AVX512: return march_packet_avx512(vol, p, stepsize, grid);
+    case SIMD_AVX2:   return march_packet_avx2(vol, p, stepsize, grid);
+    default: break;
+    }
+#endif
+    return march_packet_scalar(vol, p, stepsize, grid);
+}
+
+#endif
@@ -0,0 +1,367 @@
+#ifndef REMOTESERVER_H
+#define REMOTESERVER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+#include "Communicator.h"
+#include "FrameCodec.h"
+
+// Messages between the render server and its clients: a RemoteHeader and
+// bytes of payload, in host byte order, so both ends must agree on it.
+// A client sends REMOTE_VIEW and REMOTE_TRANSFER_FUNCTION ( the text of a
+// --tf file ) whenever it likes and REMOTE_BYE before it leaves; the
+// server answers views with REMOTE_FRAME, a RemoteFrameInfo followed by a
+// FrameEncoder stream.
+enum RemoteMessageType { REMOTE_VIEW = 1, REMOTE_TRANSFER_FUNCTION, REMOTE_FRAME, REMOTE_BYE };
+
+struct RemoteHeader {
+    uint32_t type;
+    uint32_t bytes;
+};
+
+struct RemoteView {
+    uint32_t seq;
+    float rotate, distance, stepsize;
+    double sent; // client clock in seconds, echoed with the frame
+};
+
+struct RemoteFrameInfo {
+    uint32_t seq;       // of the view the frame shows
+    uint32_t width, height;
+    uint32_t coalesced; // views of this client replaced by newer ones before this frame
+    double sent;        // RemoteView::sent of that view
+    float server_ms;    // view received to frame sent
+    float render_ms, readback_ms, encode_ms;
+};
+
+inline bool remote_write(int fd, uint32_t type, const void* a, size_t a_bytes, const void* b = 0, size_t b_bytes = 0)
+{
+    RemoteHeader h;
+    h.type = type;
+    h.bytes = uint32_t(a_bytes + b_bytes);
+    if(!Communicator::write_all(fd, &h, sizeof(h))) return false;
+    if(a_bytes && !Communicator::write_all(fd, a, a_bytes)) return false;
+    return !b_bytes || Communicator::write_all(fd, b, b_bytes);
+}
+
+inline bool remote_read(int fd, RemoteHeader& h, std::vector<unsigned char>& payload)
+{
+    if(!Communicator::read_all(fd, &h, sizeof(h)) || h.bytes > (256u << 20)) return false;
+    payload.resize(h.bytes);
+    return !h.bytes || Communicator::read_all(fd, &payload[0], h.bytes);
+}
+
+inline double remote_clock()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A frame read back for one or more clients, RGBA8 bottom row first
+struct RemoteFrame {
+    RemoteFrame() : width(0), height(0), render_ms(0.0f), readback_ms(0.0f) {}
+    std::vector<unsigned char> rgba;
+    int width, height;
+    float render_ms, readback_ms;
+};
+
+// the view of one client a frame is rendered for
+struct RemoteTarget {
+    int client;
+    RemoteView view;
+    double received; // server clock
+    uint32_t coalesced;
+};
+
+// The network side of the render server. Every client has a reader thread
+// that keeps only its newest view, so views that arrive while a frame is
+// being made are coalesced and the renderer always draws the latest camera,
+// and an encoder thread that codes and sends the newest frame rendered for
+// it; a frame that is still waiting when the next one is ready is dropped
+// before encoding, which keeps the delta stream intact. The render thread
+// takes the waiting views with next_views(), one batch per distinct view,
+// and hands what it read back to deliver().
+class RemoteServer {
+public:
+
+    RemoteServer() : listener(-1), stopping(false), next_id(0), served(0), tf_pending(false) {}
+
+    ~RemoteServer() { stop(); }
+
+    bool listen(int port)
+    {
+        char p[16];
+        snprintf(p, sizeof(p), "%d", port);
+        listener = Communicator::listen_on(p);
+        if(listener < 0) return false;
+        acceptor = std::thread(&RemoteServer::accept_loop, this);
+        return true;
+    }
+
+    // blocks until a client waits for a frame or timeout_ms passed; false
+    // once the server stops, or with once set when the last client left.
+    // A transfer function that arrived meanwhile is returned in tf_text
+    // and every client gets its last view rendered again.
+    bool next_views(std::vector<std::vector<RemoteTarget> >& batches, std::string& tf_text, bool once, int timeout_ms = 100)
+    {
+        batches.clear();
+        tf_text.clear();
+        std::unique_lock<std::mutex> lk(lock);
+        wake.wait_for(lk, std::chrono::milliseconds(timeout_ms), [&] { return stopping || tf_pending || any_pending(); });
+        reap(lk);
+        if(stopping || (once && served > 0 && clients.empty())) return false;
+        if(tf_pending)
+        {
+            tf_text = tf;
+            tf_pending = false;
+            for(size_t i = 0; i < clients.size(); i++)
+                if(clients[i]->has_view) clients[i]->pending = true;
+        }
+        for(size_t i = 0; i < clients.size(); i++)
+        {
+            Client* c = clients[i];
+            if(!c->pending || !c->open) continue;
+            RemoteTarget t;
+            t.client = c->id;
+            t.view = c->view;
+            t.received = c->received;
+            t.coalesced = c->coalesced;
+            c->pending = false;
+            c->coalesced = 0;
+            size_t b = 0;
+            while(b < batches.size() && !same_view(batches[b][0].view, t.view)) b++;
+            if(b == batches.size()) batches.push_back(std::vector<RemoteTarget>());
+            batches[b].push_back(t);
+        }
+        return true;
+    }
+
+    void deliver(const std::shared_ptr<RemoteFrame>& frame, const std::vector<RemoteTarget>& targets)
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        for(size_t t = 0; t < targets.size(); t++)
+            for(size_t i = 0; i < clients.size(); i++)
+                if(clients[i]->id == targets[t].client)
+                {
+                    Client* c = clients[i];
+                    if(c->frame) c->dropped++;
+                    c->frame = frame;
+                    c->target = targets[t];
+                    c->frame_wake.notify_one();
+                }
+    }
+
+    void stop()
+    {
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            if(listener < 0 && clients.empty()) return;
+            stopping = true;
+            if(listener >= 0) shutdown(listener, SHUT_RDWR);
+            for(size_t i = 0; i < clients.size(); i++)
+            {
+                shutdown(clients[i]->fd, SHUT_RDWR);
+                clients[i]->frame_wake.notify_one();
+            }
+        }
+        if(acceptor.joinable()) acceptor.join();
+        if(listener >= 0) close(listener);
+        listener = -1;
+        std::unique_lock<std::mutex> lk(lock);
+        while(!clients.empty())
+        {
+            reap(lk);
+            if(!clients.empty())
+            {
+                lk.unlock();
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                lk.lock();
+            }
+        }
+    }
+
+private:
+
+    struct Client {
+        Client() : id(0), fd(-1), open(true), writer_done(false), has_view(false), pending(false), received(0.0),
+                   coalesced(0), coalesced_total(0), rejected(0), frames(0), dropped(0), bytes(0), raw_bytes(0),
+                   latency_ms(0.0), connected(remote_clock()) {}
+        int id, fd;
+        bool open, writer_done;
+        bool has_view, pending;
+        RemoteView view;
+        double received;
+        uint32_t coalesced;
+        long long coalesced_total;
+        long long rejected; // views with fields that are not finite
+        std::shared_ptr<RemoteFrame> frame;
+        RemoteTarget target;
+        std::condition_variable frame_wake;
+        FrameEncoder encoder;
+        std::thread reader, writer;
+        long long frames, dropped, bytes, raw_bytes;
+        double latency_ms, connected;
+    };
+
+    static bool same_view(const RemoteView& a, const RemoteView& b)
+    {
+        return a.rotate == b.rotate && a.distance == b.distance && a.stepsize == b.stepsize;
+    }
+
+    bool any_pending() const
+    {
+        for(size_t i = 0; i < clients.size(); i++)
+            if(clients[i]->pending && clients[i]->open) return true;
+        return false;
+    }
+
+    void accept_loop()
+    {
+        while(true)
+        {
+            int fd = accept(listener, NULL, NULL);
+            std::lock_guard<std::mutex> lk(lock);
+            if(fd < 0 || stopping)
+            {
+                if(fd >= 0) close(fd);
+                if(stopping) return;
+                continue;
+            }
+            Communicator::no_delay(fd);
+            Client* c = new Client();
+            c->id = next_id++;
+            c->fd = fd;
+            clients.push_back(c);
+            served++;
+            std::cout << "client " << c->id << " connected" << std::endl;
+            c->reader = std::thread(&RemoteServer::read_loop, this, c);
+            c->writer = std::thread(&RemoteServer::write_loop, this, c);
+        }
+    }
+
+    void read_loop(Client* c)
+    {
+        RemoteHeader h;
+        std::vector<unsigned char> payload;
+        while(remote_read(c->fd, h, payload) && h.type != REMOTE_BYE)
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            RemoteView view;
+            if(h.type == REMOTE_VIEW && payload.size() == sizeof(RemoteView))
+            {
+                memcpy(&view, &payload[0], sizeof(RemoteView));
+                // a view that would put NaN or infinity into the camera is ignored
+                if(!std::isfinite(view.rotate) || !std::isfinite(view.distance) || !std::isfinite(view.stepsize))
+                {
+                    c->rejected++;
+                    continue;
+                }
+                if(c->pending)
+                {
+                    c->coalesced++;
+                    c->coalesced_total++;
+                }
+                c->view = view;
+                c->received = remote_clock();
+                c->has_view = c->pending = true;
+                wake.notify_one();
+            }
+            else if(h.type == REMOTE_TRANSFER_FUNCTION)
+            {
+                tf.assign(payload.begin(), payload.end());
+                tf_pending = true;
+                wake.notify_one();
+            }
+        }
+        std::lock_guard<std::mutex> lk(lock);
+        c->open = false;
+        c->frame_wake.notify_one();
+        wake.notify_one();
+    }
+
+    void write_loop(Client* c)
+    {
+        std::vector<unsigned char> stream;
+        std::unique_lock<std::mutex> lk(lock);
+        while(true)
+        {
+            c->frame_wake.wait(lk, [&] { return c->frame || !c->open || stopping; });
+            if(!c->frame) break;
+            std::shared_ptr<RemoteFrame> frame = c->frame;
+            RemoteTarget target = c->target;
+            c->frame.reset();
+            lk.unlock();
+
+            const double e0 = remote_clock();
+            c->encoder.encode(&frame->rgba[0], frame->width, frame->height, stream);
+            RemoteFrameInfo info;
+            info.seq = target.view.seq;
+            info.width = uint32_t(frame->width);
+            info.height = uint32_t(frame->height);
+            info.coalesced = target.coalesced;
+            info.sent = target.view.sent;
+            info.render_ms = frame->render_ms;
+            info.readback_ms = frame->readback_ms;
+            info.encode_ms = float(1000.0 * (remote_clock() - e0));
+            info.server_ms = float(1000.0 * (remote_clock() - target.received));
+            const bool ok = remote_write(c->fd, REMOTE_FRAME, &info, sizeof(info), stream.empty() ? NULL : &stream[0], stream.size());
+
+            lk.lock();
+            if(!ok) break;
+            c->frames++;
+            c->bytes += (long long)(sizeof(info) + stream.size());
+            c->raw_bytes += (long long)frame->width * frame->height * 3;
+            c->latency_ms += info.server_ms;
+        }
+        c->writer_done = true;
+        wake.notify_one();
+    }
+
+    // join and report the clients whose threads are done; called locked
+    void reap(std::unique_lock<std::mutex>& lk)
+    {
+        for(size_t i = 0; i < clients.size(); )
+        {
+            Client* c = clients[i];
+            if(c->open || !c->writer_done)
+            {
+                i++;
+                continue;
+            }
+            clients.erase(clients.begin() + i);
+            lk.unlock();
+            c->reader.join();
+            c->writer.join();
+            close(c->fd);
+            const double secs = remote_clock() - c->connected;
+            std::cout << "client " << c->id << ": " << c->frames << " frames in " << secs << " s ( "
+                      << c->frames / secs << " frames/sec ), " << (c->frames ? c->latency_ms / c->frames : 0.0)
+                      << " ms view to frame sent, " << c->coalesced_total << " views coalesced, " << c->dropped
+                      << " frames dropped, " << c->rejected << " views rejected, " << (c->bytes ? double(c->raw_bytes) / c->bytes : 0.0) << ":1 compression" << std::endl;
+            delete c;
+            lk.lock();
+        }
+    }
+
+    int listener;
+    bool stopping;
+    int next_id;
+    int served; // clients that connected so far
+    std::string tf;
+    bool tf_pending;
+    std::vector<Client*> clients;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread acceptor;
+};
+
+#endif
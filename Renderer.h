@@ -0,0 +1,190 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <iostream>
+
+// Uniform locations of one program, looked up once by name after linking
+// so the render loop never asks the driver for them. Names that the
+// compiler optimized away get -1, which glUniform ignores.
+class UniformCache {
+public:
+
+    UniformCache() : program(0) {}
+
+    void init(GLuint prog, const char* const* names, int count)
+    {
+        program = prog;
+        locations.resize(count);
+        for(int i = 0; i < count; i++)
+            locations[i] = glGetUniformLocation(program, names[i]);
+    }
+
+    GLint operator[](int i) const { return locations[i]; }
+
+    GLuint program;
+
+private:
+    std::vector<GLint> locations;
+};
+
+// The retained GL state of the render loop: the proxy cube and the
+// fullscreen quad live in vertex buffers, bound through vertex array
+// objects where the driver has them, so drawing either is one call.
+// check() and validate() are for debugging only: glGetError and
+// glValidateProgram make the driver finish the work queued so far, so
+// unless debug is set they do nothing.
+class Renderer {
+public:
+
+    Renderer() : debug(false), cube_vao(0), cube_vbo(0), quad_vao(0), quad_vbo(0) {}
+
+    // call with a current GL context
+    void init(bool debug_gl)
+    {
+        debug = debug_gl;
+        release();
+
+        // the unit cube as GL_QUADS, position = color = texture coordinate 1;
+        // the backface pass writes the color, the raycaster reads the texcoord
+        static const float c[6][4][3] = {
+            { {0,0,0}, {0,1,0}, {1,1,0}, {1,0,0} }, // back
+            { {0,0,1}, {1,0,1}, {1,1,1}, {0,1,1} }, // front
+            { {0,1,0}, {0,1,1}, {1,1,1}, {1,1,0} }, // top
+            { {0,0,0}, {1,0,0}, {1,0,1}, {0,0,1} }, // bottom
+            { {0,0,0}, {0,0,1}, {0,1,1}, {0,1,0} }, // left
+            { {1,0,0}, {1,1,0}, {1,1,1}, {1,0,1} }, // right
+        };
+        glGenBuffers(1, &cube_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, cube_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(c), c, GL_STATIC_DRAW);
+
+        // x, y, s, t of the quad over the unit square
+        static const float q[4][4] = { {0,0, 0,0}, {1,0, 1,0}, {1,1, 1,1}, {0,1, 0,1} };
+        glGenBuffers(1, &quad_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(q), q, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        if(GLEW_ARB_vertex_array_object || GLEW_VERSION_3_0)
+        {
+            glGenVertexArrays(1, &cube_vao);
+            glBindVertexArray(cube_vao);
+            cube_arrays(true);
+            glGenVertexArrays(1, &quad_vao);
+            glBindVertexArray(quad_vao);
+            quad_arrays(true);
+            glBindVertexArray(0);
+        }
+        else
+            std::cout << "no vertex array objects, binding the vertex buffers on every draw" << std::endl;
+        check("Renderer::init");
+    }
+
+    void draw_cube()
+    {
+        if(cube_vao) glBindVertexArray(cube_vao);
+        else cube_arrays(true);
+        glDrawArrays(GL_QUADS, 0, 24);
+        if(cube_vao) glBindVertexArray(0);
+        else cube_arrays(false);
+    }
+
+    // the unit square with texture coordinates, for an ortho projection
+    void draw_quad()
+    {
+        if(quad_vao) glBindVertexArray(quad_vao);
+        else quad_arrays(true);
+        glDrawArrays(GL_QUADS, 0, 4);
+        if(quad_vao) glBindVertexArray(0);
+        else quad_arrays(false);
+    }
+
+    // report GL errors raised since the last check, debug only
+    bool check(const char* what)
+    {
+        if(!debug) return true;
+        bool ok = true;
+        for(GLenum err; (err = glGetError()) != GL_NO_ERROR; ok = false)
+            std::cout << what << ": GL error 0x" << std::hex << err << std::dec << std::endl;
+        return ok;
+    }
+
+    // whether program can run with the current state, debug only
+    bool validate(GLuint program)
+    {
+        if(!debug) return true;
+        GLint ok = 0;
+        glValidateProgram(program);
+        glGetProgramiv(program, GL_VALIDATE_STATUS, &ok);
+        if(!ok)
+        {
+            GLchar log[1024] = { 0 };
+            glGetProgramInfoLog(program, sizeof(log), NULL, log);
+            std::cout << " Invalid shader program: " << log << std::endl;
+        }
+        return ok != 0;
+    }
+
+    bool debug;
+
+private:
+
+    void release()
+    {
+        if(cube_vao) glDeleteVertexArrays(1, &cube_vao);
+        if(quad_vao) glDeleteVertexArrays(1, &quad_vao);
+        if(cube_vbo) glDeleteBuffers(1, &cube_vbo);
+        if(quad_vbo) glDeleteBuffers(1, &quad_vbo);
+        cube_vao = quad_vao = cube_vbo = quad_vbo = 0;
+    }
+
+    // the array setup the vertex array objects record, or that is done
+    // around every draw without them
+    void cube_arrays(bool enable)
+    {
+        if(!enable)
+        {
+            glDisableClientState(GL_VERTEX_ARRAY);
+            glDisableClientState(GL_COLOR_ARRAY);
+            glClientActiveTexture(GL_TEXTURE1);
+            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+            glClientActiveTexture(GL_TEXTURE0);
+            return;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, cube_vbo);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, 0);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(3, GL_FLOAT, 0, 0);
+        glClientActiveTexture(GL_TEXTURE1);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(3, GL_FLOAT, 0, 0);
+        glClientActiveTexture(GL_TEXTURE0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void quad_arrays(bool enable)
+    {
+        if(!enable)
+        {
+            glDisableClientState(GL_VERTEX_ARRAY);
+            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+            return;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(2, GL_FLOAT, 4 * sizeof(float), 0);
+        glClientActiveTexture(GL_TEXTURE0);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, 4 * sizeof(float), (const GLvoid*)(2 * sizeof(float)));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    GLuint cube_vao, cube_vbo;
+    GLuint quad_vao, quad_vbo;
+};
+
+#endif
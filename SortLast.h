@@ -0,0 +1,443 @@
+#ifndef SORTLAST_H
+#define SORTLAST_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "Vector3.h"
+#include "Camera.h"
+#include "Volume.h"
+#include "VolumeLoader.h"
+#include "BrickFile.h"
+#include "OccupancyGrid.h"
+#include "TransferFunction.h"
+#include "ThreadPool.h"
+#include "RayMarch.h"
+#include "CpuRaycaster.h"
+#include "Communicator.h"
+
+// Floats per pixel of a partial image: the color the frag shader composites
+// ( rgba ), the opacity it sums and the sum of 3 * alpha_sample * color of
+// the samples, the color they would add to a ray that was still empty.
+// The shader weights a sample by 1 - alpha_acc with alpha_acc a plain sum,
+// so the samples of a brick behind a front part that reached opacity A add
+// their color less A times that sum: front over back is
+//   color = front.color + back.color - front.alpha * back.sum
+// which is exact and associative, so any grouping of the bricks in
+// visibility order gives the image of one process marching them all.
+#define PARTIAL_CHANNELS 9
+
+//--------------------------------------------------------------------------------------
+// front over back for count pixels; out may be either of them
+//--------------------------------------------------------------------------------------
+inline void composite_partial(const float* front, const float* back, float* out, size_t count)
+{
+    for(size_t i = 0; i < count; i++, front += PARTIAL_CHANNELS, back += PARTIAL_CHANNELS, out += PARTIAL_CHANNELS)
+    {
+        const float a = front[4];
+        float p[PARTIAL_CHANNELS];
+        for(int c = 0; c < 4; c++)
+        {
+            p[c] = front[c] + back[c] - a * back[5 + c];
+            p[5 + c] = front[5 + c] + back[5 + c];
+        }
+        p[4] = a + back[4];
+        std::copy(p, p + PARTIAL_CHANNELS, out);
+    }
+}
+
+// grid of k[0] x k[1] x k[2] bricks for n processes: n slabs along z, or
+// the factors of n spread over the axes so the bricks are close to cubes
+inline void split_bricks(int n, bool slabs, int k[3])
+{
+    k[0] = k[1] = 1;
+    k[2] = n;
+    if(slabs) return;
+    k[2] = 1;
+    std::vector<int> factors;
+    for(int f = 2; n > 1; )
+        if(n % f == 0) { factors.push_back(f); n /= f; }
+        else f++;
+    for(int i = int(factors.size()) - 1; i >= 0; i--)
+    {
+        int a = 2;
+        for(int b = 1; b >= 0; b--)
+            if(k[b] < k[a]) a = b;
+        k[a] *= factors[i];
+    }
+}
+
+// The part of the volume one process renders: the voxels lo .. hi - 1 of
+// the whole volume, which is full voxels in size, plus a voxel around them
+// where there is one, so GL_LINEAR fetches near the border of the brick
+// read the neighbours' voxels. A sample belongs to the brick whose voxels
+// contain it, or to the outer brick for samples past the volume border, so
+// every sample of a ray is taken by exactly one process.
+struct SortLastBrick {
+
+    // brick index, counting along x first, of a k[0] x k[1] x k[2] grid
+    // over a volume of dims voxels
+    void place(const int dims[3], const int k[3], int index)
+    {
+        cell[0] = index % k[0];
+        cell[1] = index / k[0] % k[1];
+        cell[2] = index / (k[0] * k[1]);
+        for(int a = 0; a < 3; a++)
+        {
+            full[a] = dims[a];
+            lo[a] = int(int64_t(dims[a]) * cell[a] / k[a]);
+            hi[a] = int(int64_t(dims[a]) * (cell[a] + 1) / k[a]);
+            origin[a] = std::max(lo[a] - 1, 0);
+        }
+    }
+
+    // the voxels to generate or copy, ghost_hi exclusive
+    void ghost_range(int ghost_lo[3], int ghost_hi[3]) const
+    {
+        for(int a = 0; a < 3; a++)
+        {
+            ghost_lo[a] = origin[a];
+            ghost_hi[a] = std::min(hi[a] + 1, full[a]);
+        }
+    }
+
+    // read the brick out of a mapped volume file, converting only the rows
+    // of its ghost range, as copy_brick() does for the atlas
+    void read(const VolumeFile& file, ThreadPool& pool)
+    {
+        int g0[3], g1[3];
+        ghost_range(g0, g1);
+        voxels.resize(g1[0] - g0[0], g1[1] - g0[1], g1[2] - g0[2], file.format);
+        const size_t row = size_t(voxels.width) * voxels.bytes_per_voxel();
+        pool.parallel_for(voxels.depth, [&](int z, int)
+        {
+            for(int y = 0; y < voxels.height; y++)
+                file.convert_row(g0[0], g0[1] + y, g0[2] + z, voxels.width, &voxels.data[(size_t(z) * voxels.height + y) * row]);
+        });
+    }
+
+    // the same from level 0 of a bricked volume file, reading only the
+    // file bricks the ghost range overlaps
+    bool read(const BrickFile& file, ThreadPool& pool)
+    {
+        int g0[3], g1[3], b0[3], nb[3];
+        ghost_range(g0, g1);
+        voxels.resize(g1[0] - g0[0], g1[1] - g0[1], g1[2] - g0[2], file.format());
+        const int b = file.header.brick_size, p = file.padded(), bpv = file.bytes_per_voxel();
+        for(int a = 0; a < 3; a++)
+        {
+            b0[a] = g0[a] / b;
+            nb[a] = (g1[a] - 1) / b - b0[a] + 1;
+        }
+        const BrickFileLevel& l = file.levels[0];
+        bool ok = true;
+        pool.parallel_for(nb[0] * nb[1] * nb[2], [&](int i, int)
+        {
+            const int c[3] = { b0[0] + i % nb[0], b0[1] + i / nb[0] % nb[1], b0[2] + i / (nb[0] * nb[1]) };
+            std::vector<unsigned char> brick(file.brick_bytes());
+            if(!file.read_brick(0, (c[2] * l.bricks[1] + c[1]) * l.bricks[0] + c[0], &brick[0])) { ok = false; return; }
+            int lo[3], hi[3];
+            for(int a = 0; a < 3; a++)
+            {
+                lo[a] = std::max(c[a] * b, g0[a]);
+                hi[a] = std::min((c[a] + 1) * b, g1[a]);
+            }
+            for(int z = lo[2]; z < hi[2]; z++)
+                for(int y = lo[1]; y < hi[1]; y++)
+                    memcpy((unsigned char*)voxels.voxel(lo[0] - g0[0], y - g0[1], z - g0[2]),
+                           &brick[((size_t(z - c[2] * b + 1) * p + y - c[1] * b + 1) * p + lo[0] - c[0] * b + 1) * bpv],
+                           size_t(hi[0] - lo[0]) * bpv);
+        });
+        return ok;
+    }
+
+    // after the voxels are in: the occupancy grid of the brick alone
+    void build_grid(const TransferFunction* tf)
+    {
+        grid.build(voxels, 8, tf);
+        const int dims[3] = { voxels.width, voxels.height, voxels.depth };
+        for(int a = 0; a < 3; a++)
+        {
+            scale[a] = float(full[a]) / dims[a];
+            offset[a] = -float(origin[a]) / dims[a];
+        }
+    }
+
+    bool owns(const Vector3& p) const
+    {
+        for(int a = 0; a < 3; a++)
+        {
+            const float v = p[a] * full[a];
+            if((lo[a] > 0 && v < float(lo[a])) || (hi[a] < full[a] && v >= float(hi[a])))
+                return false;
+        }
+        return true;
+    }
+
+    // texture coordinate of the whole volume to one of voxels
+    Vector3 to_local(const Vector3& p) const
+    {
+        return Vector3(p.x() * scale[0] + offset[0], p.y() * scale[1] + offset[1], p.z() * scale[2] + offset[2]);
+    }
+
+    Vector3 to_local_direction(const Vector3& d) const
+    {
+        return Vector3(d.x() * scale[0], d.y() * scale[1], d.z() * scale[2]);
+    }
+
+    // the steps n of ray whose samples can lie in the brick, n0 .. n1 - 1;
+    // a step wider on either side, owns() has the last word
+    bool step_range(const Ray& ray, int& n0, int& n1) const
+    {
+        float t0 = -1e30f, t1 = 1e30f;
+        for(int a = 0; a < 3; a++)
+        {
+            const float box_lo = lo[a] > 0 ? float(lo[a]) / full[a] : -1.0f;
+            const float box_hi = hi[a] < full[a] ? float(hi[a]) / full[a] : 2.0f;
+            const float d = ray.delta_dir[a];
+            if(d == 0.0f)
+            {
+                if(ray.start[a] < box_lo || ray.start[a] > box_hi) return false;
+                continue;
+            }
+            float ta = (box_lo - ray.start[a]) / d;
+            float tb = (box_hi - ray.start[a]) / d;
+            if(ta > tb) std::swap(ta, tb);
+            t0 = std::max(t0, ta);
+            t1 = std::min(t1, tb);
+        }
+        if(t0 > t1 || t1 < 0.0f) return false;
+        n0 = std::max(int(floorf(std::max(t0, 0.0f))) - 1, 0);
+        n1 = std::min(int(std::min(ceilf(t1), 1e6f)) + 2, ray_steps(ray));
+        return n0 < n1;
+    }
+
+    int cell[3];
+    int lo[3], hi[3];
+    int full[3];
+    int origin[3]; // first voxel of voxels in the whole volume
+    Volume voxels;
+    OccupancyGrid grid;
+    float scale[3], offset[3];
+};
+
+//--------------------------------------------------------------------------------------
+// the DVR loop of the frag shader over the samples of ray that brick owns,
+// as a partial pixel. The samples are those of the counted loop, so with
+// early exit off the composited bricks match one process marching the
+// whole ray; an early exit would need the opacity of the bricks in front.
+// Returns the number of volume fetches.
+//--------------------------------------------------------------------------------------
+inline int march_ray_partial(const SortLastBrick& brick, const Ray& ray, float stepsize, float out[PARTIAL_CHANNELS],
+                             bool skip, const TransferFunction* tf)
+{
+    std::fill(out, out + PARTIAL_CHANNELS, 0.0f);
+    int n, n1;
+    if(!brick.step_range(ray, n, n1))
+        return 0;
+    const Vector3 local_delta = brick.to_local_direction(ray.delta_dir);
+    const Vector3 inv_delta = skip ? safe_inverse(local_delta) : Vector3();
+    float alpha_acc = 0.0f;
+    float color_sample[4];
+    bool inside = false;
+    int taken = 0;
+    while(n < n1)
+    {
+        const Vector3 vect = ray.start + ray.delta_dir * float(n);
+        if(!brick.owns(vect))
+        {
+            if(inside) break;
+            n++;
+            continue;
+        }
+        inside = true;
+        const Vector3 local = brick.to_local(vect);
+        if(skip && brick.grid.empty_at(local))
+        {
+            n += brick.grid.steps_to_exit(local, local_delta, inv_delta);
+            continue;
+        }
+        sample_volume(brick.voxels, local.x(), local.y(), local.z(), color_sample, tf);
+        taken++;
+        float alpha_sample = color_sample[3] * stepsize;
+        float wgt = (1.0f - alpha_acc) * alpha_sample * 3.0f;
+        for(int c = 0; c < 4; c++)
+        {
+            out[c] += color_sample[c] * wgt;
+            out[5 + c] += color_sample[c] * alpha_sample * 3.0f;
+        }
+        alpha_acc += alpha_sample;
+        n++;
+    }
+    out[4] = alpha_acc;
+    return taken;
+}
+
+//--------------------------------------------------------------------------------------
+// the partial image of brick, PARTIAL_CHANNELS floats per pixel, bottom row
+// first; returns the number of volume fetches
+//--------------------------------------------------------------------------------------
+inline long long render_partial(ThreadPool& pool, const SortLastBrick& brick, const Camera& cam, float stepsize,
+                                int width, int height, bool skip, const TransferFunction* tf, std::vector<float>& partial)
+{
+    partial.assign(size_t(width) * height * PARTIAL_CHANNELS, 0.0f);
+    const RaySetup setup(cam, width, height);
+    std::vector<long long> samples(pool.size(), 0);
+    pool.parallel_for(height, [&](int y, int worker)
+    {
+        Vector3 start, back;
+        Ray ray;
+        for(int x = 0; x < width; x++)
+        {
+            if(!setup.ray(x, y, start, back)) continue;
+            setup_ray(start, back, stepsize, ray);
+            samples[worker] += march_ray_partial(brick, ray, stepsize, &partial[(size_t(y) * width + x) * PARTIAL_CHANNELS], skip, tf);
+        }
+    });
+    long long total = 0;
+    for(size_t i = 0; i < samples.size(); i++)
+        total += samples[i];
+    return total;
+}
+
+// Front to back order of the bricks of a k[0] x k[1] x k[2] grid seen from
+// eye ( texture coordinates ): by the sum over the axes of how many bricks
+// lie between a brick and the one of the eye. A ray moves away from the eye
+// along every axis, so that sum grows with every brick it enters.
+inline std::vector<int> visibility_order(const int k[3], const int dims[3], const Vector3& eye)
+{
+    int eye_cell[3];
+    for(int a = 0; a < 3; a++)
+    {
+        // the brick place() puts the eye's voxel in, clamped to the grid
+        const float v = eye[a] * dims[a];
+        int c = 0;
+        while(c + 1 < k[a] && v >= float(int64_t(dims[a]) * (c + 1) / k[a])) c++;
+        eye_cell[a] = c;
+    }
+    std::vector<std::pair<int, int> > by_distance;
+    for(int i = 0; i < k[0] * k[1] * k[2]; i++)
+    {
+        const int c[3] = { i % k[0], i / k[0] % k[1], i / (k[0] * k[1]) };
+        by_distance.push_back(std::make_pair(abs(c[0] - eye_cell[0]) + abs(c[1] - eye_cell[1]) + abs(c[2] - eye_cell[2]), i));
+    }
+    std::sort(by_distance.begin(), by_distance.end());
+    std::vector<int> order;
+    for(size_t i = 0; i < by_distance.size(); i++)
+        order.push_back(by_distance[i].second);
+    return order;
+}
+
+struct SwapStats {
+    SwapStats() : bytes_sent(0), stages(0) {}
+    size_t bytes_sent;
+    int stages;
+};
+
+// the pixels active process p of P holds after binary swap, begin .. end - 1
+inline void swap_range(int p, int P, size_t pixels, size_t& begin, size_t& end)
+{
+    begin = 0;
+    end = pixels;
+    for(int bit = 1; bit < P; bit <<= 1)
+    {
+        const size_t mid = begin + (end - begin) / 2;
+        if(p & bit) begin = mid;
+        else end = mid;
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// binary-swap compositing of the partial images of all ranks, order being
+// the ranks front to back. A rank count that is not a power of two is
+// first folded: the first 2 * ( n - P ) ranks in order pair up and the
+// back one of each pair hands its whole image to the front one. Then, in
+// log2 P stages, partners swap half of the pixels they hold and composite
+// the half they keep, and rank 0 gathers the finished pieces into rgba
+// ( 4 floats per pixel ). partial is overwritten; false if a peer is lost.
+//--------------------------------------------------------------------------------------
+inline bool binary_swap(Communicator& comm, const std::vector<int>& order, std::vector<float>& partial,
+                        size_t pixels, std::vector<float>& rgba, SwapStats& stats)
+{
+    const int n = comm.size;
+    int P = 1;
+    while(P * 2 <= n) P *= 2;
+    const int extra = n - P;
+    const int v = int(std::find(order.begin(), order.end(), comm.rank) - order.begin());
+    std::vector<int> active(P);
+    for(int p = 0; p < P; p++)
+        active[p] = p < extra ? order[2 * p] : order[p + extra];
+    std::vector<float> incoming;
+    bool ok = true;
+    stats = SwapStats();
+
+    int p = -1;
+    if(v < 2 * extra && (v & 1))
+    {
+        ok = comm.send(order[v - 1], &partial[0], partial.size() * sizeof(float));
+        stats.bytes_sent += partial.size() * sizeof(float);
+    }
+    else
+    {
+        p = v < 2 * extra ? v / 2 : v - extra;
+        if(v < 2 * extra)
+        {
+            incoming.resize(partial.size());
+            ok = comm.recv(order[v + 1], &incoming[0], incoming.size() * sizeof(float));
+            if(ok) composite_partial(&partial[0], &incoming[0], &partial[0], pixels);
+        }
+        size_t begin = 0, end = pixels;
+        for(int bit = 1; ok && bit < P; bit <<= 1)
+        {
+            const int partner = active[p ^ bit];
+            const size_t mid = begin + (end - begin) / 2;
+            const bool front = !(p & bit);
+            const size_t keep0 = front ? begin : mid, keep1 = front ? mid : end;
+            const size_t give0 = front ? mid : begin, give1 = front ? end : mid;
+            incoming.resize((keep1 - keep0) * PARTIAL_CHANNELS);
+            ok = comm.exchange(partner, &partial[give0 * PARTIAL_CHANNELS], (give1 - give0) * PARTIAL_CHANNELS * sizeof(float),
+                               incoming.empty() ? NULL : &incoming[0], incoming.size() * sizeof(float));
+            stats.bytes_sent += (give1 - give0) * PARTIAL_CHANNELS * sizeof(float);
+            stats.stages++;
+            float* mine = &partial[keep0 * PARTIAL_CHANNELS];
+            if(ok && keep1 > keep0)
+            {
+                if(front) composite_partial(mine, &incoming[0], mine, keep1 - keep0);
+                else      composite_partial(&incoming[0], mine, mine, keep1 - keep0);
+            }
+            begin = keep0;
+            end = keep1;
+        }
+    }
+
+    // gather the colors on rank 0
+    if(comm.rank == 0)
+        rgba.assign(pixels * 4, 0.0f);
+    for(int q = 0; ok && q < P; q++)
+    {
+        size_t begin, end;
+        swap_range(q, P, pixels, begin, end);
+        if(end == begin || (comm.rank != 0 && q != p)) continue;
+        if(q == p)
+        {
+            std::vector<float> colors((end - begin) * 4);
+            for(size_t i = begin; i < end; i++)
+                std::copy(&partial[i * PARTIAL_CHANNELS], &partial[i * PARTIAL_CHANNELS] + 4, &colors[(i - begin) * 4]);
+            if(comm.rank == 0)
+                std::copy(colors.begin(), colors.end(), rgba.begin() + begin * 4);
+            else
+            {
+                ok = comm.send(0, &colors[0], colors.size() * sizeof(float));
+                stats.bytes_sent += colors.size() * sizeof(float);
+            }
+        }
+        else
+            ok = comm.recv(active[q], &rgba[begin * 4], (end - begin) * 4 * sizeof(float));
+    }
+    return ok;
+}
+
+#endif
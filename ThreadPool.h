@@ -0,0 +1,157 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small work-stealing pool for data parallel loops such as image tiles.
+// parallel_for() hands every worker a contiguous block of task indices;
+// a worker pops from the back of its own queue and, once that is empty,
+// steals from the front of the others. The calling thread takes part as
+// worker 0, so a pool of size 1 simply runs the loop inline.
+class ThreadPool {
+public:
+
+    typedef std::function<void(int task, int worker)> Task;
+
+    explicit ThreadPool(int num_threads = 0)
+        : job(0), pending(0), generation(0), stop(false)
+    {
+        if(num_threads <= 0)
+            num_threads = int(std::thread::hardware_concurrency());
+        if(num_threads <= 0)
+            num_threads = 1;
+
+        queues.resize(num_threads);
+        for(int i = 0; i < num_threads; i++)
+            queues[i] = new WorkQueue();
+        for(int i = 1; i < num_threads; i++)
+            threads.push_back(std::thread(&ThreadPool::worker_main, this, i));
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lk(wake_lock);
+            stop = true;
+        }
+        wake.notify_all();
+        for(size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+        for(size_t i = 0; i < queues.size(); i++)
+            delete queues[i];
+    }
+
+    int size() const { return int(queues.size()); }
+
+    // run fn(task, worker) for every task in [0,count) and wait for all of them
+    void parallel_for(int count, const Task& fn)
+    {
+        if(count <= 0) return;
+
+        const int n = size();
+        job = &fn;
+        pending.store(count);
+        for(int w = 0; w < n; w++)
+        {
+            std::lock_guard<std::mutex> lk(queues[w]->lock);
+            for(int t = int((long long)count * w / n); t < int((long long)count * (w+1) / n); t++)
+                queues[w]->tasks.push_back(t);
+        }
+        {
+            std::lock_guard<std::mutex> lk(wake_lock);
+            generation++;
+        }
+        wake.notify_all();
+
+        run_tasks(0);
+
+        std::unique_lock<std::mutex> lk(done_lock);
+        done.wait(lk, [this]{ return pending.load() == 0; });
+        job = 0;
+    }
+
+private:
+
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<int> tasks;
+    };
+
+    bool pop_task(int worker, int& task)
+    {
+        {
+            WorkQueue& q = *queues[worker];
+            std::lock_guard<std::mutex> lk(q.lock);
+            if(!q.tasks.empty())
+            {
+                task = q.tasks.back();
+                q.tasks.pop_back();
+                return true;
+            }
+        }
+        const int n = size();
+        for(int i = 1; i < n; i++)
+        {
+            WorkQueue& victim = *queues[(worker + i) % n];
+            std::lock_guard<std::mutex> lk(victim.lock);
+            if(!victim.tasks.empty())
+            {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run_tasks(int worker)
+    {
+        int task;
+        while(pop_task(worker, task))
+        {
+            (*job)(task, worker);
+            if(pending.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> lk(done_lock);
+                done.notify_all();
+            }
+        }
+    }
+
+    void worker_main(int worker)
+    {
+        unsigned seen = 0;
+        for(;;)
+        {
+            {
+                std::unique_lock<std::mutex> lk(wake_lock);
+                wake.wait(lk, [&]{ return stop || generation != seen; });
+                if(stop) return;
+                seen = generation;
+            }
+            run_tasks(worker);
+        }
+    }
+
+    std::vector<WorkQueue*> queues;
+    std::vector<std::thread> threads;
+
+    const Task* job; // published to workers through the queue locks
+    std::atomic<int> pending;
+
+    std::mutex wake_lock;
+    std::condition_variable wake;
+    unsigned generation;
+    bool stop;
+
+    std::mutex done_lock;
+    std::condition_variable done;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef TILEDISPATCH_H
+#define TILEDISPATCH_H
+
+#include <vector>
+#include <algorithm>
+
+#include "Matrix4.h"
+
+// The screen tiles of a compute dispatch: those of a width x height frame
+// that the projection of the unit cube overlaps. The eight corners are
+// projected with mvp and the convex hull of the result is tested against
+// every tile of its bounding box by separating axes; with a corner behind
+// the eye every tile is kept. The list is in Morton order, so work groups
+// that run at the same time march neighbouring rays through the same part
+// of the volume and share the texture cache.
+class TileDispatch {
+public:
+
+    TileDispatch() : tile_size(8), total(0) {}
+
+    void build(const Matrix4& mvp, int width, int height, int tile)
+    {
+        tile_size = tile;
+        const int tiles_x = (width + tile - 1) / tile;
+        const int tiles_y = (height + tile - 1) / tile;
+        total = tiles_x * tiles_y;
+        tiles.clear();
+
+        std::vector<Point> corners;
+        bool behind = false;
+        for(int c = 0; c < 8; c++)
+        {
+            float o[4];
+            mvp.transform(float(c & 1), float((c >> 1) & 1), float((c >> 2) & 1), 1.0f, o);
+            if(o[3] <= 1e-6f)
+            {
+                behind = true;
+                break;
+            }
+            corners.push_back(Point((o[0] / o[3] * 0.5f + 0.5f) * width, (o[1] / o[3] * 0.5f + 0.5f) * height));
+        }
+
+        int x0 = 0, y0 = 0, x1 = tiles_x, y1 = tiles_y;
+        std::vector<Point> hull;
+        if(!behind)
+        {
+            hull = convex_hull(corners);
+            float min_x = 1e30f, min_y = 1e30f, max_x = -1e30f, max_y = -1e30f;
+            for(size_t i = 0; i < hull.size(); i++)
+            {
+                min_x = std::min(min_x, hull[i].x); max_x = std::max(max_x, hull[i].x);
+                min_y = std::min(min_y, hull[i].y); max_y = std::max(max_y, hull[i].y);
+            }
+            // a pixel of margin for the sub-pixel jitter of progressive refinement
+            x0 = std::max(int((min_x - 1.0f) / tile), 0);
+            y0 = std::max(int((min_y - 1.0f) / tile), 0);
+            x1 = std::min(int((max_x + 1.0f) / tile) + 1, tiles_x);
+            y1 = std::min(int((max_y + 1.0f) / tile) + 1, tiles_y);
+            if(min_x - 1.0f > width || min_y - 1.0f > height || max_x + 1.0f < 0.0f || max_y + 1.0f < 0.0f)
+                x1 = y1 = 0;
+        }
+
+        std::vector<std::pair<unsigned, int> > order;
+        for(int y = y0; y < y1; y++)
+            for(int x = x0; x < x1; x++)
+                if(behind || overlaps(hull, x * tile - 1.0f, y * tile - 1.0f, (x + 1) * tile + 1.0f, (y + 1) * tile + 1.0f))
+                    order.push_back(std::make_pair(morton(x, y), y * tiles_x + x));
+        std::sort(order.begin(), order.end());
+        tiles.reserve(order.size() * 2);
+        for(size_t i = 0; i < order.size(); i++)
+        {
+            tiles.push_back(order[i].second % tiles_x);
+            tiles.push_back(order[i].second / tiles_x);
+        }
+    }
+
+    int count() const { return int(tiles.size() / 2); }
+
+    std::vector<int> tiles; // x, y of every tile to render
+    int tile_size;
+    int total;              // tiles of the frame, culled or not
+
+private:
+
+    struct Point {
+        Point(float px, float py) : x(px), y(py) {}
+        bool operator<(const Point& o) const { return x < o.x || (x == o.x && y < o.y); }
+        float x, y;
+    };
+
+    static float cross(const Point& o, const Point& a, const Point& b)
+    {
+        return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+    }
+
+    // counter clockwise, by the monotone chain
+    static std::vector<Point> convex_hull(std::vector<Point> p)
+    {
+        std::sort(p.begin(), p.end());
+        std::vector<Point> h;
+        for(int pass = 0; pass < 2; pass++)
+        {
+            const size_t base = h.size();
+            for(size_t i = 0; i < p.size(); i++)
+            {
+                while(h.size() >= base + 2 && cross(h[h.size() - 2], h[h.size() - 1], p[i]) <= 0.0f)
+                    h.pop_back();
+                h.push_back(p[i]);
+            }
+            h.pop_back();
+            std::reverse(p.begin(), p.end());
+        }
+        return h;
+    }
+
+    // whether the rectangle meets the hull: no hull edge has all four
+    // corners outside, the bounding box was tested by the caller
+    static bool overlaps(const std::vector<Point>& hull, float x0, float y0, float x1, float y1)
+    {
+        if(hull.size() < 3) return true;
+        const Point r[4] = { Point(x0, y0), Point(x1, y0), Point(x1, y1), Point(x0, y1) };
+        for(size_t i = 0; i < hull.size(); i++)
+        {
+            const Point& a = hull[i];
+            const Point& b = hull[(i + 1) % hull.size()];
+            int outside = 0;
+            for(int k = 0; k < 4; k++)
+                if(cross(a, b, r[k]) < 0.0f) outside++;
+            if(outside == 4) return false;
+        }
+        return true;
+    }
+
+    static unsigned morton(unsigned x, unsigned y)
+    {
+        unsigned m = 0;
+        for(int b = 0; b < 16; b++)
+            m |= ((x >> b) & 1u) << (2 * b) | ((y >> b) & 1u) << (2 * b + 1);
+        return m;
+    }
+};
+
+#endif
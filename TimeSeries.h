@@ -0,0 +1,225 @@
+#ifndef TIMESERIES_H
+#define TIMESERIES_H
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+
+#include "Volume.h"
+#include "OccupancyGrid.h"
+#include "VolumeLoader.h"
+
+// One converted timestep, waiting in the prefetch ring
+struct TimeStep {
+    TimeStep() : seq(-1), ready(false), ok(false), target(NULL), load_ms(0.0) {}
+    long long seq;   // position in the playback, the step is seq % steps
+    bool ready, ok;
+    unsigned char* target; // the voxels go here when set, such as a mapped buffer
+    Volume voxels;   // else here
+    OccupancyGrid::SlabRanges ranges; // of all cells
+    double load_ms;
+};
+
+// A time varying volume: one volume file per timestep, named by a printf
+// pattern such as run_256x256x256_float_%04d.raw, all of the same size
+// and type. Playback runs through the steps in order and loops; a ring of
+// prefetch slots keeps the next steps converted ahead of it. I/O threads
+// map the file of the next step nobody has taken yet, convert it to R8 or
+// R16 with the value range of the first step, so every step is scaled the
+// same, and compute the occupancy ranges of its cells; the render thread
+// takes the steps out with ready() and hands the slot back with release().
+// A slot can be given a target, memory of its own such as a mapped pixel
+// buffer object, which the step is then converted straight into instead of
+// into the slot's voxels; it belongs to the I/O threads until the step is
+// ready and to the render thread until the slot is released.
+class TimeSeries {
+public:
+
+    TimeSeries() : steps(0), prefetch(0), consumed(0), next_load(0), stopping(false),
+                   loaded(0), load_ms(0.0) {}
+
+    ~TimeSeries() { stop(); }
+
+    // steps <= 0 counts the files that exist from step 0 on
+    bool open(const char* name_pattern, int step_count, const VolumeFileInfo& raw_layout, VolumeFormat preferred)
+    {
+        pattern = name_pattern;
+        raw = raw_layout;
+        steps = step_count;
+        if(steps <= 0)
+        {
+            struct stat st;
+            for(steps = 0; stat(filename(steps).c_str(), &st) == 0; steps++) ;
+        }
+        if(steps <= 0)
+        {
+            std::cout << "no timestep " << filename(0) << std::endl;
+            return false;
+        }
+        VolumeFile first;
+        if(!first.open(filename(0).c_str(), raw, preferred)) return false;
+        if(first.needs_range()) first.scan_range();
+        info = first.info;
+        format = first.format;
+        value_min = first.value_min;
+        value_max = first.value_max;
+        grid.reset(info.dims[0], info.dims[1], info.dims[2], 8);
+        return true;
+    }
+
+    std::string filename(int step) const
+    {
+        char name[1024];
+        snprintf(name, sizeof(name), pattern.c_str(), step);
+        return name;
+    }
+
+    // start converting from playback position first on, k steps ahead;
+    // targets, if given, has one for each of the k slots
+    void start(long long first, int k, int io_threads, const std::vector<unsigned char*>& targets = std::vector<unsigned char*>())
+    {
+        stop();
+        prefetch = std::max(k, 1);
+        ring.assign(prefetch, TimeStep());
+        for(size_t t = 0; t < targets.size() && t < ring.size(); t++)
+            ring[(first + t) % prefetch].target = targets[t];
+        consumed = next_load = first;
+        stopping = false;
+        for(int t = 0; t < std::max(io_threads, 1); t++)
+            threads.push_back(std::thread(&TimeSeries::load_loop, this));
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+        threads.clear();
+    }
+
+    // the step at playback position seq once it is converted, else NULL;
+    // positions are taken in order
+    const TimeStep* ready(long long seq)
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        const TimeStep& s = ring[seq % prefetch];
+        return s.seq == seq && s.ready ? &s : NULL;
+    }
+
+    // block until position seq is converted
+    const TimeStep* wait(long long seq)
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        const TimeStep& s = ring[seq % prefetch];
+        done.wait(lk, [&] { return s.seq == seq && s.ready; });
+        return &s;
+    }
+
+    // done with position seq, its slot takes the next step, into target
+    // if that is set
+    void release(long long seq, unsigned char* target = NULL)
+    {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            TimeStep& s = ring[seq % prefetch];
+            s.seq = -1;
+            s.ready = false;
+            s.target = target;
+            consumed = seq + 1;
+        }
+        wake.notify_all();
+    }
+
+    // steps converted so far, and the time the I/O threads spent on them
+    void load_stats(long long& count, double& ms)
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        count = loaded;
+        ms = load_ms;
+    }
+
+    VolumeFileInfo info; // of the first step
+    VolumeFormat format;
+    double value_min, value_max;
+    int steps, prefetch;
+
+private:
+
+    void load_loop()
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        while(true)
+        {
+            wake.wait(lk, [&] { return stopping || next_load < consumed + prefetch; });
+            if(stopping) return;
+            const long long seq = next_load++;
+            TimeStep& s = ring[seq % prefetch];
+            s.seq = seq;
+            s.ready = false;
+            lk.unlock();
+
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            s.ok = load(int(seq % steps), s);
+            const double ms = 1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+            lk.lock();
+            s.load_ms = ms;
+            s.ready = true;
+            loaded++;
+            load_ms += ms;
+            done.notify_all();
+        }
+    }
+
+    // a slot belongs to its I/O thread until it is ready
+    bool load(int step, TimeStep& s) const
+    {
+        const std::string name = filename(step);
+        VolumeFile file;
+        if(!file.open(name.c_str(), raw, format)) return false;
+        if(file.info.dims[0] != info.dims[0] || file.info.dims[1] != info.dims[1] || file.info.dims[2] != info.dims[2]
+           || file.format != format)
+        {
+            std::cout << name << " does not have the size and type of " << filename(0) << std::endl;
+            return false;
+        }
+        file.value_min = value_min;
+        file.value_max = value_max;
+        if(s.target)
+        {
+            file.convert(0, info.dims[2], s.target);
+            grid.slab_ranges(s.target, format, info.dims[0], info.dims[1], info.dims[2], 0, s.ranges);
+            return true;
+        }
+        if(s.voxels.width != info.dims[0] || s.voxels.height != info.dims[1] || s.voxels.depth != info.dims[2] || !s.voxels.has_voxels())
+            s.voxels.resize(info.dims[0], info.dims[1], info.dims[2], format);
+        file.convert(0, s.voxels);
+        grid.slab_ranges(s.voxels, 0, s.ranges);
+        return true;
+    }
+
+    std::string pattern;
+    VolumeFileInfo raw;
+    OccupancyGrid grid; // only sized, for slab_ranges()
+    std::vector<TimeStep> ring;
+    long long consumed;  // positions before this one are released
+    long long next_load; // the next position an I/O thread takes
+    bool stopping;
+    long long loaded;
+    double load_ms;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    std::vector<std::thread> threads;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef TRANSFERFUNCTION_H
+#define TRANSFERFUNCTION_H
+
+#include <math.h>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+// 1D transfer function for scalar volumes. It is edited as a list of
+// control points on the normalized scalar range and baked into a table of
+// TABLE_SIZE RGBA8 entries, which is what the GPU samples as a 1D texture
+// ( GL_LINEAR, GL_CLAMP_TO_EDGE ) and what lookup() reproduces on the CPU.
+// revision changes on every build() so users of the table can tell when
+// it is stale.
+struct TransferFunction {
+
+    enum { TABLE_SIZE = 256 };
+
+    struct Point {
+        Point(float v = 0, float r_ = 0, float g_ = 0, float b_ = 0, float a_ = 0)
+            : value(v), r(r_), g(g_), b(b_), a(a_) {}
+        float value; // 0..1 over the scalar range
+        float r, g, b, a;
+    };
+
+    TransferFunction() : opacity(1.0f), offset(0.0f), revision(0) {
+        set_default();
+    }
+
+    // low values transparent, a faint blue shell, green and a dense red core
+    void set_default()
+    {
+        points.clear();
+        points.push_back(Point(0.00f, 0.0f, 0.0f, 0.0f, 0.0f));
+        points.push_back(Point(0.20f, 0.0f, 0.0f, 0.0f, 0.0f));
+        points.push_back(Point(0.30f, 0.1f, 0.3f, 1.0f, 0.2f));
+        points.push_back(Point(0.55f, 0.2f, 1.0f, 0.3f, 0.6f));
+        points.push_back(Point(0.80f, 1.0f, 0.3f, 0.1f, 1.0f));
+        points.push_back(Point(1.00f, 1.0f, 1.0f, 0.4f, 1.0f));
+        build();
+    }
+
+    // one control point per line, "value r g b a", all in 0..1; blank
+    // lines and lines starting with '#' are skipped
+    bool load(const char* filename)
+    {
+        std::ifstream in(filename);
+        if(!in)
+        {
+            std::cout << "Could not open transfer function " << filename << std::endl;
+            return false;
+        }
+        return parse(in, filename);
+    }
+
+    // the same from a stream, such as a remote client's update; filename
+    // only names it in messages
+    bool parse(std::istream& in, const char* filename)
+    {
+        std::vector<Point> loaded;
+        std::string line;
+        int line_no = 0;
+        while(std::getline(in, line))
+        {
+            line_no++;
+            size_t first = line.find_first_not_of(" \t\r");
+            if(first == std::string::npos || line[first] == '#') continue;
+            std::istringstream ls(line);
+            Point p;
+            if(!(ls >> p.value >> p.r >> p.g >> p.b >> p.a))
+            {
+                std::cout << filename << ":" << line_no << ": expected 'value r g b a'" << std::endl;
+                return false;
+            }
+            loaded.push_back(p);
+        }
+        if(loaded.empty())
+        {
+            std::cout << "Transfer function " << filename << " has no control points" << std::endl;
+            return false;
+        }
+        points = loaded;
+        build();
+        return true;
+    }
+
+    // runtime edits, both rebuild the table
+    void shift(float d)         { offset += d; build(); }
+    void scale_opacity(float f) { opacity = std::min(std::max(opacity * f, 0.0f), 16.0f); build(); }
+
+    // bake the control points, moved by offset and with alpha scaled by
+    // opacity, into the table
+    void build()
+    {
+        std::vector<Point> p = points;
+        std::sort(p.begin(), p.end(), [](const Point& a, const Point& b) { return a.value < b.value; });
+        table.resize(TABLE_SIZE * 4);
+        for(int i = 0; i < TABLE_SIZE; i++)
+        {
+            float v = (i + 0.5f) / TABLE_SIZE - offset; // texel center
+            size_t k = 0;
+            while(k < p.size() && p[k].value < v) k++;
+            Point c;
+            if(k == 0) c = p.front();
+            else if(k == p.size()) c = p.back();
+            else
+            {
+                const Point& a = p[k-1];
+                const Point& b = p[k];
+                float t = b.value > a.value ? (v - a.value) / (b.value - a.value) : 1.0f;
+                c = Point(v, a.r + (b.r - a.r) * t, a.g + (b.g - a.g) * t,
+                             a.b + (b.b - a.b) * t, a.a + (b.a - a.a) * t);
+            }
+            c.a *= opacity;
+            const float rgba[4] = { c.r, c.g, c.b, c.a };
+            for(int j = 0; j < 4; j++)
+                table[i*4 + j] = (unsigned char)(std::min(std::max(rgba[j], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+        revision++;
+    }
+
+    // texture1D() on the table for a scalar in 0..1
+    void lookup(float s, float out[4]) const
+    {
+        float u = s * TABLE_SIZE - 0.5f;
+        float fu = floorf(u);
+        float a = u - fu;
+        int i0 = std::min(std::max(int(fu), 0), int(TABLE_SIZE) - 1);
+        int i1 = std::min(std::max(int(fu) + 1, 0), int(TABLE_SIZE) - 1);
+        const unsigned char* c0 = &table[i0*4];
+        const unsigned char* c1 = &table[i1*4];
+        const float inv = 1.0f / 255.0f;
+        for(int j = 0; j < 4; j++)
+            out[j] = (c0[j] + (c1[j] - c0[j]) * a) * inv;
+    }
+
+    // table entries a GL_LINEAR lookup of any scalar in [lo, hi] can touch
+    static void entry_range(float lo, float hi, int& first, int& last)
+    {
+        first = std::min(std::max(int(floorf(lo * TABLE_SIZE - 0.5f)), 0), int(TABLE_SIZE) - 1);
+        last  = std::min(std::max(int(floorf(hi * TABLE_SIZE - 0.5f)) + 1, 0), int(TABLE_SIZE) - 1);
+    }
+
+    std::vector<Point> points;
+    float opacity;  // alpha scale applied by build()
+    float offset;   // moves all points along the scalar range
+    std::vector<unsigned char> table; // TABLE_SIZE RGBA8 entries
+    unsigned revision;
+};
+
+#endif
@@ -23,9 +23,7 @@ public:
     void setY(float a) { e[1] = a; }
     void setZ(float a) { e[2] = a; }
 
-    inline Vector3(const Vector3 &v) {
-         e[0] = v.e[0]; e[1] = v.e[1]; e[2] = v.e[2];
-    }
+    Vector3(const Vector3 &v) = default;
 
     const Vector3& operator+() const { return *this; }
     Vector3 operator-() const { return Vector3(-e[0], -e[1], -e[2]); }
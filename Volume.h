@@ -0,0 +1,54 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include <vector>
+
+// Voxel formats: the tutorial's RGBA8 colors, or one 8 or 16 bit scalar
+// per voxel that is classified by a transfer function
+enum VolumeFormat { VOLUME_RGBA8, VOLUME_R8, VOLUME_R16 };
+
+// Host side copy of a volume, laid out the way glTexImage3D expects it:
+// x runs fastest, then y, then z. R16 voxels are in host byte order.
+struct Volume {
+
+    Volume() : width(0), height(0), depth(0), format(VOLUME_RGBA8) {}
+
+    // without allocate only the size and format are set, for volumes whose
+    // voxels live on the GPU alone
+    void resize(int w, int h, int d, VolumeFormat f = VOLUME_RGBA8, bool allocate = true) {
+        width = w; height = h; depth = d; format = f;
+        if(allocate)
+            data.assign(size_t(w) * h * d * bytes_per_voxel(), 0);
+        else
+            std::vector<unsigned char>().swap(data);
+    }
+
+    bool has_voxels() const { return !data.empty(); }
+
+    int bytes_per_voxel() const {
+        return format == VOLUME_RGBA8 ? 4 : format == VOLUME_R16 ? 2 : 1;
+    }
+
+    bool is_scalar() const { return format != VOLUME_RGBA8; }
+
+    const unsigned char* voxel(int x, int y, int z) const {
+        return &data[(size_t(x) + size_t(y)*width + size_t(z)*width*height) * bytes_per_voxel()];
+    }
+
+    // normalized scalar of an R8 or R16 voxel
+    float scalar(int x, int y, int z) const {
+        const unsigned char* v = voxel(x, y, z);
+        return format == VOLUME_R16 ? *(const unsigned short*)v * (1.0f / 65535.0f) : *v * (1.0f / 255.0f);
+    }
+
+    size_t bytes() const { return data.size(); }
+
+    // of all voxels, also when only the GPU has them
+    size_t voxel_bytes() const { return size_t(width) * height * depth * bytes_per_voxel(); }
+
+    int width, height, depth;
+    VolumeFormat format;
+    std::vector<unsigned char> data;
+};
+
+#endif
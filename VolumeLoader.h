@@ -0,0 +1,688 @@
+#ifndef VOLUMELOADER_H
+#define VOLUMELOADER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "Volume.h"
+#include "OccupancyGrid.h"
+#include "ThreadPool.h"
+
+// Voxel types found in volume files; all of them are converted to R8 or
+// R16 scalars on load
+enum VoxelType { VOXEL_UNKNOWN, VOXEL_INT8, VOXEL_UINT8, VOXEL_INT16, VOXEL_UINT16,
+                 VOXEL_INT32, VOXEL_UINT32, VOXEL_FLOAT, VOXEL_DOUBLE };
+
+inline int voxel_type_size(VoxelType t)
+{
+    switch(t)
+    {
+    case VOXEL_INT8:   case VOXEL_UINT8:  return 1;
+    case VOXEL_INT16:  case VOXEL_UINT16: return 2;
+    case VOXEL_INT32:  case VOXEL_UINT32: case VOXEL_FLOAT: return 4;
+    case VOXEL_DOUBLE: return 8;
+    default: return 0;
+    }
+}
+
+inline const char* voxel_type_name(VoxelType t)
+{
+    const char* names[] = { "unknown", "int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64" };
+    return names[t];
+}
+
+// NRRD ( "unsigned short" ), MetaImage ( "MET_USHORT" ) and file name
+// ( "uint16" ) spellings
+inline VoxelType parse_voxel_type(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    if(!s.compare(0, 4, "met_")) s = s.substr(4);
+    const char* int8[]    = { "int8", "int8_t", "signed char", "char", 0 };
+    const char* uint8[]   = { "uint8", "uint8_t", "uchar", "unsigned char", 0 };
+    const char* int16[]   = { "int16", "int16_t", "short", "short int", "signed short", "signed short int", 0 };
+    const char* uint16[]  = { "uint16", "uint16_t", "ushort", "unsigned short", "unsigned short int", 0 };
+    const char* int32[]   = { "int32", "int32_t", "int", "signed int", 0 };
+    const char* uint32[]  = { "uint32", "uint32_t", "uint", "unsigned int", 0 };
+    const char* float32[] = { "float", "float32", 0 };
+    const char* float64[] = { "double", "float64", 0 };
+    const char** names[] = { int8, uint8, int16, uint16, int32, uint32, float32, float64 };
+    const VoxelType types[] = { VOXEL_INT8, VOXEL_UINT8, VOXEL_INT16, VOXEL_UINT16,
+                                VOXEL_INT32, VOXEL_UINT32, VOXEL_FLOAT, VOXEL_DOUBLE };
+    for(int i = 0; i < 8; i++)
+        for(int j = 0; names[i][j]; j++)
+            if(s == names[i][j]) return types[i];
+    return VOXEL_UNKNOWN;
+}
+
+// Where the voxels of a volume file are and how they are stored. For .raw
+// files the caller can fill in what the file name does not tell.
+struct VolumeFileInfo {
+
+    VolumeFileInfo() : type(VOXEL_UNKNOWN), big_endian(false), offset(0), data_at_end(false),
+                       has_range(false), range_min(0.0), range_max(0.0) {
+        dims[0] = dims[1] = dims[2] = 0;
+    }
+
+    size_t voxels() const { return size_t(dims[0]) * dims[1] * dims[2]; }
+    size_t data_bytes() const { return voxels() * voxel_type_size(type); }
+
+    int dims[3];
+    VoxelType type;
+    bool big_endian;
+    std::string data_file;  // holding the voxels, the header file itself when attached
+    size_t offset;          // of the first voxel in data_file
+    bool data_at_end;       // the voxels are the last data_bytes() of data_file
+    bool has_range;         // the header gave the value range
+    double range_min, range_max;
+};
+
+// Read only memory mapping of a whole file. Pages are read in on first
+// touch and can be dropped again with release() once they were used, so
+// streaming through a file larger than memory keeps the resident set small.
+class MappedFile {
+public:
+
+    MappedFile() : base(0), length(0) {}
+    ~MappedFile() { close(); }
+
+    bool open(const char* filename)
+    {
+        close();
+#ifdef _WIN32
+        std::cout << "Memory mapped loading is not implemented on this platform" << std::endl;
+        return false;
+#else
+        int fd = ::open(filename, O_RDONLY);
+        if(fd < 0)
+        {
+            std::cout << "Could not open " << filename << std::endl;
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) || st.st_size == 0)
+        {
+            std::cout << filename << " is empty" << std::endl;
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(p == MAP_FAILED)
+        {
+            std::cout << "Could not map " << filename << std::endl;
+            return false;
+        }
+        base = (const unsigned char*)p;
+        length = size_t(st.st_size);
+        madvise(p, length, MADV_SEQUENTIAL);
+        return true;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if(base) munmap((void*)base, length);
+#endif
+        base = 0;
+        length = 0;
+    }
+
+    // the pages fully inside [offset, offset + bytes) are not needed anymore
+    void release(size_t offset, size_t bytes)
+    {
+#ifndef _WIN32
+        const size_t page = size_t(sysconf(_SC_PAGESIZE));
+        size_t first = (offset + page - 1) / page * page;
+        size_t last = std::min(offset + bytes, length) / page * page;
+        if(base && first < last)
+            madvise((void*)(base + first), last - first, MADV_DONTNEED);
+#endif
+    }
+
+    const unsigned char* data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const unsigned char* base;
+    size_t length;
+};
+
+//--------------------------------------------------------------------------------------
+// header parsing
+//--------------------------------------------------------------------------------------
+inline std::string trim_field(const std::string& s)
+{
+    size_t first = s.find_first_not_of(" \t\r\n");
+    if(first == std::string::npos) return "";
+    size_t last = s.find_last_not_of(" \t\r\n");
+    return s.substr(first, last - first + 1);
+}
+
+inline bool has_extension(const std::string& s, const char* suffix)
+{
+    size_t n = strlen(suffix);
+    if(s.size() < n) return false;
+    for(size_t i = 0; i < n; i++)
+        if(tolower(s[s.size() - n + i]) != suffix[i]) return false;
+    return true;
+}
+
+// a detached data file is named relative to its header
+inline std::string path_relative_to(const std::string& header, const std::string& file)
+{
+    if(file.empty() || file[0] == '/') return file;
+    size_t slash = header.rfind('/');
+    return slash == std::string::npos ? file : header.substr(0, slash + 1) + file;
+}
+
+// 3D volume sizes, a leading axis of size 1 ( one component ) is dropped
+inline bool parse_dims(const std::string& value, int dimension, int dims[3], const char* filename)
+{
+    std::istringstream in(value);
+    std::vector<long> sizes;
+    long v;
+    while(in >> v) sizes.push_back(v);
+    if(dimension && int(sizes.size()) != dimension)
+    {
+        std::cout << filename << ": " << sizes.size() << " sizes for " << dimension << " dimensions" << std::endl;
+        return false;
+    }
+    if(sizes.size() == 4 && sizes[0] == 1) sizes.erase(sizes.begin());
+    if(sizes.size() != 3)
+    {
+        std::cout << filename << ": only 3D volumes of one component are supported" << std::endl;
+        return false;
+    }
+    for(int a = 0; a < 3; a++)
+    {
+        if(sizes[a] <= 0 || sizes[a] > 65536)
+        {
+            std::cout << filename << ": bad size " << sizes[a] << std::endl;
+            return false;
+        }
+        dims[a] = int(sizes[a]);
+    }
+    return true;
+}
+
+// NRRD with attached ( .nrrd ) or detached ( .nhdr ) raw data
+inline bool read_nrrd_header(const char* filename, VolumeFileInfo& info)
+{
+    std::ifstream in(filename, std::ios::binary);
+    std::string line;
+    if(!in || !std::getline(in, line) || line.compare(0, 4, "NRRD"))
+    {
+        std::cout << filename << " is not a NRRD file" << std::endl;
+        return false;
+    }
+    int dimension = 0;
+    std::string sizes, encoding = "raw";
+    long byte_skip = 0;
+    bool has_min = false, has_max = false;
+    info.data_file = filename;
+    while(std::getline(in, line))
+    {
+        line = trim_field(line);
+        if(line.empty()) break; // the data follows the blank line
+        if(line[0] == '#' || line.find(":=") != std::string::npos) continue;
+        size_t colon = line.find(':');
+        if(colon == std::string::npos) continue;
+        std::string key = line.substr(0, colon);
+        std::string value = trim_field(line.substr(colon + 1));
+        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+        if(key == "type") info.type = parse_voxel_type(value);
+        else if(key == "dimension") dimension = atoi(value.c_str());
+        else if(key == "sizes") sizes = value;
+        else if(key == "endian") info.big_endian = value == "big";
+        else if(key == "encoding") encoding = value;
+        else if(key == "byte skip") byte_skip = atol(value.c_str());
+        else if(key == "data file" || key == "datafile") info.data_file = path_relative_to(filename, value);
+        else if(key == "min") { info.range_min = atof(value.c_str()); has_min = true; }
+        else if(key == "max") { info.range_max = atof(value.c_str()); has_max = true; }
+        else if(key == "line skip" && atoi(value.c_str()))
+        {
+            std::cout << filename << ": line skip is not supported" << std::endl;
+            return false;
+        }
+    }
+    if(encoding != "raw")
+    {
+        std::cout << filename << ": " << encoding << " encoding is not supported, save it as raw" << std::endl;
+        return false;
+    }
+    if(info.type == VOXEL_UNKNOWN)
+    {
+        std::cout << filename << ": missing or unsupported type" << std::endl;
+        return false;
+    }
+    if(!parse_dims(sizes, dimension, info.dims, filename)) return false;
+    if(info.data_file == filename)
+        info.offset = size_t(in.tellg());
+    info.offset += byte_skip > 0 ? size_t(byte_skip) : 0;
+    info.data_at_end = byte_skip == -1;
+    info.has_range = has_min && has_max && info.range_max > info.range_min;
+    return true;
+}
+
+// MetaImage, .mhd with a separate data file or .mha with the data attached
+inline bool read_metaimage_header(const char* filename, VolumeFileInfo& info)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if(!in)
+    {
+        std::cout << "Could not open " << filename << std::endl;
+        return false;
+    }
+    int dimension = 0;
+    std::string sizes;
+    long header_size = 0;
+    std::string line;
+    while(std::getline(in, line))
+    {
+        size_t eq = line.find('=');
+        if(eq == std::string::npos) continue;
+        std::string key = trim_field(line.substr(0, eq));
+        std::string value = trim_field(line.substr(eq + 1));
+        std::string lower = value;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        if(key == "NDims") dimension = atoi(value.c_str());
+        else if(key == "DimSize") sizes = value;
+        else if(key == "ElementType") info.type = parse_voxel_type(value);
+        else if(key == "BinaryDataByteOrderMSB" || key == "ElementByteOrderMSB") info.big_endian = lower == "true";
+        else if(key == "HeaderSize") header_size = atol(value.c_str());
+        else if(key == "ElementNumberOfChannels" && atoi(value.c_str()) != 1)
+        {
+            std::cout << filename << ": only volumes of one channel are supported" << std::endl;
+            return false;
+        }
+        else if(key == "CompressedData" && lower == "true")
+        {
+            std::cout << filename << ": compressed data is not supported" << std::endl;
+            return false;
+        }
+        else if(key == "ElementDataFile")
+        {
+            // always the last field
+            if(lower == "local")
+            {
+                info.data_file = filename;
+                info.offset = size_t(in.tellg());
+            }
+            else if(lower == "list" || value.find('%') != std::string::npos)
+            {
+                std::cout << filename << ": data split over several files is not supported" << std::endl;
+                return false;
+            }
+            else
+                info.data_file = path_relative_to(filename, value);
+            break;
+        }
+    }
+    if(info.data_file.empty())
+    {
+        std::cout << filename << ": no ElementDataFile" << std::endl;
+        return false;
+    }
+    if(info.type == VOXEL_UNKNOWN)
+    {
+        std::cout << filename << ": missing or unsupported ElementType" << std::endl;
+        return false;
+    }
+    if(!parse_dims(sizes, dimension, info.dims, filename)) return false;
+    info.offset += header_size > 0 ? size_t(header_size) : 0;
+    info.data_at_end = header_size == -1;
+    return true;
+}
+
+// Headerless raw voxels. Sizes and type not set by the caller are taken from
+// the name, as in bonsai_256x256x256_uint8.raw; without a type in the name
+// it follows from the file size.
+inline bool read_raw_info(const char* filename, size_t file_size, VolumeFileInfo& info)
+{
+    info.data_file = filename;
+    std::string name = filename;
+    size_t slash = name.rfind('/');
+    if(slash != std::string::npos) name = name.substr(slash + 1);
+    if(!info.dims[0])
+        for(size_t i = 0; i < name.size() && !info.dims[0]; i++)
+        {
+            int w, h, d, n = 0;
+            if((i == 0 || !isdigit(name[i-1])) && isdigit(name[i]) &&
+               sscanf(name.c_str() + i, "%dx%dx%d%n", &w, &h, &d, &n) == 3 && n > 0 && w > 0 && h > 0 && d > 0)
+            {
+                info.dims[0] = w; info.dims[1] = h; info.dims[2] = d;
+            }
+        }
+    if(!info.dims[0])
+    {
+        std::cout << filename << ": give the size with --raw-dims WxHxD or in the name as _WxHxD_" << std::endl;
+        return false;
+    }
+    if(info.type == VOXEL_UNKNOWN)
+    {
+        std::string token;
+        for(size_t i = 0; i <= name.size(); i++)
+        {
+            if(i < name.size() && isalnum(name[i])) { token += name[i]; continue; }
+            // only the spellings with a width, "short" may well be a word
+            bool sized = isdigit(token.empty() ? 0 : token[token.size() - 1]) || token == "float" || token == "double";
+            VoxelType t = parse_voxel_type(token);
+            if(t != VOXEL_UNKNOWN && sized) info.type = t;
+            token.clear();
+        }
+    }
+    if(info.type == VOXEL_UNKNOWN)
+    {
+        size_t bytes = (file_size - std::min(file_size, info.offset)) / std::max(info.voxels(), size_t(1));
+        info.type = bytes == 1 ? VOXEL_UINT8 : bytes == 2 ? VOXEL_UINT16 : bytes == 4 ? VOXEL_FLOAT : bytes == 8 ? VOXEL_DOUBLE : VOXEL_UNKNOWN;
+        if(info.type == VOXEL_UNKNOWN)
+        {
+            std::cout << filename << ": " << file_size << " bytes do not fit " << info.dims[0] << "x"
+                      << info.dims[1] << "x" << info.dims[2] << " voxels of any type, give it with --raw-type" << std::endl;
+            return false;
+        }
+        std::cout << filename << ": no type given, assuming " << voxel_type_name(info.type) << std::endl;
+    }
+    return true;
+}
+
+// One slab of converted voxels, whole xy slices z0 .. z0 + voxels.depth - 1,
+// with the scalar ranges of the occupancy cells it touches
+struct VolumeSlab {
+    int z0;
+    Volume voxels;
+    OccupancyGrid::SlabRanges ranges;
+};
+
+// A raw, NRRD or MetaImage volume file, mapped into memory and converted
+// to R8 or R16 slab by slab on request. 8 bit types keep their values;
+// wider types are scaled from [value_min, value_max], which the header can
+// give, to the full R16 range, or to R8 when asked for.
+class VolumeFile {
+public:
+
+    VolumeFile() : format(VOLUME_R8), value_min(0.0), value_max(1.0), host_big_endian(false) {
+        const uint16_t one = 1;
+        host_big_endian = *(const unsigned char*)&one == 0;
+    }
+
+    // raw describes .raw files, preferred is VOLUME_R8 to store wider
+    // types in 8 bits
+    bool open(const char* filename, const VolumeFileInfo& raw, VolumeFormat preferred)
+    {
+        std::string name = filename;
+        info = VolumeFileInfo();
+        bool ok;
+        if(has_extension(name, ".nrrd") || has_extension(name, ".nhdr"))
+            ok = read_nrrd_header(filename, info);
+        else if(has_extension(name, ".mhd") || has_extension(name, ".mha"))
+            ok = read_metaimage_header(filename, info);
+        else
+        {
+            info = raw;
+            ok = mapping.open(filename) && read_raw_info(filename, mapping.size(), info);
+        }
+        if(!ok || (!mapping.data() && !mapping.open(info.data_file.c_str()))) return false;
+
+        if(info.data_at_end)
+            info.offset = mapping.size() - std::min(mapping.size(), info.data_bytes());
+        if(info.offset + info.data_bytes() > mapping.size())
+        {
+            std::cout << info.data_file << " holds " << mapping.size() - std::min(mapping.size(), info.offset)
+                      << " bytes of voxels, " << info.data_bytes() << " are needed for "
+                      << info.dims[0] << "x" << info.dims[1] << "x" << info.dims[2] << " "
+                      << voxel_type_name(info.type) << std::endl;
+            return false;
+        }
+
+        const int type_size = voxel_type_size(info.type);
+        format = type_size == 1 || preferred == VOLUME_R8 ? VOLUME_R8 : VOLUME_R16;
+        if(info.type == VOXEL_UINT8 || info.type == VOXEL_INT8)
+        {
+            value_min = info.type == VOXEL_INT8 ? -128.0 : 0.0;
+            value_max = value_min + 255.0;
+        }
+        else if(info.has_range)
+        {
+            value_min = info.range_min;
+            value_max = info.range_max;
+        }
+        return true;
+    }
+
+    // whether scan_range() has to run before convert()
+    bool needs_range() const { return voxel_type_size(info.type) > 1 && !info.has_range; }
+
+    // find the value range with one parallel pass over the mapped voxels
+    void scan_range(int num_threads = 0)
+    {
+        ThreadPool pool(num_threads);
+        std::vector<double> lo(pool.size(), 1e300), hi(pool.size(), -1e300);
+        const size_t slice = size_t(info.dims[0]) * info.dims[1];
+        pool.parallel_for(info.dims[2], [&](int z, int worker)
+        {
+            double& l = lo[worker];
+            double& h = hi[worker];
+            each_value(slice_data(z), slice, [&](size_t, double v)
+            {
+                if(v < l) l = v; // NaNs fail both tests
+                if(v > h) h = v;
+            });
+        });
+        value_min = *std::min_element(lo.begin(), lo.end());
+        value_max = *std::max_element(hi.begin(), hi.end());
+        if(!(value_max > value_min)) value_max = value_min + 1.0;
+    }
+
+    // voxels z0 .. z0 + slab.depth - 1 into slab, which is already sized
+    void convert(int z0, Volume& slab) const
+    {
+        convert(z0, slab.depth, &slab.data[0]);
+    }
+
+    // the same into memory that is not a Volume, such as a mapped buffer
+    void convert(int z0, int depth, unsigned char* dst) const
+    {
+        convert_span(slice_data(z0), size_t(info.dims[0]) * info.dims[1] * depth, dst);
+    }
+
+    // count voxels of row y, z from x0 on into dst
+    void convert_row(int x0, int y, int z, int count, unsigned char* dst) const
+    {
+        const size_t first = size_t(x0) + size_t(y) * info.dims[0];
+        convert_span(slice_data(z) + first * voxel_type_size(info.type), size_t(count), dst);
+    }
+
+    void close() { mapping.close(); }
+
+    // the mapped voxels of these slices are converted and can be dropped
+    void release(int z0, int depth)
+    {
+        const size_t slice = size_t(info.dims[0]) * info.dims[1] * voxel_type_size(info.type);
+        mapping.release(info.offset + size_t(z0) * slice, size_t(depth) * slice);
+    }
+
+    VolumeFileInfo info;
+    VolumeFormat format;
+    double value_min, value_max;
+
+private:
+
+    void convert_span(const unsigned char* src, size_t count, unsigned char* dst) const
+    {
+        if(info.type == VOXEL_UINT8)
+        {
+            memcpy(dst, src, count);
+            return;
+        }
+        if(info.type == VOXEL_INT8)
+        {
+            for(size_t i = 0; i < count; i++) dst[i] = src[i] ^ 0x80;
+            return;
+        }
+        const double scale = 1.0 / (value_max - value_min);
+        if(format == VOLUME_R8)
+            each_value(src, count, [&](size_t i, double v)
+            {
+                dst[i] = (unsigned char)(normalize(v, scale) * 255.0 + 0.5);
+            });
+        else if(info.type == VOXEL_UINT16 && value_min == 0.0 && value_max == 65535.0 && info.big_endian == host_big_endian)
+            memcpy(dst, src, count * 2);
+        else
+        {
+            unsigned short* dst16 = (unsigned short*)dst;
+            each_value(src, count, [&](size_t i, double v)
+            {
+                dst16[i] = (unsigned short)(normalize(v, scale) * 65535.0 + 0.5);
+            });
+        }
+    }
+
+    const unsigned char* slice_data(int z) const {
+        return mapping.data() + info.offset + size_t(z) * info.dims[0] * info.dims[1] * voxel_type_size(info.type);
+    }
+
+    double normalize(double v, double scale) const {
+        double n = (v - value_min) * scale;
+        return n > 0.0 ? (n < 1.0 ? n : 1.0) : 0.0;
+    }
+
+    template<class T> static T load(const unsigned char* p, bool swap) {
+        unsigned char b[sizeof(T)];
+        if(swap)
+            for(size_t i = 0; i < sizeof(T); i++) b[i] = p[sizeof(T) - 1 - i];
+        else
+            memcpy(b, p, sizeof(T));
+        T v;
+        memcpy(&v, b, sizeof(T));
+        return v;
+    }
+
+    template<class T, class Fn> void each_value_of(const unsigned char* src, size_t count, Fn& fn) const {
+        const bool swap = info.big_endian != host_big_endian;
+        for(size_t i = 0; i < count; i++)
+            fn(i, double(load<T>(src + i * sizeof(T), swap)));
+    }
+
+    // fn(i, value) for count voxels from src, with the type switch outside the loop
+    template<class Fn> void each_value(const unsigned char* src, size_t count, Fn fn) const {
+        switch(info.type)
+        {
+        case VOXEL_INT8:   each_value_of<int8_t>(src, count, fn); break;
+        case VOXEL_UINT8:  each_value_of<uint8_t>(src, count, fn); break;
+        case VOXEL_INT16:  each_value_of<int16_t>(src, count, fn); break;
+        case VOXEL_UINT16: each_value_of<uint16_t>(src, count, fn); break;
+        case VOXEL_INT32:  each_value_of<int32_t>(src, count, fn); break;
+        case VOXEL_UINT32: each_value_of<uint32_t>(src, count, fn); break;
+        case VOXEL_FLOAT:  each_value_of<float>(src, count, fn); break;
+        case VOXEL_DOUBLE: each_value_of<double>(src, count, fn); break;
+        default: break;
+        }
+    }
+
+    MappedFile mapping;
+    bool host_big_endian;
+};
+
+// Convert a volume file slab by slab on worker threads and hand every slab
+// to consume() on the calling thread as soon as it is done, in no
+// particular order; this is where a GL context can upload it. Slabs are
+// about slab_mb megabytes and at most two per worker are in flight, so the
+// converted volume never exists as a whole unless consume() keeps it. With
+// a grid, the workers also compute the slab's occupancy ranges.
+inline void stream_volume(VolumeFile& file, const OccupancyGrid* grid,
+                          const std::function<void(const VolumeSlab&)>& consume,
+                          int num_threads = 0, int slab_mb = 16)
+{
+    const int w = file.info.dims[0], h = file.info.dims[1], d = file.info.dims[2];
+    const size_t slice = size_t(w) * h * (file.format == VOLUME_R16 ? 2 : 1);
+    const int slab_depth = int(std::min(std::max(size_t(slab_mb) << 20, slice) / slice, size_t(d)));
+    const int slabs = (d + slab_depth - 1) / slab_depth;
+    if(num_threads <= 0) num_threads = int(std::thread::hardware_concurrency());
+    num_threads = std::min(std::max(num_threads, 1), slabs);
+
+    std::vector<VolumeSlab> buffers(std::min(2 * num_threads, slabs));
+    std::deque<int> free_buffers, finished;
+    for(size_t i = 0; i < buffers.size(); i++) free_buffers.push_back(int(i));
+    int next = 0;
+    std::mutex mutex;
+    std::condition_variable buffer_freed, slab_finished;
+
+    std::vector<std::thread> workers;
+    for(int t = 0; t < num_threads; t++)
+        workers.push_back(std::thread([&]
+        {
+            for(;;)
+            {
+                int s, b;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    buffer_freed.wait(lock, [&] { return next >= slabs || !free_buffers.empty(); });
+                    if(next >= slabs) return;
+                    s = next++;
+                    b = free_buffers.front();
+                    free_buffers.pop_front();
+                }
+                VolumeSlab& slab = buffers[b];
+                slab.z0 = s * slab_depth;
+                int depth = std::min(slab_depth, d - slab.z0);
+                if(slab.voxels.depth != depth || !slab.voxels.has_voxels())
+                    slab.voxels.resize(w, h, depth, file.format);
+                file.convert(slab.z0, slab.voxels);
+                if(grid) grid->slab_ranges(slab.voxels, slab.z0, slab.ranges);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.push_back(b);
+                }
+                slab_finished.notify_one();
+            }
+        }));
+
+    for(int done = 0; done < slabs; done++)
+    {
+        int b;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            slab_finished.wait(lock, [&] { return !finished.empty(); });
+            b = finished.front();
+            finished.pop_front();
+        }
+        consume(buffers[b]);
+        file.release(buffers[b].z0, buffers[b].voxels.depth);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_buffers.push_back(b);
+        }
+        buffer_freed.notify_all();
+    }
+    for(size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+#endif
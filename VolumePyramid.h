@@ -0,0 +1,121 @@
+#ifndef VOLUMEPYRAMID_H
+#define VOLUMEPYRAMID_H
+
+#include <vector>
+#include <algorithm>
+
+#include "Volume.h"
+#include "TransferFunction.h"
+#include "ThreadPool.h"
+
+// Opacity preserving mip pyramid of a volume for level of detail sampling.
+// levels[0] is half the volume along each axis ( rounded down, like GL mip
+// levels ), every further level half the one before, down to one voxel.
+// Levels are classified RGBA8: a voxel holds the mean opacity of the
+// voxels it covers and their opacity weighted mean color, so a coarse
+// sample stands for as much opacity as the fine ones below it. Averaging
+// scalars and classifying the average instead would make thin opaque
+// structures next to air fade away. Scalar volumes go through the transfer
+// function on the way, so their pyramid has to be built again when it
+// changes; revision tells which table it was built with.
+struct VolumePyramid {
+
+    VolumePyramid() : revision(0) {}
+
+    // tf is needed for scalar volumes only
+    void build(const Volume& vol, const TransferFunction* tf, ThreadPool& pool)
+    {
+        // classified color of every scalar value, 0..255 per channel
+        std::vector<float> classified;
+        if(vol.is_scalar())
+        {
+            const int values = vol.format == VOLUME_R16 ? 65536 : 256;
+            classified.resize(size_t(values) * 4);
+            for(int v = 0; v < values; v++)
+            {
+                tf->lookup(float(v) / (values - 1), &classified[size_t(v) * 4]);
+                for(int c = 0; c < 4; c++) classified[size_t(v) * 4 + c] *= 255.0f;
+            }
+            revision = tf->revision;
+        }
+
+        levels.clear();
+        for(;;)
+        {
+            const Volume& src = levels.empty() ? vol : levels.back();
+            if(src.width == 1 && src.height == 1 && src.depth == 1) break;
+            Volume dst;
+            dst.resize(std::max(src.width / 2, 1), std::max(src.height / 2, 1), std::max(src.depth / 2, 1), VOLUME_RGBA8);
+            downsample(src, classified, dst, pool);
+            levels.push_back(Volume());
+            std::swap(levels.back(), dst);
+        }
+    }
+
+    bool empty() const { return levels.empty(); }
+    int count() const { return int(levels.size()); }
+
+    std::vector<Volume> levels;
+    unsigned revision; // of the transfer function a scalar volume was classified with
+
+private:
+
+    // voxels 2x .. 2x + 1 of src for every voxel x of dst, the last one
+    // also takes the odd voxel left over at the far face
+    static void covered(int x, int dst_size, int src_size, int& lo, int& hi)
+    {
+        lo = 2 * x;
+        hi = x == dst_size - 1 ? src_size - 1 : 2 * x + 1;
+    }
+
+    void downsample(const Volume& src, const std::vector<float>& classified, Volume& dst, ThreadPool& pool)
+    {
+        pool.parallel_for(dst.depth, [&](int z, int)
+        {
+            int z0, z1;
+            covered(z, dst.depth, src.depth, z0, z1);
+            for(int y = 0; y < dst.height; y++)
+            {
+                int y0, y1;
+                covered(y, dst.height, src.height, y0, y1);
+                unsigned char* out = &dst.data[(size_t(y) + size_t(z) * dst.height) * dst.width * 4];
+                for(int x = 0; x < dst.width; x++)
+                {
+                    int x0, x1;
+                    covered(x, dst.width, src.width, x0, x1);
+                    float weighted[3] = { 0.0f, 0.0f, 0.0f }, plain[3] = { 0.0f, 0.0f, 0.0f }, alpha = 0.0f;
+                    int n = 0;
+                    for(int k = z0; k <= z1; k++)
+                        for(int j = y0; j <= y1; j++)
+                            for(int i = x0; i <= x1; i++)
+                            {
+                                float c[4];
+                                const unsigned char* v = src.voxel(i, j, k);
+                                if(src.is_scalar())
+                                {
+                                    const size_t s = src.format == VOLUME_R16 ? *(const unsigned short*)v : *v;
+                                    std::copy(&classified[s * 4], &classified[s * 4] + 4, c);
+                                }
+                                else
+                                    for(int m = 0; m < 4; m++) c[m] = v[m];
+                                for(int m = 0; m < 3; m++)
+                                {
+                                    weighted[m] += c[m] * c[3];
+                                    plain[m] += c[m];
+                                }
+                                alpha += c[3];
+                                n++;
+                            }
+                    for(int m = 0; m < 3; m++)
+                    {
+                        float c = alpha > 0.0f ? weighted[m] / alpha : plain[m] / n;
+                        out[x * 4 + m] = (unsigned char)std::min(c + 0.5f, 255.0f);
+                    }
+                    out[x * 4 + 3] = (unsigned char)std::min(alpha / n + 0.5f, 255.0f);
+                }
+            }
+        });
+    }
+};
+
+#endif
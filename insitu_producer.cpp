@@ -0,0 +1,137 @@
+// --------------------------------------------------------------------------
+// Stand-in for a simulation publishing in-situ frames to the renderer
+//
+// Creates the shared memory ring of InSitu.h and writes a time varying
+// scalar field into it at a fixed rate: a few blobs that orbit the center
+// and pulse, evaluated on the thread pool straight into the free slot, so
+// the frame is never copied on this side either. A frame that finds the
+// ring full is dropped, as a simulation that must not wait for the
+// renderer would. The renderer reads it with --insitu NAME.
+// --------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Volume.h"
+#include "ThreadPool.h"
+#include "InSitu.h"
+
+using namespace std;
+
+static atomic<bool> interrupted(false);
+
+static void on_signal(int) { interrupted = true; }
+
+static void usage()
+{
+    cout << "usage: insitu_producer [--name /rayCast] [--size N] [--format r8|r16] [--slots N]" << endl
+         << "                       [--rate HZ] [--steps N] [--threads N]" << endl;
+}
+
+// the field at simulation time t, into a slot
+static void simulate(ThreadPool& pool, int n, VolumeFormat format, double t, unsigned char* out)
+{
+    const int blobs = 4;
+    float cx[blobs], cy[blobs], cz[blobs], r2[blobs];
+    for(int b = 0; b < blobs; b++)
+    {
+        const double a = t * (0.6 + 0.2 * b) + b * 1.57;
+        cx[b] = float(n * (0.5 + 0.28 * cos(a)));
+        cy[b] = float(n * (0.5 + 0.28 * sin(a)));
+        cz[b] = float(n * (0.5 + 0.2 * sin(0.7 * a + b)));
+        const float r = float(n * (0.12 + 0.04 * sin(2.0 * t + b)));
+        r2[b] = r * r;
+    }
+    pool.parallel_for(n, [&](int z, int)
+    {
+        for(int y = 0; y < n; y++)
+        {
+            const size_t row = (size_t(z) * n + y) * n;
+            for(int x = 0; x < n; x++)
+            {
+                float v = 0.0f;
+                for(int b = 0; b < blobs; b++)
+                {
+                    const float dx = x - cx[b], dy = y - cy[b], dz = z - cz[b];
+                    const float d2 = dx * dx + dy * dy + dz * dz;
+                    if(d2 < r2[b]) v += 1.0f - d2 / r2[b];
+                }
+                v = min(v, 1.0f);
+                if(format == VOLUME_R16)
+                    ((unsigned short*)out)[row + x] = (unsigned short)(v * 65535.0f + 0.5f);
+                else
+                    out[row + x] = (unsigned char)(v * 255.0f + 0.5f);
+            }
+        }
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    const char* name = "/rayCast";
+    int size = 128, slots = 3, steps = 0, threads = 0;
+    double rate = 30.0;
+    VolumeFormat format = VOLUME_R8;
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--name") && i+1 < argc) name = argv[++i];
+        else if(!strcmp(argv[i], "--size") && i+1 < argc) size = max(atoi(argv[++i]), 8);
+        else if(!strcmp(argv[i], "--slots") && i+1 < argc) slots = max(atoi(argv[++i]), 2);
+        else if(!strcmp(argv[i], "--rate") && i+1 < argc) rate = max(atof(argv[++i]), 0.0);
+        else if(!strcmp(argv[i], "--steps") && i+1 < argc) steps = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--threads") && i+1 < argc) threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--format") && i+1 < argc) format = !strcmp(argv[++i], "r16") ? VOLUME_R16 : VOLUME_R8;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    InSituRing ring;
+    const int dims[3] = { size, size, size };
+    if(!ring.create(name, dims, format, slots)) return 1;
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    ThreadPool pool(threads);
+    cout << "publishing " << size << "^3 " << (format == VOLUME_R16 ? "r16" : "r8") << " frames to " << name
+         << " in " << slots << " slots at " << rate << " Hz" << endl;
+
+    // the simulation advances at rate steps per second whether or not the
+    // renderer keeps up
+    auto start = chrono::steady_clock::now();
+    long long published = 0;
+    double simulate_ms = 0.0;
+    for(long long step = 0; (steps <= 0 || step < steps) && !interrupted; step++)
+    {
+        if(rate > 0.0)
+            this_thread::sleep_until(start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(step / rate)));
+        unsigned char* slot = ring.begin_write();
+        if(!slot)
+        {
+            if(rate == 0.0) this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+        auto t0 = chrono::steady_clock::now();
+        simulate(pool, size, format, step / 30.0, slot);
+        simulate_ms += 1000.0 * chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        ring.commit(uint64_t(step));
+        published++;
+    }
+    ring.finish();
+    const double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << published << " frames published in " << secs << " s ( " << published / secs << " frames/sec, "
+         << (published ? simulate_ms / published : 0.0) << " ms to compute one ), " << ring.dropped()
+         << " dropped with the ring full" << endl;
+    // the name goes away with the ring, a renderer that mapped it keeps
+    // the last frames
+    return 0;
+}
@@ -16,6 +16,8 @@
 #else
 #include <GL/gl.h>
 #include <GL/glut.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #endif
 
 
@@ -27,8 +29,38 @@
 #include <ctime>
 #include <cassert>
 #include <string.h>
+#include <stdlib.h>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <condition_variable>
 
 #include "Vector3.h"
+#include "Camera.h"
+#include "Volume.h"
+#include "ProceduralVolume.h"
+#include "CpuRaycaster.h"
+#include "ImageIO.h"
+#include "Profiler.h"
+#include "Bench.h"
+#include "TransferFunction.h"
+#include "VolumeLoader.h"
+#include "BrickCache.h"
+#include "VolumePyramid.h"
+#include "ProgressiveRefinement.h"
+#include "FrameGovernor.h"
+#include "Renderer.h"
+#include "ProgramCache.h"
+#include "RayMarchVariant.h"
+#include "TileDispatch.h"
+#include "SortLast.h"
+#include "RemoteServer.h"
+#include "FrameCapture.h"
+#include "TimeSeries.h"
+#include "InSitu.h"
 
 #define MAX_KEYS 256
 #define WINDOW_SIZE 800
@@ -41,79 +73,578 @@ using namespace std;
 //--------------------------------------------------------------------------------------
 static const char* vert = "                          \n \
 varying vec4 model_view;                             \n \
+varying vec3 ray_dir;                                \n \
                                                      \n \
 void main( void )                                    \n \
 {                                                    \n \
     gl_Position = ftransform();                      \n \
     model_view = gl_Position;                        \n \
     gl_TexCoord[0] = gl_MultiTexCoord1;              \n \
+    vec4 eye = gl_ModelViewMatrixInverse * vec4( 0.0, 0.0, 0.0, 1.0 ); \n \
+    ray_dir = gl_MultiTexCoord1.xyz - eye.xyz / eye.w; \n \
 }"; 
 
 //--------------------------------------------------------------------------------------
 // fragment shader
 //--------------------------------------------------------------------------------------
 static const char* frag = "                                                 \n\
+#ifndef COMPUTE                                                             \n\
+#extension GL_ARB_shader_texture_lod : enable                               \n\
+#endif                                                                      \n\
+                                                                            \n\
+// the variant of the marcher comes from #defines in front of this source,  \n\
+// see RayMarchVariant.h: COMPOSITING, EARLY_EXIT ( the opacity that ends   \n\
+// a ray ), SKIP_EMPTY and COUNTED_LOOP. With COMPUTE it is the compute     \n\
+// backend, see the end.                                                    \n\
+#define COMPOSITE_DVR 0                                                     \n\
+#define COMPOSITE_MIP 1                                                     \n\
+#define COMPOSITE_MINIP 2                                                   \n\
+#define COMPOSITE_AVERAGE 3                                                 \n\
+#ifndef COMPOSITING                                                         \n\
+#define COMPOSITING COMPOSITE_DVR                                           \n\
+#endif                                                                      \n\
+#ifdef EARLY_EXIT                                                           \n\
+#define TERMINATED( alpha ) ( ( alpha ) > EARLY_EXIT )                      \n\
+#else                                                                       \n\
+#define TERMINATED( alpha ) false                                           \n\
+#endif                                                                      \n\
+#define MAX_STEPS 450                                                       \n\
                                                                             \n\
 uniform sampler2D   tex;                                                    \n\
 uniform sampler3D   volume_tex;                                             \n\
+uniform sampler3D   occupancy_tex;                                          \n\
 uniform float   stepsize;                                                   \n\
+uniform vec3    cells_per_unit;                                             \n\
+uniform vec3    cell_count;                                                 \n\
+uniform bool    single_pass;                                                \n\
+uniform bool    scalar_volume;                                              \n\
+uniform sampler1D   transfer_tex;                                           \n\
+uniform bool    preintegrated;                                              \n\
+uniform sampler2D   preint_tex;                                             \n\
+uniform bool    bricked;                                                    \n\
+uniform sampler3D   page_tex;                                               \n\
+uniform vec3    volume_dims;                                                \n\
+uniform vec3    brick_count;                                                \n\
+uniform float   brick_size;                                                 \n\
+uniform vec3    atlas_size;                                                 \n\
+uniform float   feedback_frame;                                             \n\
+uniform bool    lod;                                                        \n\
+uniform sampler3D   lod_tex;                                                \n\
+uniform float   lod_pixel;                                                  \n\
+uniform float   ray_offset;                                                 \n\
+uniform float   frame_scale;                                                \n\
                                                                             \n\
+#ifndef COMPUTE                                                             \n\
 varying vec4 model_view;                                                    \n\
+varying vec3 ray_dir;                                                       \n\
+#endif                                                                      \n\
                                                                             \n\
-void main( void )                                                           \n\
+// bricked volumes report one brick per pixel: the first missing one, or    \n\
+// else a resident one picked by a per pixel sample number so that over a   \n\
+// few frames the cache sees every brick in use                             \n\
+vec4 feedback = vec4( 0.0 );                                                \n\
+float feedback_sample = 0.0;                                                \n\
+float used_samples = 0.0;                                                   \n\
+bool sample_void = false;                                                   \n\
+                                                                            \n\
+// the volume at texture coordinate p. A bricked volume is read through     \n\
+// the page table; a sample in a missing or empty brick sets sample_void    \n\
+// and adds nothing.                                                        \n\
+vec4 sample_volume( vec3 p )                                                \n\
+{                                                                           \n\
+    sample_void = false;                                                    \n\
+    if( !bricked )                                                          \n\
+        return texture3D( volume_tex, p );                                  \n\
+    vec3 u = p * volume_dims;                                               \n\
+    vec3 brick = clamp( floor( u / brick_size ), vec3( 0.0 ), brick_count - 1.0 );\n\
+    vec4 page = texture3D( page_tex, ( brick + 0.5 ) / brick_count );       \n\
+    if( page.a < 0.75 )                                                     \n\
+    {                                                                       \n\
+        if( page.a < 0.25 && feedback.a < 0.75 )                            \n\
+            feedback = vec4( brick / 255.0, 1.0 );                          \n\
+        sample_void = true;                                                 \n\
+        return vec4( 0.0 );                                                 \n\
+    }                                                                       \n\
+    if( feedback.a == 0.0 && used_samples == feedback_sample )              \n\
+        feedback = vec4( brick / 255.0, 0.5 );                              \n\
+    used_samples += 1.0;                                                    \n\
+    vec3 slot = floor( page.rgb * 255.0 + 0.5 );                            \n\
+    vec3 texel = slot * ( brick_size + 2.0 ) + 1.0 + u - brick * brick_size;\n\
+    return texture3D( volume_tex, texel / atlas_size );                     \n\
+}                                                                           \n\
+                                                                            \n\
+// pre-integrated classification: one lookup of the average transfer        \n\
+// function per segment between two samples, the last segment ends at       \n\
+// the back face. Empty cells are jumped over as in main(); a jump that     \n\
+// lands in an occupied cell backs up one step so the segment entering      \n\
+// the cell starts at the last sample before it.                            \n\
+vec4 march_preintegrated( vec3 start, vec3 delta_dir, float delta_dir_len, float len, vec3 inv_delta ) \n\
+{                                                                           \n\
+    vec4 col_acc = vec4( 0.0 );                                             \n\
+    float alpha_acc = 0.0;                                                  \n\
+    float n = 0.0;                                                          \n\
+    vec3 vect = start;                                                      \n\
+    float s_front = 0.0;                                                    \n\
+    bool front_stale = true;                                                \n\
+    bool front_void = false;                                                \n\
+    for( int i = 0; i < MAX_STEPS; i++ )                                    \n\
+    {                                                                       \n\
+#ifdef SKIP_EMPTY                                                           \n\
+        {                                                                   \n\
+            vec3 cell = floor( vect * cells_per_unit );                     \n\
+            vec3 occ_coord = ( clamp( cell, vec3( 0.0 ), cell_count - 1.0 ) + 0.5 ) / cell_count; \n\
+            if( texture3D( occupancy_tex, occ_coord ).r == 0.0 )            \n\
+            {                                                               \n\
+                vec3 bound = ( cell + step( 0.0, delta_dir ) ) / cells_per_unit; \n\
+                vec3 t = ( bound - vect ) * inv_delta;                      \n\
+                n += floor( max( min( min( t.x, t.y ), t.z ), 0.0 ) ) + 1.0; \n\
+                if( n >= float( MAX_STEPS ) || delta_dir_len * n > len )    \n\
+                    break;                                                  \n\
+                vect = start + delta_dir * n;                               \n\
+                front_stale = true;                                         \n\
+                continue;                                                   \n\
+            }                                                               \n\
+        }                                                                   \n\
+#endif                                                                      \n\
+        if( front_stale )                                                   \n\
+        {                                                                   \n\
+            n = max( n - 1.0, 0.0 );                                        \n\
+            vect = start + delta_dir * n;                                   \n\
+            s_front = sample_volume( vect ).r;                              \n\
+            front_stale = false;                                            \n\
+            front_void = sample_void;                                       \n\
+        }                                                                   \n\
+        float seg = min( ( len - delta_dir_len * n ) / delta_dir_len, 1.0 ); \n\
+        if( seg <= 0.0 )                                                    \n\
+            break;                                                          \n\
+        vect = start + delta_dir * ( n + seg );                             \n\
+        float s_back = sample_volume( vect ).r;                             \n\
+        vec4 segment = texture2D( preint_tex, vec2( s_front, s_back ) );    \n\
+        if( front_void || sample_void )                                     \n\
+            segment = vec4( 0.0 );                                          \n\
+        front_void = sample_void;                                           \n\
+        float alpha_sample = segment.a * stepsize * seg;                    \n\
+        col_acc.rgb += ( 1.0 - alpha_acc ) * segment.rgb * stepsize * seg * 3.0; \n\
+        col_acc.a += ( 1.0 - alpha_acc ) * segment.a * alpha_sample * 3.0;  \n\
+        alpha_acc += alpha_sample;                                          \n\
+        s_front = s_back;                                                   \n\
+        n += 1.0;                                                           \n\
+        if( seg < 1.0 || TERMINATED( alpha_acc ) || n >= float( MAX_STEPS ) ) \n\
+            break;                                                          \n\
+    }                                                                       \n\
+    return col_acc;                                                         \n\
+}                                                                           \n\
+                                                                            \n\
+// level of detail: a sample at distance d from the eye lies in a pixel     \n\
+// d * lod_pixel wide, footprint voxels of the volume. Below two voxels it  \n\
+// reads the volume, above that lod_tex, the opacity preserving pyramid,    \n\
+// at log2( footprint ) - 1; the next sample is a pixel width further on,   \n\
+// or stepsize when that is longer. Opacity scales with the step. Empty     \n\
+// cells are jumped over to just past their border.                         \n\
+vec4 march_lod( vec3 start, vec3 dir, float len, float eye_dist )           \n\
+{                                                                           \n\
+    vec4 col_acc = vec4( 0.0 );                                             \n\
+    float alpha_acc = 0.0;                                                  \n\
+    float t = 0.0;                                                          \n\
+    float voxels = max( volume_dims.x, max( volume_dims.y, volume_dims.z ) ); \n\
+    vec3 inv_dir = vec3( dir.x != 0.0 ? 1.0 / dir.x : 1e30,                 \n\
+                         dir.y != 0.0 ? 1.0 / dir.y : 1e30,                 \n\
+                         dir.z != 0.0 ? 1.0 / dir.z : 1e30 );               \n\
+    for( int i = 0; i < MAX_STEPS; i++ )                                    \n\
+    {                                                                       \n\
+        vec3 vect = start + dir * t;                                        \n\
+#ifdef SKIP_EMPTY                                                           \n\
+        {                                                                   \n\
+            vec3 cell = floor( vect * cells_per_unit );                     \n\
+            vec3 occ_coord = ( clamp( cell, vec3( 0.0 ), cell_count - 1.0 ) + 0.5 ) / cell_count; \n\
+            if( texture3D( occupancy_tex, occ_coord ).r == 0.0 )            \n\
+            {                                                               \n\
+                vec3 bound = ( cell + step( 0.0, dir ) ) / cells_per_unit;  \n\
+                vec3 cell_exit = ( bound - vect ) * inv_dir;                \n\
+                t += max( min( min( cell_exit.x, cell_exit.y ), cell_exit.z ), 0.0 ) + 1e-4; \n\
+                if( t > len )                                               \n\
+                    break;                                                  \n\
+                continue;                                                   \n\
+            }                                                               \n\
+        }                                                                   \n\
+#endif                                                                      \n\
+        float width = ( eye_dist + t ) * lod_pixel;                         \n\
+        float level = log2( max( width * voxels, 1.0 ) );                   \n\
+        vec4 color_sample;                                                  \n\
+        if( level < 1.0 )                                                   \n\
+        {                                                                   \n\
+            color_sample = sample_volume( vect );                           \n\
+            if( scalar_volume )                                             \n\
+                color_sample = texture1D( transfer_tex, color_sample.r );   \n\
+        }                                                                   \n\
+        else                                                                \n\
+#if defined( COMPUTE )                                                      \n\
+            color_sample = textureLod( lod_tex, vect, level - 1.0 );        \n\
+#elif defined( GL_ARB_shader_texture_lod )                                  \n\
+            color_sample = texture3DLod( lod_tex, vect, level - 1.0 );      \n\
+#else                                                                       \n\
+            color_sample = texture3D( lod_tex, vect );                      \n\
+#endif                                                                      \n\
+        float delta = max( stepsize, width );                               \n\
+        float alpha_sample = color_sample.a * delta;                        \n\
+        col_acc += ( 1.0 - alpha_acc ) * color_sample * alpha_sample * 3.0; \n\
+        alpha_acc += alpha_sample;                                          \n\
+        t += delta;                                                         \n\
+        if( t > len || TERMINATED( alpha_acc ) )                            \n\
+            break;                                                          \n\
+    }                                                                       \n\
+    return col_acc;                                                         \n\
+}                                                                           \n\
+                                                                            \n\
+// the ray from start through dir, whose end is the back face; eye_dist is  \n\
+// how far start is from the eye                                            \n\
+vec4 march( vec3 start, vec3 dir, float eye_dist )                          \n\
 {                                                                           \n\
-    vec2 texc = ( model_view.xy / model_view.w + 1.0 ) / 2.0 ;              \n\
-    vec4 start = gl_TexCoord[0];                                            \n\
-    vec4 back_position = texture2D( tex, texc );                            \n\
-    vec3 dir = vec3( 0.0 );                                                 \n\
-    dir.x = back_position.x - start.x;                                      \n\
-    dir.y = back_position.y - start.y;                                      \n\
-    dir.z = back_position.z - start.z;                                      \n\
     float len = length( dir.xyz );                                          \n\
     vec3 norm_dir = normalize( dir );                                       \n\
     float delta = stepsize;                                                 \n\
     vec3 delta_dir = norm_dir * delta;                                      \n\
     float delta_dir_len = length( delta_dir );                              \n\
-    vec3 vect = start.xyz;                                                  \n\
+    // progressive refinement starts the rays a fraction of a step in       \n\
+    start += delta_dir * ray_offset;                                        \n\
+    len -= delta_dir_len * ray_offset;                                      \n\
+    vec3 vect = start;                                                      \n\
     vec4 col_acc = vec4( 0., 0., 0., 0. );                                  \n\
     float alpha_acc = 0.0;                                                  \n\
     float length_acc = 0.0;                                                 \n\
     vec4 color_sample;                                                      \n\
     float alpha_sample;                                                     \n\
+    float n = 0.0;                                                          \n\
+    vec3 inv_delta = vec3( delta_dir.x != 0.0 ? 1.0 / delta_dir.x : 1e30,   \n\
+                           delta_dir.y != 0.0 ? 1.0 / delta_dir.y : 1e30,   \n\
+                           delta_dir.z != 0.0 ? 1.0 / delta_dir.z : 1e30 ); \n\
                                                                             \n\
-    for( int i = 0; i < 450; i++ )                                          \n\
+#if COMPOSITING == COMPOSITE_DVR                                            \n\
+    if( preintegrated )                                                     \n\
+        return march_preintegrated( start, delta_dir, delta_dir_len, len, inv_delta ); \n\
+    if( lod )                                                               \n\
+        return march_lod( start, norm_dir, len, eye_dist + delta_dir_len * ray_offset ); \n\
+#endif                                                                      \n\
+#ifdef COUNTED_LOOP                                                         \n\
+    // the steps to the back face, counted once instead of summing up the   \n\
+    // length marched at every step                                         \n\
+    float steps = min( floor( len / delta_dir_len ) + 1.0, float( MAX_STEPS ) ); \n\
+#define RAY_END( n, length_acc ) ( ( n ) >= steps )                         \n\
+#else                                                                       \n\
+#define RAY_END( n, length_acc ) ( ( n ) >= float( MAX_STEPS ) || ( length_acc ) > len ) \n\
+#endif                                                                      \n\
+                                                                            \n\
+    for( int i = 0; i < MAX_STEPS; i++ )                                    \n\
     {                                                                       \n\
-        color_sample = texture3D( volume_tex, vect );                       \n\
+#ifdef SKIP_EMPTY                                                           \n\
+        {                                                                   \n\
+            vec3 cell = floor( vect * cells_per_unit );                     \n\
+            vec3 occ_coord = ( clamp( cell, vec3( 0.0 ), cell_count - 1.0 ) + 0.5 ) / cell_count; \n\
+            if( texture3D( occupancy_tex, occ_coord ).r == 0.0 )            \n\
+            {                                                               \n\
+                vec3 bound = ( cell + step( 0.0, delta_dir ) ) / cells_per_unit; \n\
+                vec3 t = ( bound - vect ) * inv_delta;                      \n\
+                n += floor( max( min( min( t.x, t.y ), t.z ), 0.0 ) ) + 1.0; \n\
+                vect = start + delta_dir * n;                               \n\
+                length_acc = delta_dir_len * n;                             \n\
+                if( RAY_END( n, length_acc ) )                              \n\
+                    break;                                                  \n\
+                continue;                                                   \n\
+            }                                                               \n\
+        }                                                                   \n\
+#endif                                                                      \n\
+        color_sample = sample_volume( vect );                               \n\
+        if( scalar_volume )                                                 \n\
+            color_sample = texture1D( transfer_tex, color_sample.r );       \n\
+        if( sample_void )                                                   \n\
+            color_sample = vec4( 0.0 );                                     \n\
+#if COMPOSITING == COMPOSITE_DVR                                            \n\
         alpha_sample = color_sample.a * stepsize;                           \n\
         col_acc += ( 1. - alpha_acc ) * color_sample * alpha_sample * 3.;    \n\
         alpha_acc += alpha_sample;                                          \n\
+#elif COMPOSITING == COMPOSITE_MIP                                          \n\
+        if( color_sample.a > col_acc.a )                                    \n\
+            col_acc = color_sample;                                         \n\
+#elif COMPOSITING == COMPOSITE_MINIP                                        \n\
+        if( n == 0.0 || color_sample.a < col_acc.a )                        \n\
+            col_acc = color_sample;                                         \n\
+#else                                                                       \n\
+        col_acc += vec4( color_sample.rgb * color_sample.a, color_sample.a ); \n\
+#endif                                                                      \n\
         vect += delta_dir;                                                  \n\
         length_acc += delta_dir_len;                                        \n\
-        if( length_acc > len || alpha_acc > 1.0 )                          \n\
+        n += 1.0;                                                           \n\
+        if( RAY_END( n, length_acc ) || TERMINATED( alpha_acc ) )           \n\
             break;                                                          \n\
     }                                                                       \n\
-    gl_FragColor =  col_acc;                                                \n\
+#if COMPOSITING == COMPOSITE_AVERAGE                                        \n\
+    // of the opacity weighted colors, skipped steps add transparent samples \n\
+    col_acc /= max( min( n, floor( len / delta_dir_len ) + 1.0 ), 1.0 );    \n\
+#endif                                                                      \n\
+    return col_acc;                                                         \n\
+}                                                                           \n\
+                                                                            \n\
+#ifdef COMPUTE                                                              \n\
+// the compute backend: one work group per tile of TILE_SIZE^2 pixels from  \n\
+// the tile list, which holds the tiles the cube covers. Each ray enters    \n\
+// and leaves the unit cube where the slab test says.                       \n\
+layout( local_size_x = TILE_SIZE, local_size_y = TILE_SIZE ) in;            \n\
+layout( std430, binding = 0 ) readonly buffer tile_list { ivec2 tiles[]; }; \n\
+layout( rgba16f, binding = 0 ) uniform writeonly image2D out_image;         \n\
+layout( rgba8, binding = 1 ) uniform writeonly image2D feedback_image;      \n\
+uniform int     tile_count;                                                 \n\
+uniform int     frame_pixels;                                               \n\
+uniform vec2    pixel_jitter;                                               \n\
+uniform mat4    inv_mvp;                                                    \n\
+uniform vec3    eye;                                                        \n\
+                                                                            \n\
+void main( void )                                                           \n\
+{                                                                           \n\
+    int tile = int( gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x ); \n\
+    if( tile >= tile_count )                                                \n\
+        return;                                                             \n\
+    ivec2 pixel = tiles[tile] * TILE_SIZE + ivec2( gl_LocalInvocationID.xy ); \n\
+    if( pixel.x >= frame_pixels || pixel.y >= frame_pixels )                \n\
+        return;                                                             \n\
+    feedback_sample = mod( float( pixel.x ) + float( pixel.y ) * 5.0 + feedback_frame, 16.0 ); \n\
+    // the ray through the pixel center from the near to the far plane      \n\
+    vec2 ndc = ( vec2( pixel ) + 0.5 + pixel_jitter ) / float( frame_pixels ) * 2.0 - 1.0; \n\
+    vec4 near_point = inv_mvp * vec4( ndc, -1.0, 1.0 );                     \n\
+    vec4 far_point = inv_mvp * vec4( ndc, 1.0, 1.0 );                       \n\
+    vec3 p0 = near_point.xyz / near_point.w;                                \n\
+    vec3 d = far_point.xyz / far_point.w - p0;                              \n\
+    vec3 t0 = -p0 / d;                                                      \n\
+    vec3 t1 = ( 1.0 - p0 ) / d;                                             \n\
+    vec3 t_min = min( t0, t1 );                                             \n\
+    vec3 t_max = max( t0, t1 );                                             \n\
+    float t_near = max( max( t_min.x, t_min.y ), t_min.z );                 \n\
+    float t_far = min( min( t_max.x, t_max.y ), t_max.z );                  \n\
+    // like the rasterized cube nothing when the eye is inside it           \n\
+    vec4 color = vec4( 0.0 );                                               \n\
+    if( t_near <= t_far && t_near >= 0.0 )                                  \n\
+    {                                                                       \n\
+        vec3 start = p0 + d * t_near;                                       \n\
+        color = march( start, d * ( t_far - t_near ), length( start - eye ) ); \n\
+    }                                                                       \n\
+    imageStore( out_image, pixel, color );                                  \n\
+    if( bricked )                                                           \n\
+        imageStore( feedback_image, pixel, feedback );                      \n\
+}                                                                           \n\
+#else                                                                       \n\
+void main( void )                                                           \n\
+{                                                                           \n\
+    vec4 start = gl_TexCoord[0];                                            \n\
+    feedback_sample = mod( floor( gl_FragCoord.x ) + floor( gl_FragCoord.y ) * 5.0 + feedback_frame, 16.0 );\n\
+    vec3 dir = vec3( 0.0 );                                                 \n\
+    if( single_pass )                                                       \n\
+    {                                                                       \n\
+        // leave the unit cube through the nearest of the far slab planes   \n\
+        vec3 inv_dir = 1.0 / ray_dir;                                       \n\
+        vec3 t_exit = max( -start.xyz * inv_dir, ( 1.0 - start.xyz ) * inv_dir ); \n\
+        dir = ray_dir * min( min( t_exit.x, t_exit.y ), t_exit.z );         \n\
+    }                                                                       \n\
+    else                                                                    \n\
+    {                                                                       \n\
+        // the frame may fill only a corner of the backface buffer          \n\
+        vec2 texc = ( model_view.xy / model_view.w + 1.0 ) / 2.0 * frame_scale; \n\
+        vec4 back_position = texture2D( tex, texc );                        \n\
+        dir.x = back_position.x - start.x;                                  \n\
+        dir.y = back_position.y - start.y;                                  \n\
+        dir.z = back_position.z - start.z;                                  \n\
+    }                                                                       \n\
+    gl_FragData[0] = march( start.xyz, dir, length( ray_dir ) );            \n\
+    gl_FragData[1] = feedback;                                              \n\
+}                                                                           \n\
+#endif";
+
+//--------------------------------------------------------------------------------------
+// upsampling of a coarse frame: bilinear from the four nearest low resolution
+// pixels, each weighted down by how much it differs from the pixel the output
+// falls into, so edges stay sharp instead of being smeared over the gap
+//--------------------------------------------------------------------------------------
+static const char* upsample_frag = "                                        \n\
+uniform sampler2D   low_tex;                                                \n\
+uniform vec2    low_size;                                                   \n\
+uniform float   texel;                                                      \n\
+uniform float   sharpness;                                                  \n\
+                                                                            \n\
+vec4 low_texel( vec2 c )                                                    \n\
+{                                                                           \n\
+    return texture2D( low_tex, ( clamp( c, vec2( 0.0 ), low_size - 1.0 ) + 0.5 ) * texel ); \n\
+}                                                                           \n\
                                                                             \n\
+void main( void )                                                           \n\
+{                                                                           \n\
+    vec2 p = gl_TexCoord[0].xy * low_size - 0.5;                            \n\
+    vec2 base = floor( p );                                                 \n\
+    vec2 f = p - base;                                                      \n\
+    vec4 center = low_texel( floor( gl_TexCoord[0].xy * low_size ) );       \n\
+    vec4 sum = vec4( 0.0 );                                                 \n\
+    float weight_sum = 0.0;                                                 \n\
+    for( int j = 0; j < 2; j++ )                                            \n\
+        for( int i = 0; i < 2; i++ )                                        \n\
+        {                                                                   \n\
+            vec4 s = low_texel( base + vec2( float( i ), float( j ) ) );    \n\
+            vec4 d = s - center;                                            \n\
+            float w = ( i == 0 ? 1.0 - f.x : f.x ) * ( j == 0 ? 1.0 - f.y : f.y ); \n\
+            w *= exp( -sharpness * dot( d, d ) );                           \n\
+            sum += s * w;                                                   \n\
+            weight_sum += w;                                                \n\
+        }                                                                   \n\
+    gl_FragColor = sum / weight_sum;                                        \n\
 }";
 
 //--------------------------------------------------------------------------------------
 // global variables
 //--------------------------------------------------------------------------------------
 GLuint g_shaderProgram = 0;
+GLuint g_upsampleProgram = 0;
+
+// uniforms of the raycasting program set every frame; the samplers are
+// bound to fixed texture units once, when the program is linked
+enum { U_STEPSIZE, U_RAY_OFFSET, U_FRAME_SCALE, U_SINGLE_PASS, U_CELLS_PER_UNIT, U_CELL_COUNT,
+       U_SCALAR_VOLUME, U_PREINTEGRATED, U_BRICKED, U_VOLUME_DIMS, U_BRICK_COUNT, U_BRICK_SIZE, U_ATLAS_SIZE,
+       U_FEEDBACK_FRAME, U_LOD, U_LOD_PIXEL, U_TILE_COUNT, U_FRAME_PIXELS, U_PIXEL_JITTER, U_INV_MVP, U_EYE,
+       RAYCAST_UNIFORMS };
+static const char* raycast_uniform_names[RAYCAST_UNIFORMS] = {
+    "stepsize", "ray_offset", "frame_scale", "single_pass", "cells_per_unit", "cell_count",
+    "scalar_volume", "preintegrated", "bricked", "volume_dims", "brick_count", "brick_size", "atlas_size",
+    "feedback_frame", "lod", "lod_pixel", "tile_count", "frame_pixels", "pixel_jitter", "inv_mvp", "eye" };
+static const char* raycast_sampler_names[] = {
+    "tex", "volume_tex", "occupancy_tex", "transfer_tex", "preint_tex", "page_tex", "lod_tex" };
+enum { U_LOW_SIZE, U_TEXEL, U_SHARPNESS, UPSAMPLE_UNIFORMS };
+static const char* upsample_uniform_names[UPSAMPLE_UNIFORMS] = { "low_size", "texel", "sharpness" };
+
+Renderer renderer;
+UniformCache raycast_uniforms;
+UniformCache upsample_uniforms;
+RayMarchVariant raycast_variant; // what g_shaderProgram was built for
+bool raycast_compute = false;    // and whether it is the compute backend
+
+// raycasting programs built so far, one per variant of the marcher and
+// backend in use
+struct RaycastProgram {
+    RayMarchVariant variant;
+    bool compute;
+    GLuint program;
+    UniformCache uniforms;
+};
+vector<RaycastProgram> raycast_programs;
+bool debug_gl = false; // check GL errors and validate programs, which stalls the pipeline
+ProgramCache program_cache;
+bool shader_cache = true;
+const char* shader_cache_dir = NULL; // default location when NULL
     
 bool gKeys[MAX_KEYS];
 bool toggle_visuals = true;
 GLuint renderbuffer; 
 GLuint framebuffer; 
 GLuint volume_texture; // the volume texture
+GLuint occupancy_texture; // max alpha per macro cell of volume_texture
+GLuint transfer_texture; // 1D transfer function for scalar volumes
+GLuint preintegration_texture; // 2D pre-integrated transfer function
+GLuint page_texture; // brick states and atlas slots of a bricked volume
+GLuint feedback_texture; // bricks the raycasting pass missed or used
+GLuint lod_texture; // pyramid as the mip levels of one RGBA8 texture
 GLuint backface_buffer; // the FBO buffers
 GLuint final_image;
+GLuint accum_image; // upsampled or refined image shown in progressive mode
 float stepsize = 1.0/50.0;
+int render_size = WINDOW_SIZE; // size of backface_buffer and final_image
+int volume_size = VOLUME_TEX_SIZE;
+VolumeFormat volume_format = VOLUME_RGBA8;
+TransferFunction transfer_function;
+bool preintegrated = false; // march pre-integrated segments, scalar volumes only
+PreintegrationTable preintegration;
+PreintegrationBuilder* preintegration_builder = NULL; // rebuilds in the background when interactive
+bool level_of_detail = false; // sample the volume at the resolution of the screen
+VolumePyramid pyramid;        // of the host copy, for level_of_detail
+Camera camera;
+Volume volume; // host copy of volume_texture, used by the CPU raycaster
+const char* volume_file = NULL; // raw, NRRD or MetaImage file loaded instead of the test volume
+VolumeFileInfo raw_layout;      // sizes and type of a .raw volume_file
+bool keep_host_volume = false;  // keep the voxels of volume_file on the host in GL mode
+VolumeFile loaded_file;         // volume_file, mapped for as long as bricks are read from it
+BrickFile brick_file;           // volume_file when it is a .bvol from volume_convert
+bool bricked = false;           // page bricks into an atlas in volume_texture instead of the whole volume
+int brick_size = 32;
+int atlas_mb = 256;
+int bricks_per_frame = 64;      // most bricks paged in after a frame
+BrickedVolume bricked_volume;
+unsigned brick_frame = 0;
+int brick_misses = 0;           // missing bricks reported by the last frame
+int brick_uploads = 0;          // and how many of them were paged in
+bool feedback_wait = false;     // page in from the frame just rendered, for render_complete_frame()
+ThreadPool* brick_pool = NULL;  // reads bricks in parallel
+
+// brick feedback on its way back from the raycasting pass, read a frame late
+struct FeedbackRead {
+	FeedbackRead() : pbo(0), fence(0), size(0) {}
+	GLuint pbo;
+	GLsync fence;
+	int size; // pixels per side of the frame it holds
+};
+
+FeedbackRead feedback_reads[2];
+int feedback_next = 0;          // the one the next frame's feedback goes into
+
+const char* series_pattern = NULL; // printf pattern of the timestep files of a 4D volume
+int series_steps = 0;           // 0 counts the files
+int series_prefetch = 4;        // steps converted ahead of playback
+int series_io_threads = 2;
+double series_rate = 0.0;       // timesteps/sec, 0 shows them as fast as they come
+TimeSeries series;
+GLuint series_textures[2];      // the one shown, which is volume_texture, and the one uploaded into
+vector<GLuint> series_pbos;     // one for each prefetch slot, mapped while the I/O threads fill it
+GLsync series_fence = 0;        // of the upload into series_textures[1]
+long long series_uploading = -1; // the playback position of that upload
+OccupancyGrid::SlabRanges series_ranges; // of the step being uploaded
+long long series_next = 0;      // playback position of the next step to upload
+long long series_shown = 0;     // steps shown since playback started
+long long series_stalls = 0;    // steps that were due before they were prefetched
+double series_stall_ms = 0.0;
+double series_late_since = -1.0;
+chrono::steady_clock::time_point series_clock;
+const char* insitu_name = NULL; // shared memory ring a running simulation publishes frames into
+InSituRing insitu;
+long long insitu_frames = 0;    // uploaded
+long long insitu_superseded = 0; // published, but a newer one was there by the time it could be shown
+long long insitu_rejected = 0;  // the producer's header no longer matched the texture
+uint64_t insitu_step = 0;       // simulation step on screen
+double insitu_latency_ms = 0.0; // published to uploaded, summed
+double insitu_upload_ms = 0.0;
+chrono::steady_clock::time_point insitu_start;
+OccupancyGrid occupancy;
+RayMarchVariant march_variant; // compositing, early exit, skipping and loop bound
+bool compute_raycasting = false; // the compute shader backend instead of rasterizing the cube
+int compute_tile = 8;            // pixels per side of its work groups, 8 or 16
+TileDispatch tile_dispatch;      // the tiles of the last compute frame
+GLuint tile_buffer = 0;          // and their list for the compute shader
+bool single_pass = true; // intersect the cube in the shader instead of reading backface_buffer
+bool progressive = false; // coarse frames while the view changes, refined ones when it is still
+ProgressiveRefinement refinement;
+ProgressivePass frame_pass; // how render_frame() renders the next frame
+bool spin = true;         // turn the camera a little every frame
+int drag_x = -1;          // mouse x at the last event of a drag
+bool show_accum = false;  // the screen shows accum_image, not final_image
+FrameGovernor governor;   // frame resolution and step for a frame time budget
+double governor_budget = 33.0; // ms, what 'g' turns the governor on with
+deque<pair<long long, int> > governed_frames; // profiler frames and their levels, waiting for GPU times
+
+// timed passes, registered with the profiler in this order
+enum { PASS_CREATE_VOLUME, PASS_BACKFACE, PASS_RAYCAST, PASS_TO_SCREEN };
+Profiler profiler;
+bool show_profile = false;
+const char* profile_file = NULL; // written on exit when set
+FrameCapture frame_capture;      // records frames without waiting for the readback
+const char* capture_pattern = "capture_%05d.ppm"; // file names of the recording 'f' starts
+int captured_frames = 0;
+CpuRaycaster* cpu_raycaster = NULL;
 
 //--------------------------------------------------------------------------------------
-// add shader
+// add shader, with defines in front of the source
 //--------------------------------------------------------------------------------------
-void add_shader(GLuint ShaderProgram, const char* pShaderText, GLenum ShaderType)
+void add_shader(GLuint ShaderProgram, const char* pShaderText, GLenum ShaderType, const string& defines = "")
 {
     GLuint ShaderObj = glCreateShader(ShaderType);
     if (ShaderObj == 0)
@@ -122,11 +653,13 @@ void add_shader(GLuint ShaderProgram, const char* pShaderText, GLenum ShaderType
         return;
     }
     
-    const GLchar* p[1];
-    p[0] = pShaderText;
-    GLint Lengths[1];
-    Lengths[0]= strlen(pShaderText);
-    glShaderSource(ShaderObj, 1, p, Lengths);
+    const GLchar* p[2];
+    p[0] = defines.c_str();
+    p[1] = pShaderText;
+    GLint Lengths[2];
+    Lengths[0]= defines.size();
+    Lengths[1]= strlen(pShaderText);
+    glShaderSource(ShaderObj, 2, p, Lengths);
     glCompileShader(ShaderObj);
     GLint success;
     glGetShaderiv(ShaderObj, GL_COMPILE_STATUS, &success);
@@ -142,54 +675,137 @@ void add_shader(GLuint ShaderProgram, const char* pShaderText, GLenum ShaderType
 }
 
 //--------------------------------------------------------------------------------------
-// compile shader
+// link a program from the binary cache, or else compile and link vertex
+// ( NULL keeps the fixed function stage ) and fragment with defines in
+// front of both and store the result in the cache. 0 on errors. With stage
+// GL_COMPUTE_SHADER fragment is the source of a compute program instead.
 //--------------------------------------------------------------------------------------
-static void compile_shaders()
+static GLuint build_program(const char* name, const char* vertex, const char* fragment, const string& defines = "",
+                            GLenum stage = GL_FRAGMENT_SHADER)
 {
-    g_shaderProgram = glCreateProgram();
-    
-    if (g_shaderProgram == 0)
+    GLuint program = glCreateProgram();
+    if (program == 0)
     {
         cout<<"Error creating shader program! "<<endl;
-        return;
+        return 0;
     }
-    
-    add_shader(g_shaderProgram, vert, GL_VERTEX_SHADER);
-    add_shader(g_shaderProgram, frag, GL_FRAGMENT_SHADER);
+
+    vector<const char*> sources;
+    if(vertex) sources.push_back(vertex);
+    sources.push_back(fragment);
+    const uint64_t key = program_cache.key(sources, defines);
+    if(program_cache.load(program, key))
+        return program;
+
+    if(vertex) add_shader(program, vertex, GL_VERTEX_SHADER, defines);
+    add_shader(program, fragment, stage, defines);
+    program_cache.prepare(program);
     
     GLint Success = 0;
     GLchar ErrorLog[1024] = { 0 };
     
-    glLinkProgram(g_shaderProgram);
-    glGetProgramiv(g_shaderProgram, GL_LINK_STATUS, &Success);
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &Success);
     if (Success == 0)
     {
-        glGetProgramInfoLog(g_shaderProgram, sizeof(ErrorLog), NULL, ErrorLog);
-        cout<< "Error linking shader program : "<<ErrorLog<<endl;
-        return;
+        glGetProgramInfoLog(program, sizeof(ErrorLog), NULL, ErrorLog);
+        cout<< "Error linking " << name << " program : "<<ErrorLog<<endl;
+        glDeleteProgram(program);
+        return 0;
     }
-    
-    return;
-    
-  
+    program_cache.store(program, key);
+    return program;
 }
 
 //--------------------------------------------------------------------------------------
-// validate shader
+// whether the driver can run the compute backend
 //--------------------------------------------------------------------------------------
-void validate_shader( GLint i_program )
+static bool compute_available()
 {
-    GLint Success = 0;
-    GLchar ErrorLog[1024] = { 0 };
-    
-    glValidateProgram(g_shaderProgram);
-    glGetProgramiv(g_shaderProgram, GL_VALIDATE_STATUS, &Success);
-    if (!Success)
+    return GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_image_load_store &&
+                                GLEW_ARB_shader_storage_buffer_object);
+}
+
+//--------------------------------------------------------------------------------------
+// make g_shaderProgram the raycasting program of march_variant for the
+// backend in use, built the first time it is asked for. A compute backend
+// that is not available or does not build falls back to the fragment shader.
+//--------------------------------------------------------------------------------------
+static void use_raycast_variant()
+{
+    const RayMarchVariant variant = march_variant.normalized();
+    if(compute_raycasting && !compute_available())
     {
-        glGetProgramInfoLog(g_shaderProgram, sizeof(ErrorLog), NULL, ErrorLog);
-        cout<<" Invalid shader program: "<< ErrorLog<<endl;
-        return;
-    }  
+        cout << "compute shaders need OpenGL 4.3, rasterizing the cube instead" << endl;
+        compute_raycasting = false;
+    }
+    const bool compute = compute_raycasting;
+    if(!raycast_programs.empty() && variant == raycast_variant && compute == raycast_compute) return;
+    size_t i = 0;
+    while(i < raycast_programs.size() && !(raycast_programs[i].variant == variant && raycast_programs[i].compute == compute)) i++;
+    if(i == raycast_programs.size())
+    {
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        RaycastProgram p;
+        p.variant = variant;
+        p.compute = compute;
+        if(compute)
+        {
+            ostringstream defines;
+            defines << "#version 430 compatibility\n#define COMPUTE\n#define TILE_SIZE " << compute_tile << "\n";
+            p.program = build_program("compute raycasting", NULL, frag, defines.str() + variant.defines(), GL_COMPUTE_SHADER);
+        }
+        else
+            p.program = build_program("raycasting", vert, frag, variant.defines());
+        if(p.program)
+        {
+            p.uniforms.init(p.program, raycast_uniform_names, RAYCAST_UNIFORMS);
+            glUseProgram(p.program);
+            for(int unit = 0; unit < int(sizeof(raycast_sampler_names) / sizeof(raycast_sampler_names[0])); unit++)
+                glUniform1i(glGetUniformLocation(p.program, raycast_sampler_names[unit]), unit);
+            glUseProgram(0);
+        }
+        else if(compute)
+        {
+            cout << "rasterizing the cube instead" << endl;
+            compute_raycasting = false;
+            use_raycast_variant();
+            return;
+        }
+        if(!raycast_programs.empty())
+            cout << (compute ? "compute " : "") << "ray marcher " << variant.name() << " ready in "
+                 << chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count() << " ms" << endl;
+        raycast_programs.push_back(p);
+    }
+    raycast_variant = variant;
+    raycast_compute = compute;
+    g_shaderProgram = raycast_programs[i].program;
+    raycast_uniforms = raycast_programs[i].uniforms;
+}
+
+//--------------------------------------------------------------------------------------
+// compile shader
+//--------------------------------------------------------------------------------------
+static void compile_shaders()
+{
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    const int hits = program_cache.hits;
+
+    // the variant in use, the others when they are asked for
+    use_raycast_variant();
+
+    // the upsampling pass keeps the fixed function vertex stage
+    g_upsampleProgram = build_program("upsampling", NULL, upsample_frag);
+    if(g_upsampleProgram)
+    {
+        upsample_uniforms.init(g_upsampleProgram, upsample_uniform_names, UPSAMPLE_UNIFORMS);
+        glUseProgram(g_upsampleProgram);
+        glUniform1i(glGetUniformLocation(g_upsampleProgram, "low_tex"), 0);
+        glUseProgram(0);
+    }
+
+    cout << "shader programs ready in " << chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count()
+         << " ms ( " << program_cache.hits - hits << " of 2 from the binary cache )" << endl;
 }
 
 //--------------------------------------------------------------------------------------
@@ -210,426 +826,2637 @@ void disable_renderbuffers()
 }
 
 //--------------------------------------------------------------------------------------
-//  vertex function
+// stream volume_file into volume_texture, which is bound, and/or into the
+// host copy. Slabs are converted from the mapped file on worker threads and
+// uploaded here as they come in, so without the host copy the voxels are
+// never all in host memory at once; the occupancy grid is merged from the
+// ranges each slab brings along.
 //--------------------------------------------------------------------------------------
-void vertex(float x, float y, float z)
+bool load_volume_file(bool upload, bool keep_host)
 {
-	glColor3f(x,y,z);
-	glMultiTexCoord3fARB(GL_TEXTURE1_ARB, x, y, z);
-	glVertex3f(x,y,z);
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	VolumeFile& file = loaded_file;
+	if(!file.open(volume_file, raw_layout, volume_format)) return false;
+	const int* dims = file.info.dims;
+	if(upload)
+	{
+		GLint max_size = 0;
+		glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+		if(max(dims[0], max(dims[1], dims[2])) > max_size)
+		{
+			cout << volume_file << " is larger than the largest 3D texture, " << max_size << "^3" << endl;
+			return false;
+		}
+	}
+	if(file.needs_range()) file.scan_range();
+	double scan_secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+	volume.resize(dims[0], dims[1], dims[2], file.format, keep_host);
+	volume_format = file.format;
+	occupancy.reset(dims[0], dims[1], dims[2], 8);
+	const GLenum type = file.format == VOLUME_R16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+	if(upload)
+		glTexImage3D(GL_TEXTURE_3D, 0, file.format == VOLUME_R16 ? GL_R16 : GL_R8, dims[0], dims[1], dims[2], 0, GL_RED, type, NULL);
+
+	double first_slab_secs = -1.0;
+	stream_volume(file, &occupancy, [&](const VolumeSlab& slab)
+	{
+		if(upload)
+			glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, slab.z0, dims[0], dims[1], slab.voxels.depth, GL_RED, type, &slab.voxels.data[0]);
+		if(keep_host)
+			memcpy(&volume.data[size_t(slab.z0) * dims[0] * dims[1] * volume.bytes_per_voxel()], &slab.voxels.data[0], slab.voxels.bytes());
+		occupancy.merge_ranges(slab.ranges);
+		if(first_slab_secs < 0.0)
+			first_slab_secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	});
+	occupancy.finish_ranges(transfer_function);
+
+	double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	double mb = file.info.data_bytes() / (1024.0 * 1024.0);
+	cout << volume_file << ": " << dims[0] << "x" << dims[1] << "x" << dims[2] << " "
+		 << voxel_type_name(file.info.type) << " as " << (file.format == VOLUME_R16 ? "r16" : "r8")
+		 << ", values " << file.value_min << " .. " << file.value_max << endl;
+	cout << mb << " MB loaded in " << secs << " s ( " << mb / secs << " MB/s"
+		 << ( scan_secs > 0.01 ? ", range scan " : "" );
+	if(scan_secs > 0.01) cout << scan_secs << " s";
+	cout << ", first slab after " << first_slab_secs << " s )" << endl;
+	if(!bricked) file.close();
+	return true;
 }
 
 //--------------------------------------------------------------------------------------
-// this method is used to draw the front and backside of the volume
+// open a bricked volume file: only the header and tables are read, the
+// occupancy grid comes from the range of every level 0 brick, and bricks
+// are read when the atlas asks for them. With keep_host level 0 is read
+// whole instead.
 //--------------------------------------------------------------------------------------
-void drawQuads(float x, float y, float z)
+bool load_brick_file(bool keep_host)
 {
-	
-	glBegin(GL_QUADS);
-	/* Back side */
-	glNormal3f(0.0, 0.0, -1.0);
-	vertex(0.0, 0.0, 0.0);
-	vertex(0.0, y, 0.0);
-	vertex(x, y, 0.0);
-	vertex(x, 0.0, 0.0);
-
-	/* Front side */
-	glNormal3f(0.0, 0.0, 1.0);
-	vertex(0.0, 0.0, z);
-	vertex(x, 0.0, z);
-	vertex(x, y, z);
-	vertex(0.0, y, z);
-
-	/* Top side */
-	glNormal3f(0.0, 1.0, 0.0);
-	vertex(0.0, y, 0.0);
-	vertex(0.0, y, z);
-    vertex(x, y, z);
-	vertex(x, y, 0.0);
-
-	/* Bottom side */
-	glNormal3f(0.0, -1.0, 0.0);
-	vertex(0.0, 0.0, 0.0);
-	vertex(x, 0.0, 0.0);
-	vertex(x, 0.0, z);
-	vertex(0.0, 0.0, z);
-
-	/* Left side */
-	glNormal3f(-1.0, 0.0, 0.0);
-	vertex(0.0, 0.0, 0.0);
-	vertex(0.0, 0.0, z);
-	vertex(0.0, y, z);
-	vertex(0.0, y, 0.0);
-
-	/* Right side */
-	glNormal3f(1.0, 0.0, 0.0);
-	vertex(x, 0.0, 0.0);
-	vertex(x, y, 0.0);
-	vertex(x, y, z);
-	vertex(x, 0.0, z);
-	glEnd();
-	
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	if(!brick_file.open(volume_file)) return false;
+	const BrickFileHeader& h = brick_file.header;
+	volume_format = brick_file.format();
+	volume.resize(h.dims[0], h.dims[1], h.dims[2], volume_format, keep_host);
+	if(keep_host)
+	{
+		ThreadPool pool;
+		if(!brick_file.read_volume(0, volume, pool))
+		{
+			cout << volume_file << ": could not read the bricks" << endl;
+			return false;
+		}
+		occupancy.build(volume, 8, &transfer_function);
+	}
+	else
+	{
+		// bricks are whole cells and their range covers the cells' aprons
+		occupancy.reset(h.dims[0], h.dims[1], h.dims[2], 8);
+		const BrickFileLevel& level = brick_file.levels[0];
+		const int cells = h.brick_size / occupancy.cell_size;
+		const int n[3] = { occupancy.nx, occupancy.ny, occupancy.nz };
+		const float scale = volume_format == VOLUME_R16 ? 1.0f / 65535.0f : 1.0f / 255.0f;
+		for(int b = 0; b < level.bricks[0] * level.bricks[1] * level.bricks[2]; b++)
+		{
+			int c0[3] = { b % level.bricks[0], b / level.bricks[0] % level.bricks[1], b / (level.bricks[0] * level.bricks[1]) };
+			int c1[3];
+			for(int a = 0; a < 3; a++)
+			{
+				c0[a] *= cells;
+				c1[a] = min(c0[a] + cells, n[a]);
+			}
+			const BrickFileEntry& e = brick_file.entry(0, b);
+			occupancy.merge_cell_ranges(c0, c1, e.min * scale, e.max * scale);
+		}
+		occupancy.finish_ranges(transfer_function);
+	}
+	cout << volume_file << ": " << h.dims[0] << "x" << h.dims[1] << "x" << h.dims[2] << " "
+		 << (volume_format == VOLUME_R16 ? "r16" : "r8") << ", " << h.levels << " levels of "
+		 << h.brick_size << "^3 bricks, values " << h.value_min << " .. " << h.value_max << ", opened in "
+		 << chrono::duration<double>(chrono::steady_clock::now() - t0).count() << " s" << endl;
+	return true;
 }
+
 //--------------------------------------------------------------------------------------
-// create a test volume texture, here you could load your own volume
+// fill the host copy of the volume in volume_format and build its occupancy
+// grid, shared by the GL path and the CPU raycaster
 //--------------------------------------------------------------------------------------
-void create_volumetexture()
+void create_host_volume()
 {
-	int size = VOLUME_TEX_SIZE*VOLUME_TEX_SIZE*VOLUME_TEX_SIZE* 4;
-	GLubyte *data = new GLubyte[size];
-    
-    const int UPPER = VOLUME_TEX_SIZE *2 - 6;
-
-	for(int x = 0; x < VOLUME_TEX_SIZE; x++)
+	pyramid.levels.clear();
+	if(volume_file)
 	{
-        for(int y = 0; y < VOLUME_TEX_SIZE; y++)
-        {
-            for(int z = 0; z < VOLUME_TEX_SIZE; z++)
-            {
-                int r = (x*4)   + (y * VOLUME_TEX_SIZE * 4) + (z * VOLUME_TEX_SIZE * VOLUME_TEX_SIZE * 4);
-                int g = r+1;
-                int b = g+1;
-                int a = b+1;
-                
-                data[ r ] = z; //z%UPPER;
-                data[ g ] = y; // y%UPPER;
-                data[ b ] = UPPER;
-                data[ a ] = UPPER-20;
-                
-                Vector3 p =	Vector3(x,y,z)- Vector3(VOLUME_TEX_SIZE-20,VOLUME_TEX_SIZE-30,VOLUME_TEX_SIZE-30);
-                
-                bool test = (p.length() < 42);
-                if(test)
-                {
-                    data[ a ] = 0;
-                }
-
-                p =	Vector3(x,y,z)- Vector3(VOLUME_TEX_SIZE/2,VOLUME_TEX_SIZE/2,VOLUME_TEX_SIZE/2);
-                test = (p.length() < 24);
-                if(test)
-                    data[ a ] = 0;
-
-                
-                if(x > 20 && x < 40 && y > 0 && y < VOLUME_TEX_SIZE && z > 10 &&  z < 50)
-                {
-                    data[ r ] = UPPER/2;
-                    data[ g ] = UPPER;
-                    data[ b ] = y%(UPPER/2);
-                    data[ a ] = UPPER;
-                }
-
-                if(x > 50 && x < 70 && y > 0 && y < VOLUME_TEX_SIZE && z > 10 &&  z < 50)
-                {
-                    data[ r ] = UPPER;
-                    data[ g ] = UPPER;
-                    data[ b ] = y%(UPPER/2);
-                    data[ a ] = UPPER; 
-                }
-
-                if(x > 80 && x < 100 && y > 0 && y < VOLUME_TEX_SIZE && z > 10 &&  z < 50)
-                {
-                    data[ r ] = UPPER;
-                    data[ g ] = UPPER/3;
-                    data[ b ] = y%(UPPER/2);
-                    data[ a ] = UPPER;
-                }
-
-                p =	Vector3(x,y,z)- Vector3(24,24,24);
-                test = (p.length() < 40);
-                if(test)
-                    data[ a ] = 0;
-            }
-        }
-    }
-
-	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
-	glGenTextures(1, &volume_texture);
-	glBindTexture(GL_TEXTURE_3D, volume_texture);
-	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
-	
-    glTexImage3D(GL_TEXTURE_3D, 0,GL_RGBA, VOLUME_TEX_SIZE, VOLUME_TEX_SIZE,VOLUME_TEX_SIZE,0, GL_RGBA, GL_UNSIGNED_BYTE,data);
-    
-	delete []data;
-	cout << "volume texture created" << endl;
-
+		if(!(is_brick_file(volume_file) ? load_brick_file(true) : load_volume_file(false, true))) exit(1);
+		return;
+	}
+	if(volume_format == VOLUME_RGBA8)
+		create_test_volume(volume, volume_size);
+	else
+		create_test_scalar_volume(volume, volume_size, volume_format);
+	occupancy.build(volume, 8, &transfer_function);
 }
 
 //--------------------------------------------------------------------------------------
-// ok let's start things up 
+// upload the transfer function table, and for scalar volumes the occupancy
+// grid that was classified with it
 //--------------------------------------------------------------------------------------
-void init()
+void upload_transfer_function()
 {
-	cout << "glew init " << endl;
-	GLenum err = glewInit();
-
-	// initialize all the OpenGL extensions
-	glewGetExtension("glMultiTexCoord2fvARB");  
-	if(glewGetExtension("GL_EXT_framebuffer_object") )cout << "GL_EXT_framebuffer_object support " << endl;
-	if(glewGetExtension("GL_EXT_renderbuffer_object"))cout << "GL_EXT_renderbuffer_object support " << endl;
-	if(glewGetExtension("GL_ARB_vertex_buffer_object")) cout << "GL_ARB_vertex_buffer_object support" << endl;
-	if(GL_ARB_multitexture)cout << "GL_ARB_multitexture support " << endl;
-	
-	if (glewGetExtension("GL_ARB_fragment_shader")      != GL_TRUE ||
-		glewGetExtension("GL_ARB_vertex_shader")        != GL_TRUE ||
-		glewGetExtension("GL_ARB_shader_objects")       != GL_TRUE ||
-		glewGetExtension("GL_ARB_shading_language_100") != GL_TRUE)
+	if(!transfer_texture)
 	{
-		cout << "Driver does not support OpenGL Shading Language" << endl;
-		exit(1);
+		glGenTextures(1, &transfer_texture);
+		glBindTexture(GL_TEXTURE_1D, transfer_texture);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, TransferFunction::TABLE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glBindTexture(GL_TEXTURE_1D, transfer_texture);
+	glTexSubImage1D(GL_TEXTURE_1D, 0, 0, TransferFunction::TABLE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, &transfer_function.table[0]);
+	glBindTexture(GL_TEXTURE_1D, 0);
 
-	glEnable(GL_CULL_FACE);
-	glClearColor(0.0, 0.0, 0.0, 0);
-	create_volumetexture();
-
-	// CG init
-        
-    compile_shaders();
-        
-	// Create the to FBO's one for the backside of the volumecube and one for the finalimage rendering
-	glGenFramebuffersEXT(1, &framebuffer);
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,framebuffer);
-
-	glGenTextures(1, &backface_buffer);
-	glBindTexture(GL_TEXTURE_2D, backface_buffer);
-	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGBA16F_ARB, WINDOW_SIZE, WINDOW_SIZE, 0, GL_RGBA, GL_FLOAT, NULL);
-	(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, backface_buffer, 0);
-
-	glGenTextures(1, &final_image);
-	glBindTexture(GL_TEXTURE_2D, final_image);
-	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGBA16F_ARB, WINDOW_SIZE, WINDOW_SIZE, 0, GL_RGBA, GL_FLOAT, NULL);
-
-	glGenRenderbuffersEXT(1, &renderbuffer);
-	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffer);
-	glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT, WINDOW_SIZE, WINDOW_SIZE);
-	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, renderbuffer);
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-	
+	if(volume.is_scalar() && occupancy_texture)
+	{
+		glBindTexture(GL_TEXTURE_3D, occupancy_texture);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, occupancy.nx, occupancy.ny, occupancy.nz, GL_LUMINANCE, GL_UNSIGNED_BYTE, &occupancy.cells[0]);
+		glBindTexture(GL_TEXTURE_3D, 0);
+	}
 }
 
 //--------------------------------------------------------------------------------------
-// for contiunes keypresses
+// upload the pre-integration table into its RGBA16 2D texture
 //--------------------------------------------------------------------------------------
-void ProcessKeys()
+void upload_preintegration()
 {
-	// Process keys
-	for (int i = 0; i < 256; i++)
+	const int size = PreintegrationTable::SIZE;
+	if(!preintegration_texture)
 	{
-		if (!gKeys[i])  { continue; }
-		switch (i)
-		{
-		case ' ':
-			break;
-		case 'w':
-			stepsize += 1.0/2048.0;
-			if(stepsize > 0.25) stepsize = 0.25;
-			break;
-		case 'e':
-			stepsize -= 1.0/2048.0;
-			if(stepsize <= 1.0/200.0) stepsize = 1.0/200.0;
-			break;
-		}
+		glGenTextures(1, &preintegration_texture);
+		glBindTexture(GL_TEXTURE_2D, preintegration_texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16, size, size, 0, GL_RGBA, GL_UNSIGNED_SHORT, NULL);
 	}
-
+	glBindTexture(GL_TEXTURE_2D, preintegration_texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_SHORT, &preintegration.table[0]);
+	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 //--------------------------------------------------------------------------------------
-//
+// bring the pre-integration table up to date with the transfer function.
+// In the GL window the builder thread does the work and display() uploads
+// the result when it is done; batch modes build it right here and get
+// true back when there is a new table to upload.
 //--------------------------------------------------------------------------------------
-void key(unsigned char k, int x, int y)
+bool update_preintegration()
 {
-	gKeys[k] = true;
+	if(!volume.is_scalar()) return false;
+	if(preintegration_builder)
+	{
+		preintegration_builder->request(transfer_function);
+		return false;
+	}
+	preintegration.rebuild(transfer_function);
+	return true;
 }
 
 //--------------------------------------------------------------------------------------
-//
+// why level of detail cannot be used with this volume, NULL when it can:
+// the pyramid is built from the host copy, and the atlas has no mip levels
 //--------------------------------------------------------------------------------------
-void KeyboardUpCallback(unsigned char key, int x, int y)
+const char* level_of_detail_unavailable()
 {
-	gKeys[key] = false;
+	if(bricked) return "level of detail is not available for bricked volumes";
+	if(series_pattern) return "level of detail is not available for time series";
+	if(insitu_name) return "level of detail is not available for in-situ frames";
+	if(!volume.has_voxels()) return "level of detail needs the voxels on the host, load with --host-copy";
+	return NULL;
+}
 
-	switch (key)
-	{
-	case 27 :
-		{
-			exit(0); break; 
-		}
-	case ' ':
-		toggle_visuals = !toggle_visuals;
-		break;
-	}
+bool lod_active()
+{
+	return level_of_detail && !level_of_detail_unavailable() && !pyramid.empty();
 }
 
 //--------------------------------------------------------------------------------------
-// glut idle function
+// build the level of detail pyramid when it is missing, or when a scalar
+// volume's was classified with an older transfer function; true when it
+// was rebuilt
 //--------------------------------------------------------------------------------------
-void idle_func()
+bool update_pyramid()
 {
-	ProcessKeys();
-	glutPostRedisplay();
+	if(!level_of_detail || level_of_detail_unavailable()) return false;
+	if(!pyramid.empty() && (!volume.is_scalar() || pyramid.revision == transfer_function.revision)) return false;
+	ThreadPool pool;
+	pyramid.build(volume, &transfer_function, pool);
+	return true;
 }
 
 //--------------------------------------------------------------------------------------
-//
+// bring the pyramid up to date and upload it as the mip levels of
+// lod_texture, read with trilinear filtering between levels
 //--------------------------------------------------------------------------------------
-void reshape_ortho(int w, int h)
+void upload_pyramid()
 {
-	if (h == 0) h = 1;
-	glViewport(0, 0,w,h);
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluOrtho2D(0, 1, 0, 1);
-	glMatrixMode(GL_MODELVIEW);
+	if(!update_pyramid() || pyramid.empty()) return;
+	if(!lod_texture)
+	{
+		glGenTextures(1, &lod_texture);
+		glBindTexture(GL_TEXTURE_3D, lod_texture);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glBindTexture(GL_TEXTURE_3D, lod_texture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, pyramid.count() - 1);
+	for(int l = 0; l < pyramid.count(); l++)
+	{
+		const Volume& level = pyramid.levels[l];
+		glTexImage3D(GL_TEXTURE_3D, l, GL_RGBA8, level.width, level.height, level.depth, 0, GL_RGBA, GL_UNSIGNED_BYTE, &level.data[0]);
+	}
+	glBindTexture(GL_TEXTURE_3D, 0);
 }
+
 //--------------------------------------------------------------------------------------
-//
+// upload the whole page table of the bricked volume
 //--------------------------------------------------------------------------------------
-void resize(int w, int h)
+void upload_page_table()
 {
-	if (h == 0) h = 1;
-	glViewport(0, 0, w, h);
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(60.0, (GLfloat)w/(GLfloat)h, 0.01, 400.0);
-	glMatrixMode(GL_MODELVIEW);
+	const BrickLayout& layout = bricked_volume.layout;
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glBindTexture(GL_TEXTURE_3D, page_texture);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, layout.bricks[0], layout.bricks[1], layout.bricks[2],
+					GL_RGBA, GL_UNSIGNED_BYTE, &bricked_volume.page_table[0]);
+	glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+//--------------------------------------------------------------------------------------
+// set up the bricked volume: the atlas in volume_texture, which is bound,
+// and the page table with every brick missing or empty. Bricks are read
+// from the host copy of the volume, or from volume_file without one; a
+// bricked volume file brings its own brick size.
+//--------------------------------------------------------------------------------------
+bool create_brick_atlas()
+{
+	const bool from_brick_file = volume_file && is_brick_file(volume_file);
+	if(volume_file && !(from_brick_file ? load_brick_file(keep_host_volume) : load_volume_file(false, keep_host_volume)))
+		return false;
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+
+	// whole occupancy cells per brick, so empty bricks follow from the grid
+	const int cell = occupancy.cell_size;
+	const int size = from_brick_file ? int(brick_file.header.brick_size) : max((brick_size + cell - 1) / cell * cell, cell);
+	BrickedVolume& bv = bricked_volume;
+	bv.init(volume.width, volume.height, volume.depth, volume.format, size, size_t(atlas_mb) << 20, max_size);
+	const BrickLayout& layout = bv.layout;
+	if(max(layout.bricks[0], max(layout.bricks[1], layout.bricks[2])) > 256)
+	{
+		cout << "more than 256 bricks along an axis, use a larger --brick-size" << endl;
+		return false;
+	}
+	if(volume.has_voxels())
+		bv.set_source(&volume, NULL);
+	else
+		bv.set_source(NULL, from_brick_file ? NULL : &loaded_file, from_brick_file ? &brick_file : NULL);
+	int needed = bv.classify(occupancy);
+	if(!brick_pool) brick_pool = new ThreadPool();
+
+	const int p = layout.padded;
+	if(volume.format == VOLUME_R8)
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, layout.slots[0] * p, layout.slots[1] * p, layout.slots[2] * p, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+	else if(volume.format == VOLUME_R16)
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R16, layout.slots[0] * p, layout.slots[1] * p, layout.slots[2] * p, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+	else
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, layout.slots[0] * p, layout.slots[1] * p, layout.slots[2] * p, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	// one texel per brick, looked up at brick centers
+	glDeleteTextures(1, &page_texture);
+	glGenTextures(1, &page_texture);
+	glBindTexture(GL_TEXTURE_3D, page_texture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, layout.bricks[0], layout.bricks[1], layout.bricks[2], 0, GL_RGBA, GL_UNSIGNED_BYTE, &bv.page_table[0]);
+	glBindTexture(GL_TEXTURE_3D, volume_texture);
+
+	cout << "bricked: " << layout.bricks[0] << "x" << layout.bricks[1] << "x" << layout.bricks[2] << " bricks of "
+		 << size << "^3, " << needed << " not empty, atlas of " << layout.slot_count() << " slots ( "
+		 << double(layout.slot_count()) * bv.brick_bytes() / (1024.0 * 1024.0) << " MB )" << endl;
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// runtime transfer function edits: rebuild the table, reclassify the grid
+//--------------------------------------------------------------------------------------
+void transfer_function_changed()
+{
+	if(volume.is_scalar())
+		occupancy.classify(transfer_function);
+	if(bricked && volume.is_scalar())
+	{
+		bricked_volume.classify(occupancy);
+		upload_page_table();
+	}
+	upload_transfer_function();
+	if(update_preintegration())
+		upload_preintegration();
+	upload_pyramid();
+	cout << "transfer function offset " << transfer_function.offset
+		 << ", opacity " << transfer_function.opacity << endl;
+}
+
+//--------------------------------------------------------------------------------------
+// 4D volumes: step 0 goes into volume_texture, which is bound, and a second
+// texture of the same size takes the uploads of the steps that follow.
+// Every prefetch slot gets a pixel buffer object, mapped, which the I/O
+// threads convert its steps straight into. The I/O threads start
+// prefetching here.
+//--------------------------------------------------------------------------------------
+
+// the buffer of the slot of playback position seq, mapped for the I/O
+// threads; NULL when there are no buffers, and the slot converts into its
+// own voxels
+unsigned char* map_series_pbo(long long seq)
+{
+	if(series_pbos.empty()) return NULL;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, series_pbos[seq % series_pbos.size()]);
+	unsigned char* p = (unsigned char*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if(!p) cout << "Could not map a timestep buffer, the step is converted into host memory" << endl;
+	return p;
+}
+
+bool create_series_textures()
+{
+	if(!series.open(series_pattern, series_steps, raw_layout, volume_format)) return false;
+	const int* dims = series.info.dims;
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+	if(max(dims[0], max(dims[1], dims[2])) > max_size)
+	{
+		cout << series.filename(0) << " is larger than the largest 3D texture, " << max_size << "^3" << endl;
+		return false;
+	}
+	volume_format = series.format;
+	volume.resize(dims[0], dims[1], dims[2], series.format, false);
+	occupancy.reset(dims[0], dims[1], dims[2], 8);
+
+	vector<unsigned char*> targets;
+	if(GLEW_ARB_pixel_buffer_object && GLEW_ARB_sync)
+	{
+		series_pbos.assign(max(series_prefetch, 1), 0);
+		glGenBuffers(GLsizei(series_pbos.size()), &series_pbos[0]);
+		for(size_t b = 0; b < series_pbos.size(); b++)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, series_pbos[b]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, volume.voxel_bytes(), NULL, GL_STREAM_DRAW);
+			targets.push_back(map_series_pbo(b));
+		}
+	}
+	else
+		cout << "GL_ARB_pixel_buffer_object or GL_ARB_sync not supported, timesteps are uploaded synchronously" << endl;
+	series.start(0, series_prefetch, series_io_threads, targets);
+	const TimeStep* step = series.wait(0);
+	if(!step->ok) return false;
+	const GLenum internal = series.format == VOLUME_R16 ? GL_R16 : GL_R8;
+	const GLenum type = series.format == VOLUME_R16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if(step->target)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, series_pbos[0]);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glTexImage3D(GL_TEXTURE_3D, 0, internal, dims[0], dims[1], dims[2], 0, GL_RED, type, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	else
+		glTexImage3D(GL_TEXTURE_3D, 0, internal, dims[0], dims[1], dims[2], 0, GL_RED, type, &step->voxels.data[0]);
+	occupancy.merge_ranges(step->ranges);
+	occupancy.finish_ranges(transfer_function);
+	series.release(0, map_series_pbo(0));
+
+	series_textures[0] = volume_texture;
+	glGenTextures(1, &series_textures[1]);
+	glBindTexture(GL_TEXTURE_3D, series_textures[1]);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+	glTexImage3D(GL_TEXTURE_3D, 0, internal, dims[0], dims[1], dims[2], 0, GL_RED, type, NULL);
+	glBindTexture(GL_TEXTURE_3D, volume_texture);
+
+	cout << series_pattern << ": " << series.steps << " steps of " << dims[0] << "x" << dims[1] << "x" << dims[2] << " "
+		 << voxel_type_name(series.info.type) << " as " << (series.format == VOLUME_R16 ? "r16" : "r8")
+		 << ", values " << series.value_min << " .. " << series.value_max << ", prefetching " << series.prefetch
+		 << " steps on " << series_io_threads << " I/O threads" << endl;
+	series_next = 1;
+	series_clock = chrono::steady_clock::now();
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// 4D playback, before every frame. A step whose upload finished is swapped
+// in as volume_texture, and its buffer is mapped again and handed back to
+// the I/O threads with its slot. Then, with no upload in flight, the next
+// step is uploaded once it is due and prefetched: its buffer, which the I/O
+// threads converted it into, is unmapped and copied into the texture not
+// being shown. The upload is fenced and only swapped in a later frame, so
+// the raycasting pass never waits for it, and the voxels are never copied
+// on the render thread. A step that is due before the I/O threads have it
+// is a stall; the old step stays on screen meanwhile.
+//--------------------------------------------------------------------------------------
+void show_series_step()
+{
+	swap(series_textures[0], series_textures[1]);
+	volume_texture = series_textures[0];
+	occupancy.range_min.assign(occupancy.range_min.size(), 1.0f);
+	occupancy.range_max.assign(occupancy.range_max.size(), 0.0f);
+	occupancy.merge_ranges(series_ranges);
+	occupancy.finish_ranges(transfer_function);
+	glBindTexture(GL_TEXTURE_3D, occupancy_texture);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, occupancy.nx, occupancy.ny, occupancy.nz, GL_LUMINANCE, GL_UNSIGNED_BYTE, &occupancy.cells[0]);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	series_shown++;
+	refinement.restart();
+}
+
+void update_series()
+{
+	if(!series_pattern) return;
+	if(series_fence)
+	{
+		GLenum r = glClientWaitSync(series_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if(r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED) return;
+		glDeleteSync(series_fence);
+		series_fence = 0;
+		show_series_step();
+		series.release(series_uploading, map_series_pbo(series_uploading));
+		series_uploading = -1;
+	}
+
+	const double now = chrono::duration<double>(chrono::steady_clock::now() - series_clock).count();
+	if(series_rate > 0.0 && series_next > (long long)(now * series_rate)) return;
+	const TimeStep* step = series.ready(series_next);
+	if(!step)
+	{
+		if(series_late_since < 0.0) series_late_since = now;
+		return;
+	}
+	if(series_late_since >= 0.0)
+	{
+		series_stalls++;
+		series_stall_ms += 1000.0 * (now - series_late_since);
+		series_late_since = -1.0;
+	}
+	if(!step->ok)
+	{
+		cout << "stopping playback at step " << series_next % series.steps << endl;
+		series.stop();
+		series_pattern = NULL;
+		return;
+	}
+
+	const GLenum type = volume.format == VOLUME_R16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glBindTexture(GL_TEXTURE_3D, series_textures[1]);
+	series_ranges = step->ranges;
+	if(step->target)
+	{
+		// the slot stays taken until the upload has read its buffer
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, series_pbos[series_next % series_pbos.size()]);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, volume.width, volume.height, volume.depth, GL_RED, type, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_3D, 0);
+		series_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		series_uploading = series_next++;
+		return;
+	}
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, volume.width, volume.height, volume.depth, GL_RED, type, &step->voxels.data[0]);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	series.release(series_next, map_series_pbo(series_next));
+	series_next++;
+	show_series_step();
+}
+
+//--------------------------------------------------------------------------------------
+// end of playback: the I/O threads stop while the context their buffers
+// are mapped in is still there, then the sustained rate and stalls
+//--------------------------------------------------------------------------------------
+void stop_series()
+{
+	if(!series_textures[1]) return;
+	series.stop();
+	const double secs = chrono::duration<double>(chrono::steady_clock::now() - series_clock).count();
+	long long loaded;
+	double load_ms;
+	series.load_stats(loaded, load_ms);
+	cout << "timesteps: " << series_shown << " shown in " << secs << " s ( " << series_shown / secs << " timesteps/sec"
+		 << (series_rate > 0.0 ? " of " : "");
+	if(series_rate > 0.0) cout << series_rate;
+	cout << " ), " << series_stalls << " stalls waiting " << series_stall_ms << " ms for I/O, "
+		 << (loaded ? load_ms / loaded : 0.0) << " ms to read and convert a step on " << series_io_threads << " threads" << endl;
+}
+
+//--------------------------------------------------------------------------------------
+// in-situ frames: the newest frame a simulation published into the shared
+// memory ring goes straight from the mapping into volume_texture, then its
+// slot is handed back. Never waits: without a new frame the last one stays.
+//--------------------------------------------------------------------------------------
+bool update_insitu()
+{
+	uint64_t seq, skipped;
+	InSituSlot info;
+	const unsigned char* voxels = insitu.newest(seq, info, skipped);
+	if(!voxels) return false;
+	// the header lives in memory the producer writes, so it is checked
+	// again before every upload reads a slot
+	const int dims[3] = { volume.width, volume.height, volume.depth };
+	if(!insitu.frame_fits(dims, volume_format))
+	{
+		if(!insitu_rejected++)
+			cout << insitu_name << ": the producer changed its frame layout, its frames are not shown" << endl;
+		insitu.release(seq);
+		return false;
+	}
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glBindTexture(GL_TEXTURE_3D, volume_texture);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, volume.width, volume.height, volume.depth, GL_RED,
+					volume_format == VOLUME_R16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, voxels);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	insitu.release(seq);
+	insitu_upload_ms += 1000.0 * chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	insitu_latency_ms += 1000.0 * (insitu_clock() - info.published);
+	insitu_superseded += (long long)skipped;
+	insitu_step = info.step;
+	insitu_frames++;
+	refinement.restart();
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// map the ring of insitu_name, waiting up to 30 s for the producer and its
+// first frame, and create volume_texture, which is bound, to its size.
+// Every occupancy cell gets the whole value range, so empty space is only
+// skipped where the transfer function is transparent for all values;
+// the ranges of the cells would take a pass over every frame's voxels.
+//--------------------------------------------------------------------------------------
+bool create_insitu_texture()
+{
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	bool waited = false;
+	while(!insitu.open(insitu_name) || insitu.header->head.load() == 0)
+	{
+		if(chrono::duration<double>(chrono::steady_clock::now() - t0).count() > 30.0)
+		{
+			cout << "no in-situ frames on " << insitu_name << " after 30 s" << endl;
+			return false;
+		}
+		if(!waited) cout << "waiting for a producer on " << insitu_name << endl;
+		waited = true;
+		insitu.close();
+		this_thread::sleep_for(chrono::milliseconds(50));
+	}
+	const InSituHeader* h = insitu.header;
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+	if(max(h->dims[0], max(h->dims[1], h->dims[2])) > max_size)
+	{
+		cout << insitu_name << " is larger than the largest 3D texture, " << max_size << "^3" << endl;
+		return false;
+	}
+	volume_format = VolumeFormat(h->format);
+	volume.resize(h->dims[0], h->dims[1], h->dims[2], volume_format, false);
+	occupancy.reset(h->dims[0], h->dims[1], h->dims[2], 8);
+	occupancy.range_min.assign(occupancy.range_min.size(), 0.0f);
+	occupancy.range_max.assign(occupancy.range_max.size(), 1.0f);
+	occupancy.finish_ranges(transfer_function);
+	glTexImage3D(GL_TEXTURE_3D, 0, volume_format == VOLUME_R16 ? GL_R16 : GL_R8, volume.width, volume.height, volume.depth, 0,
+				 GL_RED, volume_format == VOLUME_R16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, NULL);
+	update_insitu();
+	glBindTexture(GL_TEXTURE_3D, volume_texture);
+	cout << insitu_name << ": " << volume.width << "x" << volume.height << "x" << volume.depth << " "
+		 << (volume_format == VOLUME_R16 ? "r16" : "r8") << " in-situ frames, " << h->slots << " slots" << endl;
+	insitu_start = chrono::steady_clock::now();
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// what reached the screen of what the simulation published
+//--------------------------------------------------------------------------------------
+void print_insitu_stats()
+{
+	if(!insitu.header) return;
+	const double secs = chrono::duration<double>(chrono::steady_clock::now() - insitu_start).count();
+	cout << "in-situ: " << insitu_frames << " frames uploaded in " << secs << " s ( " << insitu_frames / secs
+		 << " frames/sec, last simulation step " << insitu_step << " ), " << insitu_superseded
+		 << " superseded by newer ones, " << insitu.dropped() << " dropped by the producer with the ring full, "
+		 << insitu_rejected << " rejected for a changed layout, "
+		 << (insitu_frames ? insitu_latency_ms / insitu_frames : 0.0) << " ms published to uploaded, "
+		 << (insitu_frames ? insitu_upload_ms / insitu_frames : 0.0) << " ms/frame uploading" << endl;
+}
+
+//--------------------------------------------------------------------------------------
+// create a test volume texture, here you could load your own volume
+//--------------------------------------------------------------------------------------
+void create_volumetexture()
+{
+	ProfileScope timing(profiler, PASS_CREATE_VOLUME);
+	if(!volume_file && !series_pattern && !insitu_name)
+	{
+		chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+		create_host_volume();
+		cout << volume_size << "^3 volume generated in "
+			 << chrono::duration<double>(chrono::steady_clock::now() - t0).count() << " s" << endl;
+	}
+
+	// called again when the volume size changes
+	glDeleteTextures(1, &volume_texture);
+	glDeleteTextures(1, &occupancy_texture);
+	pyramid.levels.clear();
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glGenTextures(1, &volume_texture);
+	glBindTexture(GL_TEXTURE_3D, volume_texture);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+	
+	// scalar volumes are stored with a single channel and classified in the shader
+	if(bricked)
+	{
+		if(!create_brick_atlas()) exit(1);
+	}
+	else if(series_pattern)
+	{
+		if(!create_series_textures()) exit(1);
+	}
+	else if(insitu_name)
+	{
+		if(!create_insitu_texture()) exit(1);
+	}
+	else if(volume_file)
+	{
+		if(!load_volume_file(true, keep_host_volume)) exit(1);
+	}
+	else if(volume.format == VOLUME_R8)
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, volume.width, volume.height, volume.depth, 0, GL_RED, GL_UNSIGNED_BYTE, &volume.data[0]);
+	else if(volume.format == VOLUME_R16)
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R16, volume.width, volume.height, volume.depth, 0, GL_RED, GL_UNSIGNED_SHORT, &volume.data[0]);
+	else
+    glTexImage3D(GL_TEXTURE_3D, 0,GL_RGBA, volume.width, volume.height, volume.depth,0, GL_RGBA, GL_UNSIGNED_BYTE,&volume.data[0]);
+    
+	if(!bricked)
+		cout << "volume texture created, " << volume.voxel_bytes() / (1024 * 1024) << " MB" << endl;
+
+	// the occupancy grid is looked up per macro cell, so no filtering
+	glGenTextures(1, &occupancy_texture);
+	glBindTexture(GL_TEXTURE_3D, occupancy_texture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_LUMINANCE8, occupancy.nx, occupancy.ny, occupancy.nz, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, &occupancy.cells[0]);
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	upload_transfer_function();
+	if(update_preintegration())
+		upload_preintegration();
+	if(level_of_detail && level_of_detail_unavailable())
+		cout << level_of_detail_unavailable() << endl;
+	upload_pyramid();
+}
+
+//--------------------------------------------------------------------------------------
+// (re)create backface_buffer, final_image, accum_image and the depth buffer
+// at render_size
+//--------------------------------------------------------------------------------------
+void create_render_targets()
+{
+	glDeleteTextures(1, &backface_buffer);
+	glDeleteTextures(1, &final_image);
+	glDeleteRenderbuffersEXT(1, &renderbuffer);
+
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,framebuffer);
+
+	glGenTextures(1, &backface_buffer);
+	glBindTexture(GL_TEXTURE_2D, backface_buffer);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGBA16F_ARB, render_size, render_size, 0, GL_RGBA, GL_FLOAT, NULL);
+	(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, backface_buffer, 0);
+
+	glGenTextures(1, &final_image);
+	glBindTexture(GL_TEXTURE_2D, final_image);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGBA16F_ARB, render_size, render_size, 0, GL_RGBA, GL_FLOAT, NULL);
+
+	glDeleteTextures(1, &accum_image);
+	glGenTextures(1, &accum_image);
+	glBindTexture(GL_TEXTURE_2D, accum_image);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGBA16F_ARB, render_size, render_size, 0, GL_RGBA, GL_FLOAT, NULL);
+	refinement.restart();
+
+	// bricked volumes: the raycasting pass writes its brick feedback here,
+	// and it comes back through two pixel buffer objects
+	glDeleteTextures(1, &feedback_texture);
+	feedback_texture = 0;
+	for(int r = 0; r < 2; r++)
+	{
+		if(feedback_reads[r].fence) glDeleteSync(feedback_reads[r].fence);
+		glDeleteBuffers(1, &feedback_reads[r].pbo);
+		feedback_reads[r] = FeedbackRead();
+	}
+	if(bricked)
+	{
+		glGenTextures(1, &feedback_texture);
+		glBindTexture(GL_TEXTURE_2D, feedback_texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, render_size, render_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		for(int r = 0; r < 2 && GLEW_ARB_pixel_buffer_object && GLEW_ARB_sync; r++)
+		{
+			glGenBuffers(1, &feedback_reads[r].pbo);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, feedback_reads[r].pbo);
+			glBufferData(GL_PIXEL_PACK_BUFFER, size_t(render_size) * render_size * 4, NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	glGenRenderbuffersEXT(1, &renderbuffer);
+	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffer);
+	glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT, render_size, render_size);
+	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, renderbuffer);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+}
+
+//--------------------------------------------------------------------------------------
+// ok let's start things up 
+//--------------------------------------------------------------------------------------
+void init()
+{
+	cout << "glew init " << endl;
+	GLenum err = glewInit();
+
+	// initialize all the OpenGL extensions
+	glewGetExtension("glMultiTexCoord2fvARB");  
+	if(glewGetExtension("GL_EXT_framebuffer_object") )cout << "GL_EXT_framebuffer_object support " << endl;
+	if(glewGetExtension("GL_EXT_renderbuffer_object"))cout << "GL_EXT_renderbuffer_object support " << endl;
+	if(glewGetExtension("GL_ARB_vertex_buffer_object")) cout << "GL_ARB_vertex_buffer_object support" << endl;
+	if(GL_ARB_multitexture)cout << "GL_ARB_multitexture support " << endl;
+	
+	if (glewGetExtension("GL_ARB_fragment_shader")      != GL_TRUE ||
+		glewGetExtension("GL_ARB_vertex_shader")        != GL_TRUE ||
+		glewGetExtension("GL_ARB_shader_objects")       != GL_TRUE ||
+		glewGetExtension("GL_ARB_shading_language_100") != GL_TRUE)
+	{
+		cout << "Driver does not support OpenGL Shading Language" << endl;
+		exit(1);
+	}
+
+	renderer.init(debug_gl);
+	profiler.init();
+	profiler.add_pass("create_volumetexture");
+	profiler.add_pass("render_backface");
+	profiler.add_pass("raycasting_pass");
+	profiler.add_pass("render_buffer_to_screen");
+
+	glEnable(GL_CULL_FACE);
+	glClearColor(0.0, 0.0, 0.0, 0);
+	create_volumetexture();
+
+	// CG init
+        
+    if(shader_cache)
+        program_cache.init(shader_cache_dir);
+    compile_shaders();
+        
+	// Create the to FBO's one for the backside of the volumecube and one for the finalimage rendering
+	glGenFramebuffersEXT(1, &framebuffer);
+	create_render_targets();
+	
+}
+
+//--------------------------------------------------------------------------------------
+// for contiunes keypresses
+//--------------------------------------------------------------------------------------
+void ProcessKeys()
+{
+	// Process keys
+	for (int i = 0; i < 256; i++)
+	{
+		if (!gKeys[i])  { continue; }
+		switch (i)
+		{
+		case ' ':
+			break;
+		case 'w':
+			stepsize += 1.0/2048.0;
+			if(stepsize > 0.25) stepsize = 0.25;
+			break;
+		case 'e':
+			stepsize -= 1.0/2048.0;
+			if(stepsize <= 1.0/200.0) stepsize = 1.0/200.0;
+			break;
+		}
+	}
+
+}
+
+//--------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------
+void key(unsigned char k, int x, int y)
+{
+	gKeys[k] = true;
+}
+
+//--------------------------------------------------------------------------------------
+// copy final_image, or another render_size image, to host memory, RGBA float
+// with the bottom row first
+//--------------------------------------------------------------------------------------
+void read_final_image(vector<float>& rgba, GLuint image = 0)
+{
+	rgba.resize(size_t(render_size)*render_size*4);
+	glBindTexture(GL_TEXTURE_2D, image ? image : final_image);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &rgba[0]);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void render_frame();
+
+//--------------------------------------------------------------------------------------
+// read back final_image and check it against the CPU raycaster for the same view
+//--------------------------------------------------------------------------------------
+void compare_cpu_reference()
+{
+	if(!volume.has_voxels())
+	{
+		cout << "the CPU reference needs the voxels on the host, load with --host-copy" << endl;
+		return;
+	}
+	if(!cpu_raycaster) cpu_raycaster = new CpuRaycaster();
+
+	// a plain frame, not the refined image, which the CPU raycaster does not make
+	if(progressive)
+		render_frame();
+	vector<float> gpu;
+	read_final_image(gpu);
+
+	vector<float> cpu;
+	cpu_raycaster->set_occupancy_grid(march_variant.skip_empty ? &occupancy : NULL);
+	cpu_raycaster->set_variant(march_variant);
+	cpu_raycaster->set_transfer_function(&transfer_function);
+	cpu_raycaster->set_preintegration(preintegrated && !preintegration.empty() ? &preintegration : NULL);
+	cpu_raycaster->set_level_of_detail(lod_active() ? &pyramid : NULL);
+	cpu_raycaster->render(volume, camera, stepsize, render_size, render_size, cpu);
+
+	double sum = 0.0;
+	float max_err = 0.0f;
+	int bad = 0;
+	for(size_t i = 0; i < cpu.size(); i++)
+	{
+		float err = fabs(cpu[i] - gpu[i]);
+		sum += err;
+		max_err = max(max_err, err);
+		if(err > 1.0f/64.0f) bad++;
+	}
+	cout << "cpu vs gl final_image: max error " << max_err
+		 << ", mean error " << sum / cpu.size()
+		 << ", " << bad << " channels off by more than 1/64" << endl;
+}
+
+//--------------------------------------------------------------------------------------
+// write what is still in flight of a recording and report it
+//--------------------------------------------------------------------------------------
+void stop_capture()
+{
+	frame_capture.finish();
+	cout << "recorded " << frame_capture.frames << " frames, the render loop waited " << frame_capture.stall_ms
+		 << " ms for the writers ( " << frame_capture.stalls << " times ), "
+		 << (frame_capture.frames ? frame_capture.write_ms / frame_capture.frames : 0.0) << " ms/frame writing" << endl;
+}
+
+//--------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------
+void KeyboardUpCallback(unsigned char key, int x, int y)
+{
+	gKeys[key] = false;
+
+	switch (key)
+	{
+	case 27 :
+		{
+			if(profile_file) profiler.write(profile_file);
+			if(frame_capture.enabled()) stop_capture();
+			stop_series();
+			print_insitu_stats();
+			exit(0); break; 
+		}
+	case ' ':
+		toggle_visuals = !toggle_visuals;
+		break;
+	case 'c':
+		compare_cpu_reference();
+		break;
+	case 's':
+		march_variant.skip_empty = !march_variant.skip_empty;
+		cout << "empty space skipping " << (march_variant.skip_empty ? "on" : "off") << endl;
+		break;
+	case 'v':
+		march_variant.compositing = Compositing((march_variant.compositing + 1) % COMPOSITINGS);
+		cout << "compositing " << compositing_name(march_variant.compositing) << endl;
+		break;
+	case 'k':
+		compute_raycasting = !compute_raycasting;
+		cout << (compute_raycasting ? "compute shader" : "rasterized") << " raycasting" << endl;
+		break;
+	case 'o':
+		show_profile = !show_profile;
+		break;
+	case 'p':
+		single_pass = !single_pass;
+		cout << (single_pass ? "single pass" : "two pass") << " raycasting" << endl;
+		break;
+	case '[':
+		transfer_function.shift(-1.0f/64.0f);
+		transfer_function_changed();
+		break;
+	case ']':
+		transfer_function.shift(1.0f/64.0f);
+		transfer_function_changed();
+		break;
+	case '-':
+		transfer_function.scale_opacity(0.8f);
+		transfer_function_changed();
+		break;
+	case '=':
+		transfer_function.scale_opacity(1.25f);
+		transfer_function_changed();
+		break;
+	case 'i':
+		preintegrated = !preintegrated;
+		cout << "pre-integrated transfer function " << (preintegrated ? "on" : "off") << endl;
+		break;
+	case 'l':
+		level_of_detail = !level_of_detail;
+		if(level_of_detail && level_of_detail_unavailable())
+			cout << level_of_detail_unavailable() << endl;
+		upload_pyramid();
+		cout << "level of detail " << (lod_active() ? "on" : "off") << endl;
+		break;
+	case 'r':
+		progressive = !progressive;
+		refinement.moved(0.0);
+		cout << "progressive refinement " << (progressive ? "on" : "off") << endl;
+		break;
+	case 'm':
+		spin = !spin;
+		break;
+	case 'g':
+		governor.set_budget(governor.enabled() ? 0.0 : governor_budget);
+		cout << "frame time governor " << (governor.enabled() ? "on" : "off") << endl;
+		break;
+	case 'f':
+		if(frame_capture.enabled())
+			stop_capture();
+		else
+		{
+			frame_capture.init(render_size, render_size);
+			captured_frames = 0;
+			cout << "recording to " << capture_pattern << endl;
+		}
+		break;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// dragging with the left button turns the camera
+//--------------------------------------------------------------------------------------
+void mouse(int button, int state, int x, int y)
+{
+	drag_x = button == GLUT_LEFT_BUTTON && state == GLUT_DOWN ? x : -1;
+}
+
+void motion(int x, int y)
+{
+	if(drag_x < 0) return;
+	camera.rotate += 0.5f * (x - drag_x);
+	drag_x = x;
+}
+
+//--------------------------------------------------------------------------------------
+// glut idle function
+//--------------------------------------------------------------------------------------
+void idle_func()
+{
+	ProcessKeys();
+	glutPostRedisplay();
+}
+
+//--------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------
+void reshape_ortho(int w, int h)
+{
+	if (h == 0) h = 1;
+	glViewport(0, 0,w,h);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	gluOrtho2D(0, 1, 0, 1);
+	glMatrixMode(GL_MODELVIEW);
+}
+//--------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------
+void resize(int w, int h)
+{
+	if (h == 0) h = 1;
+	glViewport(0, 0, w, h);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	gluPerspective(60.0, (GLfloat)w/(GLfloat)h, 0.01, 400.0);
+	glMatrixMode(GL_MODELVIEW);
+}
+
+//--------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------
+void draw_fullscreen_quad()
+{
+	glDisable(GL_DEPTH_TEST);
+	renderer.draw_quad();
+	glEnable(GL_DEPTH_TEST);
+}
+
+//--------------------------------------------------------------------------------------
+// per pass timings on top of the image, the statistics are refreshed twice
+// a second so they stay readable
+//--------------------------------------------------------------------------------------
+void draw_profile_overlay()
+{
+	static vector<string> lines;
+	static long long refreshed = -1000;
+	if(profiler.frames() - refreshed >= 30)
+	{
+		refreshed = profiler.frames();
+		lines.clear();
+		char line[256];
+		Profiler::Stats fs = profiler.stats(-1, false);
+		snprintf(line, sizeof(line), "frame  %.2f ms  p95 %.2f  p99 %.2f", fs.p50, fs.p95, fs.p99);
+		lines.push_back(line);
+		for(int p = PASS_BACKFACE; p < profiler.num_passes(); p++)
+		{
+			Profiler::Stats c = profiler.stats(p, false), g = profiler.stats(p, true);
+			if(!c.count) continue;
+			snprintf(line, sizeof(line), "%s  cpu %.2f ms  gpu %.2f ms  ( gpu p95 %.2f )",
+					 profiler.pass_name(p), c.p50, g.count ? g.p50 : -1.0, g.count ? g.p95 : -1.0);
+			lines.push_back(line);
+		}
+		if(governor.enabled())
+		{
+			const GovernorDecision& d = governor.decision();
+			snprintf(line, sizeof(line), "governor  %.0f ms budget  level %d  1/%d res  %.2fx step  %.2f ms",
+					 governor.budget_ms(), d.level, d.scale, d.step_scale, d.frame_ms);
+			lines.push_back(line);
+		}
+	}
+
+	glDisable(GL_DEPTH_TEST);
+	glColor3f(1.0, 1.0, 0.0);
+	for(size_t i = 0; i < lines.size(); i++)
+	{
+		glRasterPos2f(0.01, 0.97 - 0.03 * i);
+		for(const char* c = lines[i].c_str(); *c; c++)
+			glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, *c);
+	}
+	glColor3f(1.0, 1.0, 1.0);
+	glEnable(GL_DEPTH_TEST);
+}
+
+//--------------------------------------------------------------------------------------
+// display the final image on the screen
+//--------------------------------------------------------------------------------------
+void render_buffer_to_screen()
+{
+	ProfileScope timing(profiler, PASS_TO_SCREEN);
+	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+	glLoadIdentity();
+	glEnable(GL_TEXTURE_2D);
+	if(toggle_visuals)
+		glBindTexture(GL_TEXTURE_2D,show_accum ? accum_image : final_image);
+	else
+		glBindTexture(GL_TEXTURE_2D,backface_buffer);
+	reshape_ortho(WINDOW_SIZE,WINDOW_SIZE);
+	draw_fullscreen_quad();
+	glDisable(GL_TEXTURE_2D);
+	if(show_profile)
+		draw_profile_overlay();
+}
+
+//--------------------------------------------------------------------------------------
+// pixels per side of the frame render_frame() renders, coarse passes fill
+// the lower left corner of the render targets
+//--------------------------------------------------------------------------------------
+int frame_size()
+{
+	return max(render_size / frame_pass.scale, 1);
+}
+
+//--------------------------------------------------------------------------------------
+// render the backface to the offscreen buffer backface_buffer
+//--------------------------------------------------------------------------------------
+void render_backface()
+{
+	ProfileScope timing(profiler, PASS_BACKFACE);
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, backface_buffer, 0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_FRONT);
+	renderer.draw_cube();
+	glDisable(GL_CULL_FACE);
+}
+
+//--------------------------------------------------------------------------------------
+// the compute backend of raycasting_pass(): a work group for every tile of
+// the frame the cube covers, written to final_image ( and the brick feedback )
+// with imageStore
+//--------------------------------------------------------------------------------------
+void dispatch_raycasting_tiles(const UniformCache& u)
+{
+	const int size = frame_size();
+	Matrix4 mvp = camera.projection(size, size) * camera.modelview();
+	if(frame_pass.jitter[0] != 0.0f || frame_pass.jitter[1] != 0.0f)
+		mvp = Matrix4::translation(2.0f * frame_pass.jitter[0] / size, 2.0f * frame_pass.jitter[1] / size, 0.0f) * mvp;
+	tile_dispatch.build(mvp, size, size, compute_tile);
+	const Vector3 eye = camera.modelview().inverse().transformPoint(Vector3(0.0f, 0.0f, 0.0f));
+	const int count = tile_dispatch.count();
+	glUniform1i(u[U_TILE_COUNT], count);
+	glUniform1i(u[U_FRAME_PIXELS], size);
+	glUniform2f(u[U_PIXEL_JITTER], frame_pass.jitter[0], frame_pass.jitter[1]);
+	glUniformMatrix4fv(u[U_INV_MVP], 1, GL_FALSE, mvp.inverse().m);
+	glUniform3f(u[U_EYE], eye.x(), eye.y(), eye.z());
+	if(count == 0)
+		return;
+
+	if(!tile_buffer)
+		glGenBuffers(1, &tile_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, tile_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, tile_dispatch.tiles.size() * sizeof(int), &tile_dispatch.tiles[0], GL_STREAM_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, tile_buffer);
+	glBindImageTexture(0, final_image, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	if(bricked)
+		glBindImageTexture(1, feedback_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+	// a second dimension of work groups for more tiles than one may count
+	const int groups_x = min(count, 65535);
+	glDispatchCompute(groups_x, (count + groups_x - 1) / groups_x, 1);
+	// the images are sampled, read back or read from the framebuffer next
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT |
+					GL_PIXEL_BUFFER_BARRIER_BIT);
+
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
 //--------------------------------------------------------------------------------------
 //
 //--------------------------------------------------------------------------------------
-void draw_fullscreen_quad()
+void raycasting_pass()
+{
+	ProfileScope timing(profiler, PASS_RAYCAST);
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, final_image, 0);
+	const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0_EXT, GL_COLOR_ATTACHMENT1_EXT };
+	if(bricked)
+	{
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT, GL_TEXTURE_2D, feedback_texture, 0);
+		glDrawBuffers(2, draw_buffers);
+	}
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+    
+    // set step size: 
+    use_raycast_variant();
+    const UniformCache& u = raycast_uniforms;
+    glUseProgram( g_shaderProgram );
+    glUniform1f( u[U_STEPSIZE], min( stepsize * frame_pass.step_scale, 0.25f ) );
+    glUniform1f( u[U_RAY_OFFSET], frame_pass.ray_offset );
+    glUniform1f( u[U_FRAME_SCALE], float( frame_size() ) / render_size );
+
+    // set backface texture, unused in single pass mode
+    glUniform1i( u[U_SINGLE_PASS], single_pass );
+    glActiveTexture(GL_TEXTURE0 );
+    glBindTexture(GL_TEXTURE_2D, single_pass ? 0 : backface_buffer);
+    
+    // set 3D volume textures:
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, volume_texture);
+
+    // empty space skipping
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, occupancy_texture);
+    glUniform3f( u[U_CELLS_PER_UNIT], occupancy.cells_per_unit[0], occupancy.cells_per_unit[1], occupancy.cells_per_unit[2] );
+    glUniform3f( u[U_CELL_COUNT], occupancy.nx, occupancy.ny, occupancy.nz );
+
+    // classification of scalar volumes
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_1D, transfer_texture);
+    glUniform1i( u[U_SCALAR_VOLUME], volume.is_scalar() );
+
+    // pre-integrated segments once the table is there
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, preintegration_texture);
+    glUniform1i( u[U_PREINTEGRATED], preintegrated && volume.is_scalar() && !preintegration.empty() );
+
+    // bricks through the page table, volume_texture holds the atlas
+    const BrickLayout& layout = bricked_volume.layout;
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_3D, bricked ? page_texture : 0);
+    glUniform1i( u[U_BRICKED], bricked );
+    glUniform3f( u[U_VOLUME_DIMS], volume.width, volume.height, volume.depth );
+    glUniform3f( u[U_BRICK_COUNT], layout.bricks[0], layout.bricks[1], layout.bricks[2] );
+    glUniform1f( u[U_BRICK_SIZE], layout.brick_size );
+    glUniform3f( u[U_ATLAS_SIZE], layout.slots[0] * layout.padded, layout.slots[1] * layout.padded, layout.slots[2] * layout.padded );
+    glUniform1f( u[U_FEEDBACK_FRAME], float(brick_frame % 16) );
+
+    // level of detail from the pyramid, lod_pixel is the width of a pixel at unit distance
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_3D, lod_active() ? lod_texture : 0);
+    glUniform1i( u[U_LOD], lod_active() );
+    glUniform1f( u[U_LOD_PIXEL], 2.0f * tanf(camera.fovy * 0.5f * float(M_PI) / 180.0f) / frame_size() );
+    
+    // only with --debug-gl, both stall the pipeline
+    renderer.validate( g_shaderProgram );
+    renderer.check( "raycasting_pass" );
+    
+    // the compute backend covers the frame with tiles instead of drawing the cube
+    if( raycast_compute )
+        dispatch_raycasting_tiles( u );
+    else
+    {
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        renderer.draw_cube();
+        glDisable(GL_CULL_FACE);
+    }
+	
+    glUseProgram(0);
+    if(bricked)
+        glDrawBuffers(1, draw_buffers); // the feedback stays attached for page_in_bricks()
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+}
+
+//--------------------------------------------------------------------------------------
+// page in the most requested missing bricks of a feedback image: read in
+// parallel from the host copy or the mapped file, then uploaded into their
+// atlas slots. Bricks used in this frame are never evicted for them.
+//--------------------------------------------------------------------------------------
+void page_in_feedback(const unsigned char* feedback, size_t pixels)
+{
+	static vector<unsigned char> staging;
+	static bool warned = false;
+	vector<int> misses;
+	BrickedVolume& bv = bricked_volume;
+	bv.read_feedback(feedback, pixels, brick_frame, misses);
+	brick_misses = int(misses.size());
+
+	vector<int> placed, slots;
+	for(size_t i = 0; i < misses.size() && int(placed.size()) < bricks_per_frame; i++)
+	{
+		int slot = bv.place(misses[i], brick_frame);
+		if(slot < 0)
+		{
+			if(!warned) cout << "every atlas slot is in use, raise --atlas-mb" << endl;
+			warned = true;
+			break;
+		}
+		placed.push_back(misses[i]);
+		slots.push_back(slot);
+	}
+	brick_uploads += int(placed.size());
+	if(placed.empty()) return;
+
+	const size_t bytes = bv.brick_bytes();
+	staging.resize(placed.size() * bytes);
+	brick_pool->parallel_for(int(placed.size()), [&](int i, int)
+	{
+		bv.read_brick(placed[i], &staging[i * bytes]);
+	});
+
+	const BrickLayout& layout = bv.layout;
+	const int p = layout.padded;
+	const GLenum format = volume.format == VOLUME_RGBA8 ? GL_RGBA : GL_RED;
+	const GLenum type = volume.format == VOLUME_R16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glBindTexture(GL_TEXTURE_3D, volume_texture);
+	for(size_t i = 0; i < placed.size(); i++)
+	{
+		int c[3];
+		layout.slot_coords(slots[i], c);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, c[0] * p, c[1] * p, c[2] * p, p, p, p, format, type, &staging[i * bytes]);
+	}
+	glBindTexture(GL_TEXTURE_3D, 0);
+	upload_page_table();
+}
+
+// the feedback of an earlier frame once its copy is done, or with wait
+// set once it is done; the read is finished either way
+void page_in_feedback(FeedbackRead& r, bool wait)
+{
+	GLenum s = glClientWaitSync(r.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+	if(s != GL_ALREADY_SIGNALED && s != GL_CONDITION_SATISFIED && !wait) return;
+	glDeleteSync(r.fence);
+	r.fence = 0;
+	if(s != GL_ALREADY_SIGNALED && s != GL_CONDITION_SATISFIED) return;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+	const unsigned char* p = (const unsigned char*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if(p)
+	{
+		page_in_feedback(p, size_t(r.size) * r.size);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+//--------------------------------------------------------------------------------------
+// after the raycasting pass, with the framebuffer still bound: its brick
+// feedback, only the frame_size() corner it drew, is copied into the next
+// of two pixel buffer objects and fenced, and the bricks the frame before
+// asked for are paged in once its copy has landed, so the frame never
+// waits for its own readback. With feedback_wait set the bricks of this
+// frame are paged in right away. Without GL_ARB_pixel_buffer_object or
+// GL_ARB_sync the feedback is read back at once.
+//--------------------------------------------------------------------------------------
+void page_in_bricks()
+{
+	static vector<unsigned char> feedback;
+	const int size = frame_size();
+	brick_frame++;
+	brick_uploads = 0;
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadBuffer(GL_COLOR_ATTACHMENT1_EXT);
+	FeedbackRead& r = feedback_reads[feedback_next];
+	if(r.pbo)
+	{
+		// two frames old, so its copy has landed long ago
+		if(r.fence) page_in_feedback(r, true);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, r.pbo);
+		glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		r.size = size;
+	}
+	else
+	{
+		feedback.resize(size_t(size) * size * 4);
+		glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, &feedback[0]);
+	}
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT, GL_TEXTURE_2D, 0, 0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+	feedback_next ^= 1;
+	if(!r.pbo)
+	{
+		page_in_feedback(&feedback[0], size_t(size) * size);
+		return;
+	}
+	FeedbackRead& previous = feedback_reads[feedback_next];
+	if(previous.fence) page_in_feedback(previous, feedback_wait);
+	if(feedback_wait) page_in_feedback(r, true);
+}
+
+//--------------------------------------------------------------------------------------
+// render the volume for the current camera into final_image, as frame_pass
+// says
+//--------------------------------------------------------------------------------------
+void render_frame()
+{
+	const int size = frame_size();
+	resize(size,size);
+	if(frame_pass.jitter[0] != 0.0f || frame_pass.jitter[1] != 0.0f)
+	{
+		// shift the image by a fraction of a pixel
+		glMatrixMode(GL_PROJECTION);
+		glLoadIdentity();
+		glTranslatef(2.0f * frame_pass.jitter[0] / size, 2.0f * frame_pass.jitter[1] / size, 0.0f);
+		gluPerspective(camera.fovy, 1.0, 0.01, 400.0);
+		glMatrixMode(GL_MODELVIEW);
+	}
+	enable_renderbuffers();
+
+	glLoadMatrixf(camera.modelview().m); // center the texturecube and spin it
+	use_raycast_variant();
+	// the compute backend finds the back face itself
+	if(!single_pass && !raycast_compute)
+		render_backface();
+	raycasting_pass();
+	if(bricked)
+		page_in_bricks();
+	disable_renderbuffers();
+}
+
+//--------------------------------------------------------------------------------------
+// render_frame(), and for a bricked volume again until no brick is missing,
+// for batch modes that want whole images. A view that needs more bricks
+// than the atlas holds keeps evicting what it needs, so this gives up once
+// a whole atlas was paged in.
+//--------------------------------------------------------------------------------------
+void render_complete_frame()
+{
+	feedback_wait = true;
+	render_frame();
+	int uploads = brick_uploads;
+	while(bricked && brick_misses && brick_uploads && uploads <= bricked_volume.layout.slot_count())
+	{
+		render_frame();
+		uploads += brick_uploads;
+	}
+	feedback_wait = false;
+	if(bricked && brick_misses)
+		cout << brick_misses << " bricks still missing, the atlas is too small for this view" << endl;
+}
+
+//--------------------------------------------------------------------------------------
+// whether anything the image depends on changed since the last call
+//--------------------------------------------------------------------------------------
+bool view_changed()
+{
+	static vector<float> last;
+	const float state[] = { camera.rotate, camera.distance, stepsize, float(transfer_function.revision),
+							float(preintegrated), float(lod_active()), float(single_pass),
+							float(march_variant.compositing), march_variant.early_exit, float(compute_raycasting) };
+	vector<float> key(state, state + sizeof(state) / sizeof(state[0]));
+	bool changed = key != last;
+	last = key;
+	return changed;
+}
+
+//--------------------------------------------------------------------------------------
+// scale the coarse frame in the corner of final_image up to all of accum_image
+//--------------------------------------------------------------------------------------
+void upsample_frame()
+{
+	enable_renderbuffers();
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, accum_image, 0);
+	reshape_ortho(render_size, render_size);
+	glLoadIdentity();
+	glUseProgram(g_upsampleProgram);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, final_image);
+	glUniform2f(upsample_uniforms[U_LOW_SIZE], frame_size(), frame_size());
+	glUniform1f(upsample_uniforms[U_TEXEL], 1.0f / render_size);
+	glUniform1f(upsample_uniforms[U_SHARPNESS], 64.0f);
+	draw_fullscreen_quad();
+	glUseProgram(0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	disable_renderbuffers();
+	show_accum = true;
+}
+
+//--------------------------------------------------------------------------------------
+// blend final_image into accum_image with the given weight, which keeps
+// accum_image the mean of the frames since the last weight of 1
+//--------------------------------------------------------------------------------------
+void accumulate_frame(float weight)
+{
+	enable_renderbuffers();
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, accum_image, 0);
+	reshape_ortho(render_size, render_size);
+	glLoadIdentity();
+	glEnable(GL_BLEND);
+	glBlendColor(0.0f, 0.0f, 0.0f, weight);
+	glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, final_image);
+	draw_fullscreen_quad();
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glDisable(GL_TEXTURE_2D);
+	glDisable(GL_BLEND);
+	disable_renderbuffers();
+	show_accum = true;
+}
+
+//--------------------------------------------------------------------------------------
+// one frame of progressive refinement into accum_image: a coarse frame,
+// upsampled, while the view changes, else the next refinement pass. Once
+// the image is final nothing is rendered. Returns whether the frame was
+// rendered as the governor says.
+//--------------------------------------------------------------------------------------
+bool render_progressive_frame()
+{
+	const double now = chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+	if(view_changed())
+		refinement.moved(now);
+	if(refinement.done(now))
+		return false;
+	frame_pass = refinement.next(now);
+	const bool governed = frame_pass.coarse && governor.enabled();
+	if(governed)
+	{
+		frame_pass.scale = governor.decision().scale;
+		frame_pass.step_scale = governor.decision().step_scale;
+	}
+	render_frame();
+	if(frame_pass.coarse)
+		upsample_frame();
+	else
+		accumulate_frame(frame_pass.weight);
+	// bricks paged in after the frame change the image, start the mean over
+	if(bricked && brick_uploads)
+		refinement.restart();
+	frame_pass = ProgressivePass();
+	return governed;
+}
+
+//--------------------------------------------------------------------------------------
+// one frame at the resolution and step the governor asks for, scaled up to
+// accum_image when it is not the full resolution
+//--------------------------------------------------------------------------------------
+void render_governed_frame()
+{
+	frame_pass.scale = governor.decision().scale;
+	frame_pass.step_scale = governor.decision().step_scale;
+	render_frame();
+	if(frame_pass.scale > 1)
+		upsample_frame();
+	else
+		show_accum = false;
+	frame_pass = ProgressivePass();
+}
+
+//--------------------------------------------------------------------------------------
+// feed the times of governed frames to the governor and report new
+// decisions. A frame counts once the profiler has its GPU time, a frame or
+// two after it was rendered, so nothing waits for the GPU; its time is the
+// longer of the GPU time and the wall clock time to the next frame, and
+// frames of a level the governor has left since are skipped. Without
+// timer queries the wall clock time is all there is.
+//--------------------------------------------------------------------------------------
+void govern()
+{
+	while(!governed_frames.empty())
+	{
+		const Profiler::Frame* fr = profiler.finished(governed_frames.front().first);
+		if(!fr && governed_frames.front().first >= profiler.frames() - Profiler::HISTORY_FRAMES) return;
+		const int level = governed_frames.front().second;
+		governed_frames.pop_front();
+		if(!fr || level != governor.decision().level) continue;
+		if(!governor.frame(max(fr->interval_ms, fr->gpu_frame_ms))) continue;
+		const GovernorDecision& d = governor.decision();
+		cout << "governor: " << d.frame_ms << " ms for a " << governor.budget_ms() << " ms budget, level " << d.level
+			 << ": 1/" << d.scale << " resolution, " << d.step_scale << "x step" << endl;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// This display function is called once pr frame 
+//--------------------------------------------------------------------------------------
+void display()
+{
+	if(spin)
+		camera.rotate += 0.25;
+
+	// a table finished by the builder thread
+	if(preintegration_builder && preintegration_builder->poll(preintegration))
+	{
+		upload_preintegration();
+		cout << "pre-integration table rebuilt in " << preintegration_builder->last_build_ms() << " ms ( "
+			 << preintegration_builder->last_build_entries() << " entries )" << endl;
+		refinement.restart();
+	}
+	update_series();
+	if(insitu_name)
+		update_insitu();
+
+	profiler.begin_frame();
+	bool governed = false;
+	if(progressive)
+		governed = render_progressive_frame();
+	else if(governor.enabled())
+	{
+		render_governed_frame();
+		governed = true;
+	}
+	else
+	{
+		render_frame();
+		show_accum = false;
+	}
+	render_buffer_to_screen();
+	glutSwapBuffers();
+	if(frame_capture.enabled())
+	{
+		char filename[1024];
+		snprintf(filename, sizeof(filename), capture_pattern, captured_frames++);
+		frame_capture.capture(show_accum ? accum_image : final_image, filename);
+	}
+	profiler.end_frame();
+	if(governed)
+		governed_frames.push_back(make_pair(profiler.frames() - 1, governor.decision().level));
+	govern();
+}
+
+//--------------------------------------------------------------------------------------
+// render frames on the CPU only, no GL context is needed for this
+//--------------------------------------------------------------------------------------
+int run_cpu_renderer(int argc, char* argv[])
+{
+	int threads = 0;
+	int frames = 100;
+	const char* out = "cpu_frame.ppm";
+	const char* simd = NULL;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--threads") && i+1 < argc) threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--simd") && i+1 < argc) simd = argv[++i];
+		else if(!strcmp(argv[i], "--no-skip")) march_variant.skip_empty = false;
+		else if(!strcmp(argv[i], "--frames") && i+1 < argc) frames = max(atoi(argv[++i]), 1);
+		else if(!strcmp(argv[i], "--out") && i+1 < argc) out = argv[++i];
+	}
+
+	create_host_volume();
+	update_preintegration();
+	update_pyramid();
+	CpuRaycaster raycaster(threads);
+	raycaster.set_occupancy_grid(march_variant.skip_empty ? &occupancy : NULL);
+	raycaster.set_variant(march_variant);
+	raycaster.set_transfer_function(&transfer_function);
+	raycaster.set_preintegration(preintegrated && volume.is_scalar() ? &preintegration : NULL);
+	raycaster.set_level_of_detail(level_of_detail ? &pyramid : NULL);
+	if(simd)
+	{
+		SimdLevel level = SIMD_SCALAR;
+		if(!strcmp(simd, "avx2")) level = SIMD_AVX2;
+		else if(!strcmp(simd, "avx512")) level = SIMD_AVX512;
+		if(!raycaster.set_simd_level(level))
+			cout << simd << " is not supported by this CPU, using " << simd_level_name(raycaster.simd_level()) << endl;
+	}
+	cout << "cpu raycaster: " << raycaster.num_threads() << " threads, "
+		 << simd_level_name(raycaster.simd_level()) << " kernel, "
+		 << WINDOW_SIZE << "x" << WINDOW_SIZE << ", " << frames << " frames" << endl;
+
+	vector<float> image;
+	long long samples = 0;
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	for(int f = 0; f < frames; f++)
+	{
+		camera.rotate += 0.25;
+		raycaster.render(volume, camera, stepsize, WINDOW_SIZE, WINDOW_SIZE, image);
+		samples += raycaster.last_samples();
+	}
+	double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	cout << frames / secs << " frames/sec ( " << 1000.0 * secs / frames << " ms/frame ), "
+		 << double(samples) / frames / (WINDOW_SIZE * WINDOW_SIZE) << " samples/pixel"
+		 << ( march_variant.skip_empty ? "" : " ( no empty space skipping )" ) << endl;
+
+	write_ppm(out, &image[0], WINDOW_SIZE, WINDOW_SIZE);
+	return 0;
+}
+
+//--------------------------------------------------------------------------------------
+// the composited sort-last frame against the CPU raycaster marching the
+// whole volume in one process with the same view, step and skipping; the
+// bricks take the samples of the counted loop, so that is the reference
+//--------------------------------------------------------------------------------------
+bool check_sort_last(const vector<float>& composited, int threads)
+{
+	create_host_volume();
+	RayMarchVariant v = march_variant;
+	v.compositing = COMPOSITE_DVR;
+	v.loop = LOOP_COUNTED;
+	CpuRaycaster raycaster(threads);
+	raycaster.set_occupancy_grid(v.skip_empty ? &occupancy : NULL);
+	raycaster.set_variant(v);
+	raycaster.set_transfer_function(&transfer_function);
+	vector<float> single;
+	raycaster.render(volume, camera, stepsize, WINDOW_SIZE, WINDOW_SIZE, single);
+
+	double sum = 0.0;
+	float max_err = 0.0f;
+	int bad = 0;
+	for(size_t i = 0; i < single.size(); i++)
+	{
+		float err = fabs(single[i] - composited[i]);
+		sum += err;
+		max_err = max(max_err, err);
+		if(err > 1.0f/255.0f) bad++;
+	}
+	cout << "sort-last vs one process: max error " << max_err
+		 << ", mean error " << sum / single.size()
+		 << ", " << bad << " channels off by more than 1/255" << endl;
+	return bad == 0;
+}
+
+//--------------------------------------------------------------------------------------
+// sort-last parallel rendering on the CPU: every process holds and marches
+// one brick of the volume, and binary-swap compositing puts each frame
+// together on rank 0. --sort-last N forks N processes on this machine;
+// --rank R --peers host:port,... is rank R of processes started on several
+// nodes, all with the same options. No GL context is needed. A brick
+// cannot know the opacity of the bricks in front of it, so rays are never
+// ended early and --early-exit 0 must be given; --check renders the last
+// frame again in one process and compares the two.
+//--------------------------------------------------------------------------------------
+int run_sort_last(int argc, char* argv[])
+{
+	int processes = 1, rank = -1, threads = 0, frames = 10;
+	bool slabs = false, check = false;
+	const char* out = "sort_last_frame.ppm";
+	vector<string> peers;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--sort-last") && i+1 < argc) processes = max(atoi(argv[++i]), 1);
+		else if(!strcmp(argv[i], "--rank") && i+1 < argc) rank = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--peers") && i+1 < argc)
+		{
+			stringstream list(argv[++i]);
+			string peer;
+			while(getline(list, peer, ','))
+				if(!peer.empty()) peers.push_back(peer);
+		}
+		else if(!strcmp(argv[i], "--split") && i+1 < argc) slabs = !strcmp(argv[++i], "slabs");
+		else if(!strcmp(argv[i], "--threads") && i+1 < argc) threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--frames") && i+1 < argc) frames = max(atoi(argv[++i]), 1);
+		else if(!strcmp(argv[i], "--out") && i+1 < argc) out = argv[++i];
+		else if(!strcmp(argv[i], "--check")) check = true;
+	}
+	if(march_variant.early_exit > 0.0f)
+	{
+		cout << "sort-last marches every brick to its end and cannot end a ray early as one process does, "
+			 << "give --early-exit 0" << endl;
+		return 1;
+	}
+
+	// before any thread exists, fork() only copies the calling one
+	Communicator comm;
+	if(!peers.empty() ? !comm.connect(rank, peers) : !comm.spawn(processes))
+		return 1;
+	if(threads <= 0)
+		threads = max(int(thread::hardware_concurrency()) / comm.size, 1);
+
+	int k[3];
+	split_bricks(comm.size, slabs, k);
+	ThreadPool pool(threads);
+	SortLastBrick brick;
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	if(volume_file && is_brick_file(volume_file))
+	{
+		// only the file bricks the brick overlaps are read
+		BrickFile file;
+		if(!file.open(volume_file)) return 1;
+		volume_format = file.format();
+		brick.place(file.header.dims, k, comm.rank);
+		if(!brick.read(file, pool))
+		{
+			cout << volume_file << ": could not read the bricks" << endl;
+			return 1;
+		}
+	}
+	else if(volume_file)
+	{
+		// only the rows of the brick are converted out of the mapping; the
+		// value range still comes from the whole file, so every rank
+		// scales its voxels the same
+		VolumeFile file;
+		if(!file.open(volume_file, raw_layout, volume_format)) return 1;
+		if(file.needs_range()) file.scan_range();
+		volume_format = file.format;
+		brick.place(file.info.dims, k, comm.rank);
+		brick.read(file, pool);
+	}
+	else
+	{
+		const int dims[3] = { volume_size, volume_size, volume_size };
+		int g0[3], g1[3];
+		brick.place(dims, k, comm.rank);
+		brick.ghost_range(g0, g1);
+		ProceduralVolume generator = volume_format == VOLUME_RGBA8 ? test_volume(volume_size)
+																	: test_scalar_volume(volume_size, volume_format);
+		generator.generate_region(brick.voxels, g0, g1, volume_format, threads);
+	}
+	brick.build_grid(&transfer_function);
+	const double load_s = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+	if(comm.rank == 0)
+	{
+		cout << "sort-last: " << comm.size << " processes, " << k[0] << "x" << k[1] << "x" << k[2] << " bricks, "
+			 << threads << " threads each, " << WINDOW_SIZE << "x" << WINDOW_SIZE << ", " << frames << " frames" << endl;
+		cout << "rank 0 brick " << brick.voxels.width << "x" << brick.voxels.height << "x" << brick.voxels.depth
+			 << " voxels ( " << brick.voxels.bytes() / 1048576.0 << " MB ), ready in " << load_s << " s" << endl;
+		if(preintegrated || level_of_detail || march_variant.compositing != COMPOSITE_DVR)
+			cout << "sort-last rendering composites point sampled DVR only, other modes are ignored" << endl;
+	}
+
+	const size_t pixels = size_t(WINDOW_SIZE) * WINDOW_SIZE;
+	vector<float> partial, image;
+	SwapStats stats;
+	double render_ms = 0.0, composite_ms = 0.0;
+	long long samples = 0;
+	bool ok = true;
+	for(int f = 0; ok && f < frames; f++)
+	{
+		camera.rotate += 0.25;
+		const Vector3 eye = camera.modelview().inverse().transformPoint(Vector3(0.0f, 0.0f, 0.0f));
+		const int dims[3] = { brick.full[0], brick.full[1], brick.full[2] };
+		vector<int> order = visibility_order(k, dims, eye);
+
+		chrono::steady_clock::time_point r0 = chrono::steady_clock::now();
+		samples += render_partial(pool, brick, camera, stepsize, WINDOW_SIZE, WINDOW_SIZE,
+								  march_variant.skip_empty, &transfer_function, partial);
+		chrono::steady_clock::time_point r1 = chrono::steady_clock::now();
+		ok = binary_swap(comm, order, partial, pixels, image, stats);
+		render_ms += chrono::duration<double, milli>(r1 - r0).count();
+		composite_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - r1).count();
+	}
+
+	// the slowest rank sets the frame rate
+	double times[2] = { render_ms, composite_ms };
+	if(ok && comm.rank != 0)
+		ok = comm.send(0, times, sizeof(times));
+	if(ok && comm.rank == 0)
+	{
+		double slowest = render_ms;
+		for(int r = 1; ok && r < comm.size; r++)
+		{
+			ok = comm.recv(r, times, sizeof(times));
+			slowest = max(slowest, times[0]);
+		}
+		if(ok)
+		{
+			cout << "render " << slowest / frames << " ms/frame on the slowest rank ( rank 0 "
+				 << render_ms / frames << " ms, " << double(samples) / frames / pixels << " samples/pixel )" << endl;
+			cout << "binary swap " << composite_ms / frames << " ms/frame on rank 0 ( waiting for slower ranks included ), "
+				 << stats.stages << " stages, " << stats.bytes_sent / 1048576.0 << " MB sent by rank 0 per frame" << endl;
+			write_ppm(out, &image[0], WINDOW_SIZE, WINDOW_SIZE);
+		}
+	}
+	comm.finish();
+	if(ok && check && comm.rank == 0)
+		ok = check_sort_last(image, threads);
+	return ok ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// how many samples pre-integration saves at equal quality: renders a few
+// views of the scalar volume on the CPU with a fine step as reference, then
+// finds the largest pre-integrated step whose error is no worse than point
+// sampling at the current stepsize
+//--------------------------------------------------------------------------------------
+double quality_error(CpuRaycaster& raycaster, const vector<vector<float> >& reference,
+					 const int* angles, int views, int size, float step, long long& samples)
 {
-	glDisable(GL_DEPTH_TEST);
-	glBegin(GL_QUADS);
-   
-	glTexCoord2f(0,0); 
-	glVertex2f(0,0);
+	vector<float> image;
+	double sum = 0.0;
+	samples = 0;
+	for(int v = 0; v < views; v++)
+	{
+		camera = Camera();
+		camera.rotate = angles[v];
+		raycaster.render(volume, camera, step, size, size, image);
+		samples += raycaster.last_samples();
+		for(size_t i = 0; i < image.size(); i++)
+			if(i % 4 != 3)
+			{
+				double d = image[i] - reference[v][i];
+				sum += d * d;
+			}
+	}
+	return sqrt(sum / (double(views) * size * size * 3));
+}
 
-	glTexCoord2f(1,0); 
-	glVertex2f(1,0);
+int run_quality_study(int argc, char* argv[])
+{
+	int size = 400;
+	for(int i = 1; i < argc; i++)
+		if(!strcmp(argv[i], "--size") && i+1 < argc) size = atoi(argv[++i]);
 
-	glTexCoord2f(1, 1); 
+	if(volume_format == VOLUME_RGBA8 && !volume_file) volume_format = VOLUME_R8;
+	create_host_volume();
+	preintegration.build(transfer_function);
+	CpuRaycaster raycaster;
+	raycaster.set_occupancy_grid(march_variant.skip_empty ? &occupancy : NULL);
+	raycaster.set_variant(march_variant);
+	raycaster.set_transfer_function(&transfer_function);
 
-	glVertex2f(1, 1);
-	glTexCoord2f(0, 1); 
-	glVertex2f(0, 1);
+	// 1/250 still reaches through the cube diagonal in 450 steps
+	const int angles[] = { 0, 60, 120 };
+	const int views = 3;
+	vector<vector<float> > reference(views);
+	for(int v = 0; v < views; v++)
+	{
+		camera = Camera();
+		camera.rotate = angles[v];
+		raycaster.render(volume, camera, 1.0f/250.0f, size, size, reference[v]);
+	}
 
-	glEnd();
-	glEnable(GL_DEPTH_TEST);
+	long long base_samples, samples;
+	double base_error = quality_error(raycaster, reference, angles, views, size, stepsize, base_samples);
+	printf("%-16s %8s %12s %10s\n", "mode", "steps", "samples", "rms error");
+	printf("%-16s %8d %12lld %10.5f\n", "point samples", int(1.0f / stepsize + 0.5f), base_samples, base_error);
 
+	raycaster.set_preintegration(&preintegration);
+	const int steps[] = { 50, 40, 32, 25, 20, 16, 12, 10, 8 };
+	int best = 0;
+	long long best_samples = 0;
+	for(int i = 0; i < int(sizeof(steps) / sizeof(steps[0])); i++)
+	{
+		double error = quality_error(raycaster, reference, angles, views, size, 1.0f / steps[i], samples);
+		printf("%-16s %8d %12lld %10.5f\n", "pre-integrated", steps[i], samples, error);
+		if(error <= base_error && (!best || samples < best_samples))
+		{
+			best = steps[i];
+			best_samples = samples;
+		}
+	}
+	if(best && best_samples < base_samples)
+		cout << "pre-integration matches point sampling at " << int(1.0f / stepsize + 0.5f) << " steps with "
+			 << best << " steps: " << 100.0 * (1.0 - double(best_samples) / base_samples) << "% fewer samples" << endl;
+	else
+		cout << "pre-integration did not reach the error of point sampling in the tested steps" << endl;
+	return 0;
 }
 
+#ifndef __APPLE__
+// the headless context, kept for contexts of other threads that share it
+EGLDisplay headless_display = EGL_NO_DISPLAY;
+EGLConfig headless_config = 0;
+EGLContext headless_context = EGL_NO_CONTEXT;
+#endif
+
 //--------------------------------------------------------------------------------------
-// display the final image on the screen
+// create a GL context without any window system: EGL on the Mesa surfaceless
+// platform, which also works with llvmpipe on machines without a display.
+// All rendering goes to the FBOs, so no surface is needed.
 //--------------------------------------------------------------------------------------
-void render_buffer_to_screen()
+bool create_headless_context()
 {
-	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-	glLoadIdentity();
-	glEnable(GL_TEXTURE_2D);
-	if(toggle_visuals)
-		glBindTexture(GL_TEXTURE_2D,final_image);
+#ifdef __APPLE__
+	cout << "headless rendering needs EGL, which is not available on this platform" << endl;
+	return false;
+#else
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(get_platform_display)
+		display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if(display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+	{
+		cout << "Could not initialize EGL" << endl;
+		return false;
+	}
+	if(!eglBindAPI(EGL_OPENGL_API))
+	{
+		cout << "EGL has no desktop OpenGL support" << endl;
+		return false;
+	}
+
+	// the fixed function matrix stack is still used, so ask for compatibility
+	const EGLint config_attribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	const EGLint context_attribs[] = { EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT, EGL_NONE };
+	EGLConfig config = 0;
+	EGLint num_configs = 0;
+	eglChooseConfig(display, config_attribs, &config, 1, &num_configs);
+	EGLContext context = eglCreateContext(display, num_configs ? config : (EGLConfig)0, EGL_NO_CONTEXT, context_attribs);
+	if(context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		cout << "Could not create a surfaceless GL context ( EGL error 0x" << hex << eglGetError() << dec << " )" << endl;
+		return false;
+	}
+	headless_display = display;
+	headless_config = num_configs ? config : (EGLConfig)0;
+	headless_context = context;
+	cout << "EGL " << major << "." << minor << ", " << glGetString(GL_RENDERER) << endl;
+	return true;
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// make a context of the headless context's share group current on the
+// calling thread, which then sees its textures and sync objects
+//--------------------------------------------------------------------------------------
+bool make_shared_context_current()
+{
+#ifdef __APPLE__
+	return false;
+#else
+	// the bound API is per thread
+	const EGLint context_attribs[] = { EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT, EGL_NONE };
+	EGLContext context = EGL_NO_CONTEXT;
+	if(eglBindAPI(EGL_OPENGL_API))
+		context = eglCreateContext(headless_display, headless_config, headless_context, context_attribs);
+	if(context == EGL_NO_CONTEXT || !eglMakeCurrent(headless_display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		cout << "Could not create a shared GL context ( EGL error 0x" << hex << eglGetError() << dec << " )" << endl;
+		return false;
+	}
+	return true;
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// render a camera path without a window and write every frame to disk
+//--------------------------------------------------------------------------------------
+int run_headless(int argc, char* argv[])
+{
+	const char* path_file = NULL;
+	const char* out = "frame_%04d.ppm";
+	int frames = 0;
+	bool sync_capture = false;
+	int capture_ring = 3, capture_threads = 2;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--path") && i+1 < argc) path_file = argv[++i];
+		else if(!strcmp(argv[i], "--frames") && i+1 < argc) frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--out") && i+1 < argc) out = argv[++i];
+		else if(!strcmp(argv[i], "--no-output")) out = NULL;
+		else if(!strcmp(argv[i], "--sync-capture")) sync_capture = true;
+		else if(!strcmp(argv[i], "--capture-ring") && i+1 < argc) capture_ring = max(atoi(argv[++i]), 2);
+		else if(!strcmp(argv[i], "--capture-threads") && i+1 < argc) capture_threads = max(atoi(argv[++i]), 1);
+	}
+
+	CameraPath path;
+	if(path_file)
+	{
+		if(!path.load(path_file)) return 1;
+		if(frames <= 0) frames = int(path.keys.size());
+	}
 	else
-		glBindTexture(GL_TEXTURE_2D,backface_buffer);
-	reshape_ortho(WINDOW_SIZE,WINDOW_SIZE);
-	draw_fullscreen_quad();
-	glDisable(GL_TEXTURE_2D);
+	{
+		if(frames <= 0) frames = 100;
+		path.make_spin(frames);
+	}
+
+	if(!create_headless_context()) return 1;
+	init();
+	if(out && !sync_capture)
+		frame_capture.init(render_size, render_size, capture_ring, capture_threads);
+
+	vector<float> image;
+	char filename[1024];
+	double render_secs = 0.0;
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	for(int f = 0; f < frames; f++)
+	{
+		camera = path.at(f, frames);
+		profiler.begin_frame();
+		chrono::steady_clock::time_point r0 = chrono::steady_clock::now();
+		update_series();
+		if(insitu_name)
+			update_insitu();
+		bool governed = false;
+		if(progressive)
+			governed = render_progressive_frame();
+		else if(governor.enabled())
+		{
+			render_governed_frame();
+			governed = true;
+		}
+		else
+			render_complete_frame();
+		// governed frames are timed by the profiler and not waited for
+		if(!governed)
+			glFinish();
+		double frame_secs = chrono::duration<double>(chrono::steady_clock::now() - r0).count();
+		render_secs += frame_secs;
+		if(out)
+		{
+			snprintf(filename, sizeof(filename), out, f);
+			if(frame_capture.enabled())
+				frame_capture.capture(show_accum ? accum_image : final_image, filename);
+			else
+			{
+				read_final_image(image, show_accum ? accum_image : 0);
+				if(!write_image(filename, &image[0], render_size, render_size)) return 1;
+			}
+		}
+		profiler.end_frame();
+		if(governed)
+			governed_frames.push_back(make_pair(profiler.frames() - 1, governor.decision().level));
+		govern();
+	}
+	// the last frames are still on their way to disk
+	double loop_secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	const bool capture = frame_capture.enabled();
+	if(capture && !frame_capture.finish()) return 1;
+	double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+	cout << frames << " frames in " << secs << " s: " << frames / secs << " frames/sec total, "
+		 << 1000.0 * render_secs / frames << " ms/frame rendering, "
+		 << 1000.0 * (loop_secs - render_secs) / frames << " ms/frame readback and output in the render loop" << endl;
+	if(capture)
+		cout << "capture: " << frames / loop_secs << " frames/sec in the render loop, waited " << frame_capture.stall_ms
+			 << " ms for a free buffer ( " << frame_capture.stalls << " times ), "
+			 << frame_capture.write_ms / frames << " ms/frame writing on " << capture_threads << " threads, "
+			 << 1000.0 * (secs - loop_secs) << " ms to write the last frames" << endl;
+	stop_series();
+	print_insitu_stats();
+	profiler.print_summary();
+	if(profile_file) profiler.write(profile_file);
+	return 0;
 }
 
 //--------------------------------------------------------------------------------------
-// render the backface to the offscreen buffer backface_buffer
+// frames of the remote server on their way from render to readback: the
+// render thread blits final_image into one of two RGBA8 slots and fences
+// it, the readback thread waits for the fence in a shared context and reads
+// the slot while the next frame renders
 //--------------------------------------------------------------------------------------
-void render_backface()
+struct ReadbackSlot {
+	ReadbackSlot() : texture(0), fbo(0), fence(0), busy(false), render_ms(0.0f) {}
+	GLuint texture, fbo;
+	GLsync fence;
+	bool busy;
+	float render_ms;
+	vector<RemoteTarget> targets;
+};
+
+ReadbackSlot readback_slots[2];
+GLuint readback_source = 0; // FBO of final_image to blit from
+mutex readback_lock;
+condition_variable readback_wake;
+deque<int> readback_queue;
+bool readback_stop = false;
+int readback_state = 0; // 1 once the readback thread has its context, -1 if it failed
+
+void readback_loop(RemoteServer* server)
 {
-	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, backface_buffer, 0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_FRONT);
-	drawQuads(1.0,1.0, 1.0);
-	glDisable(GL_CULL_FACE);
+	const bool ok = make_shared_context_current();
+	unique_lock<mutex> lk(readback_lock);
+	readback_state = ok ? 1 : -1;
+	readback_wake.notify_all();
+	while(ok)
+	{
+		readback_wake.wait(lk, [] { return readback_stop || !readback_queue.empty(); });
+		if(readback_queue.empty()) break;
+		ReadbackSlot& slot = readback_slots[readback_queue.front()];
+		readback_queue.pop_front();
+		lk.unlock();
+
+		chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+		shared_ptr<RemoteFrame> frame = make_shared<RemoteFrame>();
+		while(glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) == GL_TIMEOUT_EXPIRED) {}
+		glDeleteSync(slot.fence);
+		frame->width = frame->height = render_size;
+		frame->rgba.resize(size_t(render_size) * render_size * 4);
+		glBindTexture(GL_TEXTURE_2D, slot.texture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &frame->rgba[0]);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		frame->render_ms = slot.render_ms;
+		frame->readback_ms = float(chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+		vector<RemoteTarget> targets;
+		targets.swap(slot.targets);
+
+		server->deliver(frame, targets);
+		lk.lock();
+		slot.busy = false;
+		readback_wake.notify_all();
+	}
 }
 
 //--------------------------------------------------------------------------------------
-//
+// serve frames to remote clients: render the newest view of every client
+// that waits for one, clients with the same view sharing the frame, and
+// pipeline render, readback and encoding on their own threads
 //--------------------------------------------------------------------------------------
-void raycasting_pass()
+int run_server(int argc, char* argv[])
 {
+	int port = 47000;
+	bool once = false;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--serve") && i+1 < argc) port = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--serve-once")) once = true;
+	}
+	if(!create_headless_context()) return 1;
+	init();
+	if(!GLEW_ARB_sync)
+	{
+		cout << "the remote server needs GL_ARB_sync" << endl;
+		return 1;
+	}
+
+	glGenFramebuffersEXT(1, &readback_source);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, readback_source);
 	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, final_image, 0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-    
-    // set step size: 
-    glUseProgram( g_shaderProgram );
-    //glBindParameterEXT( g_shaderProgram );
-    glUniform1f( glGetUniformLocation( g_shaderProgram, "stepsize" ), stepsize );
+	for(int i = 0; i < 2; i++)
+	{
+		ReadbackSlot& slot = readback_slots[i];
+		glGenTextures(1, &slot.texture);
+		glBindTexture(GL_TEXTURE_2D, slot.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, render_size, render_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glGenFramebuffersEXT(1, &slot.fbo);
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, slot.fbo);
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, slot.texture, 0);
+	}
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
-    // set backface texture 
-    glActiveTexture(GL_TEXTURE0 );
-    glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, backface_buffer);
-    glUniform1i(glGetUniformLocation( g_shaderProgram, "tex" ), 0 ); 
-    
-    if( glGetError() != GL_NO_ERROR ) cout<<" pass 2D texture is wrong..."<<endl;
+	RemoteServer server;
+	thread readback(readback_loop, &server);
+	{
+		unique_lock<mutex> lk(readback_lock);
+		readback_wake.wait(lk, [] { return readback_state != 0; });
+	}
+	if(readback_state < 0 || !server.listen(port))
+	{
+		readback.join();
+		return 1;
+	}
+	cout << "serving " << render_size << "x" << render_size << " frames on port " << port << endl;
 
-    
-    // set 3D volume textures:
-    glActiveTexture(GL_TEXTURE1);
-    glEnable(GL_TEXTURE_3D);
-    glBindTexture(GL_TEXTURE_3D, volume_texture);
-    glUniform1i( glGetUniformLocation( g_shaderProgram, "volume_tex" ) , 1 ); 
-    
-    if( glGetError() != GL_NO_ERROR ) cout<<" pass 3D texture is wrong..."<<endl;
-    
-    // validate shader program
-    validate_shader( g_shaderProgram );
-    
-    //
-    glEnable(GL_CULL_FACE);
-	glCullFace(GL_BACK);
-	drawQuads(1.0,1.0, 1.0);
-	glDisable(GL_CULL_FACE);
-	
-    glUseProgram(0);
-    glActiveTexture(GL_TEXTURE1);
-    glDisable(GL_TEXTURE_3D);
-    glActiveTexture(GL_TEXTURE0);
-    
+	vector<vector<RemoteTarget> > batches;
+	string tf_text;
+	int next_slot = 0;
+	long long frames = 0, shared = 0;
+	while(server.next_views(batches, tf_text, once))
+	{
+		if(!tf_text.empty())
+		{
+			istringstream in(tf_text);
+			if(transfer_function.parse(in, "remote transfer function"))
+				transfer_function_changed();
+		}
+		for(size_t b = 0; b < batches.size(); b++)
+		{
+			ReadbackSlot& slot = readback_slots[next_slot];
+			{
+				unique_lock<mutex> lk(readback_lock);
+				readback_wake.wait(lk, [&] { return !slot.busy; });
+			}
+			const RemoteView& v = batches[b][0].view;
+			camera = Camera();
+			camera.rotate = v.rotate;
+			camera.distance = v.distance;
+			// the range the 'w' and 'e' keys allow
+			stepsize = min(max(v.stepsize, 1.0f / 200.0f), 0.25f);
+
+			chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+			render_complete_frame();
+			glBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT, readback_source);
+			glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, slot.fbo);
+			glBlitFramebufferEXT(0, 0, render_size, render_size, 0, 0, render_size, render_size, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+			slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			glFlush();
+			slot.render_ms = float(chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+			slot.targets = batches[b];
+			frames++;
+			shared += batches[b].size() - 1;
+
+			lock_guard<mutex> lk(readback_lock);
+			slot.busy = true;
+			readback_queue.push_back(next_slot);
+			readback_wake.notify_all();
+			next_slot = 1 - next_slot;
+		}
+	}
+	{
+		lock_guard<mutex> lk(readback_lock);
+		readback_stop = true;
+		readback_wake.notify_all();
+	}
+	readback.join();
+	server.stop();
+	cout << frames << " frames rendered, " << shared << " more clients served by a frame rendered for another" << endl;
+	return 0;
 }
 
 //--------------------------------------------------------------------------------------
-// This display function is called once pr frame 
+// a stand-in for a thin client of --serve: asks for a spinning view at
+// --request-hz, decodes the frames it gets back and reports their latency
+// from view request to decoded frame
 //--------------------------------------------------------------------------------------
-void display()
+int run_client(int argc, char* argv[])
 {
-	static float rotate = 0; 
-	rotate += 0.25;
+	string address = "localhost:47000";
+	int frames = 100;
+	double hz = 60.0;
+	const char* tf_file = NULL;
+	const char* out = "client_frame.ppm";
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--connect") && i+1 < argc) address = argv[++i];
+		else if(!strcmp(argv[i], "--frames") && i+1 < argc) frames = max(atoi(argv[++i]), 1);
+		else if(!strcmp(argv[i], "--request-hz") && i+1 < argc) hz = max(atof(argv[++i]), 0.1);
+		else if(!strcmp(argv[i], "--send-tf") && i+1 < argc) tf_file = argv[++i];
+		else if(!strcmp(argv[i], "--out") && i+1 < argc) out = argv[++i];
+	}
+	string tf_text;
+	if(tf_file)
+	{
+		ifstream in(tf_file);
+		if(!in)
+		{
+			cout << "Could not open transfer function " << tf_file << endl;
+			return 1;
+		}
+		tf_text.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+	}
+	const size_t colon = address.rfind(':');
+	int fd = -1;
+	for(int tries = 0; tries < 50 && fd < 0 && colon != string::npos; tries++)
+	{
+		fd = Communicator::dial(address.substr(0, colon).c_str(), address.substr(colon + 1).c_str());
+		if(fd < 0) this_thread::sleep_for(chrono::milliseconds(100));
+	}
+	if(fd < 0)
+	{
+		cout << "Could not connect to " << address << endl;
+		return 1;
+	}
 
-	resize(WINDOW_SIZE,WINDOW_SIZE);
-	enable_renderbuffers();
+	// views go out at a steady rate, whether the frames keep up or not
+	atomic<bool> done(false);
+	atomic<int> received(0);
+	thread sender([&]
+	{
+		chrono::steady_clock::time_point next = chrono::steady_clock::now();
+		bool tf_sent = tf_text.empty();
+		for(uint32_t seq = 0; !done; seq++)
+		{
+			RemoteView v;
+			v.seq = seq;
+			v.rotate = 0.25f * seq;
+			v.distance = Camera().distance;
+			v.stepsize = stepsize;
+			v.sent = remote_clock();
+			if(!remote_write(fd, REMOTE_VIEW, &v, sizeof(v))) break;
+			if(!tf_sent && received >= frames / 2)
+				tf_sent = remote_write(fd, REMOTE_TRANSFER_FUNCTION, tf_text.data(), tf_text.size());
+			next += chrono::microseconds((long long)(1e6 / hz));
+			this_thread::sleep_until(next);
+		}
+	});
 
-	glLoadIdentity();
-	glTranslatef(0,0,-2.25);
-	glRotatef(rotate,0,1,1);
-	glTranslatef(-0.5,-0.5,-0.5); // center the texturecube
-	render_backface();
-	raycasting_pass();
-	disable_renderbuffers();
-	render_buffer_to_screen();
-	glutSwapBuffers();
+	FrameDecoder decoder;
+	vector<double> latency;
+	double server_ms = 0.0, render_ms = 0.0, readback_ms = 0.0, encode_ms = 0.0;
+	long long bytes = 0, coalesced = 0;
+	RemoteHeader h;
+	vector<unsigned char> payload;
+	RemoteFrameInfo info;
+	bool ok = true;
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	while(received < frames)
+	{
+		if(!remote_read(fd, h, payload) || h.type != REMOTE_FRAME || payload.size() < sizeof(info))
+		{
+			cout << "connection to the server lost" << endl;
+			ok = false;
+			break;
+		}
+		memcpy(&info, &payload[0], sizeof(info));
+		if(!decoder.decode(&payload[sizeof(info)], payload.size() - sizeof(info), info.width, info.height))
+		{
+			cout << "bad frame " << info.seq << endl;
+			ok = false;
+			break;
+		}
+		latency.push_back(1000.0 * (remote_clock() - info.sent));
+		server_ms += info.server_ms;
+		render_ms += info.render_ms;
+		readback_ms += info.readback_ms;
+		encode_ms += info.encode_ms;
+		coalesced += info.coalesced;
+		bytes += payload.size();
+		received++;
+	}
+	const double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	done = true;
+	sender.join();
+	remote_write(fd, REMOTE_BYE, NULL, 0);
+	close(fd);
+	if(latency.empty()) return 1;
+
+	const int n = int(latency.size());
+	vector<double> sorted = latency;
+	sort(sorted.begin(), sorted.end());
+	double mean = 0.0;
+	for(int i = 0; i < n; i++) mean += latency[i] / n;
+	cout << n << " frames in " << secs << " s: " << n / secs << " frames/sec, latency mean " << mean << " ms, p50 "
+		 << sorted[n / 2] << " ms, p95 " << sorted[min(n - 1, n * 95 / 100)] << " ms, max " << sorted[n - 1] << " ms" << endl;
+	cout << "server " << server_ms / n << " ms/frame from view to send ( render " << render_ms / n << ", readback "
+		 << readback_ms / n << ", encode " << encode_ms / n << " ), " << coalesced << " views coalesced, "
+		 << bytes / n / 1024.0 << " KB/frame, " << double(info.width) * info.height * 3 * n / bytes << ":1 compression" << endl;
+
+	vector<float> image(size_t(info.width) * info.height * 4, 1.0f);
+	for(size_t i = 0; i < size_t(info.width) * info.height; i++)
+		for(int c = 0; c < 3; c++)
+			image[i * 4 + c] = decoder.rgb[i * 3 + c] / 255.0f;
+	write_image(out, &image[0], info.width, info.height);
+	return ok ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------
+// time one benchmark case; camera, stepsize, render_size and the volume are
+// already set up. The GL path has no sample counter, so the samples of a
+// frame are counted by the CPU raycaster, which marches the same rays.
+//--------------------------------------------------------------------------------------
+BenchResult bench_case(bool gl, CpuRaycaster& raycaster, const BenchMatrix& matrix)
+{
+	BenchResult r;
+	r.backend = !gl ? "cpu" : compute_raycasting ? "compute" : "gl";
+	r.volume = volume_size;
+	r.size = render_size;
+	r.steps = int(1.0f / stepsize + 0.5f);
+	r.angle = int(camera.rotate);
+
+	vector<float> image;
+	vector<double> ms, submit_ms;
+	long long samples = 0;
+	for(int f = 0; f < matrix.warmup + matrix.frames; f++)
+	{
+		chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+		if(gl)
+		{
+			render_complete_frame();
+			if(f >= matrix.warmup)
+				submit_ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+			glFinish();
+		}
+		else
+		{
+			raycaster.render(volume, camera, stepsize, render_size, render_size, image);
+			samples = raycaster.last_samples();
+		}
+		if(f >= matrix.warmup)
+			ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+	}
+	if(gl)
+	{
+		raycaster.render(volume, camera, stepsize, render_size, render_size, image);
+		samples = raycaster.last_samples();
+	}
+	frame_time_stats(ms, r.ms_median, r.ms_mean);
+	double submit_mean;
+	frame_time_stats(submit_ms, r.submit_ms, submit_mean);
+	r.msamples_per_sec = r.ms_median > 0.0 ? samples / (r.ms_median * 1000.0) : 0.0;
+
+	double bytes = occupancy.bytes();
+	if(gl && bricked) bytes += double(bricked_volume.layout.slot_count()) * bricked_volume.brick_bytes();
+	else              bytes += volume.voxel_bytes();
+	if(gl) bytes += double(render_size) * render_size * (8 + 8 + 4); // two RGBA16F images and the depth buffer
+	else   bytes += double(render_size) * render_size * 16;          // the RGBA float image
+	r.memory_mb = bytes / (1024.0 * 1024.0);
+	r.rss_mb = peak_rss_mb();
+	return r;
+}
+
+//--------------------------------------------------------------------------------------
+// run the benchmark matrix headless ( or on the CPU with --cpu ), write the
+// results as CSV and optionally compare them against a saved baseline
+//--------------------------------------------------------------------------------------
+int run_bench(int argc, char* argv[])
+{
+	BenchMatrix matrix;
+	matrix.parse(argc, argv);
+	bool gl = true;
+	const char* out = "bench.csv";
+	const char* baseline_file = NULL;
+	const char* results_file = NULL;
+	double threshold = 0.05;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--cpu")) gl = false;
+		else if(!strcmp(argv[i], "--out") && i+1 < argc) out = argv[++i];
+		else if(!strcmp(argv[i], "--compare") && i+1 < argc) baseline_file = argv[++i];
+		else if(!strcmp(argv[i], "--results") && i+1 < argc) results_file = argv[++i];
+		else if(!strcmp(argv[i], "--threshold") && i+1 < argc) threshold = atof(argv[++i]);
+	}
+
+	vector<BenchResult> baseline, results;
+	if(baseline_file && !read_bench_results(baseline_file, baseline)) return 1;
+
+	// compare two saved runs without rendering anything
+	if(results_file)
+	{
+		if(!baseline_file)
+		{
+			cout << "--results needs a --compare baseline" << endl;
+			return 1;
+		}
+		if(!read_bench_results(results_file, results)) return 1;
+		return compare_bench_results(baseline, results, threshold) ? 2 : 0;
+	}
+
+	// a loaded volume replaces the generated sizes; the GL path counts
+	// samples on its host copy
+	if(volume_file)
+	{
+		matrix.volumes.assign(1, 0);
+		keep_host_volume = true;
+	}
+
+	CpuRaycaster raycaster;
+	raycaster.set_occupancy_grid(march_variant.skip_empty ? &occupancy : NULL);
+	raycaster.set_variant(march_variant);
+	raycaster.set_transfer_function(&transfer_function);
+	raycaster.set_preintegration(preintegrated && (volume_format != VOLUME_RGBA8 || volume_file) ? &preintegration : NULL);
+	raycaster.set_level_of_detail(level_of_detail ? &pyramid : NULL);
+	string machine;
+	if(gl)
+	{
+		if(!create_headless_context()) return 1;
+		init();
+		machine = string("gl renderer ") + (const char*)glGetString(GL_RENDERER);
+	}
+	else
+		machine = string("cpu raycaster ") + simd_level_name(raycaster.simd_level());
+	{
+		ostringstream desc;
+		desc << machine << ", " << raycaster.num_threads() << " threads, "
+			 << (single_pass ? "single pass" : "two pass") << ( march_variant.skip_empty ? "" : ", no skipping" )
+			 << ( volume_format == VOLUME_R8 ? ", r8 volume" : volume_format == VOLUME_R16 ? ", r16 volume" : "" )
+			 << ( preintegrated && (volume_format != VOLUME_RGBA8 || volume_file) ? ", pre-integrated" : "" )
+			 << ( level_of_detail ? ", level of detail" : "" )
+			 << ( march_variant == RayMarchVariant() ? string() : ", " + march_variant.name() )
+			 << ( volume_file ? string(", ") + volume_file : string() )
+			 << ", " << matrix.frames << " frames per case";
+		machine = desc.str();
+	}
+	cout << "bench: " << matrix.cases() << " cases, " << machine << endl;
+
+	printf("%-8s %6s %6s %6s %6s %10s %12s %10s %10s\n", "backend", "volume", "size", "steps", "angle", "ms/frame", "Msamples/s", "memory MB", "submit ms");
+	for(size_t v = 0; v < matrix.volumes.size(); v++)
+	{
+		if(!volume_file) volume_size = matrix.volumes[v];
+		if(gl)
+			create_volumetexture();
+		else
+		{
+			create_host_volume();
+			update_preintegration();
+			update_pyramid();
+		}
+		if(volume_file) volume_size = max(volume.width, max(volume.height, volume.depth));
+		for(size_t s = 0; s < matrix.sizes.size(); s++)
+		{
+			render_size = matrix.sizes[s];
+			if(gl) create_render_targets();
+			for(size_t t = 0; t < matrix.steps.size(); t++)
+				for(size_t a = 0; a < matrix.angles.size(); a++)
+				{
+					stepsize = 1.0f / matrix.steps[t];
+					camera = Camera();
+					camera.rotate = matrix.angles[a];
+					BenchResult r = bench_case(gl, raycaster, matrix);
+					printf("%-8s %6d %6d %6d %6d %10.3f %12.2f %10.1f %10.3f\n", r.backend.c_str(), r.volume, r.size,
+						   r.steps, r.angle, r.ms_median, r.msamples_per_sec, r.memory_mb, r.submit_ms);
+					fflush(stdout);
+					results.push_back(r);
+				}
+		}
+	}
+
+	if(!write_bench_results(out, results, machine)) return 1;
+	if(baseline_file && compare_bench_results(baseline, results, threshold)) return 2;
+	return 0;
 }
 
 //--------------------------------------------------------------------------------------
@@ -637,12 +3464,146 @@ void display()
 //--------------------------------------------------------------------------------------
 int main(int argc, char* argv[])
 {
+	bool headless = false, bench = false, cpu = false, quality = false, sort_last = false, serve = false, client = false;
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--bench"))
+			bench = true;
+		if(!strcmp(argv[i], "--quality"))
+			quality = true;
+		if(!strcmp(argv[i], "--cpu"))
+			cpu = true;
+		if(!strcmp(argv[i], "--headless"))
+			headless = true;
+		if(!strcmp(argv[i], "--sort-last") || !strcmp(argv[i], "--peers"))
+			sort_last = true;
+		if(!strcmp(argv[i], "--serve"))
+			serve = true;
+		if(!strcmp(argv[i], "--connect"))
+			client = true;
+		if(!strcmp(argv[i], "--two-pass"))
+			single_pass = false;
+		if(!strcmp(argv[i], "--no-skip"))
+			march_variant.skip_empty = false;
+		if(!strcmp(argv[i], "--composite") && i+1 < argc && !parse_compositing(argv[++i], march_variant.compositing))
+		{
+			cout << "--composite expects dvr, mip, minip or average" << endl;
+			return 1;
+		}
+		if(!strcmp(argv[i], "--early-exit") && i+1 < argc)
+			march_variant.early_exit = max(float(atof(argv[++i])), 0.0f);
+		if(!strcmp(argv[i], "--counted-loop"))
+			march_variant.loop = LOOP_COUNTED;
+		if(!strcmp(argv[i], "--compute"))
+			compute_raycasting = true;
+		if(!strcmp(argv[i], "--compute-tile") && i+1 < argc)
+			compute_tile = atoi(argv[++i]) >= 16 ? 16 : 8;
+		if(!strcmp(argv[i], "--profile") && i+1 < argc)
+			profile_file = argv[++i];
+		if(!strcmp(argv[i], "--format") && i+1 < argc)
+		{
+			const char* f = argv[++i];
+			volume_format = !strcmp(f, "r8") ? VOLUME_R8 : !strcmp(f, "r16") ? VOLUME_R16 : VOLUME_RGBA8;
+		}
+		if(!strcmp(argv[i], "--tf") && i+1 < argc && !transfer_function.load(argv[++i]))
+			return 1;
+		if(!strcmp(argv[i], "--preint"))
+			preintegrated = true;
+		if(!strcmp(argv[i], "--lod"))
+			level_of_detail = true;
+		if(!strcmp(argv[i], "--progressive"))
+			progressive = true;
+		if(!strcmp(argv[i], "--coarse-scale") && i+1 < argc)
+			refinement.scale = max(atoi(argv[++i]), 1);
+		if(!strcmp(argv[i], "--no-spin"))
+			spin = false;
+		if(!strcmp(argv[i], "--debug-gl"))
+			debug_gl = true;
+		if(!strcmp(argv[i], "--no-shader-cache"))
+			shader_cache = false;
+		if(!strcmp(argv[i], "--shader-cache") && i+1 < argc)
+			shader_cache_dir = argv[++i];
+		if(!strcmp(argv[i], "--budget") && i+1 < argc)
+			governor.set_budget(governor_budget = atof(argv[++i]));
+		if(!strcmp(argv[i], "--volume-size") && i+1 < argc)
+			volume_size = max(atoi(argv[++i]), 8);
+		if(!strcmp(argv[i], "--load") && i+1 < argc)
+			volume_file = argv[++i];
+		if(!strcmp(argv[i], "--raw-dims") && i+1 < argc &&
+		   sscanf(argv[++i], "%dx%dx%d", &raw_layout.dims[0], &raw_layout.dims[1], &raw_layout.dims[2]) != 3)
+		{
+			cout << "--raw-dims expects WxHxD" << endl;
+			return 1;
+		}
+		if(!strcmp(argv[i], "--raw-type") && i+1 < argc && (raw_layout.type = parse_voxel_type(argv[++i])) == VOXEL_UNKNOWN)
+		{
+			cout << "unknown --raw-type " << argv[i] << endl;
+			return 1;
+		}
+		if(!strcmp(argv[i], "--raw-big-endian"))
+			raw_layout.big_endian = true;
+		if(!strcmp(argv[i], "--raw-skip") && i+1 < argc)
+			raw_layout.offset = strtoull(argv[++i], NULL, 10);
+		if(!strcmp(argv[i], "--host-copy"))
+			keep_host_volume = true;
+		if(!strcmp(argv[i], "--bricked"))
+			bricked = true;
+		if(!strcmp(argv[i], "--brick-size") && i+1 < argc)
+			brick_size = max(atoi(argv[++i]), 8);
+		if(!strcmp(argv[i], "--atlas-mb") && i+1 < argc)
+			atlas_mb = max(atoi(argv[++i]), 1);
+		if(!strcmp(argv[i], "--bricks-per-frame") && i+1 < argc)
+			bricks_per_frame = max(atoi(argv[++i]), 1);
+		if(!strcmp(argv[i], "--series") && i+1 < argc)
+			series_pattern = argv[++i];
+		if(!strcmp(argv[i], "--series-steps") && i+1 < argc)
+			series_steps = atoi(argv[++i]);
+		if(!strcmp(argv[i], "--prefetch") && i+1 < argc)
+			series_prefetch = max(atoi(argv[++i]), 1);
+		if(!strcmp(argv[i], "--io-threads") && i+1 < argc)
+			series_io_threads = max(atoi(argv[++i]), 1);
+		if(!strcmp(argv[i], "--step-rate") && i+1 < argc)
+			series_rate = max(atof(argv[++i]), 0.0);
+		if(!strcmp(argv[i], "--insitu") && i+1 < argc)
+			insitu_name = argv[++i];
+	}
+	// bricked volume files are only ever paged in brick by brick
+	if(volume_file && is_brick_file(volume_file))
+		bricked = true;
+	if(series_pattern && (bricked || volume_file))
+	{
+		cout << "--series plays its own files, it cannot be combined with --load or --bricked" << endl;
+		return 1;
+	}
+	if(insitu_name && (bricked || volume_file || series_pattern))
+	{
+		cout << "--insitu renders the frames of a simulation, it cannot be combined with --load, --series or --bricked" << endl;
+		return 1;
+	}
+	if(quality)
+		return run_quality_study(argc, argv);
+	if(bench)
+		return run_bench(argc, argv);
+	if(sort_last)
+		return run_sort_last(argc, argv);
+	if(serve)
+		return run_server(argc, argv);
+	if(client)
+		return run_client(argc, argv);
+	if(cpu)
+		return run_cpu_renderer(argc, argv);
+	if(headless)
+		return run_headless(argc, argv);
+
+	preintegration_builder = new PreintegrationBuilder();
 	glutInit(&argc,argv);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
 	glutCreateWindow("GPU raycasting tutorial");
 	glutReshapeWindow(WINDOW_SIZE,WINDOW_SIZE);
 	glutKeyboardFunc(key);
 	glutKeyboardUpFunc(KeyboardUpCallback);
+	glutMouseFunc(mouse);
+	glutMotionFunc(motion);
 	
 	glutDisplayFunc(display);
 	glutIdleFunc(idle_func);
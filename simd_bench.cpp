@@ -0,0 +1,79 @@
+// --------------------------------------------------------------------------
+// Microbenchmark for the CPU ray packet kernels
+//
+// Renders the test volume with every kernel the CPU supports on a single
+// thread and reports volume samples per second for each ISA level, along
+// with the largest difference to the scalar image.
+// --------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CpuRaycaster.h"
+#include "ProceduralVolume.h"
+
+#define WINDOW_SIZE 800
+#define VOLUME_TEX_SIZE 128
+
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    int frames = 20;
+    int size = WINDOW_SIZE;
+    float stepsize = 1.0/50.0;
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--frames") && i+1 < argc) frames = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--size") && i+1 < argc) size = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--stepsize") && i+1 < argc) stepsize = atof(argv[++i]);
+    }
+
+    Volume volume;
+    create_test_volume(volume, VOLUME_TEX_SIZE);
+    CpuRaycaster raycaster(1);
+
+    vector<float> reference, image;
+    const SimdLevel levels[] = { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 };
+    double scalar_rate = 0.0;
+
+    for(int l = 0; l < 3; l++)
+    {
+        if(!raycaster.set_simd_level(levels[l]))
+        {
+            cout << simd_level_name(levels[l]) << ": not supported by this CPU" << endl;
+            continue;
+        }
+
+        Camera camera;
+        long long samples = 0;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for(int f = 0; f < frames; f++)
+        {
+            camera.rotate += 360.0f / frames;
+            raycaster.render(volume, camera, stepsize, size, size, image);
+            samples += raycaster.last_samples();
+        }
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        double rate = samples / secs;
+
+        if(levels[l] == SIMD_SCALAR)
+        {
+            reference = image;
+            scalar_rate = rate;
+        }
+        float max_err = 0.0f;
+        for(size_t i = 0; i < image.size() && i < reference.size(); i++)
+            max_err = max(max_err, fabsf(image[i] - reference[i]));
+
+        cout << simd_level_name(levels[l]) << ": " << rate / 1e6 << " Msamples/sec, "
+             << 1000.0 * secs / frames << " ms/frame";
+        if(scalar_rate > 0.0)
+            cout << ", " << rate / scalar_rate << "x scalar, max diff " << max_err;
+        cout << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,234 @@
+// --------------------------------------------------------------------------
+// Converter from raw, NRRD and MetaImage volumes to bricked volume files
+//
+// Writes the .bvol format of BrickFile.h: a mip pyramid of bricks with the
+// value range of every brick, each brick compressed on its own, so the
+// renderer opens the file by reading two small tables and then reads only
+// the bricks a view touches. The source is mapped, level 0 is cut straight
+// from it; the smaller levels are built in memory, the largest of them an
+// eighth of the converted volume. Bricks are converted and compressed in
+// parallel and written in order, so the output does not depend on the
+// number of threads.
+// --------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Volume.h"
+#include "VolumeLoader.h"
+#include "ThreadPool.h"
+#include "BrickFile.h"
+
+using namespace std;
+
+struct ConvertedBrick {
+    BrickFileEntry entry;
+    vector<unsigned char> stored;
+};
+
+// the voxels and range of a brick, and how it is stored
+static void convert_brick(const Volume* volume, const VolumeFile* file, const int size[3], int brick_size,
+                          VolumeFormat format, int codec, const int c[3], vector<unsigned char>& voxels,
+                          ConvertedBrick& out)
+{
+    const int bpv = format == VOLUME_R16 ? 2 : 1;
+    copy_brick(volume, file, size, brick_size, bpv, c, &voxels[0]);
+
+    unsigned lo = 65535, hi = 0;
+    const size_t n = voxels.size() / bpv;
+    for(size_t i = 0; i < n; i++)
+    {
+        unsigned v = bpv == 2 ? ((const unsigned short*)&voxels[0])[i] : voxels[i];
+        lo = min(lo, v);
+        hi = max(hi, v);
+    }
+    memset(&out.entry, 0, sizeof(out.entry));
+    out.entry.min = (uint16_t)lo;
+    out.entry.max = (uint16_t)hi;
+    out.stored.clear();
+    if(lo == hi)
+        out.entry.codec = BRICK_CONSTANT;
+    else if(codec != BRICK_RAW && compress_brick(codec, &voxels[0], voxels.size(), out.stored))
+        out.entry.codec = (uint8_t)codec;
+    else
+    {
+        out.entry.codec = BRICK_RAW;
+        out.stored = voxels;
+    }
+    out.entry.bytes = (uint32_t)out.stored.size();
+}
+
+static void usage()
+{
+    cout << "usage: volume_convert input output.bvol [--brick-size N] [--codec raw|lz4|zstd] [--r8]" << endl
+         << "                      [--threads N] [--raw-dims WxHxD] [--raw-type T] [--raw-big-endian] [--raw-skip N]" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 3)
+    {
+        usage();
+        return 1;
+    }
+    const char* input = argv[1];
+    const char* output = argv[2];
+    int brick_size = 32;
+    int codec = BRICK_RAW;
+    int threads = 0;
+    VolumeFormat format = VOLUME_R16;
+    VolumeFileInfo raw_layout;
+    for(int i = 3; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--brick-size") && i+1 < argc) brick_size = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--threads") && i+1 < argc) threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--r8")) format = VOLUME_R8;
+        else if(!strcmp(argv[i], "--codec") && i+1 < argc)
+        {
+            const char* name = argv[++i];
+            codec = !strcmp(name, "lz4") ? BRICK_LZ4 : !strcmp(name, "zstd") ? BRICK_ZSTD
+                  : !strcmp(name, "raw") ? BRICK_RAW : -1;
+            if(codec < 0 || !brick_codec_available(codec))
+            {
+                cout << "codec " << name << " is not available in this build" << endl;
+                return 1;
+            }
+        }
+        else if(!strcmp(argv[i], "--raw-dims") && i+1 < argc)
+        {
+            if(sscanf(argv[++i], "%dx%dx%d", &raw_layout.dims[0], &raw_layout.dims[1], &raw_layout.dims[2]) != 3)
+            {
+                cout << "--raw-dims expects WxHxD" << endl;
+                return 1;
+            }
+        }
+        else if(!strcmp(argv[i], "--raw-type") && i+1 < argc)
+        {
+            if((raw_layout.type = parse_voxel_type(argv[++i])) == VOXEL_UNKNOWN)
+            {
+                cout << "unknown --raw-type " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else if(!strcmp(argv[i], "--raw-big-endian")) raw_layout.big_endian = true;
+        else if(!strcmp(argv[i], "--raw-skip") && i+1 < argc) raw_layout.offset = strtoull(argv[++i], NULL, 10);
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if(brick_size < 8 || brick_size % 8 || brick_size > BRICK_FILE_MAX_BRICK_SIZE)
+    {
+        cout << "--brick-size must be a multiple of 8 up to " << BRICK_FILE_MAX_BRICK_SIZE << endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    VolumeFile file;
+    if(!file.open(input, raw_layout, format)) return 1;
+    if(file.needs_range()) file.scan_range(threads);
+    format = file.format;
+    ThreadPool pool(threads);
+
+    FILE* out = fopen(output, "wb");
+    if(!out)
+    {
+        cout << "Could not create " << output << endl;
+        return 1;
+    }
+    BrickFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BRICK_FILE_MAGIC, 8);
+    header.format = format;
+    header.brick_size = brick_size;
+    header.value_min = file.value_min;
+    header.value_max = file.value_max;
+    for(int a = 0; a < 3; a++) header.dims[a] = file.info.dims[a];
+    fwrite(&header, sizeof(header), 1, out);
+
+    vector<BrickFileLevel> levels;
+    vector<BrickFileEntry> entries;
+    uint64_t offset = sizeof(header);
+    size_t constant = 0, compressed = 0;
+    const int padded = brick_size + 2;
+    const size_t brick_bytes = size_t(padded) * padded * padded * (format == VOLUME_R16 ? 2 : 1);
+    bool ok = true;
+
+    Volume level_volume, next_volume;
+    const Volume* volume = 0; // the level being cut, the mapped file for level 0
+    int size[3] = { file.info.dims[0], file.info.dims[1], file.info.dims[2] };
+    for(;;)
+    {
+        BrickFileLevel level;
+        memset(&level, 0, sizeof(level));
+        for(int a = 0; a < 3; a++)
+        {
+            level.dims[a] = size[a];
+            level.bricks[a] = (size[a] + brick_size - 1) / brick_size;
+        }
+        level.first = entries.size();
+        levels.push_back(level);
+
+        // a few bricks per thread at a time, written in brick order
+        const int count = level.bricks[0] * level.bricks[1] * level.bricks[2];
+        const int batch = pool.size() * 16;
+        vector<ConvertedBrick> converted(batch);
+        vector<vector<unsigned char> > scratch(pool.size(), vector<unsigned char>(brick_bytes));
+        for(int first = 0; first < count && ok; first += batch)
+        {
+            const int n = min(batch, count - first);
+            pool.parallel_for(n, [&](int i, int worker)
+            {
+                const int b = first + i;
+                int c[3] = { b % level.bricks[0], b / level.bricks[0] % level.bricks[1], b / (level.bricks[0] * level.bricks[1]) };
+                convert_brick(volume, volume ? 0 : &file, size, brick_size, format, codec, c, scratch[worker], converted[i]);
+            });
+            for(int i = 0; i < n; i++)
+            {
+                ConvertedBrick& brick = converted[i];
+                brick.entry.offset = brick.stored.empty() ? 0 : offset;
+                if(!brick.stored.empty() && fwrite(&brick.stored[0], brick.stored.size(), 1, out) != 1) ok = false;
+                offset += brick.stored.size();
+                constant += brick.entry.codec == BRICK_CONSTANT;
+                compressed += brick.entry.codec == BRICK_LZ4 || brick.entry.codec == BRICK_ZSTD;
+                entries.push_back(brick.entry);
+            }
+        }
+        if(!ok || count == 1 || levels.size() == BRICK_FILE_MAX_LEVELS) break;
+
+        downsample_volume(volume, volume ? 0 : &file, size, format, next_volume, pool);
+        swap(level_volume, next_volume);
+        volume = &level_volume;
+        size[0] = level_volume.width; size[1] = level_volume.height; size[2] = level_volume.depth;
+    }
+
+    header.levels = (uint32_t)levels.size();
+    header.level_table = offset;
+    header.brick_table = offset + levels.size() * sizeof(BrickFileLevel);
+    ok = ok && fwrite(&levels[0], sizeof(BrickFileLevel), levels.size(), out) == levels.size()
+            && fwrite(&entries[0], sizeof(BrickFileEntry), entries.size(), out) == entries.size()
+            && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+    if(fclose(out) != 0) ok = false;
+    if(!ok)
+    {
+        cout << "Could not write " << output << endl;
+        remove(output);
+        return 1;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t total = header.brick_table + entries.size() * sizeof(BrickFileEntry);
+    cout << input << " -> " << output << ": " << header.dims[0] << "x" << header.dims[1] << "x" << header.dims[2]
+         << (format == VOLUME_R16 ? " R16" : " R8") << ", " << levels.size() << " levels, "
+         << entries.size() << " bricks of " << brick_size << "^3 ( " << constant << " constant";
+    if(codec != BRICK_RAW)
+        cout << ", " << compressed << " " << brick_codec_name(codec);
+    cout << " ), " << total / (1024.0 * 1024.0)
+         << " MB in " << seconds << " s" << endl;
+    return 0;
+}